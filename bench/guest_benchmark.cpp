@@ -0,0 +1,578 @@
+// Runs a suite of guest workloads on every execution engine and reports
+// simulated MIPS, nanoseconds per instruction and the peak resident set size.
+// The workloads are assembly sources, so they also go through the parser and
+// the encoder like real programs. Results can be written as JSON to compare
+// releases.
+//
+// Every run also times a host reference, a CRC-32 compiled for the host, so
+// the performance gate can compare runs on hosts of different speed.
+//
+// With -p the host hardware counters are read around every timed run, and
+// the report adds host cycles and instructions per guest instruction, branch
+// misses per guest branch and cache misses per thousand guest instructions.
+//
+// usage: guest_benchmark [-w warmup runs] [-r repetitions] [-j json file]
+//                        [-f workload] [-p]
+
+#include "host_counters.h"
+#include "instruction.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#define MEMORY_SIZE 0x10000
+
+// Each workload halts with SWI and leaves a result that check compares to the
+// same computation on the host
+struct workload {
+  const char *name;
+  const char *source;
+  bool (*check)(Machine &m);
+};
+
+static uint32_t get_register(Machine &m, uint8_t reg) {
+  return m.get_register_value(reg).to_unsigned32();
+}
+
+static const char *loop_source = R"(
+        MOV r0, #0
+        LDR r1, =1000000
+loop    ADD r0, r0, #1
+        SUBS r1, r1, #1
+        BNE loop
+        SWI 0
+)";
+
+static bool check_loop(Machine &m) { return get_register(m, 0) == 1000000; }
+
+// copies 256 words 2000 times, 8 words per LDM/STM pair
+static const char *memcpy_source = R"(
+        LDR r0, =source
+        MOV r1, #0
+fill    STR r1, [r0, r1]
+        ADD r1, r1, #1
+        CMP r1, #256
+        BNE fill
+        LDR r12, =2000
+copy    LDR r0, =source
+        LDR r1, =destination
+        MOV r11, #32
+block   LDMIA r0!, {r2-r9}
+        STMIA r1!, {r2-r9}
+        SUBS r11, r11, #1
+        BNE block
+        SUBS r12, r12, #1
+        BNE copy
+        SWI 0
+        .data
+source  .space 256
+destination .space 256
+)";
+
+static bool check_memcpy(Machine &m) {
+  // the pointers end after the copied words
+  const uint32_t source = get_register(m, 0) - 256;
+  const uint32_t destination = get_register(m, 1) - 256;
+  for (uint32_t idx = 0; idx < 256; ++idx) {
+    if (m.get_memory(source + idx).to_unsigned32() != idx ||
+        m.get_memory(destination + idx).to_unsigned32() != idx) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// sorts 256 pseudo-random words
+static const char *bubble_sort_source = R"(
+        LDR r0, =array
+        MOV r1, #0
+        MOV r4, #1
+        LDR r5, =1103515245
+        LDR r6, =12345
+random  MUL r7, r4, r5
+        ADD r4, r7, r6
+        MOV r7, r4, LSR #16
+        STR r7, [r0, r1]
+        ADD r1, r1, #1
+        CMP r1, #256
+        BNE random
+        MOV r1, #255
+outer   MOV r2, r0
+        MOV r3, r1
+inner   LDR r4, [r2]
+        LDR r5, [r2, #1]
+        CMP r4, r5
+        STRHI r5, [r2]
+        STRHI r4, [r2, #1]
+        ADD r2, r2, #1
+        SUBS r3, r3, #1
+        BNE inner
+        SUBS r1, r1, #1
+        BNE outer
+        SWI 0
+        .data
+array   .space 256
+)";
+
+static bool check_bubble_sort(Machine &m) {
+  const uint32_t array = get_register(m, 0);
+  uint32_t previous = 0;
+  uint32_t sum = 0;
+  uint32_t expected_sum = 0;
+  uint32_t value = 1;
+  for (uint32_t idx = 0; idx < 256; ++idx) {
+    value = value * 1103515245 + 12345;
+    expected_sum += value >> 16;
+    const uint32_t sorted = m.get_memory(array + idx).to_unsigned32();
+    if (sorted < previous) {
+      return false;
+    }
+    previous = sorted;
+    sum += sorted;
+  }
+  return sum == expected_sum;
+}
+
+// Bitwise CRC-32 of 8192 bytes, one byte per word. The buffer is after the
+// program instead of in its data, which would put the literal pool out of
+// reach of LDR
+static const char *crc_source = R"(
+        MOV r0, #0x1000
+        LDR r1, =8192
+        MOV r2, #0
+fill    AND r3, r2, #0xFF
+        STR r3, [r0, r2]
+        ADD r2, r2, #1
+        CMP r2, r1
+        BNE fill
+        MVN r4, #0
+        LDR r5, =0xEDB88320
+        MOV r2, #0
+byte    LDR r3, [r0, r2]
+        EOR r4, r4, r3
+        MOV r6, #8
+bit     MOVS r4, r4, LSR #1
+        EORCS r4, r4, r5
+        SUBS r6, r6, #1
+        BNE bit
+        ADD r2, r2, #1
+        CMP r2, r1
+        BNE byte
+        MVN r0, r4
+        SWI 0
+)";
+
+static bool check_crc(Machine &m) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (uint32_t idx = 0; idx < 8192; ++idx) {
+    crc ^= idx & 0xFF;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+    }
+  }
+  return get_register(m, 0) == ~crc;
+}
+
+// recursive Fibonacci, every call saves its registers on the stack
+static const char *fibonacci_source = R"(
+        LDR sp, =0xFF00
+        MOV r0, #22
+        BL fib
+        SWI 0
+fib     CMP r0, #2
+        MOVLT pc, lr
+        PUSH {r4, r5, lr}
+        MOV r4, r0
+        SUB r0, r4, #1
+        BL fib
+        MOV r5, r0
+        SUB r0, r4, #2
+        BL fib
+        ADD r0, r0, r5
+        POP {r4, r5, pc}
+)";
+
+static bool check_fibonacci(Machine &m) {
+  uint32_t previous = 0;
+  uint32_t current = 1;
+  for (int idx = 1; idx < 22; ++idx) {
+    const uint32_t next = previous + current;
+    previous = current;
+    current = next;
+  }
+  return get_register(m, 0) == current;
+}
+
+static const workload workloads[] = {
+    {"loop", loop_source, check_loop},
+    {"memcpy", memcpy_source, check_memcpy},
+    {"bubble_sort", bubble_sort_source, check_bubble_sort},
+    {"crc32", crc_source, check_crc},
+    {"fibonacci", fibonacci_source, check_fibonacci}};
+
+enum class engines { INSTRUCTIONS = 0, OPTIMIZED, MEMORY };
+
+static const char *engine_names[] = {"instructions", "optimized", "memory"};
+
+// in the order of host_events
+static const char *host_event_names[] = {"cycles", "instructions",
+                                         "branch_misses", "l1d_misses",
+                                         "llc_misses"};
+
+struct run_result {
+  const char *workload;
+  const char *engine;
+  uint64_t retired;
+  double best_seconds;
+  double mean_seconds;
+  long peak_rss_kb;
+  bool correct;
+  // every timed repetition, for the statistics of the performance gate
+  std::vector<double> samples_seconds;
+  // host events of all timed repetitions
+  host_counts counts;
+  uint64_t guest_branches;
+};
+
+// Branches and other instructions that can write the PC, whether or not
+// their condition passes
+static bool is_branch(const Instruction &i) {
+  switch (i.get_opcode()) {
+  case opcodes::B:
+  case opcodes::BL: // intentional fall-through
+    return true;
+  case opcodes::CMN:
+  case opcodes::CMP: // intentional fall-through
+  case opcodes::STM: // intentional fall-through
+  case opcodes::STR: // intentional fall-through
+  case opcodes::SWI: // intentional fall-through
+  case opcodes::TEQ: // intentional fall-through
+  case opcodes::TST: // intentional fall-through
+    return false;
+  case opcodes::LDM:
+    return i.get_last_register() == PROGRAM_COUNTER_INDEX;
+  default:
+    return i.get_register_count() > 0 &&
+           i.get_register(0) == PROGRAM_COUNTER_INDEX;
+  }
+}
+
+// The engines don't count branches, so the program is stepped once
+static uint64_t count_guest_branches(const std::vector<Instruction> &program,
+                                     const SourceCodeParser &parser) {
+  Machine m(MEMORY_SIZE);
+  Simulator::load_data(parser.get_data(), parser.get_data_address(), m);
+  uint64_t branches = 0;
+  uint32_t pc = 0;
+  while (pc < program.size()) {
+    branches += is_branch(program[pc]);
+    if (m.execute(program[pc])) {
+      break;
+    }
+    pc = m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32();
+  }
+  return branches;
+}
+
+#define REFERENCE_BYTES 0x4000
+#define REFERENCE_ROUNDS 64
+
+// the host reference writes its result here, so the compiler keeps the work
+static volatile uint32_t reference_sink;
+
+// Times the host reference once
+static double run_host_reference() {
+  std::vector<uint8_t> data(REFERENCE_BYTES);
+  for (size_t idx = 0; idx < data.size(); ++idx) {
+    data[idx] = static_cast<uint8_t>(idx * 31);
+  }
+  const auto start = std::chrono::steady_clock::now();
+  uint32_t crc = 0xFFFFFFFF;
+  for (int round = 0; round < REFERENCE_ROUNDS; ++round) {
+    for (const uint8_t byte : data) {
+      crc ^= byte;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+      }
+    }
+  }
+  reference_sink = crc;
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+static long get_peak_rss_kb() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // kilobytes on Linux
+  return usage.ru_maxrss;
+}
+
+static run_result run_workload(const workload &w, engines engine,
+                               unsigned int warmup, unsigned int repetitions,
+                               HostCounters *counters) {
+  SourceCodeParser parser;
+  std::istringstream source(w.source);
+  std::vector<Instruction> program = parser.parse(source);
+  const std::vector<optimized_instruction> optimized_program =
+      Optimizer::optimize(program);
+
+  run_result result = run_result();
+  result.workload = w.name;
+  result.engine = engine_names[static_cast<int>(engine)];
+  result.correct = parser.get_error_count() == 0;
+  result.guest_branches =
+      counters ? count_guest_branches(program, parser) : 0;
+  double total_seconds = 0;
+  for (unsigned int run = 0; run < warmup + repetitions; ++run) {
+    Machine m(MEMORY_SIZE);
+    result.correct &= Simulator::load_data(parser.get_data(),
+                                           parser.get_data_address(), m);
+    if (engine == engines::MEMORY) {
+      result.correct &= Simulator::load_program(program, m);
+    }
+
+    // the simulator reports halting, which is not part of the result
+    std::streambuf *output = std::cout.rdbuf(nullptr);
+    const bool counted = counters && run >= warmup;
+    if (counted) {
+      counters->start();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    switch (engine) {
+    case engines::INSTRUCTIONS:
+      result.retired = Simulator::run_program(program, m);
+      break;
+    case engines::OPTIMIZED:
+      result.retired = Simulator::run_program(optimized_program, m);
+      break;
+    case engines::MEMORY:
+      result.retired = Simulator::run_from_memory(m);
+      break;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (counted) {
+      result.counts += counters->stop();
+    }
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    result.correct &= w.check(m);
+    if (run < warmup) {
+      continue;
+    }
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    if (run == warmup || seconds < result.best_seconds) {
+      result.best_seconds = seconds;
+    }
+    total_seconds += seconds;
+    result.samples_seconds.push_back(seconds);
+  }
+  result.mean_seconds = total_seconds / repetitions;
+  result.peak_rss_kb = get_peak_rss_kb();
+  return result;
+}
+
+// A ratio of two host events or n/a when the host couldn't count one of them
+static std::string format_ratio(const host_counts &counts, host_events event,
+                                double per) {
+  std::ostringstream out;
+  if (counts.has(event) && per > 0) {
+    out << std::fixed << std::setprecision(2) << counts.get(event) / per;
+  } else {
+    out << "n/a";
+  }
+  return out.str();
+}
+
+static void print_host_events(const std::vector<run_result> &results) {
+  std::cout << "\nhost events per guest instruction, branch misses per guest "
+               "branch\nand cache misses per 1000 guest instructions"
+            << std::endl;
+  std::cout << std::left << std::setw(13) << "workload" << std::setw(14)
+            << "engine" << std::right << std::setw(10) << "cycles"
+            << std::setw(14) << "instructions" << std::setw(15)
+            << "branch misses" << std::setw(12) << "L1D misses"
+            << std::setw(12) << "LLC misses" << std::endl;
+  for (const auto &r : results) {
+    // the counts are the sum of all timed repetitions
+    const double retired =
+        static_cast<double>(r.retired) * r.samples_seconds.size();
+    const double branches =
+        static_cast<double>(r.guest_branches) * r.samples_seconds.size();
+    std::cout << std::left << std::setw(13) << r.workload << std::setw(14)
+              << r.engine << std::right << std::setw(10)
+              << format_ratio(r.counts, host_events::CYCLES, retired)
+              << std::setw(14)
+              << format_ratio(r.counts, host_events::INSTRUCTIONS, retired)
+              << std::setw(15)
+              << format_ratio(r.counts, host_events::BRANCH_MISSES, branches)
+              << std::setw(12)
+              << format_ratio(r.counts, host_events::L1D_MISSES,
+                              retired / 1000)
+              << std::setw(12)
+              << format_ratio(r.counts, host_events::LLC_MISSES,
+                              retired / 1000)
+              << std::endl;
+  }
+}
+
+static void write_json(std::ostream &out,
+                       const std::vector<run_result> &results,
+                       const std::vector<double> &reference_seconds,
+                       unsigned int warmup, unsigned int repetitions) {
+  // one result per line, so the file is also easy to read without a parser
+  out << std::fixed << std::setprecision(3);
+  out << "{\n  \"warmup\": " << warmup << ",\n  \"repetitions\": "
+      << repetitions << ",\n  \"optimized_build\": "
+#ifdef __OPTIMIZE__
+      << "true"
+#else
+      << "false"
+#endif
+      << ",\n  \"host_reference_ms\": [";
+  for (size_t sample = 0; sample < reference_seconds.size(); ++sample) {
+    out << (sample ? ", " : "") << reference_seconds[sample] * 1000;
+  }
+  out << "],\n  \"results\": [\n";
+  for (size_t idx = 0; idx < results.size(); ++idx) {
+    const run_result &r = results[idx];
+    out << "    {\"workload\": \"" << r.workload << "\", \"engine\": \""
+        << r.engine << "\", \"instructions\": " << r.retired
+        << ", \"best_ms\": " << r.best_seconds * 1000
+        << ", \"mean_ms\": " << r.mean_seconds * 1000
+        << ", \"mips\": " << r.retired / r.best_seconds / 1e6
+        << ", \"ns_per_instruction\": " << r.best_seconds * 1e9 / r.retired
+        << ", \"peak_rss_kb\": " << r.peak_rss_kb
+        << ", \"correct\": " << (r.correct ? "true" : "false")
+        << ", \"samples_ms\": [";
+    for (size_t sample = 0; sample < r.samples_seconds.size(); ++sample) {
+      out << (sample ? ", " : "") << r.samples_seconds[sample] * 1000;
+    }
+    out << "]";
+    // host events only when they were counted
+    for (int event = 0; event < static_cast<int>(host_events::COUNT);
+         ++event) {
+      if (r.counts.available[event]) {
+        out << ", \"host_" << host_event_names[event]
+            << "\": " << r.counts.values[event];
+      }
+    }
+    if (r.guest_branches > 0) {
+      out << ", \"guest_branches\": " << r.guest_branches;
+    }
+    out << "}"
+        << (idx + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int warmup = 1;
+  unsigned int repetitions = 5;
+  std::string json_file;
+  std::string filter;
+  bool count_host_events = false;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "-p") == 0) {
+      count_host_events = true;
+    } else if (idx + 1 == argc) {
+      repetitions = 0;
+    } else if (strcmp(argv[idx], "-w") == 0) {
+      warmup = std::atoi(argv[++idx]);
+    } else if (strcmp(argv[idx], "-r") == 0) {
+      repetitions = std::atoi(argv[++idx]);
+    } else if (strcmp(argv[idx], "-j") == 0) {
+      json_file = argv[++idx];
+    } else if (strcmp(argv[idx], "-f") == 0) {
+      filter = argv[++idx];
+    }
+  }
+  if (repetitions == 0) {
+    std::cout << "usage: " << argv[0]
+              << " [-w warmup runs] [-r repetitions] [-j json file]"
+                 " [-f workload] [-p]"
+              << std::endl;
+    return 1;
+  }
+
+  HostCounters host_counters;
+  HostCounters *counters = nullptr;
+  if (count_host_events) {
+    if (host_counters.is_available()) {
+      counters = &host_counters;
+    } else {
+      std::cout << "Host counters are not available: "
+                << host_counters.get_error() << std::endl;
+    }
+  }
+
+  std::vector<double> reference_seconds;
+  for (unsigned int run = 0; run < warmup + repetitions; ++run) {
+    const double seconds = run_host_reference();
+    if (run >= warmup) {
+      reference_seconds.push_back(seconds);
+    }
+  }
+
+  std::vector<run_result> results;
+  for (const auto &w : workloads) {
+    if (!filter.empty() && filter != w.name) {
+      continue;
+    }
+    for (int engine = 0; engine <= static_cast<int>(engines::MEMORY);
+         ++engine) {
+      results.push_back(run_workload(w, static_cast<engines>(engine), warmup,
+                                     repetitions, counters));
+    }
+  }
+
+  std::cout << "best of " << repetitions << " after " << warmup
+            << " warmup runs" << std::endl;
+  std::cout << std::left << std::setw(13) << "workload" << std::setw(14)
+            << "engine" << std::right << std::setw(12) << "instructions"
+            << std::setw(10) << "ms" << std::setw(10) << "MIPS"
+            << std::setw(10) << "ns/instr" << std::setw(12) << "peak RSS kB"
+            << std::endl;
+  bool correct = true;
+  for (const auto &r : results) {
+    std::cout << std::left << std::setw(13) << r.workload << std::setw(14)
+              << r.engine << std::right << std::setw(12) << r.retired
+              << std::fixed << std::setprecision(3) << std::setw(10)
+              << r.best_seconds * 1000 << std::setprecision(1)
+              << std::setw(10) << r.retired / r.best_seconds / 1e6
+              << std::setprecision(2) << std::setw(10)
+              << r.best_seconds * 1e9 / r.retired << std::setw(12)
+              << r.peak_rss_kb << std::endl;
+    correct &= r.correct;
+  }
+  if (counters) {
+    print_host_events(results);
+  }
+
+  if (!json_file.empty()) {
+    std::ofstream out(json_file);
+    write_json(out, results, reference_seconds, warmup, repetitions);
+  }
+  if (!correct) {
+    std::cout << "A guest result does not match the host result"
+              << std::endl;
+    return 1;
+  }
+  return 0;
+}
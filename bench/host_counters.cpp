@@ -0,0 +1,130 @@
+#include "host_counters.h"
+
+#include <cstring>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define EVENT_COUNT static_cast<int>(host_events::COUNT)
+
+host_counts &host_counts::operator+=(const host_counts &other) {
+  for (int idx = 0; idx < EVENT_COUNT; ++idx) {
+    values[idx] += other.values[idx];
+    available[idx] = other.available[idx];
+  }
+  return *this;
+}
+
+#ifdef __linux__
+
+static int open_event(uint32_t type, uint64_t config, int group) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  // only the simulator itself, which also works with perf_event_paranoid 2
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.disabled = group == -1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static uint64_t get_cache_miss_config(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+HostCounters::HostCounters() {
+  for (int &descriptor : descriptors) {
+    descriptor = -1;
+  }
+  // cycles lead the group, so all events count over the same time
+  descriptors[0] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (descriptors[0] < 0) {
+    error = std::strerror(errno);
+    return;
+  }
+  const int leader = descriptors[0];
+  descriptors[static_cast<int>(host_events::INSTRUCTIONS)] =
+      open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+  descriptors[static_cast<int>(host_events::BRANCH_MISSES)] =
+      open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, leader);
+  descriptors[static_cast<int>(host_events::L1D_MISSES)] =
+      open_event(PERF_TYPE_HW_CACHE,
+                 get_cache_miss_config(PERF_COUNT_HW_CACHE_L1D), leader);
+  descriptors[static_cast<int>(host_events::LLC_MISSES)] =
+      open_event(PERF_TYPE_HW_CACHE,
+                 get_cache_miss_config(PERF_COUNT_HW_CACHE_LL), leader);
+}
+
+HostCounters::~HostCounters() {
+  for (int descriptor : descriptors) {
+    if (descriptor >= 0) {
+      close(descriptor);
+    }
+  }
+}
+
+bool HostCounters::is_available() const { return descriptors[0] >= 0; }
+
+void HostCounters::start() {
+  if (!is_available()) {
+    return;
+  }
+  ioctl(descriptors[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(descriptors[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+host_counts HostCounters::stop() {
+  host_counts counts;
+  if (!is_available()) {
+    return counts;
+  }
+  ioctl(descriptors[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  // the number of events, the enabled and running times, and the values in
+  // the order the events joined the group
+  uint64_t data[3 + EVENT_COUNT] = {};
+  if (read(descriptors[0], data, sizeof(data)) < 0) {
+    return counts;
+  }
+  const double scale =
+      data[2] ? static_cast<double>(data[1]) / data[2] : 0;
+  uint64_t member = 0;
+  for (int idx = 0; idx < EVENT_COUNT && member < data[0]; ++idx) {
+    if (descriptors[idx] < 0) {
+      continue;
+    }
+    counts.values[idx] = static_cast<uint64_t>(data[3 + member] * scale);
+    counts.available[idx] = true;
+    member++;
+  }
+  return counts;
+}
+
+#else
+
+HostCounters::HostCounters() : error("not supported on this platform") {
+  for (int &descriptor : descriptors) {
+    descriptor = -1;
+  }
+}
+
+HostCounters::~HostCounters() {}
+
+bool HostCounters::is_available() const { return false; }
+
+void HostCounters::start() {}
+
+host_counts HostCounters::stop() { return host_counts(); }
+
+#endif
+
+const std::string &HostCounters::get_error() const { return error; }
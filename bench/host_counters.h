@@ -0,0 +1,54 @@
+#ifndef HOST_COUNTERS_H
+#define HOST_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+enum class host_events {
+  CYCLES = 0,
+  INSTRUCTIONS,
+  BRANCH_MISSES,
+  L1D_MISSES,
+  LLC_MISSES,
+  COUNT
+};
+
+// Counts of the host events, and whether each of them could be counted
+struct host_counts {
+  uint64_t values[static_cast<int>(host_events::COUNT)] = {};
+  bool available[static_cast<int>(host_events::COUNT)] = {};
+
+  uint64_t get(host_events event) const {
+    return values[static_cast<int>(event)];
+  }
+  bool has(host_events event) const {
+    return available[static_cast<int>(event)];
+  }
+  host_counts &operator+=(const host_counts &other);
+};
+
+// Hardware counters of the host process, read as one group through
+// perf_event_open on Linux. Events the host doesn't have are left out, and
+// without cycles nothing is counted. Containers and other platforms often
+// have no counters at all, which is_available reports with the reason.
+class HostCounters {
+public:
+  HostCounters();
+  ~HostCounters();
+  HostCounters(const HostCounters &) = delete;
+  HostCounters &operator=(const HostCounters &) = delete;
+
+  bool is_available() const;
+  // why the counters are not available
+  const std::string &get_error() const;
+  void start();
+  // Stops counting and returns the counts since start, scaled up when the
+  // kernel multiplexed the group with other events
+  host_counts stop();
+
+private:
+  int descriptors[static_cast<int>(host_events::COUNT)];
+  std::string error;
+};
+
+#endif // HOST_COUNTERS_H
@@ -0,0 +1,199 @@
+// Multiplies two square matrices in the guest, once with MLA and once with
+// the shift-and-add loop that guest code needed before the multiply
+// instructions existed, and reports retired instructions and wall clock.
+// Both kernels are also run through the peephole optimizer.
+//
+// usage: matmul_benchmark [size] [repetitions]
+
+#include "instruction.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "simulator.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#define MATRIX_A_ADDRESS 0x400
+#define MEMORY_SIZE 0x10000
+
+static Instruction make(opcodes code, std::vector<uint8_t> regs,
+                        int64_t operand = 0,
+                        condition_codes condition = condition_codes::NONE,
+                        suffixes suf = suffixes::NONE) {
+  return Instruction(code, condition, suf, update_modes::NONE, regs, operand);
+}
+
+static Instruction make_register_operand(opcodes code,
+                                         std::vector<uint8_t> regs,
+                                         suffixes suf = suffixes::NONE) {
+  Instruction i = make(code, regs, 0, condition_codes::NONE, suf);
+  i.set_is_2nd_operand_register(true);
+  return i;
+}
+
+// C = A * B for size x size matrices stored row by row at a, b and c
+static std::vector<Instruction> build_kernel(uint32_t size, uint32_t a,
+                                             uint32_t b, uint32_t c,
+                                             bool use_multiply) {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MOV, {9}, c));  // C element pointer
+  program.push_back(make(opcodes::MOV, {10}, a)); // A row pointer
+  program.push_back(make(opcodes::MOV, {0}, 0));  // i
+  const uint32_t row_loop = program.size();
+  program.push_back(make(opcodes::MOV, {1}, 0)); // j
+  const uint32_t column_loop = program.size();
+  program.push_back(make(opcodes::MOV, {3}, 0)); // sum
+  program.push_back(make_register_operand(opcodes::MOV, {4, 10}));
+  program.push_back(make(opcodes::ADD, {5, 1}, b));
+  program.push_back(make(opcodes::MOV, {2}, size)); // k
+  const uint32_t dot_loop = program.size();
+  program.push_back(make(opcodes::LDR, {6, 4}));
+  program.push_back(make(opcodes::LDR, {7, 5}));
+  if (use_multiply) {
+    program.push_back(make(opcodes::MLA, {3, 6, 7, 3}));
+  } else {
+    // sum += r6 * r7 one multiplier bit at a time
+    const uint32_t multiply_loop = program.size();
+    Instruction shift =
+        make_register_operand(opcodes::MOV, {7, 7}, suffixes::S);
+    shift.set_shift(shift_types::LSR, 1);
+    program.push_back(shift);
+    Instruction add = make_register_operand(opcodes::ADD, {3, 3, 6});
+    add.set_condition_code(condition_codes::CS);
+    program.push_back(add);
+    Instruction double_multiplicand =
+        make_register_operand(opcodes::MOV, {6, 6});
+    double_multiplicand.set_shift(shift_types::LSL, 1);
+    program.push_back(double_multiplicand);
+    program.push_back(
+        make(opcodes::B, {}, multiply_loop, condition_codes::NE));
+  }
+  program.push_back(make(opcodes::ADD, {4, 4}, 1));
+  program.push_back(make(opcodes::ADD, {5, 5}, size));
+  program.push_back(
+      make(opcodes::SUB, {2, 2}, 1, condition_codes::NONE, suffixes::S));
+  program.push_back(make(opcodes::B, {}, dot_loop, condition_codes::NE));
+  program.push_back(make(opcodes::STR, {3, 9}));
+  program.push_back(make(opcodes::ADD, {9, 9}, 1));
+  program.push_back(make(opcodes::ADD, {1, 1}, 1));
+  program.push_back(make(opcodes::CMP, {0, 1}, size));
+  program.push_back(make(opcodes::B, {}, column_loop, condition_codes::NE));
+  program.push_back(make(opcodes::ADD, {10, 10}, size));
+  program.push_back(make(opcodes::ADD, {0, 0}, 1));
+  program.push_back(make(opcodes::CMP, {0, 0}, size));
+  program.push_back(make(opcodes::B, {}, row_loop, condition_codes::NE));
+  program.push_back(make(opcodes::SWI, {}, 0));
+  return program;
+}
+
+struct kernel_result {
+  uint64_t retired;
+  double best_seconds;
+  bool correct;
+};
+
+static kernel_result run_kernel(uint32_t size, unsigned int repetitions,
+                                bool use_multiply, bool optimize) {
+  const uint32_t a = MATRIX_A_ADDRESS;
+  const uint32_t b = a + size * size;
+  const uint32_t c = b + size * size;
+  std::vector<Instruction> program = build_kernel(size, a, b, c, use_multiply);
+  const std::vector<optimized_instruction> optimized_program =
+      Optimizer::optimize(program);
+
+  kernel_result result = {0, 0, true};
+  for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+    Machine m(MEMORY_SIZE);
+    for (uint32_t idx = 0; idx < size * size; ++idx) {
+      m.set_memory(a + idx, Machine_byte((idx * 7 + 3) % 251));
+      m.set_memory(b + idx, Machine_byte((idx * 13 + 5) % 241));
+    }
+
+    // the simulator reports halting, which is not part of the result
+    std::streambuf *output = std::cout.rdbuf(nullptr);
+    const auto start = std::chrono::steady_clock::now();
+    result.retired = optimize
+                         ? Simulator::run_program(optimized_program, m)
+                         : Simulator::run_program(program, m);
+    const auto end = std::chrono::steady_clock::now();
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    if (repetition == 0 || seconds < result.best_seconds) {
+      result.best_seconds = seconds;
+    }
+    for (uint32_t row = 0; row < size; ++row) {
+      for (uint32_t column = 0; column < size; ++column) {
+        uint32_t expected = 0;
+        for (uint32_t k = 0; k < size; ++k) {
+          expected += m.get_memory(a + row * size + k).to_unsigned32() *
+                      m.get_memory(b + k * size + column).to_unsigned32();
+        }
+        result.correct &=
+            m.get_memory(c + row * size + column).to_unsigned32() == expected;
+      }
+    }
+  }
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  const uint32_t size = argc > 1 ? std::atoi(argv[1]) : 16;
+  const unsigned int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+  if (size == 0 || size > 64 || repetitions == 0) {
+    std::cout << "usage: " << argv[0] << " [size (1-64)] [repetitions]"
+              << std::endl;
+    return 1;
+  }
+
+  struct {
+    const char *name;
+    bool use_multiply;
+    bool optimize;
+    kernel_result result;
+  } kernels[] = {{"shift-and-add", false, false, {}},
+                 {"shift-and-add -O", false, true, {}},
+                 {"MLA", true, false, {}},
+                 {"MLA -O", true, true, {}}};
+  for (auto &kernel : kernels) {
+    kernel.result =
+        run_kernel(size, repetitions, kernel.use_multiply, kernel.optimize);
+  }
+
+  std::cout << size << "x" << size << " matrix multiply, best of "
+            << repetitions << std::endl;
+  std::cout << std::left << std::setw(18) << "kernel" << std::right
+            << std::setw(16) << "instructions" << std::setw(12) << "ms"
+            << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  bool correct = true;
+  for (const auto &kernel : kernels) {
+    std::cout << std::left << std::setw(18) << kernel.name << std::right
+              << std::setw(16) << kernel.result.retired << std::setw(12)
+              << kernel.result.best_seconds * 1000 << std::endl;
+    correct &= kernel.result.correct;
+  }
+  const kernel_result &shift_add = kernels[0].result;
+  const kernel_result &multiply = kernels[2].result;
+  std::cout << std::setprecision(1) << "MLA reduction: "
+            << static_cast<double>(shift_add.retired) / multiply.retired
+            << "x instructions, "
+            << shift_add.best_seconds / multiply.best_seconds << "x time"
+            << std::endl;
+  std::cout << std::setprecision(2) << "optimizer speedup: "
+            << shift_add.best_seconds / kernels[1].result.best_seconds
+            << "x shift-and-add, "
+            << multiply.best_seconds / kernels[3].result.best_seconds
+            << "x MLA" << std::endl;
+
+  if (!correct) {
+    std::cout << "Guest result does not match the host result" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+// Parses a large synthetic program with every kind of syntax the parser
+// accepts, and reports lines and bytes parsed per second. The program is kept
+// in memory, so the file system is not part of the result.
+//
+// usage: parser_benchmark [blocks] [repetitions]
+
+#include "instruction.h"
+#include "source_parser.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Every block defines its own labels, so the symbol table grows with the
+// program like it does in real code
+static void add_code_block(std::ostringstream &program, unsigned int block) {
+  program << "block" << block << ":\n"
+          << "    MOV r0, #" << block % 256 << "\n"
+          << "    MOVS r1, r0, LSL #2 ; shifted register operand\n"
+          << "loop" << block << "  ADDNE r2, r1, r0, ASR r3\n"
+          << "    SUBS r4, r4, #1\n"
+          << "    RSB r5, r4, r2, ROR #7\n"
+          << "    CMP r4, #0x100\n"
+          << "    TST r5, r6, RRX\n"
+          << "    BGT loop" << block << "\n"
+          << "    MLA r7, r2, r3, r7\n"
+          << "    UMULL r8, r9, r2, r3\n"
+          << "\n"
+          << "    LDR r10, [r11, #4]!\n"
+          << "    STRB r10, [r11], #-1\n"
+          << "    LDRSH r12, [r11, -r1]\n"
+          << "    LDR r0, =value" << block << "\n"
+          << "    LDR r1, =0x12345678\n"
+          << "    ADR r2, next" << block << "\n"
+          << "    STMFD sp!, {r0-r3, lr}\n"
+          << "    LDMIA sp!, {r0, r1, r2, r3, lr}\n"
+          << "    PUSH {r4 - r7}\n"
+          << "    POP {r4-r7}\n"
+          << "@ branch to the next block\n"
+          << "next" << block << ":  BL block" << block + 1 << "\n";
+}
+
+static void add_data_block(std::ostringstream &program, unsigned int block) {
+  program << "value" << block << " .word " << block << ", 0x1F, -3, block"
+          << block << "\n"
+          << "    .byte 1, 2, 3\n"
+          << "    .asciz \"block\\n\"\n"
+          << "    .align 3\n";
+}
+
+int main(int argc, char *argv[]) {
+  const unsigned int blocks = argc > 1 ? std::atoi(argv[1]) : 2000;
+  const unsigned int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+  if (blocks == 0 || repetitions == 0) {
+    std::cout << "usage: " << argv[0] << " [blocks] [repetitions]"
+              << std::endl;
+    return 1;
+  }
+
+  std::ostringstream generated;
+  for (unsigned int block = 0; block < blocks; ++block) {
+    add_code_block(generated, block);
+  }
+  generated << "block" << blocks << ":  SWI 0\n"
+            << "    .data\n";
+  for (unsigned int block = 0; block < blocks; ++block) {
+    add_data_block(generated, block);
+  }
+  const std::string program = generated.str();
+  uint64_t lines = 0;
+  for (char c : program) {
+    lines += c == '\n';
+  }
+
+  SourceCodeParser parser;
+  double best_seconds = 0;
+  size_t instructions = 0;
+  for (unsigned int repetition = 0; repetition < repetitions; ++repetition) {
+    std::istringstream source(program);
+    const auto start = std::chrono::steady_clock::now();
+    instructions = parser.parse(source).size();
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    if (repetition == 0 || seconds < best_seconds) {
+      best_seconds = seconds;
+    }
+  }
+
+  std::cout << lines << " lines, " << program.size() << " bytes, "
+            << instructions << " instructions, best of " << repetitions
+            << std::endl;
+  std::cout << std::fixed << std::setprecision(3) << best_seconds * 1000
+            << " ms, " << std::setprecision(0) << lines / best_seconds
+            << " lines/s, " << std::setprecision(1)
+            << program.size() / best_seconds / 1e6 << " MB/s" << std::endl;
+
+  if (parser.get_error_count() > 0) {
+    std::cout << "The generated program has parse errors" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,252 @@
+// Compares a fresh guest_benchmark JSON run against a stored baseline and
+// fails when a workload got slower. Each workload and engine is compared with
+// the median of the instructions per second over the repetitions, and a 95%
+// confidence interval of that median. A regression is only reported when the
+// whole interval is below the baseline median by more than the threshold, so
+// a noisy run doesn't fail the gate.
+//
+// The baseline may come from a faster or slower host. Both files have the
+// time of a host reference workload, and the current results are scaled by
+// the ratio of the two reference medians before they are compared. Files
+// without a reference are compared as they are. A baseline from an optimized
+// build isn't compared with an unoptimized run or the other way around, the
+// gate is skipped then.
+//
+// usage: perf_gate baseline.json results.json [threshold percent]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// ctest reports a test that returns this as skipped
+#define SKIP_RETURN_CODE 77
+
+struct benchmark_result {
+  std::string workload;
+  std::string engine;
+  double instructions = 0;
+  bool correct = false;
+  // instructions per second of every repetition, sorted
+  std::vector<double> samples;
+};
+
+// The value after "key": on a line. Returns an empty string if the line
+// doesn't have the key
+static std::string find_value(const std::string &line, const std::string &key) {
+  const auto key_pos = line.find("\"" + key + "\":");
+  if (key_pos == std::string::npos) {
+    return "";
+  }
+  const auto start = line.find_first_not_of(' ', key_pos + key.size() + 3);
+  if (start == std::string::npos) {
+    return "";
+  }
+  if (line[start] == '"') {
+    return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+  }
+  if (line[start] == '[') {
+    return line.substr(start + 1, line.find(']', start) - start - 1);
+  }
+  return line.substr(start, line.find_first_of(",}", start) - start);
+}
+
+// The reference workload and the kind of build the results are from
+struct benchmark_host {
+  // median of the host reference in ms, 0 if the file doesn't have one
+  double reference_ms = 0;
+  // "true", "false" or empty if the file doesn't say
+  std::string optimized_build;
+};
+
+// Parses a list of numbers like 1.5, 2, 3
+static std::vector<double> parse_numbers(const std::string &list) {
+  std::vector<double> numbers;
+  const char *pos = list.c_str();
+  char *end = nullptr;
+  for (double number = std::strtod(pos, &end); end != pos;
+       number = std::strtod(pos, &end)) {
+    numbers.push_back(number);
+    pos = end + (*end == ',' ? 1 : 0);
+  }
+  return numbers;
+}
+
+static double get_median(const std::vector<double> &sorted) {
+  const size_t n = sorted.size();
+  return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+// guest_benchmark writes one result per line
+static bool load_results(const std::string &file_name,
+                         std::vector<benchmark_result> &results,
+                         benchmark_host &host) {
+  std::ifstream file(file_name);
+  if (!file) {
+    std::cout << "Can't open " << file_name << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    std::vector<double> reference =
+        parse_numbers(find_value(line, "host_reference_ms"));
+    if (!reference.empty()) {
+      std::sort(reference.begin(), reference.end());
+      host.reference_ms = get_median(reference);
+    }
+    const std::string optimized = find_value(line, "optimized_build");
+    if (!optimized.empty()) {
+      host.optimized_build = optimized;
+    }
+    benchmark_result result;
+    result.workload = find_value(line, "workload");
+    if (result.workload.empty()) {
+      continue;
+    }
+    result.engine = find_value(line, "engine");
+    result.instructions = std::atof(find_value(line, "instructions").c_str());
+    result.correct = find_value(line, "correct") == "true";
+    for (const double ms : parse_numbers(find_value(line, "samples_ms"))) {
+      if (ms > 0) {
+        result.samples.push_back(result.instructions / (ms / 1000));
+      }
+    }
+    if (result.samples.empty()) {
+      std::cout << "No samples for " << result.workload << " "
+                << result.engine << " in " << file_name << std::endl;
+      return false;
+    }
+    std::sort(result.samples.begin(), result.samples.end());
+    results.push_back(result);
+  }
+  return true;
+}
+
+// Distribution free 95% confidence interval of the median, from the order
+// statistics around it. Few samples give the whole range
+static void get_median_interval(const std::vector<double> &sorted,
+                                double &low, double &high) {
+  const double n = sorted.size();
+  const double spread = 1.96 * std::sqrt(n) / 2;
+  const long first = std::max(0L, static_cast<long>(n / 2 - spread));
+  const long last = std::min(static_cast<long>(n) - 1,
+                             static_cast<long>(std::ceil(n / 2 + spread)));
+  low = sorted[first];
+  high = sorted[last];
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0]
+              << " baseline.json results.json [threshold percent]"
+              << std::endl;
+    return 1;
+  }
+  const double threshold = argc > 3 ? std::atof(argv[3]) / 100 : 0.2;
+  std::vector<benchmark_result> baseline;
+  std::vector<benchmark_result> fresh;
+  benchmark_host baseline_host;
+  benchmark_host fresh_host;
+  if (!load_results(argv[1], baseline, baseline_host) ||
+      !load_results(argv[2], fresh, fresh_host)) {
+    return 1;
+  }
+
+  if (!baseline_host.optimized_build.empty() &&
+      !fresh_host.optimized_build.empty() &&
+      baseline_host.optimized_build != fresh_host.optimized_build) {
+    std::cout << "The baseline is from an "
+              << (baseline_host.optimized_build == "true" ? "optimized"
+                                                          : "unoptimized")
+              << " build and the results aren't, skipping the gate"
+              << std::endl;
+    return SKIP_RETURN_CODE;
+  }
+  // a slower host takes longer for the reference, and its results are
+  // scaled up by as much
+  double scale = 1;
+  if (baseline_host.reference_ms > 0 && fresh_host.reference_ms > 0) {
+    scale = fresh_host.reference_ms / baseline_host.reference_ms;
+    std::cout << std::fixed << std::setprecision(2) << "Host reference "
+              << baseline_host.reference_ms << " ms in the baseline, "
+              << fresh_host.reference_ms
+              << " ms now, the results are scaled by " << scale << std::endl;
+  } else {
+    std::cout << "A file has no host reference, comparing the results as "
+                 "they are"
+              << std::endl;
+  }
+  for (auto &result : fresh) {
+    for (auto &sample : result.samples) {
+      sample *= scale;
+    }
+  }
+
+  std::cout << "MIPS medians with 95% intervals, regressions are more than "
+            << threshold * 100 << "% below the baseline" << std::endl;
+  std::cout << std::left << std::setw(13) << "workload" << std::setw(14)
+            << "engine" << std::right << std::setw(10) << "baseline"
+            << std::setw(10) << "current" << std::setw(20) << "interval"
+            << std::setw(9) << "change" << "  result" << std::endl;
+  std::cout << std::fixed;
+  unsigned int failures = 0;
+  for (const auto &expected : baseline) {
+    auto actual = std::find_if(fresh.begin(), fresh.end(),
+                               [&](const benchmark_result &r) {
+                                 return r.workload == expected.workload &&
+                                        r.engine == expected.engine;
+                               });
+    std::cout << std::left << std::setw(13) << expected.workload
+              << std::setw(14) << expected.engine << std::right;
+    if (actual == fresh.end()) {
+      std::cout << "  missing from the results" << std::endl;
+      failures++;
+      continue;
+    }
+
+    const double baseline_median = get_median(expected.samples);
+    const double median = get_median(actual->samples);
+    double low = 0;
+    double high = 0;
+    get_median_interval(actual->samples, low, high);
+    const double change = median / baseline_median - 1;
+    const char *verdict = "ok";
+    if (!actual->correct) {
+      verdict = "WRONG RESULT";
+      failures++;
+    } else if (high < baseline_median * (1 - threshold)) {
+      verdict = "REGRESSION";
+      failures++;
+    } else if (median < baseline_median * (1 - threshold)) {
+      verdict = "noisy";
+    }
+    std::ostringstream interval;
+    interval << std::fixed << std::setprecision(1) << "[" << low / 1e6 << ", "
+             << high / 1e6 << "]";
+    std::cout << std::setprecision(1) << std::setw(10)
+              << baseline_median / 1e6 << std::setw(10) << median / 1e6
+              << std::setw(20) << interval.str() << std::showpos
+              << std::setw(8) << change * 100 << "%" << std::noshowpos << "  "
+              << verdict;
+    if (actual->instructions != expected.instructions) {
+      // the workload or the engine changed what it runs
+      std::cout << ", " << static_cast<uint64_t>(actual->instructions)
+                << " instructions instead of "
+                << static_cast<uint64_t>(expected.instructions);
+    }
+    std::cout << std::endl;
+  }
+
+  if (failures > 0) {
+    std::cout << failures << " of " << baseline.size()
+              << " benchmarks failed the performance gate" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,534 @@
+// Runs random instruction sequences on every execution engine and compares
+// the registers, the CPSR and the data memory after each step. The engines
+// are the reference Machine running parsed instructions, the same program
+// encoded to memory and run through the decoder, and the peephole optimized
+// program. A step is one optimized entry, so fused and folded instructions
+// are checked as a whole.
+//
+// The programs branch forward, apart from counted loops, so every case ends.
+// The loops make a case run a few hundred instructions, so generating the
+// program and the state is a small part of the time.
+//
+// Every case is generated from a 64-bit seed. Seeds that make the engines
+// disagree are written to the corpus directory, which is shared by all
+// threads: each thread replays the seeds the others find.
+//
+// usage: differential_fuzzer [-t threads] [-n cases per thread]
+//                            [-s first seed] [-c corpus directory]
+
+#include "arm_codec.h"
+#include "instruction.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "simulator.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define MEMORY_SIZE 1024
+#define MAX_PROGRAM_SIZE 48
+// loads and stores use r11 as the base, and it points to the middle of the
+// data window, so the code is never overwritten
+#define BASE_REGISTER 11
+// counted loops keep their count in r10
+#define LOOP_REGISTER 10
+#define MAX_LOOP_BODY 8
+#define MAX_LOOP_COUNT 32
+#define DATA_ADDRESS 512
+#define DATA_SIZE 256
+#define BASE_ADDRESS (DATA_ADDRESS + DATA_SIZE / 2)
+#define RESCAN_INTERVAL 1000
+
+static const opcodes data_processing_opcodes[] = {
+    opcodes::ADC, opcodes::ADD, opcodes::AND, opcodes::BIC,
+    opcodes::CMN, opcodes::CMP, opcodes::EOR, opcodes::MOV,
+    opcodes::MVN, opcodes::ORR, opcodes::RSB, opcodes::RSC,
+    opcodes::SBC, opcodes::SUB, opcodes::TEQ, opcodes::TST};
+
+static const opcodes multiply_opcodes[] = {opcodes::MLA,   opcodes::MUL,
+                                           opcodes::SMLAL, opcodes::SMULL,
+                                           opcodes::UMLAL, opcodes::UMULL};
+
+static const suffixes transfer_suffixes[] = {suffixes::NONE, suffixes::B,
+                                             suffixes::H, suffixes::SB,
+                                             suffixes::SH};
+
+static const update_modes multiple_modes[] = {update_modes::IA,
+                                              update_modes::IB,
+                                              update_modes::DA,
+                                              update_modes::DB};
+
+// destinations never include the base register, the loop count or the PC
+static const uint8_t destinations[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 12, 13,
+                                       14};
+
+template <typename T, size_t N> static T pick(std::mt19937_64 &rng,
+                                              const T (&values)[N]) {
+  return values[rng() % N];
+}
+
+static condition_codes random_condition(std::mt19937_64 &rng) {
+  // half of the instructions are unconditional
+  if (rng() % 2) {
+    return condition_codes::NONE;
+  }
+  return static_cast<condition_codes>(
+      rng() % static_cast<uint32_t>(condition_codes::LE) + 1);
+}
+
+static uint8_t random_source(std::mt19937_64 &rng) {
+  return rng() % PROGRAM_COUNTER_INDEX;
+}
+
+static void random_second_operand(std::mt19937_64 &rng, Instruction &i,
+                                  std::vector<uint8_t> &registers) {
+  if (rng() % 2) {
+    // an 8-bit value rotated right by an even amount
+    const uint32_t value = rng() & 0xFF;
+    const uint32_t rotation = (rng() % 16) * 2;
+    i.set_second_operand(rotation ? (value >> rotation) |
+                                        (value << (32 - rotation))
+                                  : value);
+    return;
+  }
+  registers.push_back(random_source(rng));
+  i.set_is_2nd_operand_register(true);
+  switch (rng() % 4) {
+  case 0:
+    break;
+  case 1:
+    i.set_shift(static_cast<shift_types>(rng() % 4 + 1), rng() % 31 + 1);
+    break;
+  case 2:
+    i.set_shift(shift_types::RRX, 0);
+    break;
+  default:
+    i.set_shift_by_register(static_cast<shift_types>(rng() % 4 + 1),
+                            random_source(rng));
+    break;
+  }
+}
+
+static Instruction random_instruction(std::mt19937_64 &rng, uint32_t address,
+                                      uint32_t end) {
+  Instruction i;
+  i.set_condition_code(random_condition(rng));
+  std::vector<uint8_t> registers;
+  const uint32_t kind = rng() % 16;
+  if (kind < 10) {
+    const opcodes code = pick(rng, data_processing_opcodes);
+    i.set_opcode(code);
+    if (rng() % 2) {
+      i.set_suffix(suffixes::S);
+    }
+    if (code == opcodes::CMN || code == opcodes::CMP || code == opcodes::TEQ ||
+        code == opcodes::TST) {
+      const uint8_t rn = random_source(rng);
+      registers = {rn, rn};
+    } else if (code == opcodes::MOV || code == opcodes::MVN) {
+      registers = {pick(rng, destinations)};
+    } else {
+      registers = {pick(rng, destinations), random_source(rng)};
+    }
+    random_second_operand(rng, i, registers);
+  } else if (kind < 12) {
+    const opcodes code = pick(rng, multiply_opcodes);
+    i.set_opcode(code);
+    if (rng() % 2) {
+      i.set_suffix(suffixes::S);
+    }
+    const uint8_t first = pick(rng, destinations);
+    uint8_t second = pick(rng, destinations);
+    while (second == first) {
+      second = pick(rng, destinations);
+    }
+    registers = {first, random_source(rng), random_source(rng)};
+    if (code == opcodes::MLA) {
+      registers.push_back(random_source(rng));
+    } else if (code != opcodes::MUL) {
+      registers = {first, second, random_source(rng), random_source(rng)};
+    }
+  } else if (kind < 14) {
+    const bool load = rng() % 2;
+    i.set_opcode(load ? opcodes::LDR : opcodes::STR);
+    i.set_suffix(pick(rng, transfer_suffixes));
+    registers = {load ? pick(rng, destinations) : random_source(rng),
+                 BASE_REGISTER};
+    i.set_second_operand(static_cast<int64_t>(rng() % 64) - 32);
+  } else if (kind < 15) {
+    const bool load = rng() % 2;
+    i.set_opcode(load ? opcodes::LDM : opcodes::STM);
+    i.set_update_mode(pick(rng, multiple_modes));
+    registers = {BASE_REGISTER};
+    for (uint8_t reg : destinations) {
+      if (rng() % 3 == 0) {
+        registers.push_back(reg);
+      }
+    }
+    if (registers.size() == 1) {
+      registers.push_back(pick(rng, destinations));
+    }
+  } else {
+    // forward branches only, so every case ends
+    i.set_opcode(opcodes::B);
+    i.set_second_operand(address + 1 + rng() % (end - address));
+  }
+  i.set_registers(registers);
+  return i;
+}
+
+// MOV rX, #a followed by operations rX, rX, #b, which the optimizer folds
+static void add_immediate_chain(std::mt19937_64 &rng,
+                                std::vector<Instruction> &program) {
+  static const opcodes chain_opcodes[] = {opcodes::ADD, opcodes::AND,
+                                          opcodes::BIC, opcodes::EOR,
+                                          opcodes::ORR, opcodes::RSB,
+                                          opcodes::SUB};
+  const uint8_t reg = pick(rng, destinations);
+  program.push_back(Instruction(rng() % 2 ? opcodes::MOV : opcodes::MVN,
+                                condition_codes::NONE, suffixes::NONE,
+                                update_modes::NONE, {reg}, rng() & 0xFF));
+  for (uint32_t length = rng() % 3 + 1; length > 0; --length) {
+    program.push_back(Instruction(pick(rng, chain_opcodes),
+                                  condition_codes::NONE, suffixes::NONE,
+                                  update_modes::NONE, {reg, reg},
+                                  rng() & 0xFF));
+  }
+}
+
+// Adds a random instruction that can be encoded, as the memory engine needs
+// every instruction encoded. Branches go up to end
+static void add_random_instruction(std::mt19937_64 &rng,
+                                   std::vector<Instruction> &program,
+                                   uint32_t end) {
+  const uint32_t address = program.size();
+  Instruction i;
+  uint32_t word;
+  do {
+    i = random_instruction(rng, address, end);
+  } while (!ArmCodec::encode(i, address, word));
+  program.push_back(i);
+}
+
+// MOV r10, #count, a body of random instructions, SUBS r10, r10, #1 and BGT
+// back to the body. The body doesn't write r10 and its branches don't skip
+// the SUBS, and r10 is never above the largest count, also when a forward
+// branch enters the body, so the loop ends
+static void add_counted_loop(std::mt19937_64 &rng,
+                             std::vector<Instruction> &program) {
+  program.push_back(Instruction(opcodes::MOV, condition_codes::NONE,
+                                suffixes::NONE, update_modes::NONE,
+                                {LOOP_REGISTER}, rng() % MAX_LOOP_COUNT + 1));
+  const uint32_t body = program.size();
+  const uint32_t subtract = body + rng() % MAX_LOOP_BODY + 1;
+  while (program.size() < subtract) {
+    add_random_instruction(rng, program, subtract);
+  }
+  program.push_back(Instruction(opcodes::SUB, condition_codes::NONE,
+                                suffixes::S, update_modes::NONE,
+                                {LOOP_REGISTER, LOOP_REGISTER}, 1));
+  program.push_back(Instruction(opcodes::B, condition_codes::GT,
+                                suffixes::NONE, update_modes::NONE, {}, body));
+}
+
+static std::vector<Instruction> random_program(std::mt19937_64 &rng) {
+  const uint32_t size = rng() % MAX_PROGRAM_SIZE + 1;
+  std::vector<Instruction> program;
+  while (program.size() < size) {
+    switch (rng() % 8) {
+    case 0:
+      add_immediate_chain(rng, program);
+      break;
+    case 1:
+      add_counted_loop(rng, program);
+      break;
+    default:
+      add_random_instruction(rng, program, size);
+      break;
+    }
+  }
+  program.push_back(Instruction(opcodes::SWI, condition_codes::NONE,
+                                suffixes::NONE, update_modes::NONE, {}, 0));
+  return program;
+}
+
+static void set_initial_state(std::mt19937_64 &rng, Cpu_state &state,
+                              std::vector<uint32_t> &data) {
+  for (uint32_t &value : state.registers) {
+    // small values and the edges of the signed range are the interesting ones
+    switch (rng() % 4) {
+    case 0:
+      value = rng() % 64;
+      break;
+    case 1:
+      value = 0x80000000 - 2 + rng() % 4;
+      break;
+    default:
+      value = static_cast<uint32_t>(rng());
+      break;
+    }
+  }
+  state.registers[BASE_REGISTER] = BASE_ADDRESS;
+  state.registers[LOOP_REGISTER] = rng() % MAX_LOOP_COUNT;
+  state.registers[PROGRAM_COUNTER_INDEX] = 0;
+  state.cpsr = static_cast<uint32_t>(rng()) & 0xF0000000;
+  data.resize(DATA_SIZE);
+  for (uint32_t &value : data) {
+    value = static_cast<uint32_t>(rng());
+  }
+}
+
+static bool same_data(Machine &reference, Machine &other) {
+  return std::memcmp(
+             reference.get_guest_bytes(DATA_ADDRESS, DATA_SIZE * 4, false),
+             other.get_guest_bytes(DATA_ADDRESS, DATA_SIZE * 4, false),
+             DATA_SIZE * 4) == 0;
+}
+
+// Returns an empty string if the machines have the same state, and the
+// differences otherwise. The data window is only compared when the step
+// stored to memory
+static std::string compare(Machine &reference, Machine &other,
+                           bool check_data) {
+  const Cpu_state &expected = reference.get_state();
+  const Cpu_state &actual = other.get_state();
+  if (expected == actual && (!check_data || same_data(reference, other))) {
+    return "";
+  }
+  std::ostringstream differences;
+  for (uint8_t reg = 0; reg < REGISTER_COUNT; ++reg) {
+    if (expected.registers[reg] != actual.registers[reg]) {
+      differences << " r" << static_cast<int>(reg) << ": " << std::hex
+                  << expected.registers[reg] << " != " << actual.registers[reg]
+                  << std::dec;
+    }
+  }
+  if (expected.cpsr != actual.cpsr) {
+    differences << " cpsr: " << std::hex << expected.cpsr << " != "
+                << actual.cpsr << std::dec;
+  }
+  for (uint32_t address = DATA_ADDRESS;
+       check_data && address < DATA_ADDRESS + DATA_SIZE; ++address) {
+    if (reference.get_memory(address).to_unsigned32() !=
+        other.get_memory(address).to_unsigned32()) {
+      differences << " memory " << address;
+    }
+  }
+  return differences.str();
+}
+
+static bool is_store(const Instruction &i) {
+  return i.get_opcode() == opcodes::STR || i.get_opcode() == opcodes::STM;
+}
+
+struct case_result {
+  uint64_t instructions;
+  std::string mismatch;
+};
+
+// The machines are reused between the cases of a thread, which keeps the
+// decoded instruction pages of the memory engine allocated
+struct engines {
+  Machine reference{MEMORY_SIZE};
+  Machine decoded{MEMORY_SIZE};
+  Machine optimizing{MEMORY_SIZE};
+};
+
+static case_result run_case(uint64_t seed, engines &machines) {
+  std::mt19937_64 rng(seed);
+  std::vector<Instruction> program = random_program(rng);
+  const std::vector<optimized_instruction> optimized =
+      Optimizer::optimize(program);
+  Machine &reference = machines.reference;
+  Machine &decoded = machines.decoded;
+  Machine &optimizing = machines.optimizing;
+  Cpu_state state = Cpu_state();
+  std::vector<uint32_t> data;
+  set_initial_state(rng, state, data);
+  for (Machine *m : {&reference, &decoded, &optimizing}) {
+    m->get_state() = state;
+    m->load_memory(DATA_ADDRESS, data.data(), data.size());
+  }
+  Simulator::load_program(program, decoded);
+
+  case_result result = {0, ""};
+  uint32_t pc = 0;
+  while (pc < program.size()) {
+    const unsigned int count = optimized[pc].length;
+    bool check_data = false;
+    for (uint32_t address = pc; address < pc + count; ++address) {
+      check_data |= is_store(program[address]);
+    }
+    // the quiet runs leave out the clock, the metrics and the output
+    const uint64_t retired = Simulator::run_slice(program, reference, count);
+    std::string differences;
+    if (Simulator::run_slice_from_memory(decoded, count) != retired) {
+      differences = " decoded retired count";
+    }
+    differences += compare(reference, decoded, check_data);
+    if (!differences.empty()) {
+      differences = " decoded:" + differences;
+    }
+    if (Simulator::run_slice(optimized, optimizing, count) != retired) {
+      differences += " optimized: retired count";
+    }
+    const std::string optimized_differences =
+        compare(reference, optimizing, check_data);
+    if (!optimized_differences.empty()) {
+      differences += " optimized:" + optimized_differences;
+    }
+    result.instructions += retired;
+    if (!differences.empty()) {
+      std::ostringstream report;
+      report << "seed " << seed << " at address " << pc << differences;
+      result.mismatch = report.str();
+      return result;
+    }
+    if (retired < count) {
+      break;
+    }
+    pc = reference.get_state().registers[PROGRAM_COUNTER_INDEX];
+  }
+  return result;
+}
+
+class corpus {
+public:
+  explicit corpus(const std::string &directory) : directory(directory) {
+    if (!directory.empty()) {
+      mkdir(directory.c_str(), 0755);
+    }
+  }
+
+  // seeds in the directory that the thread has not replayed yet
+  std::vector<uint64_t> get_new_seeds(std::set<std::string> &replayed) {
+    std::vector<uint64_t> seeds;
+    if (directory.empty()) {
+      return seeds;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+      return seeds;
+    }
+    while (dirent *entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (name.compare(0, 5, "seed-") == 0 && replayed.insert(name).second) {
+        seeds.push_back(std::strtoull(name.c_str() + 5, nullptr, 10));
+      }
+    }
+    closedir(dir);
+    return seeds;
+  }
+
+  void add(uint64_t seed, const std::string &report) {
+    if (directory.empty()) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ofstream file(directory + "/seed-" + std::to_string(seed));
+    file << report << std::endl;
+  }
+
+private:
+  std::string directory;
+  std::mutex mutex;
+};
+
+struct fuzz_totals {
+  std::atomic<uint64_t> cases{0};
+  std::atomic<uint64_t> instructions{0};
+  std::atomic<uint64_t> mismatches{0};
+};
+
+static std::mutex report_mutex;
+
+static void fuzz_thread(uint64_t first_seed, uint64_t case_count,
+                        corpus &shared_corpus, fuzz_totals &totals) {
+  std::set<std::string> replayed;
+  engines machines;
+  uint64_t instructions = 0;
+  for (uint64_t idx = 0; idx < case_count; ++idx) {
+    std::vector<uint64_t> seeds;
+    if (idx % RESCAN_INTERVAL == 0) {
+      seeds = shared_corpus.get_new_seeds(replayed);
+    }
+    seeds.push_back(first_seed + idx);
+    for (uint64_t seed : seeds) {
+      const case_result result = run_case(seed, machines);
+      instructions += result.instructions;
+      if (!result.mismatch.empty()) {
+        totals.mismatches++;
+        replayed.insert("seed-" + std::to_string(seed));
+        shared_corpus.add(seed, result.mismatch);
+        std::lock_guard<std::mutex> lock(report_mutex);
+        std::cerr << result.mismatch << std::endl;
+      }
+    }
+  }
+  totals.cases += case_count;
+  totals.instructions += instructions;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int thread_count = std::thread::hardware_concurrency();
+  uint64_t case_count = 10000;
+  uint64_t first_seed = std::random_device()();
+  std::string corpus_directory;
+  for (int idx = 1; idx + 1 < argc; idx += 2) {
+    if (strcmp(argv[idx], "-t") == 0) {
+      thread_count = std::atoi(argv[idx + 1]);
+    } else if (strcmp(argv[idx], "-n") == 0) {
+      case_count = std::strtoull(argv[idx + 1], nullptr, 10);
+    } else if (strcmp(argv[idx], "-s") == 0) {
+      first_seed = std::strtoull(argv[idx + 1], nullptr, 10);
+    } else if (strcmp(argv[idx], "-c") == 0) {
+      corpus_directory = argv[idx + 1];
+    }
+  }
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+
+  // the memory engine reports invalid instructions, which the compare of
+  // the retired counts already catches
+  std::cout.rdbuf(nullptr);
+  corpus shared_corpus(corpus_directory);
+  fuzz_totals totals;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned int idx = 0; idx < thread_count; ++idx) {
+    threads.emplace_back(fuzz_thread, first_seed + idx * case_count,
+                         case_count, std::ref(shared_corpus),
+                         std::ref(totals));
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+  std::cerr << totals.cases << " cases from seed " << first_seed << ", "
+            << totals.instructions << " instructions cross-checked on "
+            << thread_count << " threads, "
+            << static_cast<uint64_t>(totals.instructions / seconds)
+            << " instructions/s, " << totals.mismatches << " mismatches"
+            << std::endl;
+  return totals.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+// Fuzz target for SourceCodeParser. Any input must parse without crashing,
+// every parsed instruction must only name registers that exist, and the
+// program must encode and optimize without crashing.
+//
+// Built with -DARSMULATOR_LIBFUZZER=ON the target is run by libFuzzer.
+// Otherwise it has its own driver that mutates lines of valid assembly, and
+// replays the files given as arguments.
+//
+// usage: parser_fuzzer [-n cases] [-s seed] [files...]
+
+#include "arm_codec.h"
+#include "instruction.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "source_parser.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  std::istringstream source(
+      std::string(reinterpret_cast<const char *>(data), size));
+  SourceCodeParser parser;
+  const std::vector<Instruction> program = parser.parse(source);
+  for (uint32_t address = 0; address < program.size(); ++address) {
+    const Instruction &i = program[address];
+    for (uint8_t idx = 0; idx < i.get_register_count(); ++idx) {
+      if (i.get_register(idx) >= REGISTER_COUNT) {
+        std::cerr << "Register " << i.get_register(idx) << " at address "
+                  << address << std::endl;
+        std::abort();
+      }
+    }
+    if (i.is_shift_by_register() && i.get_shift_register() >= REGISTER_COUNT) {
+      std::cerr << "Shift register at address " << address << std::endl;
+      std::abort();
+    }
+    uint32_t word;
+    ArmCodec::encode(i, address, word);
+  }
+  Optimizer::optimize(program);
+  return 0;
+}
+
+#ifndef ARSMULATOR_LIBFUZZER
+
+static const char *const valid_lines[] = {
+    "start:  MOV r0, #1",
+    "loop    ADDS r1, r1, r0, LSL #2 ; comment",
+    "    SUBNE r2, r2, r3, ASR r4",
+    "    MOVS r5, r6, RRX",
+    "    CMP r0, #0x10",
+    "    TEQ r1, r2",
+    "    BGT loop",
+    "    BL start",
+    "    MLA r3, r4, r5, r6",
+    "    UMULL r0, r1, r2, r3",
+    "    LDR r0, [r1, #4]!",
+    "    STRB r2, [r3], #-1",
+    "    LDRSH r4, [r5, -r6]",
+    "    LDR r0, =0x12345678",
+    "    LDR r1, =table",
+    "    ADR r2, start",
+    "    STMFD sp!, {r0-r3, lr}",
+    "    LDMIA r0, {r1, r2 - r4}",
+    "    PUSH {r4-r7}",
+    "    POP {r4, pc}",
+    "    SWI 0",
+    "@ comment",
+    "",
+    "    .data",
+    "table .word 1, -2, 0x3, start",
+    "    .byte 255, 256",
+    "text:   .asciz \"a\\n\\\"b\"",
+    "    .space 4, 0xFF",
+    "    .align 3"};
+
+// fragments that are valid in some places and not in others
+static const char *const tokens[] = {
+    " ",  ",",  "#",   "-",   "[",   "]",    "!",   "{",   "}",   ":",
+    ";",  "@",  "=",   "\"",  "\\",  "\t",   "r",   "r15", "r16", "pc",
+    "#-", "0x", "LSL", "RRX", "ROR", " r1 ", "#32", "#33", "99",  "label",
+    ".",  "\n", "\r",  "\xff"};
+
+static std::string random_input(std::mt19937_64 &rng) {
+  std::string input;
+  for (uint32_t line = rng() % 16 + 1; line > 0; --line) {
+    input += valid_lines[rng() % (sizeof(valid_lines) / sizeof(char *))];
+    input += '\n';
+  }
+  for (uint32_t mutation = rng() % 8; mutation > 0 && !input.empty();
+       --mutation) {
+    const size_t pos = rng() % input.size();
+    switch (rng() % 4) {
+    case 0: // insert a token
+      input.insert(pos, tokens[rng() % (sizeof(tokens) / sizeof(char *))]);
+      break;
+    case 1: // erase a few characters
+      input.erase(pos, rng() % 4 + 1);
+      break;
+    case 2: // replace a character with a random byte
+      input[pos] = static_cast<char>(rng());
+      break;
+    default: // duplicate a part of the input
+      input.insert(pos, input.substr(rng() % input.size(), rng() % 16));
+      break;
+    }
+  }
+  return input;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t case_count = 100000;
+  uint64_t seed = std::random_device()();
+  std::vector<std::string> files;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (strcmp(argv[idx], "-n") == 0 && idx + 1 < argc) {
+      case_count = std::strtoull(argv[++idx], nullptr, 10);
+    } else if (strcmp(argv[idx], "-s") == 0 && idx + 1 < argc) {
+      seed = std::strtoull(argv[++idx], nullptr, 10);
+    } else {
+      files.push_back(argv[idx]);
+    }
+  }
+
+  // the parser reports every malformed line
+  std::cout.rdbuf(nullptr);
+  for (const auto &file_name : files) {
+    std::ifstream file(file_name, std::ios::binary);
+    const std::string input((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()),
+                           input.size());
+  }
+  if (!files.empty()) {
+    return 0;
+  }
+
+  std::mt19937_64 rng(seed);
+  uint64_t bytes = 0;
+  for (uint64_t idx = 0; idx < case_count; ++idx) {
+    const std::string input = random_input(rng);
+    bytes += input.size();
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()),
+                           input.size());
+  }
+  std::cerr << case_count << " inputs, " << bytes << " bytes from seed "
+            << seed << std::endl;
+  return 0;
+}
+
+#endif // ARSMULATOR_LIBFUZZER
@@ -0,0 +1,43 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+#include "machine.h"
+
+#include <cstdint>
+
+// reserved SWI numbers of the accelerated routines
+#define SWI_MEMCPY 0x100
+#define SWI_MEMMOVE 0x101
+#define SWI_MEMSET 0x102
+#define SWI_MEMCMP 0x103
+#define SWI_STRLEN 0x104
+
+// Runs memory routines on guest memory with the host library instead of
+// guest loops. Memory is word addressed, so the routines work on words, and
+// strings end with a zero word like the ones of .asciz. Arguments are in r0,
+// r1 and r2 and the result is in r0:
+//
+//   memcpy(dst, src, n), memmove(dst, src, n) and memset(dst, value, n)
+//   return dst, memcmp(a, b, n) returns the difference of the first words
+//   that differ or 0, and strlen(s) returns the number of words before the
+//   zero word.
+//
+// An SWI leaves r0-r12, the flags and memory as the BL to the matching
+// reference guest routine in the README would, and memcpy copies forward
+// like it when the ranges overlap. With instruction accounting the SWI also
+// retires the instructions the routine would have run. A routine that would
+// access memory outside of the machine halts it instead.
+class Accelerator {
+public:
+  static void attach(Machine &m, bool count_instructions = false);
+
+private:
+  // the SWI handlers, they return true if the machine should halt
+  static bool copy(Machine &m, bool count_instructions);
+  static bool move(Machine &m, bool count_instructions);
+  static bool fill(Machine &m, bool count_instructions);
+  static bool compare(Machine &m, bool count_instructions);
+  static bool length(Machine &m, bool count_instructions);
+};
+
+#endif // ACCELERATOR_H
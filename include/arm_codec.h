@@ -0,0 +1,25 @@
+#ifndef ARM_CODEC_H
+#define ARM_CODEC_H
+
+#include "instruction.h"
+
+#include <cstdint>
+
+// Translates instructions to and from 32-bit ARM machine code. Addresses are
+// machine memory addresses (one instruction per address), so PC relative
+// offsets are encoded exactly as ARM does in words: a branch at address N to
+// address M is stored as offset M - (N + 2). Load and store offsets are in
+// memory addresses as well.
+class ArmCodec {
+public:
+  // returns false if the instruction has no ARM encoding
+  static bool encode(const Instruction &i, uint32_t address, uint32_t &word);
+  // returns false if the word is not a supported ARM instruction
+  static bool decode(uint32_t word, uint32_t address, Instruction &result);
+  // Encodes value as an 8-bit immediate rotated right by an even amount.
+  // Returns false if that's not possible
+  static bool encode_immediate(uint32_t value, uint32_t &encoded);
+  static uint32_t decode_immediate(uint32_t encoded);
+};
+
+#endif // ARM_CODEC_H
@@ -1,5 +1,8 @@
+#include "coverage.h"
 #include "instruction.h"
 #include "machine.h"
+#include "optimizer.h"
+#include "semihosting.h"
 #include "source_parser.h"
 
 #include <list>
@@ -7,11 +10,22 @@
 
 class cli_app {
 public:
-  cli_app() : m(256), program({}), file_name(""), source_parser(){};
+  cli_app()
+      : m(256), program({}), file_name(""), source_parser(),
+        run_from_memory(false), optimize(false){};
   void parse_cli_args(int argc, char *argv[]);
   bool parse_command(std::string &command);
   void run(int count = 0);
   std::string get_next_command_from_queue();
+  // writes the metrics to the file given with -M, if any
+  void write_metrics_file();
+  // merges the coverage to the file given with -C and writes the line
+  // coverage to the file given with -L, if any
+  void write_coverage_files();
+  // writes the inputs recorded with -R, if any
+  void write_replay_log();
+  // the exit code of the guest, 0 if it didn't exit through semihosting
+  int get_exit_code() const;
 
 private:
   Machine m;
@@ -19,4 +33,19 @@ private:
   std::string file_name;
   SourceCodeParser source_parser;
   std::list<std::string> command_queue;
+  // true when an executable is loaded to memory instead of a parsed program
+  bool run_from_memory;
+  // true when the parsed program is run through the peephole optimizer
+  bool optimize;
+  std::vector<optimized_instruction> optimized_program;
+  // metrics are written here on exit, as JSON if it ends with .json
+  std::string metrics_file;
+  // coverage is on when either of the files is given
+  std::string coverage_file;
+  std::string line_coverage_file;
+  Coverage coverage;
+  Semihosting semihosting;
+  // inputs are recorded to this file, or replayed from the one given with -P
+  std::string record_file;
+  ReplayLog replay_log;
 };
@@ -0,0 +1,62 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// The edge map has 2^COVERAGE_MAP_SHIFT counters
+#define COVERAGE_MAP_SHIFT 16
+#define COVERAGE_MAP_SIZE (1 << COVERAGE_MAP_SHIFT)
+
+// Guest code coverage. Every executed instruction increments the hit counter
+// of its address, and control flow that doesn't fall through to the next
+// address increments a counter of the edge in an AFL style map: taken
+// branches and other PC writes as PC->target, and instructions skipped by
+// their condition as PC->PC+1. Edges hash to the map, so different edges can
+// share a counter. Edge counters saturate at 255 instead of wrapping to 0.
+//
+// A Coverage is filled by one machine at a time. Parallel runs each use their
+// own, and merge them or the files they wrote.
+class Coverage {
+public:
+  // hits are counted for addresses below address_count
+  Coverage(size_t address_count = 0);
+  void add_hit(uint32_t address) {
+    if (address < hits.size()) {
+      hits[address]++;
+    }
+  }
+  void add_edge(uint32_t from, uint32_t to) {
+    uint8_t &counter = edges[get_edge_index(from, to)];
+    if (counter != UINT8_MAX) {
+      counter++;
+    }
+  }
+  static uint32_t get_edge_index(uint32_t from, uint32_t to);
+  uint32_t get_hit_count(uint32_t address) const;
+  uint8_t get_edge_count(uint32_t from, uint32_t to) const;
+  // number of edge map counters that are not zero
+  size_t get_covered_edge_count() const;
+  const std::vector<uint8_t> &get_edges() const;
+  const std::vector<uint32_t> &get_hits() const;
+  // adds the counts of other to this one
+  void merge(const Coverage &other);
+  // Writes the counters to a binary file. Returns false if it can't be
+  // written
+  bool write(const std::string &file_name) const;
+  // Merges the counters of a file made by write. Returns false if the file
+  // can't be read or it's not a coverage file
+  bool merge_file(const std::string &file_name);
+  // Writes the hits of each source line as an lcov tracefile. source_lines
+  // has the line of each address, as SourceCodeParser::get_source_lines
+  void write_line_coverage(std::ostream &out, const std::string &source_name,
+                           const std::vector<unsigned int> &source_lines) const;
+
+private:
+  std::vector<uint8_t> edges;
+  std::vector<uint32_t> hits;
+};
+
+#endif // COVERAGE_H
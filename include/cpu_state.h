@@ -0,0 +1,48 @@
+#ifndef CPU_STATE_H
+#define CPU_STATE_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#define REGISTER_COUNT 16
+// register banks of the modes: user and system, FIQ, IRQ and supervisor
+#define CPU_BANK_COUNT 4
+// r8-r12, which only FIQ mode banks
+#define FIQ_BANKED_COUNT 5
+
+// Architectural state of the processor, r0-r15 and the CPSR of the current
+// mode, and the banked registers of the others. It's trivially copyable, so
+// execution engines can access it directly and snapshots are plain copies.
+// Machine_byte is only the view the Machine API gives of a register.
+struct Cpu_state {
+  uint32_t registers[REGISTER_COUNT];
+  uint32_t cpsr;
+  // r13 and r14 of each bank, and r8-r12 of the modes other than FIQ and of
+  // FIQ. The entries of the current mode are stale, as it runs on registers
+  uint32_t banked_sp_lr[CPU_BANK_COUNT][2];
+  uint32_t banked_r8_r12[2][FIQ_BANKED_COUNT];
+  // the SPSR of each exception mode, the user one is unused
+  uint32_t spsr[CPU_BANK_COUNT];
+};
+
+static_assert(std::is_trivially_copyable<Cpu_state>::value,
+              "Cpu_state is copied with memcpy");
+
+// compares the fields, as any padding after them is not initialized
+inline bool operator==(const Cpu_state &first, const Cpu_state &second) {
+  return std::memcmp(first.registers, second.registers,
+                     sizeof(first.registers)) == 0 &&
+         first.cpsr == second.cpsr &&
+         std::memcmp(first.banked_sp_lr, second.banked_sp_lr,
+                     sizeof(first.banked_sp_lr)) == 0 &&
+         std::memcmp(first.banked_r8_r12, second.banked_r8_r12,
+                     sizeof(first.banked_r8_r12)) == 0 &&
+         std::memcmp(first.spsr, second.spsr, sizeof(first.spsr)) == 0;
+}
+
+inline bool operator!=(const Cpu_state &first, const Cpu_state &second) {
+  return !(first == second);
+}
+
+#endif // CPU_STATE_H
@@ -0,0 +1,117 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "event_queue.h"
+#include "machine.h"
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+
+// UART registers, in words from the address of the device
+#define UART_DATA 0
+#define UART_STATUS 1
+#define UART_WORD_COUNT 2
+// UART_STATUS bits
+#define UART_RX_READY 0x1
+#define UART_TX_READY 0x2
+
+// Timer registers, in words from the address of the device
+#define TIMER_LOAD 0
+#define TIMER_CONTROL 1
+#define TIMER_STATUS 2
+#define TIMER_WORD_COUNT 3
+// TIMER_CONTROL bits
+#define TIMER_ENABLE 0x1
+#define TIMER_PERIODIC 0x2
+// TIMER_STATUS bits
+#define TIMER_EXPIRED 0x1
+
+// Interrupt controller registers, in words from the address of the device
+#define INTC_PENDING 0
+#define INTC_ENABLE 1
+#define INTC_FIQ_SELECT 2
+#define INTC_WORD_COUNT 3
+// sources are the bits of the registers
+#define INTC_SOURCE_COUNT 32
+
+// A serial port on the host streams. Writing UART_DATA sends its low byte,
+// and reading it takes the next input byte, or 0 when there is none. Input
+// is ready when the stream has buffered characters, so reading the status
+// never blocks.
+class Uart {
+public:
+  Uart(std::ostream &out = std::cout, std::istream &in = std::cin);
+  // Maps the registers to the address. The machine must not access them
+  // after this is destroyed
+  void attach(Machine &m, uint32_t address);
+
+private:
+  uint32_t read(uint32_t offset);
+  void write(uint32_t offset, uint32_t value);
+
+  std::ostream &out;
+  std::istream &in;
+};
+
+// A timer that counts retired instructions on an event queue. Enabling it,
+// or writing TIMER_LOAD while it's enabled, starts it counting TIMER_LOAD
+// instructions. When they have been retired it sets TIMER_EXPIRED and calls
+// the expiry handler, and a periodic timer starts counting again from the
+// time it expired. Writing a bit of TIMER_STATUS clears it.
+class Timer {
+public:
+  typedef std::function<void()> expiry_handler;
+
+  Timer(EventQueue &events);
+  ~Timer();
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+  // Maps the registers to the address. The machine must not access them
+  // after this is destroyed
+  void attach(Machine &m, uint32_t address);
+  // called after TIMER_EXPIRED is set, for raising interrupts
+  void set_expiry_handler(expiry_handler handler);
+  bool has_expired() const;
+
+private:
+  uint32_t read(uint32_t offset);
+  void write(uint32_t offset, uint32_t value);
+  // schedules the expiry load instructions after from
+  void start(uint64_t from);
+  void stop();
+  void expire(uint64_t time);
+
+  EventQueue &events;
+  uint32_t load = 0;
+  uint32_t control = 0;
+  uint32_t status = 0;
+  bool scheduled = false;
+  uint64_t event_id = 0;
+  expiry_handler on_expiry;
+};
+
+// Routes device interrupts to the lines of a machine. A raised source stays
+// pending in INTC_PENDING until the guest writes its bit there. Pending
+// sources that are set in INTC_ENABLE raise the FIQ line if they are set in
+// INTC_FIQ_SELECT, and the IRQ line otherwise.
+class InterruptController {
+public:
+  // Maps the registers to the address and drives the lines of the machine.
+  // The machine must not access them after this is destroyed
+  void attach(Machine &m, uint32_t address);
+  // latches the source, for the expiry handler of a timer for example
+  void raise(unsigned int source);
+
+private:
+  uint32_t read(uint32_t offset);
+  void write(uint32_t offset, uint32_t value);
+  void update_lines();
+
+  Machine *machine = nullptr;
+  uint32_t pending = 0;
+  uint32_t enabled = 0;
+  uint32_t fiq_selected = 0;
+};
+
+#endif // DEVICES_H
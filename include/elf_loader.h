@@ -0,0 +1,22 @@
+#ifndef ELF_LOADER_H
+#define ELF_LOADER_H
+
+#include "machine.h"
+
+#include <string>
+
+// Loads little-endian ARM ELF32 executables to machine memory. ELF addresses
+// are in bytes, and byte address A is stored in memory word A / 4, so a
+// segment keeps the same byte layout it has in the file. The machine runs
+// the executable with byte addresses, see Machine::set_byte_addresses.
+class ElfLoader {
+public:
+  // Loads the PT_LOAD segments, points the program counter to the entry
+  // point and the stack pointer to the end of memory. Read-only segments are
+  // mapped from the file instead of copied when the host allows it. Returns
+  // false if the file is not a supported executable or it doesn't fit in
+  // memory
+  static bool load(const std::string &file_name, Machine &m);
+};
+
+#endif // ELF_LOADER_H
@@ -0,0 +1,84 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Each level of the timing wheel has 2^EVENT_WHEEL_SHIFT slots
+#define EVENT_WHEEL_SHIFT 6
+#define EVENT_WHEEL_SIZE (1 << EVENT_WHEEL_SHIFT)
+#define EVENT_WHEEL_LEVELS 4
+
+// Events scheduled on a time that counts retired instructions, kept in a
+// hierarchical timing wheel. Level 0 has a slot for each of the next 64
+// times, and each slot of level n covers 64 slots of level n - 1. Events move
+// down a level when the time reaches the start of their slot, and events more
+// than 2^24 ahead wait in an overflow list. A bitmap of the used slots of
+// each level finds the next one without visiting the empty ones.
+//
+// The simulator advances the queue of a machine as it retires instructions,
+// so handlers run at the first instruction boundary at or after their time,
+// and runs without events due only compare the retired count to a deadline.
+class EventQueue {
+public:
+  // Called with the time the event was scheduled for
+  typedef std::function<void(uint64_t time)> event_handler;
+
+  // Inside a run, the time at its start plus the instructions it retired
+  uint64_t get_time() const {
+    return run_retired ? run_start + *run_retired : time;
+  }
+  // Schedules the handler to run when the time reaches at, or on the next
+  // advance when it already has. Returns an id for cancel
+  uint64_t schedule(uint64_t at, event_handler handler);
+  // returns false if the event already ran or was cancelled
+  bool cancel(uint64_t id);
+  size_t get_pending_count() const { return handlers.size(); }
+  // The time the queue has work at next, which is at or before the next
+  // event, or UINT64_MAX when it's empty
+  uint64_t get_next_time() const;
+  // Moves the time forward to to and runs the events that are due by then
+  // in the order of their times, and of scheduling for equal times. Handlers
+  // may schedule and cancel events
+  void advance(uint64_t to);
+  // The simulator counts the retired instructions of a run at retired, and
+  // advances the queue when they reach the deadline. Scheduling during the
+  // run moves the deadline. The end of the run advances to its last
+  // instruction
+  void begin_run(const uint64_t *retired);
+  void end_run();
+  const uint64_t *get_run_deadline() const { return &run_deadline; }
+
+private:
+  struct event {
+    uint64_t at;
+    uint64_t id;
+  };
+
+  // puts the event in the wheel, or in the due list when its time has come
+  void insert(const event &e);
+  // runs the due events in order
+  void run_due();
+  // moves the events of the slots that start at the current time down
+  void cascade();
+  void update_run_deadline();
+
+  uint64_t time = 0;
+  const uint64_t *run_retired = nullptr;
+  uint64_t run_start = 0;
+  // retired instructions of the run at which the queue has work next
+  uint64_t run_deadline = UINT64_MAX;
+  uint64_t next_id = 0;
+  std::vector<event> slots[EVENT_WHEEL_LEVELS][EVENT_WHEEL_SIZE];
+  uint64_t used_slots[EVENT_WHEEL_LEVELS] = {};
+  std::vector<event> overflow;
+  std::vector<event> due;
+  // handlers of the pending events, cancel removes them
+  std::unordered_map<uint64_t, event_handler> handlers;
+};
+
+#endif // EVENT_QUEUE_H
@@ -20,18 +20,24 @@ enum class opcodes {
   EOR,
   LDM,
   LDR,
+  MLA,
   MOV,
+  MUL,
   MVN,
   ORR,
   RSB,
   RSC,
   SBC,
+  SMLAL,
+  SMULL,
   STM,
   STR,
   SUB,
   SWI,
   TEQ,
-  TST
+  TST,
+  UMLAL,
+  UMULL
 };
 
 enum class condition_codes {
@@ -57,6 +63,11 @@ enum class update_modes { NONE = 0, IA, IB, DA, DB };
 
 enum class suffixes { NONE = 0, S, B, SH, H, SB, D };
 
+// Barrel shifter operations for a register second operand. Immediate shift
+// amounts are kept in the range the operation uses, so LSR and ASR by 32 are
+// stored as 32 and shifts by 0 are stored as NONE
+enum class shift_types { NONE = 0, LSL, LSR, ASR, ROR, RRX };
+
 class Instruction {
 public:
   Instruction(opcodes operation, condition_codes condition, suffixes suf,
@@ -85,15 +96,36 @@ public:
   uint32_t get_last_register() const;
   size_t get_register_count() const;
   void append_to_registers(uint8_t index);
+  void set_shift(shift_types type, uint8_t amount);
+  void set_shift_by_register(shift_types type, uint8_t shift_register);
+  shift_types get_shift_type() const;
+  uint8_t get_shift_amount() const;
+  bool is_shift_by_register() const;
+  uint8_t get_shift_register() const;
+  // Single transfer addressing. The offset is the second operand, and a
+  // register offset is subtracted instead of added if it's negated
+  void set_writeback(bool enabled);
+  bool has_writeback() const;
+  void set_post_indexed(bool enabled);
+  bool is_post_indexed() const;
+  void set_offset_subtracted(bool subtracted);
+  bool is_offset_subtracted() const;
 
 private:
-  opcodes opcode;
-  condition_codes condition_code;
-  suffixes suffix;
-  update_modes update_mode;
+  opcodes opcode = opcodes::NONE;
+  condition_codes condition_code = condition_codes::NONE;
+  suffixes suffix = suffixes::NONE;
+  update_modes update_mode = update_modes::NONE;
   std::vector<uint8_t> registers;
-  int64_t flex_2nd_operand;
-  bool flex_2nd_is_register;
+  int64_t flex_2nd_operand = 0;
+  bool flex_2nd_is_register = false;
+  shift_types shift_type = shift_types::NONE;
+  // shift amount, or the register holding it if shift_by_register is set
+  uint8_t shift_operand = 0;
+  bool shift_by_register = false;
+  bool writeback = false;
+  bool post_indexed = false;
+  bool offset_subtracted = false;
 };
 
 #endif // INSTRUCTION_H
\ No newline at end of file
@@ -1,12 +1,16 @@
 #ifndef MACHINE_H
 #define MACHINE_H
 
+#include "cpu_state.h"
 #include "instruction.h"
 #include "machine_byte.h"
+#include "metrics.h"
 
 #include <cstdint>
+#include <functional>
 #include <stdint.h>
 #include <stdlib.h>
+#include <utility>
 #include <vector>
 
 #define SHIFT_CPRS_N 31
@@ -17,42 +21,253 @@
 #define BITMASK_CPSR_Z (0x01 << SHIFT_CPRS_Z)
 #define BITMASK_CPSR_C (0x01 << SHIFT_CPRS_C)
 #define BITMASK_CPSR_V (0x01 << SHIFT_CPRS_V)
+// interrupt disable bits and the mode field
+#define SHIFT_CPRS_I 7
+#define SHIFT_CPRS_F 6
+#define BITMASK_CPSR_I (0x01 << SHIFT_CPRS_I)
+#define BITMASK_CPSR_F (0x01 << SHIFT_CPRS_F)
+#define BITMASK_CPSR_MODE 0x1F
+// Processor modes. The reset CPSR has a mode field of 0, which runs as user
+// mode, and so do the modes without a bank here
+#define MODE_USR 0x10
+#define MODE_FIQ 0x11
+#define MODE_IRQ 0x12
+#define MODE_SVC 0x13
+#define MODE_SYS 0x1F
+// Exception vectors, as word addresses
+#define VECTOR_SWI 2
+#define VECTOR_IRQ 6
+#define VECTOR_FIQ 7
 #define PROGRAM_COUNTER_INDEX 15
 #define LINK_REGISTER_INDEX 14
+#define STACK_POINTER_INDEX 13
+// Decoded instructions are cached in pages of 2^CODE_PAGE_SHIFT addresses
+#define CODE_PAGE_SHIFT 10
+
+// forward declarations
+class Coverage;
+class EventQueue;
 
 class Machine {
 public:
+  // Runs an SWI instead of the machine, and returns true if it should halt
+  typedef std::function<bool(Machine &m)> swi_handler;
+  // Handlers of a device region, called with the word offset into it
+  typedef std::function<uint32_t(uint32_t offset)> device_read_handler;
+  typedef std::function<void(uint32_t offset, uint32_t value)>
+      device_write_handler;
+
   Machine(int mem_size);
+  // A core that shares the memory of memory_owner, which must outlive it.
+  // The core has its own registers, SWI handlers, coverage and decoded
+  // instructions, so code written by one core may still run decoded on
+  // another until it writes the code itself
+  explicit Machine(Machine *memory_owner);
   Machine(Machine &machine) = delete;
   ~Machine();
+  Machine &operator=(Machine &&machine);
   // returns true if machine should be halted (due to SWI or an error), false
   // otherwise
-  bool execute(Instruction i);
+  bool execute(const Instruction &i);
+  // Superinstructions of the optimizer, which run like executing a CMP or a
+  // SUBS and then the B after it. The first instruction must be
+  // unconditional, have an unshifted second operand and not use the PC
+  void execute_compare_and_branch(const Instruction &compare,
+                                  const Instruction &branch);
+  void execute_subtract_and_branch(const Instruction &subtract,
+                                   const Instruction &branch);
   void set_register_value(uint8_t reg_number, Machine_byte value);
   Machine_byte get_register_value(uint8_t reg_number);
   uint32_t get_current_program_status_register();
+  // Writing a different mode switches the banked registers, like an MSR
   void set_current_program_status_register(uint32_t register_value);
   void print_registers();
+  // The whole architectural state, for snapshots and direct access. Writes
+  // to the PC take effect as a branch. Writes to the CPSR don't switch the
+  // banked registers or look for pending interrupts
+  Cpu_state &get_state();
+  const Cpu_state &get_state() const;
+  // Runs the machine on the registers of context instead of its own, or on
+  // its own again for nullptr. Only the pointer is switched, so it's cheap
+  // enough for every scheduler turn. The machine doesn't own the context
+  void switch_context(Cpu_state *context);
   bool meets_condition_code(condition_codes code);
   void set_memory(int address, Machine_byte byte);
   Machine_byte get_memory(int address);
+  int get_memory_size() const;
+  // Copies count words to memory starting from the address
+  void load_memory(uint32_t address, const uint32_t *words, size_t count);
+  // Maps byte_count bytes of the file starting from offset to memory at the
+  // address without copying them. Memory word n holds guest bytes 4n..4n+3.
+  // Mapping works on whole host pages, so the rest of the first and last page
+  // are replaced from the file as well. Returns false if the region can't be
+  // mapped, and it should be copied instead
+  bool map_file(int file_descriptor, uint64_t offset, uint32_t address,
+                uint32_t byte_count);
   Machine_byte get_flex_2nd_operand_value(Instruction i);
+  // Returns the instruction stored in memory at the address. Words are decoded
+  // only on the first fetch and cached until the address is written. Returns
+  // nullptr if the word is not a valid instruction
+  const Instruction *fetch_instruction(uint32_t address);
+  // Returns byte_count guest bytes starting from the address, a word address
+  // or a byte address with byte addresses on, for transfers without copying,
+  // or nullptr if they are not all in memory. Memory word n holds guest bytes
+  // 4n..4n+3, which is the host order on little-endian hosts. With write, the
+  // decoded instructions of the range are dropped, as the caller is going to
+  // write them
+  uint8_t *get_guest_bytes(uint32_t address, uint32_t byte_count, bool write);
+  // With enabled, the addresses loads and stores compute from registers and
+  // offsets are in bytes, as in toolchain output, and byte address A is in
+  // memory word A / 4. Byte and halfword transfers access their part of the
+  // word. Instructions fetched from memory read the PC as the byte address
+  // of the instruction plus 8 for PC relative loads and ADD/SUB, so literal
+  // pools work. The PC itself, branch targets and the return addresses BL
+  // writes stay word addresses, so code pointers loaded as data don't work
+  void set_byte_addresses(bool enabled);
+  bool has_byte_addresses() const { return byte_addresses; }
+  // Calls handler for SWI number. SWIs without a handler halt the machine,
+  // and an empty handler removes the one of the number
+  void set_swi_handler(uint32_t number, swi_handler handler);
+  // With enabled, SWIs without a handler enter supervisor mode at VECTOR_SWI
+  // instead of halting. MOVS pc, lr returns after the SWI
+  void set_swi_exceptions(bool enabled) { swi_exceptions = enabled; }
+  // Interrupt request lines, held by devices until the guest clears their
+  // cause. Lines are set on the thread that runs the machine
+  void set_irq_line(bool raised);
+  void set_fiq_line(bool raised);
+  // true when a raised line is not masked by the CPSR. Runs test only this
+  // before each instruction, so code without interrupts pays for one load
+  bool is_interrupt_pending() const { return interrupt_pending; }
+  // Enters FIQ mode at VECTOR_FIQ, or IRQ mode at VECTOR_IRQ, for the pending
+  // interrupt, with r14 one past the next instruction. SUBS pc, lr, #1
+  // returns to it
+  void take_interrupt();
+  // Counts instructions that an SWI handler ran in place of guest code. The
+  // simulator adds them to the retired instructions of the run
+  void add_retired_instructions(uint64_t count) { extra_retired += count; }
+  // returns the instructions added since the last call
+  uint64_t take_retired_instructions();
+  // Adds the counts of the executed instructions to the process metrics.
+  // Machines count locally, and the simulator flushes them after each run
+  void flush_metrics();
+  // Coverage the instructions of this machine are recorded to, or nullptr
+  // when coverage is off. The machine records the instructions its condition
+  // skips and the simulator the rest. The machine doesn't own it
+  void set_coverage(Coverage *coverage);
+  Coverage *get_coverage() const { return coverage; }
+  // Maps word_count words from the address, which must be past the end of
+  // memory, to a device. Loads and stores only look for a device after the
+  // range check of memory fails, so memory accesses don't pay for them.
+  // Multiple transfers into a device access it a word at a time
+  void map_device(uint32_t address, uint32_t word_count,
+                  device_read_handler read, device_write_handler write);
+  // Events the simulator advances by the retired instructions of the
+  // machine, or nullptr. The machine doesn't own them
+  void set_event_queue(EventQueue *events) { this->events = events; }
+  EventQueue *get_event_queue() const { return events; }
+  // true after an instruction halted the machine, until it's cleared
+  bool is_halted() const { return halted; }
+  void clear_halted() { halted = false; }
 
 private:
-  void execute_add(Instruction i, bool use_carry = false);
-  void execute_subtract(Instruction i, bool use_carry = false);
-  void execute_and(Instruction i);
-  void execute_eor(Instruction i);
-  void execute_orr(Instruction i);
+  typedef void (Machine::*alu_handler)(const Instruction &i);
+  // Data processing instructions, specialized on the opcode, on updating the
+  // flags and on the second operand being a register. The ADC, SBC and RSC
+  // carry comes from the C flag
+  template <opcodes code, bool update_flags, bool register_operand>
+  void execute_data_processing(const Instruction &i);
+  // Returns the address a single transfer accesses, and sets updated_base to
+  // the base register value after the offset is applied
+  uint32_t get_transfer_address(const Instruction &i, uint32_t &updated_base);
+  // writes the updated base back for pre-indexed ! and post-indexed transfers
+  void write_back_base(const Instruction &i, uint32_t updated_base);
+  // Word accesses of the instructions. Addresses past the end of memory go
+  // to the devices
+  uint32_t load(uint32_t address);
+  void store(uint32_t address, uint32_t value);
+  uint32_t load_device(uint32_t address);
+  void store_device(uint32_t address, uint32_t value);
   void execute_load(Instruction i);
   void execute_store(Instruction i);
-  void execute_move(Instruction i);
+  // transfers of a single register at a byte address
+  void execute_byte_addressed_load(const Instruction &i, uint32_t address);
+  void execute_byte_addressed_store(const Instruction &i, uint32_t address);
+  // MUL and MLA, registers are {Rd, Rm, Rs[, Rn]}
+  void execute_multiply(Instruction i);
+  // 32x32->64 multiplies, registers are {RdLo, RdHi, Rm, Rs}
+  void execute_multiply_long(Instruction i);
+  // Returns the lowest address a multiple transfer accesses, and sets
+  // updated_base to the base register value after the transfer
+  uint32_t get_multiple_transfer_address(const Instruction &i,
+                                         uint32_t &updated_base);
+  // Registers are expected in ascending order after the base register, and
+  // the block of memory they move from or to is range checked once
   void execute_load_multiple(Instruction i);
+  // copies the registers of a multiple transfer from or to a memory block
+  void copy_register_block(const Instruction &i, uint32_t *block, bool load);
   void execute_store_multiple(Instruction i);
+  // a multiple transfer that reaches past the end of memory, word by word
+  void transfer_device_block(const Instruction &i, uint32_t address,
+                             bool load_registers);
+  // runs the handler of the SWI, returns true if the machine should halt
+  bool execute_software_interrupt(const Instruction &i);
+  // Sets the CPSR, and switches the banked registers when the mode changes
+  void write_cpsr(uint32_t value);
+  // saves the CPSR to the SPSR of the mode and branches to the vector
+  void enter_exception(uint32_t mode, uint32_t vector,
+                       uint32_t return_address);
+  // restores the CPSR of the mode from its SPSR, for data processing with S
+  // that writes the PC
+  void return_from_exception();
+  void update_interrupt_pending();
+  // Returns the second operand after the barrel shifter, and sets carry to
+  // the shifter carry-out
+  uint32_t get_shifted_operand(const Instruction &i, bool &carry);
+  // Writes N and Z from the result and C from the shifter, V is unchanged
+  void update_logical_flags(uint32_t result, bool carry);
+  // Returns first minus the second operand of the CMP or SUBS, and sets the
+  // flags like it
+  uint32_t subtract_with_flags(const Instruction &i);
+  // the B of a superinstruction, after the PC of the first one was advanced
+  void execute_fused_branch(const Instruction &branch);
+  // Makes an instruction decoded at the address that reads the PC as its base
+  // or first operand see the byte address ARM gives, for byte addresses
+  void adjust_pc_relative_offset(Instruction &i, uint32_t address);
+  void invalidate_decoded_instruction(uint32_t address);
+  void invalidate_decoded_range(uint32_t address, size_t count);
+  void count(metrics counter) {
+    pending_metrics.values[static_cast<int>(counter)]++;
+  }
 
-  std::vector<Machine_byte> registers;
-  uint32_t current_program_status_register;
-  Machine_byte *memory;
+  // the registers the machine runs on, its own ones unless it was switched
+  Cpu_state *state;
+  Cpu_state own_state;
+  uint32_t *memory;
   int memory_size;
+  // predecode cache, a page is allocated when code is first fetched from it
+  std::vector<std::vector<Instruction>> decoded_pages;
+  // counts that are not flushed to the process metrics yet
+  metrics_snapshot pending_metrics;
+  Coverage *coverage = nullptr;
+  // a few SWI numbers at most, so they are searched in order
+  std::vector<std::pair<uint32_t, swi_handler>> swi_handlers;
+  uint64_t extra_retired = 0;
+  struct device_region {
+    uint32_t address;
+    uint32_t word_count;
+    device_read_handler read;
+    device_write_handler write;
+  };
+  // a few devices at most, so they are searched in order
+  std::vector<device_region> devices;
+  EventQueue *events = nullptr;
+  // false for cores that share the memory of another machine
+  bool owns_memory = true;
+  bool halted = false;
+  bool swi_exceptions = false;
+  bool byte_addresses = false;
+  bool irq_line = false;
+  bool fiq_line = false;
+  bool interrupt_pending = false;
 };
 #endif // MACHINE_H
\ No newline at end of file
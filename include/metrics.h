@@ -0,0 +1,52 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <ostream>
+
+// Counters of the whole process, in the order of the exported names
+enum class metrics {
+  // retired by Simulator runs, including the ones whose condition failed
+  INSTRUCTIONS_RETIRED = 0,
+  // skipped because their condition failed
+  CONDITION_FAILED,
+  // LDR and LDM instructions
+  LOADS,
+  // STR and STM instructions
+  STORES,
+  SWIS,
+  // IRQs and FIQs taken
+  INTERRUPTS,
+  // Simulator runs and the wall clock time they took
+  RUNS,
+  RUN_NANOSECONDS,
+  // guest memory and decoded instruction pages
+  ALLOCATIONS,
+  ALLOCATED_BYTES,
+  COUNT
+};
+
+struct metrics_snapshot {
+  uint64_t values[static_cast<int>(metrics::COUNT)] = {};
+
+  uint64_t get(metrics counter) const {
+    return values[static_cast<int>(counter)];
+  }
+};
+
+// Process wide metrics of the machines and the simulator. Every thread adds
+// to its own cache line padded block without locking, and the blocks are
+// summed when the metrics are read. The counts of threads that have exited
+// are kept, so the counters only grow.
+class Metrics {
+public:
+  static void add(metrics counter, uint64_t amount = 1);
+  // adds all counters of the snapshot
+  static void add(const metrics_snapshot &amounts);
+  static metrics_snapshot get_snapshot();
+  // Prometheus text exposition format
+  static void write_prometheus(std::ostream &out);
+  static void write_json(std::ostream &out);
+};
+
+#endif // METRICS_H
@@ -0,0 +1,39 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "instruction.h"
+
+#include <cstdint>
+#include <vector>
+
+// FOLDED entries are a single instruction with the combined result of the
+// instructions they replace. COMPARE_BRANCH and SUBTRACT_BRANCH entries are a
+// CMP or a SUBS and the B after it, which run in one superinstruction of the
+// machine
+enum class fusion_types { NONE = 0, FOLDED, COMPARE_BRANCH, SUBTRACT_BRANCH };
+
+// An entry of an optimized program stands for length instructions of the
+// original program starting from the same address. The program keeps one
+// entry per address, so a branch to any address still finds the original
+// instruction boundary
+struct optimized_instruction {
+  Instruction original;
+  Instruction instruction;
+  // the branch of a COMPARE_BRANCH or SUBTRACT_BRANCH
+  Instruction second;
+  fusion_types fusion = fusion_types::NONE;
+  uint8_t length = 1;
+};
+
+// Peephole optimizer that runs between parsing and execution. It folds
+// immediate chains like MOV r0, #1; ADD r0, r0, #2 to one MOV, drops
+// instructions whose result is overwritten by the next one before it's read,
+// and fuses CMP and SUBS with the branch after them. Architectural results
+// are the same as running the original program.
+class Optimizer {
+public:
+  static std::vector<optimized_instruction>
+  optimize(const std::vector<Instruction> &program);
+};
+
+#endif // OPTIMIZER_H
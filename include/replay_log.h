@@ -0,0 +1,41 @@
+#ifndef REPLAY_LOG_H
+#define REPLAY_LOG_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Log of the nondeterministic inputs of a run, in the order the guest got
+// them. An entry is an operation number, its result and the data the guest
+// read, and it's stored as a byte with LEB128 numbers, so most entries take
+// three bytes and the data.
+class ReplayLog {
+public:
+  void add(uint8_t operation, uint32_t result, const uint8_t *data,
+           uint32_t size);
+  // Reads the next entry if it's of the operation, and sets data to point
+  // into the log. Returns false if the log has ended or the next entry is of
+  // another operation, which means the replay diverged
+  bool next(uint8_t operation, uint32_t &result, const uint8_t *&data,
+            uint32_t &size);
+  // the number of entries added, or read when replaying
+  uint64_t get_entry_count() const;
+  bool at_end() const;
+  // starts reading from the first entry
+  void rewind();
+  // Returns false if the file can't be written
+  bool write(const std::string &file_name) const;
+  // Replaces the log with a file made by write. Returns false if it can't be
+  // read or it's not a replay log
+  bool read(const std::string &file_name);
+
+private:
+  void add_number(uint32_t value);
+  bool read_number(uint32_t &value);
+
+  std::vector<uint8_t> bytes;
+  size_t position = 0;
+  uint64_t entry_count = 0;
+};
+
+#endif // REPLAY_LOG_H
@@ -0,0 +1,50 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "cpu_state.h"
+#include "instruction.h"
+#include "machine.h"
+
+#include <deque>
+#include <vector>
+
+// Runs many guest tasks of a program on the calling thread, in turns of a
+// fixed number of instructions and in the order they were added. Each task
+// has its own registers and runs on a machine, and tasks on the same machine
+// share its memory. A turn switches the machine to the registers of the task
+// instead of copying them. The tasks interleave the same way on every run, so
+// races between them can be reproduced.
+class Scheduler {
+public:
+  // Adds a task that starts from the state, and returns its number. The
+  // machine must outlive the scheduler
+  int add_task(Machine &m, const Cpu_state &state);
+  int get_task_count() const;
+  Cpu_state &get_state(int task);
+  // true when the task halted or ran past the end of the program
+  bool is_finished(int task) const;
+  // Runs the tasks that are not finished in turns of quantum instructions
+  // until they all finish, or until count instructions have been retired
+  // since the call. Returns the retired instructions. A run that stops inside
+  // a turn continues it in the next run. The metrics count the call as one
+  // run
+  uint64_t run(std::vector<Instruction> &program, unsigned int quantum,
+               uint64_t count = 0);
+
+private:
+  struct task {
+    Machine *machine;
+    Cpu_state state;
+    bool finished;
+  };
+
+  // a deque, so adding tasks doesn't move the registers of the others
+  std::deque<task> tasks;
+  // the task of the turn and the instructions left in it
+  size_t current = 0;
+  unsigned int turn_left = 0;
+  // the first task to look at for the next turn
+  size_t next = 0;
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,108 @@
+#ifndef SEMIHOSTING_H
+#define SEMIHOSTING_H
+
+#include "machine.h"
+#include "replay_log.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// the ARM state semihosting SWI
+#define SEMIHOSTING_SWI 0x123456
+
+// operation numbers in r0
+#define SYS_OPEN 0x01
+#define SYS_CLOSE 0x02
+#define SYS_WRITEC 0x03
+#define SYS_WRITE0 0x04
+#define SYS_WRITE 0x05
+#define SYS_READ 0x06
+#define SYS_READC 0x07
+#define SYS_CLOCK 0x10
+#define SYS_TIME 0x11
+#define SYS_EXIT 0x18
+#define SYS_EXIT_EXTENDED 0x20
+// reason of SYS_EXIT for a normal exit
+#define ADP_STOPPED_APPLICATION_EXIT 0x20026
+
+enum class replay_modes { NONE = 0, RECORD, REPLAY };
+
+// ARM semihosting for guest programs. SWI 0x123456 runs the operation in r0
+// with the parameter in r1, which is the address of a block of words for most
+// operations, and returns the result in r0. Other SWIs still halt.
+//
+// Buffers, file names and SYS_WRITE0 strings are bytes packed four to a word,
+// as in ELF executables, and they are transferred straight from and to
+// machine memory. The console handles 0, 1 and 2 are open from the start,
+// and opening ":tt" returns one of them by the mode. Console output is
+// written to the stream buffer and only flushed when the guest reads from the
+// console or exits.
+//
+// Runs can be recorded to a ReplayLog and replayed from it. Replays take the
+// results of open, close, write, read, readc, clock and time, and the data
+// read, from the log instead of the host. They don't touch host files or
+// input, so a replay can be stepped or run to any instruction count and it
+// runs the same. Console output is written again.
+class Semihosting {
+public:
+  Semihosting(std::ostream &out = std::cout, std::istream &in = std::cin);
+  ~Semihosting();
+  Semihosting(const Semihosting &) = delete;
+  Semihosting &operator=(const Semihosting &) = delete;
+  // Registers the semihosting SWI of the machine. The machine must not run
+  // it after this is destroyed
+  void attach(Machine &m);
+  // runs the operation in r0, returns true if the machine should halt
+  bool call(Machine &m);
+  bool has_exited() const;
+  // 0 for a normal exit, the status of SYS_EXIT_EXTENDED, or 1 for other
+  // reasons
+  int get_exit_code() const;
+  // Records the inputs to the log or replays them from it. The log is not
+  // owned, and replays start from where the log is
+  void set_replay_log(ReplayLog *log, replay_modes mode);
+  // true when the guest asked for an input the replay log doesn't have next,
+  // which halts the machine
+  bool has_diverged() const;
+
+private:
+  typedef uint32_t (Semihosting::*operation)(Machine &m, uint32_t parameter);
+  uint32_t open(Machine &m, uint32_t parameter);
+  uint32_t close(Machine &m, uint32_t parameter);
+  uint32_t write_character(Machine &m, uint32_t parameter);
+  uint32_t write_string(Machine &m, uint32_t parameter);
+  uint32_t write(Machine &m, uint32_t parameter);
+  uint32_t read(Machine &m, uint32_t parameter);
+  uint32_t read_character(Machine &m, uint32_t parameter);
+  uint32_t clock(Machine &m, uint32_t parameter);
+  uint32_t time(Machine &m, uint32_t parameter);
+  uint32_t exit(Machine &m, uint32_t parameter);
+  uint32_t exit_extended(Machine &m, uint32_t parameter);
+  // reads count words of a parameter block, returns false if it's not in
+  // memory
+  bool get_parameters(Machine &m, uint32_t address, uint32_t *parameters,
+                      uint32_t count);
+  // true for the operations whose results come from the host
+  static bool is_nondeterministic(uint32_t number);
+  void record(Machine &m, uint32_t number, uint32_t parameter,
+              uint32_t result);
+  // sets the result from the log, returns false if the replay diverged
+  bool replay(Machine &m, uint32_t number, uint32_t parameter,
+              uint32_t &result);
+
+  std::ostream &out;
+  std::istream &in;
+  // files by handle, the console handles have none
+  std::vector<std::FILE *> files;
+  std::chrono::steady_clock::time_point start;
+  bool exited = false;
+  int exit_code = 0;
+  ReplayLog *log = nullptr;
+  replay_modes replay_mode = replay_modes::NONE;
+  bool diverged = false;
+};
+
+#endif // SEMIHOSTING_H
@@ -3,14 +3,52 @@
 
 #include "instruction.h"
 #include "machine.h"
+#include "optimizer.h"
 
+#include <chrono>
 #include <string>
 #include <vector>
 
 class Simulator {
 public:
-  static void run_program(std::vector<Instruction> &program, Machine &m,
-                          unsigned int count = 0);
+  // Runs until the program halts or count instructions have been executed.
+  // Returns the number of retired instructions, including the ones whose
+  // condition failed and the ones SWI handlers counted with
+  // Machine::add_retired_instructions
+  static uint64_t run_program(std::vector<Instruction> &program, Machine &m,
+                              unsigned int count = 0);
+  // Same as run_program, but doesn't print, read the clock, flush the counts
+  // of the machine or add the run to the metrics. For callers that run a
+  // program in many short slices and record them once with add_run_metrics
+  static uint64_t run_slice(std::vector<Instruction> &program, Machine &m,
+                            unsigned int count = 0);
+  // Adds a run of the retired instructions that started at start to the
+  // metrics
+  static void add_run_metrics(uint64_t retired,
+                              std::chrono::steady_clock::time_point start);
+  // Runs a program made by Optimizer::optimize. Retired instructions and
+  // count are in original instructions, and a run that would stop inside an
+  // optimized entry runs the original instructions instead, so stepping stops
+  // at the same places as without optimization. A machine with coverage on
+  // runs only the original instructions, so they are all recorded
+  static uint64_t run_program(const std::vector<optimized_instruction> &program,
+                              Machine &m, unsigned int count = 0);
+  // Same as run_program, but as quiet as the run_slice of instructions
+  static uint64_t run_slice(const std::vector<optimized_instruction> &program,
+                            Machine &m, unsigned int count = 0);
+  // Encodes the program as ARM machine code to memory starting from address
+  // 0. Returns false if some instruction has no machine code encoding
+  static bool load_program(const std::vector<Instruction> &program,
+                           Machine &m);
+  // Copies a data image, such as the one built from the data directives of a
+  // source file, to memory starting from address. Returns false if it doesn't
+  // fit in memory
+  static bool load_data(const std::vector<uint32_t> &data, uint32_t address,
+                        Machine &m);
+  // Same as run_program, but instructions are fetched from machine memory
+  static uint64_t run_from_memory(Machine &m, unsigned int count = 0);
+  // Same as run_from_memory, but as quiet as run_slice
+  static uint64_t run_slice_from_memory(Machine &m, unsigned int count = 0);
 };
 
 #endif // SIMULATOR_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "instruction.h"
+#include "machine.h"
+
+#include <memory>
+#include <vector>
+
+// Several cores that run a program against one memory. Core 0 owns the
+// memory and the others share it, and each core starts with its number in r0
+// so the program can tell them apart. Word loads and stores of the cores are
+// atomic, and a core that sees a word another core stored also sees the
+// stores that came before it, which is enough for flags and message passing.
+// Multiple transfers are atomic only word by word.
+//
+// Each core has its own SWI handlers. Handlers that share state with other
+// cores, such as one Semihosting for all of them, must only be used with
+// run_deterministic.
+class Smp {
+public:
+  Smp(int core_count, int mem_size);
+  int get_core_count() const;
+  Machine &get_core(int number);
+  // Runs every core on its own host thread until each halts or has run count
+  // instructions. Returns the retired instructions of each core. The metrics
+  // count the call as one run
+  std::vector<uint64_t> run(std::vector<Instruction> &program,
+                            unsigned int count = 0);
+  // Runs the cores in turns of quantum instructions, in the order of their
+  // numbers, on the calling thread. The cores interleave the same way on
+  // every run, so races in the program can be reproduced. The metrics count
+  // the call as one run
+  std::vector<uint64_t> run_deterministic(std::vector<Instruction> &program,
+                                          unsigned int quantum,
+                                          unsigned int count = 0);
+
+private:
+  std::vector<std::unique_ptr<Machine>> cores;
+};
+
+#endif // SMP_H
@@ -3,6 +3,8 @@
 
 #include "instruction.h"
 
+#include <cstdint>
+#include <istream>
 #include <map>
 #include <string>
 #include <vector>
@@ -10,9 +12,30 @@
 // forward declaration
 class SourceParserTestFixture;
 
+// Parses an assembly file to instructions, one instruction per address
+// starting from 0. Data directives (.word, .byte, .space, .ascii, .asciz and
+// .align) build a memory image that is placed right after the code, and
+// labels before data resolve to data addresses. Memory is word addressed, so
+// each .byte value and string character takes a whole word.
+//
+// LDR Rd, =value is assembled to MOV or MVN when the value is an ARM rotated
+// immediate, and otherwise to a PC relative load from a literal pool at the
+// end of the data image. ADR Rd, label is assembled to ADD or SUB from the
+// PC. The PC reads as the address of the next instruction.
+//
+// Malformed lines are reported with their line number and left out of the
+// program, so every returned instruction has the registers its opcode needs.
 class SourceCodeParser {
 public:
   std::vector<Instruction> parse(std::string file_name);
+  std::vector<Instruction> parse(std::istream &source);
+  // number of errors reported while parsing the last file
+  unsigned int get_error_count() const;
+  // data image of the last parsed file, and the address it's loaded to
+  const std::vector<uint32_t> &get_data() const;
+  uint32_t get_data_address() const;
+  // line of the last parsed file each instruction came from, starting from 1
+  const std::vector<unsigned int> &get_source_lines() const;
   friend class SourceParserTestFixture;
 
 private:
@@ -21,10 +44,49 @@ private:
                   std::pair<std::string, unsigned int> &unsolved_label_info);
   std::vector<uint8_t> parse_registers(std::string &line, Instruction &result,
                                        bool &unsolved_label);
+  // Parses the destination and the [Rn...] address of a single transfer,
+  // returns false if the address is malformed
+  bool parse_address(std::string &line, Instruction &result,
+                     std::vector<uint8_t> &register_list);
+  // Parses the operands of LDR Rd, =value and ADR Rd, label. Returns false if
+  // they are malformed
+  bool parse_pc_relative(std::string &line, Instruction &result,
+                         std::vector<uint8_t> &register_list);
+  void parse_directive(std::string &line);
+  // appends a word to the data image
+  void add_data(uint32_t value);
+  // parses a barrel shifter operand and removes it from the line
+  void parse_shift(std::string &line, Instruction &result);
+  // Returns the address of a label, and reports it if it's not defined
+  unsigned int find_symbol(const std::string &label);
+  void report_error(const char *message, const std::string &text);
+  void set_operand_registers(std::vector<uint8_t> &register_list,
+                             Instruction &result);
 
   std::map<std::string, unsigned int> symbol_address_table;
-  unsigned int line_number;
+  // data labels, as offsets from the beginning of the data image
+  std::map<std::string, unsigned int> data_symbol_table;
+  // labels that are not followed by an instruction or data yet
+  std::vector<std::string> pending_labels;
+  // address of the next instruction
+  unsigned int line_number = 0;
+  // line of the file, for error messages
+  unsigned int source_line_number = 0;
+  unsigned int error_count = 0;
+  std::vector<unsigned int> source_lines;
   std::vector<std::pair<std::string, unsigned int>> unsolved_labels;
+  // .word values that are labels, with their offsets in the data image
+  std::vector<std::pair<std::string, unsigned int>> unsolved_data_labels;
+  // ADR labels with the addresses of the instructions that use them
+  std::vector<std::pair<std::string, unsigned int>> unsolved_relative_labels;
+  // Literal pool values, which are labels when the string is not empty, and
+  // the loads from the pool as instruction and literal indices
+  std::vector<std::pair<std::string, uint32_t>> literals;
+  std::vector<std::pair<unsigned int, unsigned int>> literal_loads;
+  std::vector<uint32_t> data;
+  // in words
+  uint32_t data_alignment = 1;
+  uint32_t data_address = 0;
 };
 
 #endif // SOURCE_PARSER_H
\ No newline at end of file
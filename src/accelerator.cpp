@@ -0,0 +1,241 @@
+#include "accelerator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+// words compared at a time before the first different word is searched
+#define COMPARE_BLOCK_SIZE 64
+
+// the words of memory from the address, or nullptr if they are not all in it
+static uint32_t *get_words(Machine &m, uint32_t address, uint32_t count,
+                           bool write) {
+  if (count > UINT32_MAX / sizeof(uint32_t)) {
+    return nullptr;
+  }
+  return reinterpret_cast<uint32_t *>(
+      m.get_guest_bytes(address, count * sizeof(uint32_t), write));
+}
+
+// the number of words from the address to the end of memory
+static uint32_t get_words_left(Machine &m, uint32_t address) {
+  const uint32_t size = static_cast<uint32_t>(m.get_memory_size());
+  return address < size ? size - address : 0;
+}
+
+// Sets the flags like SUBS of first - second in the machine: N and Z from the
+// 32 bit result, C without a borrow and V on a signed overflow. The reference
+// routines end with SUBS or CMP, and most of them with a zero result, which
+// is 0 - 0
+static void set_subtraction_flags(Cpu_state &state, uint32_t first,
+                                  uint32_t second) {
+  const uint32_t result = first - second;
+  const int64_t signed_result =
+      static_cast<int64_t>(static_cast<int32_t>(first)) -
+      static_cast<int32_t>(second);
+  state.cpsr &= ~static_cast<uint32_t>(BITMASK_CPSR_N | BITMASK_CPSR_Z |
+                                       BITMASK_CPSR_C | BITMASK_CPSR_V);
+  state.cpsr |= (result >> 31) << SHIFT_CPRS_N;
+  state.cpsr |= (result == 0) << SHIFT_CPRS_Z;
+  state.cpsr |= (first >= second) << SHIFT_CPRS_C;
+  state.cpsr |= (signed_result > INT32_MAX || signed_result < INT32_MIN)
+                << SHIFT_CPRS_V;
+}
+
+static bool report_outside_of_memory(const char *routine) {
+  std::cout << routine << " outside of memory" << std::endl;
+  return true;
+}
+
+// The loop of the reference memcpy, which copies r2 words from r1 to r0 one
+// at a time. Returns false if they are not all in memory
+static bool copy_forward(Machine &m) {
+  Cpu_state &state = m.get_state();
+  const uint32_t destination = state.registers[0];
+  const uint32_t source = state.registers[1];
+  const uint32_t count = state.registers[2];
+  state.registers[3] = destination;
+  set_subtraction_flags(state, 0, 0);
+  if (count == 0) {
+    return true;
+  }
+  const uint32_t *from = get_words(m, source, count, false);
+  uint32_t *to = get_words(m, destination, count, true);
+  if (!from || !to) {
+    return false;
+  }
+  if (destination > source && destination - source < count) {
+    // the copy reads words it has already written, so it repeats
+    uint32_t value = 0;
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      value = from[idx];
+      to[idx] = value;
+    }
+    state.registers[12] = value;
+  } else {
+    // the last word read is not written before it's read
+    state.registers[12] = from[count - 1];
+    std::memmove(to, from, count * sizeof(uint32_t));
+  }
+  state.registers[1] = source + count;
+  state.registers[2] = 0;
+  state.registers[3] = destination + count;
+  return true;
+}
+
+void Accelerator::attach(Machine &m, bool count_instructions) {
+  m.set_swi_handler(SWI_MEMCPY, [count_instructions](Machine &machine) {
+    return copy(machine, count_instructions);
+  });
+  m.set_swi_handler(SWI_MEMMOVE, [count_instructions](Machine &machine) {
+    return move(machine, count_instructions);
+  });
+  m.set_swi_handler(SWI_MEMSET, [count_instructions](Machine &machine) {
+    return fill(machine, count_instructions);
+  });
+  m.set_swi_handler(SWI_MEMCMP, [count_instructions](Machine &machine) {
+    return compare(machine, count_instructions);
+  });
+  m.set_swi_handler(SWI_STRLEN, [count_instructions](Machine &machine) {
+    return length(machine, count_instructions);
+  });
+}
+
+bool Accelerator::copy(Machine &m, bool count_instructions) {
+  const uint32_t count = m.get_state().registers[2];
+  if (!copy_forward(m)) {
+    return report_outside_of_memory("memcpy");
+  }
+  if (count_instructions) {
+    m.add_retired_instructions(4 * static_cast<uint64_t>(count) + 4);
+  }
+  return false;
+}
+
+bool Accelerator::move(Machine &m, bool count_instructions) {
+  Cpu_state &state = m.get_state();
+  const uint32_t destination = state.registers[0];
+  const uint32_t source = state.registers[1];
+  const uint32_t count = state.registers[2];
+  uint64_t instructions = 4 * static_cast<uint64_t>(count);
+  if (destination <= source || source + count <= destination) {
+    // the reference routine branches to memcpy
+    if (!copy_forward(m)) {
+      return report_outside_of_memory("memmove");
+    }
+    instructions += destination <= source ? 6 : 9;
+  } else {
+    // copies backward from the end, so the source ends up where it was
+    const uint32_t *from = get_words(m, source, count, false);
+    uint32_t *to = get_words(m, destination, count, true);
+    if (!from || !to) {
+      return report_outside_of_memory("memmove");
+    }
+    state.registers[12] = from[0];
+    std::memmove(to, from, count * sizeof(uint32_t));
+    state.registers[2] = 0;
+    state.registers[3] = destination;
+    set_subtraction_flags(state, 0, 0);
+    instructions += 8;
+  }
+  if (count_instructions) {
+    m.add_retired_instructions(instructions);
+  }
+  return false;
+}
+
+bool Accelerator::fill(Machine &m, bool count_instructions) {
+  Cpu_state &state = m.get_state();
+  const uint32_t destination = state.registers[0];
+  const uint32_t count = state.registers[2];
+  if (count > 0) {
+    uint32_t *to = get_words(m, destination, count, true);
+    if (!to) {
+      return report_outside_of_memory("memset");
+    }
+    std::fill_n(to, count, state.registers[1]);
+  }
+  state.registers[2] = 0;
+  state.registers[3] = destination + count;
+  set_subtraction_flags(state, 0, 0);
+  if (count_instructions) {
+    m.add_retired_instructions(3 * static_cast<uint64_t>(count) + 4);
+  }
+  return false;
+}
+
+bool Accelerator::compare(Machine &m, bool count_instructions) {
+  Cpu_state &state = m.get_state();
+  const uint32_t first = state.registers[0];
+  const uint32_t second = state.registers[1];
+  const uint32_t count = state.registers[2];
+  // the reference routine stops reading at the first different word
+  const uint32_t readable = std::min(
+      count, std::min(get_words_left(m, first), get_words_left(m, second)));
+  const uint32_t *first_words = get_words(m, first, readable, false);
+  const uint32_t *second_words = get_words(m, second, readable, false);
+  uint32_t idx = 0;
+  while (idx < readable) {
+    // equal blocks are skipped with the host memcmp
+    const uint32_t block = std::min<uint32_t>(COMPARE_BLOCK_SIZE,
+                                              readable - idx);
+    if (std::memcmp(first_words + idx, second_words + idx,
+                    block * sizeof(uint32_t)) != 0) {
+      idx = std::mismatch(first_words + idx, first_words + idx + block,
+                          second_words + idx)
+                .first -
+            first_words;
+      break;
+    }
+    idx += block;
+  }
+  if (idx == readable && readable < count) {
+    return report_outside_of_memory("memcmp");
+  }
+
+  uint64_t instructions;
+  if (idx < count) {
+    const uint32_t difference = first_words[idx] - second_words[idx];
+    state.registers[0] = difference;
+    state.registers[1] = second + idx + 1;
+    state.registers[2] = count - idx;
+    state.registers[3] = difference;
+    state.registers[12] = second_words[idx];
+    set_subtraction_flags(state, first_words[idx], second_words[idx]);
+    instructions = 8 * static_cast<uint64_t>(idx) + 9;
+  } else {
+    state.registers[0] = 0;
+    state.registers[1] = second + count;
+    state.registers[2] = 0;
+    state.registers[3] = 0;
+    if (count > 0) {
+      state.registers[12] = second_words[count - 1];
+    }
+    set_subtraction_flags(state, 0, 0);
+    instructions = 8 * static_cast<uint64_t>(count) + 5;
+  }
+  if (count_instructions) {
+    m.add_retired_instructions(instructions);
+  }
+  return false;
+}
+
+bool Accelerator::length(Machine &m, bool count_instructions) {
+  Cpu_state &state = m.get_state();
+  const uint32_t text = state.registers[0];
+  const uint32_t readable = get_words_left(m, text);
+  const uint32_t *words = get_words(m, text, readable, false);
+  const uint32_t *end = words ? std::find(words, words + readable, 0u) : words;
+  if (!words || end == words + readable) {
+    return report_outside_of_memory("strlen");
+  }
+  const uint32_t length = end - words;
+  state.registers[0] = length;
+  state.registers[1] = text + length + 1;
+  state.registers[2] = 0;
+  set_subtraction_flags(state, 0, 0);
+  if (count_instructions) {
+    m.add_retired_instructions(3 * static_cast<uint64_t>(length) + 7);
+  }
+  return false;
+}
@@ -0,0 +1,641 @@
+#include "arm_codec.h"
+
+#define CONDITION_SHIFT 28
+#define CONDITION_ALWAYS 0xE
+#define MAX_REGISTER 15
+
+// Data processing opcode field values, indexed by ARM encoding
+static const opcodes data_processing_opcodes[16] = {
+    opcodes::AND, opcodes::EOR, opcodes::SUB, opcodes::RSB,
+    opcodes::ADD, opcodes::ADC, opcodes::SBC, opcodes::RSC,
+    opcodes::TST, opcodes::TEQ, opcodes::CMP, opcodes::CMN,
+    opcodes::ORR, opcodes::MOV, opcodes::BIC, opcodes::MVN};
+
+// Condition field values, indexed by ARM encoding. 0xE (always) is decoded as
+// NONE, which is what the source parser produces for an unconditional line
+static const condition_codes condition_table[15] = {
+    condition_codes::EQ, condition_codes::NE, condition_codes::CS,
+    condition_codes::CC, condition_codes::MI, condition_codes::PL,
+    condition_codes::VS, condition_codes::VC, condition_codes::HI,
+    condition_codes::LS, condition_codes::GE, condition_codes::LT,
+    condition_codes::GT, condition_codes::LE, condition_codes::NONE};
+
+static uint32_t encode_condition(condition_codes code) {
+  for (uint32_t idx = 0; idx < CONDITION_ALWAYS; ++idx) {
+    if (condition_table[idx] == code) {
+      return idx << CONDITION_SHIFT;
+    }
+  }
+  // AL and NONE
+  return static_cast<uint32_t>(CONDITION_ALWAYS) << CONDITION_SHIFT;
+}
+
+static bool find_data_processing_opcode(opcodes code, uint32_t &field) {
+  for (uint32_t idx = 0; idx < 16; ++idx) {
+    if (data_processing_opcodes[idx] == code) {
+      field = idx;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_compare(opcodes code) {
+  return code == opcodes::CMP || code == opcodes::CMN ||
+         code == opcodes::TST || code == opcodes::TEQ;
+}
+
+static uint32_t rotate_right(uint32_t value, uint32_t amount) {
+  amount &= 31;
+  if (amount == 0) {
+    return value;
+  }
+  return (value >> amount) | (value << (32 - amount));
+}
+
+bool ArmCodec::encode_immediate(uint32_t value, uint32_t &encoded) {
+  for (uint32_t rotation = 0; rotation < 16; ++rotation) {
+    // rotating left undoes the rotate right done when decoding
+    const uint32_t imm8 = rotate_right(value, 32 - rotation * 2);
+    if (imm8 <= 0xFF) {
+      encoded = (rotation << 8) | imm8;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t ArmCodec::decode_immediate(uint32_t encoded) {
+  return rotate_right(encoded & 0xFF, ((encoded >> 8) & 0xF) * 2);
+}
+
+// Finds an encodable immediate for the operation, switching to the
+// complementary operation if only the inverted or negated value fits
+static bool encode_data_processing_immediate(const Instruction &i,
+                                             opcodes &code,
+                                             uint32_t &encoded) {
+  const uint32_t value = static_cast<uint32_t>(i.get_second_operand());
+  if (ArmCodec::encode_immediate(value, encoded)) {
+    return true;
+  }
+  opcodes alternative = opcodes::NONE;
+  uint32_t alternative_value = ~value;
+  switch (code) {
+  case opcodes::MOV:
+    alternative = opcodes::MVN;
+    break;
+  case opcodes::MVN:
+    alternative = opcodes::MOV;
+    break;
+  case opcodes::AND:
+    alternative = opcodes::BIC;
+    break;
+  case opcodes::BIC:
+    alternative = opcodes::AND;
+    break;
+  case opcodes::ADD: // negation changes the carry, so only without S
+  case opcodes::SUB: // intentional fall-through
+    if (!i.get_update_condition_flags()) {
+      alternative = code == opcodes::ADD ? opcodes::SUB : opcodes::ADD;
+      alternative_value = 0 - value;
+    }
+    break;
+  default:
+    break;
+  }
+  if (alternative == opcodes::NONE ||
+      !ArmCodec::encode_immediate(alternative_value, encoded)) {
+    return false;
+  }
+  code = alternative;
+  return true;
+}
+
+// Shift type field values, indexed by ARM encoding
+static const shift_types shift_table[4] = {shift_types::LSL, shift_types::LSR,
+                                           shift_types::ASR, shift_types::ROR};
+
+// Adds the shift of a register operand to the operand field
+static bool encode_shift(const Instruction &i, uint32_t &operand2) {
+  const shift_types type = i.get_shift_type();
+  if (type == shift_types::NONE) {
+    return true;
+  }
+  // RRX is a rotate by an immediate 0
+  if (type == shift_types::RRX) {
+    operand2 |= 0x3 << 5;
+    return true;
+  }
+  uint32_t type_field = 0;
+  while (shift_table[type_field] != type) {
+    type_field++;
+  }
+  if (i.is_shift_by_register()) {
+    if (i.get_shift_register() > MAX_REGISTER) {
+      return false;
+    }
+    operand2 |= (i.get_shift_register() << 8) | (type_field << 5) | (1 << 4);
+    return true;
+  }
+  uint32_t amount = i.get_shift_amount();
+  // shifts right by 32 are encoded as 0
+  if (amount == 32 &&
+      (type == shift_types::LSR || type == shift_types::ASR)) {
+    amount = 0;
+  } else if (amount == 0 || amount > 31) {
+    return false;
+  }
+  operand2 |= (amount << 7) | (type_field << 5);
+  return true;
+}
+
+// Resolves the shift of a register operand. Shifts by a constant are stored
+// in the form the machine applies them, so it doesn't need to handle the
+// special encodings of 0
+static void decode_shift(uint32_t word, Instruction &result) {
+  const shift_types type = shift_table[(word >> 5) & 0x3];
+  if ((word >> 4) & 1) {
+    result.set_shift_by_register(type, (word >> 8) & 0xF);
+    return;
+  }
+  const uint8_t amount = (word >> 7) & 0x1F;
+  if (amount != 0 || type == shift_types::LSL) {
+    result.set_shift(type, amount);
+  } else if (type == shift_types::ROR) {
+    result.set_shift(shift_types::RRX, 0);
+  } else {
+    result.set_shift(type, 32);
+  }
+}
+
+static bool encode_data_processing(const Instruction &i, uint32_t &word) {
+  opcodes code = i.get_opcode();
+  const size_t count = i.get_register_count();
+  if (count == 0) {
+    return false;
+  }
+  const bool compare = is_compare(code);
+  const bool move = code == opcodes::MOV || code == opcodes::MVN;
+  // Machine reads the first operand of a compare from the second register
+  const uint32_t rd = compare ? 0 : i.get_register(0);
+  uint32_t rn = 0;
+  if (compare) {
+    rn = i.get_register(count > 1 ? 1 : 0);
+  } else if (!move) {
+    if (count < 2) {
+      return false;
+    }
+    rn = i.get_register(1);
+  }
+
+  uint32_t operand2 = 0;
+  uint32_t immediate_bit = 0;
+  if (i.is_2nd_operand_register()) {
+    operand2 = i.get_last_register();
+    if (operand2 > MAX_REGISTER || !encode_shift(i, operand2)) {
+      return false;
+    }
+  } else {
+    if (!encode_data_processing_immediate(i, code, operand2)) {
+      return false;
+    }
+    immediate_bit = 1 << 25;
+  }
+
+  uint32_t opcode_field = 0;
+  if (!find_data_processing_opcode(code, opcode_field)) {
+    return false;
+  }
+  const uint32_t s_bit = (compare || i.get_update_condition_flags()) ? 1 : 0;
+  if (rd > MAX_REGISTER || rn > MAX_REGISTER) {
+    return false;
+  }
+  word = encode_condition(i.get_condition_code()) | immediate_bit |
+         (opcode_field << 21) | (s_bit << 20) | (rn << 16) | (rd << 12) |
+         operand2;
+  return true;
+}
+
+static bool encode_single_transfer(const Instruction &i, uint32_t &word) {
+  if (i.get_register_count() < 2) {
+    return false;
+  }
+  const uint32_t rd = i.get_register(0);
+  const uint32_t rn = i.get_register(1);
+  if (rd > MAX_REGISTER || rn > MAX_REGISTER) {
+    return false;
+  }
+  const bool load = i.get_opcode() == opcodes::LDR;
+  const bool register_offset = i.is_2nd_operand_register();
+  uint32_t rm = 0;
+  uint32_t offset = 0;
+  bool add = true;
+  if (register_offset) {
+    rm = i.get_last_register();
+    if (i.get_register_count() < 3 || rm > MAX_REGISTER) {
+      return false;
+    }
+    add = !i.is_offset_subtracted();
+  } else {
+    int64_t value = i.get_second_operand();
+    if (value < 0) {
+      add = false;
+      value = -value;
+    }
+    offset = static_cast<uint32_t>(value);
+  }
+  // P, U and W bits, W is only used for pre-indexed writeback
+  const bool pre_indexed = !i.is_post_indexed();
+  const uint32_t base = encode_condition(i.get_condition_code()) |
+                        (pre_indexed << 24) | (add << 23) |
+                        ((pre_indexed && i.has_writeback()) << 21) |
+                        (rn << 16) | (rd << 12);
+
+  // the extra load/store encoding is selected by the S and H bits
+  bool extra = true;
+  bool byte = false;
+  bool load_bit = load;
+  uint32_t sh = 0;
+  switch (i.get_suffix()) {
+  case suffixes::NONE:
+  case suffixes::S: // intentional fall-through
+    extra = false;
+    break;
+  case suffixes::B:
+    extra = false;
+    byte = true;
+    break;
+  case suffixes::SB:
+    // there's no signed store, Machine stores it as a byte
+    extra = load;
+    byte = !load;
+    sh = 0x2;
+    break;
+  case suffixes::H:
+    sh = 0x1;
+    break;
+  case suffixes::SH:
+    sh = load ? 0x3 : 0x1;
+    break;
+  case suffixes::D:
+    // LDRD and STRD both live in the store encoding space
+    sh = load ? 0x2 : 0x3;
+    load_bit = false;
+    break;
+  }
+
+  if (!extra) {
+    word = base | (1 << 26) | (byte << 22) | (load << 20);
+    if (!register_offset) {
+      if (offset > 0xFFF) {
+        return false;
+      }
+      word |= offset;
+      return true;
+    }
+    // the offset register can only be shifted by a constant
+    if (i.get_shift_type() != shift_types::NONE && i.is_shift_by_register()) {
+      return false;
+    }
+    uint32_t operand = rm;
+    if (!encode_shift(i, operand)) {
+      return false;
+    }
+    word |= (1 << 25) | operand;
+    return true;
+  }
+
+  word = base | (load_bit << 20) | (1 << 7) | (sh << 5) | (1 << 4);
+  if (register_offset) {
+    // and extra transfers can't shift it at all
+    if (i.get_shift_type() != shift_types::NONE) {
+      return false;
+    }
+    word |= rm;
+    return true;
+  }
+  if (offset > 0xFF) {
+    return false;
+  }
+  word |= (1 << 22) | ((offset & 0xF0) << 4) | (offset & 0xF);
+  return true;
+}
+
+static bool encode_multiple_transfer(const Instruction &i, uint32_t &word) {
+  if (i.get_register_count() < 2 || i.get_register(0) > MAX_REGISTER) {
+    return false;
+  }
+  uint32_t register_list = 0;
+  for (uint8_t idx = 1; idx < i.get_register_count(); ++idx) {
+    const uint32_t reg = i.get_register(idx);
+    // ARM transfers registers in ascending order, so other orders would
+    // change the memory layout
+    if (reg > MAX_REGISTER || (register_list >> reg) != 0) {
+      return false;
+    }
+    register_list |= 1 << reg;
+  }
+  uint32_t pu = 0x1;
+  switch (i.get_update_mode()) {
+  case update_modes::DA:
+    pu = 0x0;
+    break;
+  case update_modes::DB:
+    pu = 0x2;
+    break;
+  case update_modes::IB:
+    pu = 0x3;
+    break;
+  case update_modes::IA:
+  case update_modes::NONE: // intentional fall-through
+    break;
+  }
+  const uint32_t load = i.get_opcode() == opcodes::LDM ? 1 : 0;
+  const uint32_t writeback = i.has_writeback() ? 1 : 0;
+  word = encode_condition(i.get_condition_code()) | (0x4 << 25) |
+         (pu << 23) | (writeback << 21) | (load << 20) |
+         (i.get_register(0) << 16) | register_list;
+  return true;
+}
+
+static bool encode_multiply(const Instruction &i, uint32_t &word) {
+  const opcodes code = i.get_opcode();
+  const bool long_multiply = code != opcodes::MUL && code != opcodes::MLA;
+  const bool accumulate = code == opcodes::MLA || code == opcodes::SMLAL ||
+                          code == opcodes::UMLAL;
+  if (i.get_register_count() < (accumulate || long_multiply ? 4u : 3u)) {
+    return false;
+  }
+  for (uint8_t idx = 0; idx < i.get_register_count(); ++idx) {
+    if (i.get_register(idx) > MAX_REGISTER) {
+      return false;
+    }
+  }
+  const uint32_t set_flags = i.get_update_condition_flags() ? 1 : 0;
+  word = encode_condition(i.get_condition_code()) | (accumulate << 21) |
+         (set_flags << 20) | 0x90;
+  if (long_multiply) {
+    const uint32_t is_signed =
+        (code == opcodes::SMULL || code == opcodes::SMLAL) ? 1 : 0;
+    // {RdLo, RdHi, Rm, Rs}
+    word |= (1 << 23) | (is_signed << 22) | (i.get_register(1) << 16) |
+            (i.get_register(0) << 12) | (i.get_register(3) << 8) |
+            i.get_register(2);
+  } else {
+    // {Rd, Rm, Rs[, Rn]}
+    const uint32_t rn = accumulate ? i.get_register(3) : 0;
+    word |= (i.get_register(0) << 16) | (rn << 12) |
+            (i.get_register(2) << 8) | i.get_register(1);
+  }
+  return true;
+}
+
+static bool encode_branch(const Instruction &i, uint32_t address,
+                          uint32_t &word) {
+  const int64_t offset = static_cast<int64_t>(i.get_second_operand()) -
+                         (static_cast<int64_t>(address) + 2);
+  if (offset < -(1 << 23) || offset >= (1 << 23)) {
+    return false;
+  }
+  const uint32_t link = i.get_opcode() == opcodes::BL ? 1 : 0;
+  word = encode_condition(i.get_condition_code()) | (0x5 << 25) |
+         (link << 24) | (static_cast<uint32_t>(offset) & 0xFFFFFF);
+  return true;
+}
+
+bool ArmCodec::encode(const Instruction &i, uint32_t address, uint32_t &word) {
+  switch (i.get_opcode()) {
+  case opcodes::B:
+  case opcodes::BL: // intentional fall-through
+    return encode_branch(i, address, word);
+  case opcodes::LDR:
+  case opcodes::STR: // intentional fall-through
+    return encode_single_transfer(i, word);
+  case opcodes::LDM:
+  case opcodes::STM: // intentional fall-through
+    return encode_multiple_transfer(i, word);
+  case opcodes::MLA:
+  case opcodes::MUL:   // intentional fall-through
+  case opcodes::SMLAL: // intentional fall-through
+  case opcodes::SMULL: // intentional fall-through
+  case opcodes::UMLAL: // intentional fall-through
+  case opcodes::UMULL: // intentional fall-through
+    return encode_multiply(i, word);
+  case opcodes::SWI:
+    if (static_cast<uint32_t>(i.get_second_operand()) > 0xFFFFFF) {
+      return false;
+    }
+    word = encode_condition(i.get_condition_code()) | (0xF << 24) |
+           static_cast<uint32_t>(i.get_second_operand());
+    return true;
+  case opcodes::NONE:
+    return false;
+  default:
+    return encode_data_processing(i, word);
+  }
+}
+
+static void decode_data_processing(uint32_t word, Instruction &result) {
+  const opcodes code = data_processing_opcodes[(word >> 21) & 0xF];
+  const uint8_t rn = (word >> 16) & 0xF;
+  const uint8_t rd = (word >> 12) & 0xF;
+  result.set_opcode(code);
+  if (is_compare(code)) {
+    // S is implied by the operation
+    result.set_registers({rn, rn});
+  } else {
+    if ((word >> 20) & 1) {
+      result.set_suffix(suffixes::S);
+    }
+    if (code == opcodes::MOV || code == opcodes::MVN) {
+      result.set_registers({rd});
+    } else {
+      result.set_registers({rd, rn});
+    }
+  }
+  if ((word >> 25) & 1) {
+    result.set_second_operand(ArmCodec::decode_immediate(word & 0xFFF));
+  } else {
+    result.append_to_registers(word & 0xF);
+    result.set_is_2nd_operand_register(true);
+    decode_shift(word, result);
+  }
+}
+
+// Decodes the P, U and W bits. Returns false for post-indexed transfers with
+// W set, which are the user mode transfers
+static bool decode_indexing(uint32_t word, Instruction &result) {
+  const bool pre_indexed = (word >> 24) & 1;
+  const bool writeback = (word >> 21) & 1;
+  if (!pre_indexed && writeback) {
+    return false;
+  }
+  result.set_post_indexed(!pre_indexed);
+  result.set_writeback(writeback);
+  return true;
+}
+
+// Sets an immediate offset, negated unless the U bit is set
+static void decode_immediate_offset(uint32_t word, uint32_t offset,
+                                    Instruction &result) {
+  const bool add = (word >> 23) & 1;
+  result.set_second_operand(add ? static_cast<int64_t>(offset)
+                                : -static_cast<int64_t>(offset));
+}
+
+static void decode_register_offset(uint32_t word, Instruction &result) {
+  result.append_to_registers(word & 0xF);
+  result.set_is_2nd_operand_register(true);
+  result.set_offset_subtracted(!((word >> 23) & 1));
+}
+
+static bool decode_single_transfer(uint32_t word, Instruction &result) {
+  // register offsets with bit 4 set are media instructions
+  const bool register_offset = (word >> 25) & 1;
+  if ((register_offset && ((word >> 4) & 1)) ||
+      !decode_indexing(word, result)) {
+    return false;
+  }
+  const bool load = (word >> 20) & 1;
+  result.set_opcode(load ? opcodes::LDR : opcodes::STR);
+  if ((word >> 22) & 1) {
+    result.set_suffix(suffixes::B);
+  }
+  result.set_registers({static_cast<uint8_t>((word >> 12) & 0xF),
+                        static_cast<uint8_t>((word >> 16) & 0xF)});
+  if (register_offset) {
+    decode_register_offset(word, result);
+    decode_shift(word, result);
+  } else {
+    decode_immediate_offset(word, word & 0xFFF, result);
+  }
+  return true;
+}
+
+static bool decode_extra_transfer(uint32_t word, Instruction &result) {
+  const bool immediate_offset = (word >> 22) & 1;
+  // register offsets have no shift, and bits 8-11 must be clear
+  if ((!immediate_offset && ((word >> 8) & 0xF) != 0) ||
+      !decode_indexing(word, result)) {
+    return false;
+  }
+  const bool load = (word >> 20) & 1;
+  const uint32_t sh = (word >> 5) & 0x3;
+  static const suffixes load_suffixes[4] = {suffixes::NONE, suffixes::H,
+                                            suffixes::SB, suffixes::SH};
+  static const suffixes store_suffixes[4] = {suffixes::NONE, suffixes::H,
+                                             suffixes::D, suffixes::D};
+  if (sh == 0) {
+    return false;
+  }
+  // LDRD shares the store encoding space
+  result.set_opcode((load || sh == 0x2) ? opcodes::LDR : opcodes::STR);
+  result.set_suffix(load ? load_suffixes[sh] : store_suffixes[sh]);
+  result.set_registers({static_cast<uint8_t>((word >> 12) & 0xF),
+                        static_cast<uint8_t>((word >> 16) & 0xF)});
+  if (immediate_offset) {
+    decode_immediate_offset(word, ((word >> 4) & 0xF0) | (word & 0xF),
+                            result);
+  } else {
+    decode_register_offset(word, result);
+  }
+  return true;
+}
+
+static bool decode_multiply(uint32_t word, Instruction &result) {
+  static const opcodes long_opcodes[4] = {opcodes::UMULL, opcodes::UMLAL,
+                                          opcodes::SMULL, opcodes::SMLAL};
+  const bool accumulate = (word >> 21) & 1;
+  const uint8_t rd_high = (word >> 16) & 0xF;
+  const uint8_t rn_low = (word >> 12) & 0xF;
+  const uint8_t rs = (word >> 8) & 0xF;
+  const uint8_t rm = word & 0xF;
+  if ((word >> 23) & 1) {
+    result.set_opcode(long_opcodes[(word >> 21) & 0x3]);
+    result.set_registers({rn_low, rd_high, rm, rs});
+  } else {
+    // bit 22 set is not a multiply
+    if ((word >> 22) & 1) {
+      return false;
+    }
+    result.set_opcode(accumulate ? opcodes::MLA : opcodes::MUL);
+    result.set_registers({rd_high, rm, rs});
+    if (accumulate) {
+      result.append_to_registers(rn_low);
+    }
+  }
+  if ((word >> 20) & 1) {
+    result.set_suffix(suffixes::S);
+  }
+  return true;
+}
+
+static void decode_multiple_transfer(uint32_t word, Instruction &result) {
+  static const update_modes modes[4] = {update_modes::DA, update_modes::IA,
+                                        update_modes::DB, update_modes::IB};
+  result.set_opcode(((word >> 20) & 1) ? opcodes::LDM : opcodes::STM);
+  result.set_update_mode(modes[(word >> 23) & 0x3]);
+  result.set_writeback((word >> 21) & 1);
+  result.set_registers({static_cast<uint8_t>((word >> 16) & 0xF)});
+  for (uint8_t reg = 0; reg <= MAX_REGISTER; ++reg) {
+    if ((word >> reg) & 1) {
+      result.append_to_registers(reg);
+    }
+  }
+}
+
+// Compares without the S bit encode other instructions, like BX and MRS
+static bool is_miscellaneous(uint32_t word) {
+  return ((word >> 23) & 0x3) == 0x2 && !((word >> 20) & 1);
+}
+
+bool ArmCodec::decode(uint32_t word, uint32_t address, Instruction &result) {
+  const uint32_t condition = word >> CONDITION_SHIFT;
+  if (condition > CONDITION_ALWAYS) {
+    return false;
+  }
+  result = Instruction(opcodes::NONE, condition_table[condition],
+                       suffixes::NONE, update_modes::NONE, {}, 0);
+
+  switch ((word >> 25) & 0x7) {
+  case 0x0:
+    if ((word & 0x010000F0) == 0x90) {
+      return decode_multiply(word, result);
+    }
+    if ((word & 0x90) == 0x90) {
+      return decode_extra_transfer(word, result);
+    }
+  case 0x1: // intentional fall-through
+    if (is_miscellaneous(word)) {
+      return false;
+    }
+    decode_data_processing(word, result);
+    return true;
+  case 0x2:
+  case 0x3: // intentional fall-through
+    return decode_single_transfer(word, result);
+  case 0x4:
+    // user bank transfers are not supported
+    if ((word >> 22) & 1) {
+      return false;
+    }
+    decode_multiple_transfer(word, result);
+    return true;
+  case 0x5: {
+    // sign extend the 24-bit word offset
+    const int32_t offset = static_cast<int32_t>(word << 8) >> 8;
+    result.set_opcode(((word >> 24) & 1) ? opcodes::BL : opcodes::B);
+    result.set_second_operand(static_cast<int64_t>(address) + 2 + offset);
+    return true;
+  }
+  case 0x7:
+    if (((word >> 24) & 1) == 0) {
+      return false; // coprocessor instructions are not supported
+    }
+    result.set_opcode(opcodes::SWI);
+    result.set_second_operand(word & 0xFFFFFF);
+    return true;
+  default:
+    return false;
+  }
+}
@@ -1,13 +1,18 @@
 #include "cli.h"
+#include "accelerator.h"
+#include "elf_loader.h"
+#include "metrics.h"
 #include "simulator.h"
 #include <cassert>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 
 std::string help_text(
     "Available commands:\nh: display this help\nr: run program until it's "
     "stopped\ns: run one instruction\nx{X}: run X instructions and stop\np: "
-    "print register values\nm{X}: print memory at address X\nq: quit");
+    "print register values\nm{X}: print memory at address X\nstats: print "
+    "metrics\nq: quit");
 
 void cli_app::parse_cli_args(int argc, char *argv[]) {
   int i = 0;
@@ -15,11 +20,49 @@ void cli_app::parse_cli_args(int argc, char *argv[]) {
     if (strcmp(argv[i], "-f") == 0) {
       i++;
       assert(i < argc);
-      program = source_parser.parse(argv[i]);
+      file_name = argv[i];
+      program = source_parser.parse(file_name);
+      if (source_parser.get_error_count() > 0) {
+        // a program with errors would run differently than it was written
+        std::cout << source_parser.get_error_count() << " errors in "
+                  << argv[i] << std::endl;
+        program.clear();
+      }
+    } else if (strcmp(argv[i], "-e") == 0) {
+      i++;
+      assert(i < argc);
+      run_from_memory = ElfLoader::load(argv[i], m);
     } else if (strcmp(argv[i], "-m") == 0) {
       i++;
       assert(i < argc);
       m = Machine(std::stoi(argv[i]));
+    } else if (strcmp(argv[i], "-C") == 0) {
+      i++;
+      assert(i < argc);
+      coverage_file = argv[i];
+    } else if (strcmp(argv[i], "-L") == 0) {
+      i++;
+      assert(i < argc);
+      line_coverage_file = argv[i];
+    } else if (strcmp(argv[i], "-R") == 0) {
+      i++;
+      assert(i < argc);
+      record_file = argv[i];
+      semihosting.set_replay_log(&replay_log, replay_modes::RECORD);
+    } else if (strcmp(argv[i], "-P") == 0) {
+      i++;
+      assert(i < argc);
+      if (replay_log.read(argv[i])) {
+        semihosting.set_replay_log(&replay_log, replay_modes::REPLAY);
+      } else {
+        std::cout << "Can't read the replay log " << argv[i] << std::endl;
+      }
+    } else if (strcmp(argv[i], "-M") == 0) {
+      i++;
+      assert(i < argc);
+      metrics_file = argv[i];
+    } else if (strcmp(argv[i], "-O") == 0) {
+      optimize = true;
     } else if (strcmp(argv[i], "-c") == 0) {
       i++;
       assert(i < argc);
@@ -36,6 +79,21 @@ void cli_app::parse_cli_args(int argc, char *argv[]) {
     }
     i++;
   }
+  // the memory size can be given after the program
+  if (!program.empty()) {
+    Simulator::load_data(source_parser.get_data(),
+                         source_parser.get_data_address(), m);
+  }
+  if (optimize) {
+    optimized_program = Optimizer::optimize(program);
+  }
+  // the machine may have been replaced by -m
+  semihosting.attach(m);
+  Accelerator::attach(m, true);
+  if (!coverage_file.empty() || !line_coverage_file.empty()) {
+    coverage = Coverage(run_from_memory ? m.get_memory_size() : program.size());
+    m.set_coverage(&coverage);
+  }
 }
 
 bool cli_app::parse_command(std::string &command) {
@@ -43,6 +101,8 @@ bool cli_app::parse_command(std::string &command) {
     std::cout << help_text << std::endl;
   } else if (command.c_str()[0] == 'r') {
     run();
+  } else if (command == "stats") {
+    Metrics::write_prometheus(std::cout);
   } else if (command.c_str()[0] == 's') {
     run(1);
   } else if (command.c_str()[0] == 'x') {
@@ -60,13 +120,76 @@ bool cli_app::parse_command(std::string &command) {
 }
 
 void cli_app::run(int count) {
+  if (run_from_memory) {
+    Simulator::run_from_memory(m, count);
+    return;
+  }
   if (program.empty()) {
     std::cout << "Please insert a program before running!" << std::endl;
     return;
   }
+  if (optimize) {
+    Simulator::run_program(optimized_program, m, count);
+    return;
+  }
   Simulator::run_program(program, m, count);
 }
 
+void cli_app::write_metrics_file() {
+  if (metrics_file.empty()) {
+    return;
+  }
+  std::ofstream out(metrics_file);
+  if (!out) {
+    std::cout << "Can't write metrics to " << metrics_file << std::endl;
+    return;
+  }
+  // the format follows the extension, Prometheus text otherwise
+  const std::string json = ".json";
+  if (metrics_file.size() >= json.size() &&
+      metrics_file.compare(metrics_file.size() - json.size(), json.size(),
+                           json) == 0) {
+    Metrics::write_json(out);
+  } else {
+    Metrics::write_prometheus(out);
+  }
+}
+
+void cli_app::write_coverage_files() {
+  if (!coverage_file.empty()) {
+    // runs add up in the file, a missing or broken one starts from zero
+    coverage.merge_file(coverage_file);
+    if (!coverage.write(coverage_file)) {
+      std::cout << "Can't write coverage to " << coverage_file << std::endl;
+    }
+  }
+  if (line_coverage_file.empty()) {
+    return;
+  }
+  if (run_from_memory) {
+    std::cout << "Line coverage needs a source file" << std::endl;
+    return;
+  }
+  std::ofstream out(line_coverage_file);
+  if (!out) {
+    std::cout << "Can't write line coverage to " << line_coverage_file
+              << std::endl;
+    return;
+  }
+  coverage.write_line_coverage(out, file_name,
+                               source_parser.get_source_lines());
+}
+
+int cli_app::get_exit_code() const {
+  return semihosting.has_exited() ? semihosting.get_exit_code() : 0;
+}
+
+void cli_app::write_replay_log() {
+  if (!record_file.empty() && !replay_log.write(record_file)) {
+    std::cout << "Can't write the replay log " << record_file << std::endl;
+  }
+}
+
 std::string cli_app::get_next_command_from_queue() {
   if (command_queue.empty()) {
     return "";
@@ -85,13 +208,17 @@ int main(int argc, char *argv[]) {
   bool cont = true;
   while (cont) {
     std::string command = app.get_next_command_from_queue();
-    if (command.empty()) {
-      std::cin >> command;
+    if (command.empty() && !(std::cin >> command)) {
+      // end of input quits
+      command = "q";
     }
 
     if (!app.parse_command(command)) {
       cont = false;
     }
   }
-  return 0;
+  app.write_metrics_file();
+  app.write_coverage_files();
+  app.write_replay_log();
+  return app.get_exit_code();
 }
\ No newline at end of file
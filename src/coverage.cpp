@@ -0,0 +1,114 @@
+#include "coverage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+static const char coverage_file_magic[8] = {'A', 'R', 'S', 'C',
+                                            'O', 'V', '1', '\n'};
+
+Coverage::Coverage(size_t address_count)
+    : edges(COVERAGE_MAP_SIZE), hits(address_count) {}
+
+// Fibonacci hashing spreads nearby addresses over the map, and shifting the
+// source keeps A->B and B->A apart as in AFL
+uint32_t Coverage::get_edge_index(uint32_t from, uint32_t to) {
+  const uint32_t from_hash = from * 2654435761u;
+  const uint32_t to_hash = to * 2654435761u;
+  return ((from_hash >> 1) ^ to_hash) >> (32 - COVERAGE_MAP_SHIFT);
+}
+
+uint32_t Coverage::get_hit_count(uint32_t address) const {
+  return address < hits.size() ? hits[address] : 0;
+}
+
+uint8_t Coverage::get_edge_count(uint32_t from, uint32_t to) const {
+  return edges[get_edge_index(from, to)];
+}
+
+size_t Coverage::get_covered_edge_count() const {
+  return edges.size() - std::count(edges.begin(), edges.end(), 0);
+}
+
+const std::vector<uint8_t> &Coverage::get_edges() const { return edges; }
+
+const std::vector<uint32_t> &Coverage::get_hits() const { return hits; }
+
+void Coverage::merge(const Coverage &other) {
+  for (size_t idx = 0; idx < edges.size(); ++idx) {
+    edges[idx] = std::min<unsigned int>(edges[idx] + other.edges[idx],
+                                        UINT8_MAX);
+  }
+  if (hits.size() < other.hits.size()) {
+    hits.resize(other.hits.size());
+  }
+  for (size_t idx = 0; idx < other.hits.size(); ++idx) {
+    hits[idx] += other.hits[idx];
+  }
+}
+
+// The magic, the number of hit counters as 32 bits, the edge map and the hit
+// counters, in the byte order of the host
+bool Coverage::write(const std::string &file_name) const {
+  std::ofstream file(file_name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  const uint32_t hit_count = hits.size();
+  file.write(coverage_file_magic, sizeof(coverage_file_magic));
+  file.write(reinterpret_cast<const char *>(&hit_count), sizeof(hit_count));
+  file.write(reinterpret_cast<const char *>(edges.data()), edges.size());
+  file.write(reinterpret_cast<const char *>(hits.data()),
+             hits.size() * sizeof(uint32_t));
+  return static_cast<bool>(file);
+}
+
+bool Coverage::merge_file(const std::string &file_name) {
+  std::ifstream file(file_name, std::ios::binary);
+  char magic[sizeof(coverage_file_magic)];
+  uint32_t hit_count = 0;
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, coverage_file_magic, sizeof(magic)) != 0 ||
+      !file.read(reinterpret_cast<char *>(&hit_count), sizeof(hit_count))) {
+    return false;
+  }
+  // the counters must fill the rest of the file, which is checked before
+  // they are allocated
+  const std::streamoff counters_start = file.tellg();
+  file.seekg(0, std::ios::end);
+  if (file.tellg() - counters_start !=
+      static_cast<std::streamoff>(COVERAGE_MAP_SIZE +
+                                  static_cast<uint64_t>(hit_count) *
+                                      sizeof(uint32_t))) {
+    return false;
+  }
+  file.seekg(counters_start);
+  Coverage other(hit_count);
+  if (!file.read(reinterpret_cast<char *>(other.edges.data()),
+                 other.edges.size()) ||
+      !file.read(reinterpret_cast<char *>(other.hits.data()),
+                 other.hits.size() * sizeof(uint32_t))) {
+    return false;
+  }
+  merge(other);
+  return true;
+}
+
+void Coverage::write_line_coverage(
+    std::ostream &out, const std::string &source_name,
+    const std::vector<unsigned int> &source_lines) const {
+  // a line has one instruction, but it's summed in case that changes
+  std::map<unsigned int, uint64_t> line_hits;
+  for (size_t address = 0; address < source_lines.size(); ++address) {
+    line_hits[source_lines[address]] += get_hit_count(address);
+  }
+  size_t lines_hit = 0;
+  out << "TN:\nSF:" << source_name << "\n";
+  for (const auto &line : line_hits) {
+    out << "DA:" << line.first << "," << line.second << "\n";
+    lines_hit += line.second > 0;
+  }
+  out << "LF:" << line_hits.size() << "\nLH:" << lines_hit
+      << "\nend_of_record\n";
+}
@@ -0,0 +1,175 @@
+#include "devices.h"
+
+#include <cassert>
+
+Uart::Uart(std::ostream &out, std::istream &in) : out(out), in(in) {}
+
+void Uart::attach(Machine &m, uint32_t address) {
+  m.map_device(
+      address, UART_WORD_COUNT,
+      [this](uint32_t offset) { return read(offset); },
+      [this](uint32_t offset, uint32_t value) { write(offset, value); });
+}
+
+uint32_t Uart::read(uint32_t offset) {
+  switch (offset) {
+  case UART_DATA: {
+    if (in.rdbuf()->in_avail() <= 0) {
+      return 0;
+    }
+    const int character = in.get();
+    return character == std::char_traits<char>::eof()
+               ? 0
+               : static_cast<uint8_t>(character);
+  }
+  case UART_STATUS:
+    return UART_TX_READY |
+           (in.rdbuf()->in_avail() > 0 ? UART_RX_READY : 0);
+  default:
+    return 0;
+  }
+}
+
+void Uart::write(uint32_t offset, uint32_t value) {
+  if (offset == UART_DATA) {
+    out.put(static_cast<char>(value & 0xFF));
+  }
+}
+
+Timer::Timer(EventQueue &events) : events(events) {}
+
+Timer::~Timer() { stop(); }
+
+void Timer::attach(Machine &m, uint32_t address) {
+  m.map_device(
+      address, TIMER_WORD_COUNT,
+      [this](uint32_t offset) { return read(offset); },
+      [this](uint32_t offset, uint32_t value) { write(offset, value); });
+}
+
+void Timer::set_expiry_handler(expiry_handler handler) {
+  on_expiry = std::move(handler);
+}
+
+bool Timer::has_expired() const { return status & TIMER_EXPIRED; }
+
+uint32_t Timer::read(uint32_t offset) {
+  switch (offset) {
+  case TIMER_LOAD:
+    return load;
+  case TIMER_CONTROL:
+    return control;
+  case TIMER_STATUS:
+    return status;
+  default:
+    return 0;
+  }
+}
+
+void Timer::write(uint32_t offset, uint32_t value) {
+  switch (offset) {
+  case TIMER_LOAD:
+    load = value;
+    if (control & TIMER_ENABLE) {
+      start(events.get_time());
+    }
+    break;
+  case TIMER_CONTROL: {
+    const bool was_enabled = control & TIMER_ENABLE;
+    control = value;
+    if (!(control & TIMER_ENABLE)) {
+      stop();
+    } else if (!was_enabled) {
+      start(events.get_time());
+    }
+    break;
+  }
+  case TIMER_STATUS:
+    status &= ~value;
+    break;
+  default:
+    break;
+  }
+}
+
+void Timer::start(uint64_t from) {
+  stop();
+  if (load == 0) {
+    return;
+  }
+  event_id = events.schedule(from + load,
+                             [this](uint64_t time) { expire(time); });
+  scheduled = true;
+}
+
+void Timer::stop() {
+  if (scheduled) {
+    events.cancel(event_id);
+    scheduled = false;
+  }
+}
+
+void Timer::expire(uint64_t time) {
+  scheduled = false;
+  status |= TIMER_EXPIRED;
+  if (control & TIMER_PERIODIC) {
+    start(time);
+  }
+  if (on_expiry) {
+    on_expiry();
+  }
+}
+
+void InterruptController::attach(Machine &m, uint32_t address) {
+  machine = &m;
+  m.map_device(
+      address, INTC_WORD_COUNT,
+      [this](uint32_t offset) { return read(offset); },
+      [this](uint32_t offset, uint32_t value) { write(offset, value); });
+  update_lines();
+}
+
+void InterruptController::raise(unsigned int source) {
+  assert(source < INTC_SOURCE_COUNT);
+  pending |= 1u << source;
+  update_lines();
+}
+
+uint32_t InterruptController::read(uint32_t offset) {
+  switch (offset) {
+  case INTC_PENDING:
+    return pending;
+  case INTC_ENABLE:
+    return enabled;
+  case INTC_FIQ_SELECT:
+    return fiq_selected;
+  default:
+    return 0;
+  }
+}
+
+void InterruptController::write(uint32_t offset, uint32_t value) {
+  switch (offset) {
+  case INTC_PENDING:
+    pending &= ~value;
+    break;
+  case INTC_ENABLE:
+    enabled = value;
+    break;
+  case INTC_FIQ_SELECT:
+    fiq_selected = value;
+    break;
+  default:
+    break;
+  }
+  update_lines();
+}
+
+void InterruptController::update_lines() {
+  if (!machine) {
+    return;
+  }
+  const uint32_t active = pending & enabled;
+  machine->set_irq_line((active & ~fiq_selected) != 0);
+  machine->set_fiq_line((active & fiq_selected) != 0);
+}
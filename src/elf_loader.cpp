@@ -0,0 +1,172 @@
+#include "elf_loader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ARSMULATOR_USE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define ELF_HEADER_SIZE 52
+#define ELF_PROGRAM_HEADER_SIZE 32
+#define ELF_CLASS_32 1
+#define ELF_DATA_LITTLE_ENDIAN 1
+#define ELF_TYPE_EXECUTABLE 2
+#define ELF_MACHINE_ARM 40
+#define ELF_SEGMENT_LOAD 1
+#define ELF_SEGMENT_FLAG_WRITE 0x2
+
+struct elf_segment {
+  uint32_t offset;
+  uint32_t address;
+  uint32_t file_size;
+  uint32_t memory_size;
+  uint32_t flags;
+};
+
+// ELF fields are little-endian regardless of the host
+static uint32_t read_field(const std::vector<uint8_t> &bytes, size_t offset,
+                           size_t size) {
+  uint32_t value = 0;
+  for (size_t idx = 0; idx < size; ++idx) {
+    value |= static_cast<uint32_t>(bytes[offset + idx]) << (8 * idx);
+  }
+  return value;
+}
+
+static bool read_bytes(std::ifstream &file, uint64_t offset, size_t count,
+                       std::vector<uint8_t> &bytes) {
+  bytes.resize(count);
+  file.seekg(offset);
+  file.read(reinterpret_cast<char *>(bytes.data()), count);
+  return static_cast<size_t>(file.gcount()) == count;
+}
+
+static bool copy_segment(std::ifstream &file, const elf_segment &segment,
+                         Machine &m) {
+  std::vector<uint8_t> bytes;
+  if (!read_bytes(file, segment.offset, segment.file_size, bytes)) {
+    return false;
+  }
+  // the part of the segment that's not in the file is zero filled
+  bytes.resize(segment.memory_size, 0);
+  std::vector<uint32_t> words((bytes.size() + 3) / 4, 0);
+  for (size_t idx = 0; idx < bytes.size(); ++idx) {
+    words[idx / 4] |= static_cast<uint32_t>(bytes[idx]) << (8 * (idx % 4));
+  }
+  m.load_memory(segment.address / 4, words.data(), words.size());
+  return true;
+}
+
+bool ElfLoader::load(const std::string &file_name, Machine &m) {
+  std::ifstream file(file_name, std::ios::binary);
+  std::vector<uint8_t> header;
+  if (!file || !read_bytes(file, 0, ELF_HEADER_SIZE, header)) {
+    std::cout << "Can't read ELF header from " << file_name << std::endl;
+    return false;
+  }
+  if (header[0] != 0x7F || header[1] != 'E' || header[2] != 'L' ||
+      header[3] != 'F' || header[4] != ELF_CLASS_32 ||
+      header[5] != ELF_DATA_LITTLE_ENDIAN ||
+      read_field(header, 16, 2) != ELF_TYPE_EXECUTABLE ||
+      read_field(header, 18, 2) != ELF_MACHINE_ARM) {
+    std::cout << file_name << " is not a little-endian ARM ELF32 executable"
+              << std::endl;
+    return false;
+  }
+  const uint32_t entry = read_field(header, 24, 4);
+  const uint32_t program_header_offset = read_field(header, 28, 4);
+  const uint32_t program_header_size = read_field(header, 42, 2);
+  const uint32_t program_header_count = read_field(header, 44, 2);
+  // Thumb entry points have the lowest bit set
+  if (entry % 4 != 0 || program_header_size < ELF_PROGRAM_HEADER_SIZE) {
+    std::cout << "Unsupported entry point or program header" << std::endl;
+    return false;
+  }
+
+  const uint64_t memory_bytes =
+      static_cast<uint64_t>(m.get_memory_size()) * sizeof(uint32_t);
+  std::vector<elf_segment> segments;
+  for (uint32_t idx = 0; idx < program_header_count; ++idx) {
+    std::vector<uint8_t> program_header;
+    if (!read_bytes(file,
+                    program_header_offset +
+                        static_cast<uint64_t>(idx) * program_header_size,
+                    ELF_PROGRAM_HEADER_SIZE, program_header)) {
+      std::cout << "Can't read program header " << idx << std::endl;
+      return false;
+    }
+    if (read_field(program_header, 0, 4) != ELF_SEGMENT_LOAD) {
+      continue;
+    }
+    elf_segment segment;
+    segment.offset = read_field(program_header, 4, 4);
+    segment.address = read_field(program_header, 8, 4);
+    segment.file_size = read_field(program_header, 16, 4);
+    segment.memory_size = read_field(program_header, 20, 4);
+    segment.flags = read_field(program_header, 24, 4);
+    if (segment.address % 4 != 0 || segment.file_size > segment.memory_size ||
+        static_cast<uint64_t>(segment.address) + segment.memory_size >
+            memory_bytes) {
+      std::cout << "Segment " << idx << " does not fit in memory" << std::endl;
+      return false;
+    }
+    segments.push_back(segment);
+  }
+
+  // Read-only segments are mapped first, as mapping replaces whole host
+  // pages. Copying the other segments afterwards restores any bytes they
+  // share with a mapped page.
+  std::vector<bool> mapped(segments.size(), false);
+#ifdef ARSMULATOR_USE_MMAP
+  const int file_descriptor = open(file_name.c_str(), O_RDONLY);
+  if (file_descriptor >= 0) {
+    const uint32_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t idx = 0; idx < segments.size(); ++idx) {
+      const elf_segment &segment = segments[idx];
+      if ((segment.flags & ELF_SEGMENT_FLAG_WRITE) ||
+          segment.file_size != segment.memory_size) {
+        continue;
+      }
+      // a later mapping would replace the pages shared with an earlier one
+      bool shares_page = false;
+      for (size_t other = 0; other < idx; ++other) {
+        shares_page |=
+            mapped[other] &&
+            segment.address / page_size <=
+                (segments[other].address + segments[other].file_size) /
+                    page_size &&
+            segments[other].address / page_size <=
+                (segment.address + segment.file_size) / page_size;
+      }
+      if (!shares_page) {
+        mapped[idx] = m.map_file(file_descriptor, segment.offset,
+                                 segment.address / 4, segment.file_size);
+      }
+    }
+    // the mappings stay valid after the descriptor is closed
+    close(file_descriptor);
+  }
+#endif
+  for (size_t idx = 0; idx < segments.size(); ++idx) {
+    if (!mapped[idx] && !copy_segment(file, segments[idx], m)) {
+      std::cout << "Can't read segment " << idx << std::endl;
+      return false;
+    }
+  }
+
+  // toolchain code computes byte addresses, and its stack grows down from
+  // the end of memory
+  m.set_byte_addresses(true);
+  m.set_register_value(
+      STACK_POINTER_INDEX,
+      Machine_byte(static_cast<uint32_t>(
+          std::min<uint64_t>(memory_bytes, UINT32_MAX & ~uint32_t(3)))));
+  m.set_register_value(PROGRAM_COUNTER_INDEX, Machine_byte(entry / 4));
+  return true;
+}
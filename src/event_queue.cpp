@@ -0,0 +1,168 @@
+#include "event_queue.h"
+
+#include <algorithm>
+#include <cassert>
+
+#define EVENT_WHEEL_MASK (EVENT_WHEEL_SIZE - 1)
+
+// Returns how many slots after start the first used one is, going around
+// the wheel, or EVENT_WHEEL_SIZE if none is used
+static unsigned int get_distance_to_used(uint64_t used, unsigned int start) {
+  if (!used) {
+    return EVENT_WHEEL_SIZE;
+  }
+  const uint64_t rotated =
+      start == 0 ? used
+                 : (used >> start) | (used << (EVENT_WHEEL_SIZE - start));
+#if defined(__GNUC__)
+  return __builtin_ctzll(rotated);
+#else
+  unsigned int distance = 0;
+  while (!(rotated & (1ULL << distance))) {
+    distance++;
+  }
+  return distance;
+#endif
+}
+
+uint64_t EventQueue::schedule(uint64_t at, event_handler handler) {
+  const uint64_t id = next_id++;
+  handlers[id] = std::move(handler);
+  insert(event{at, id});
+  update_run_deadline();
+  return id;
+}
+
+bool EventQueue::cancel(uint64_t id) {
+  // the entry in the wheel is skipped when its time comes
+  return handlers.erase(id) > 0;
+}
+
+void EventQueue::insert(const event &e) {
+  if (e.at <= time) {
+    due.push_back(e);
+    return;
+  }
+  // the lowest level whose slots reach the time of the event
+  for (int level = 0; level < EVENT_WHEEL_LEVELS; ++level) {
+    const unsigned int shift = level * EVENT_WHEEL_SHIFT;
+    if ((e.at >> shift) - (time >> shift) < EVENT_WHEEL_SIZE) {
+      const unsigned int slot = (e.at >> shift) & EVENT_WHEEL_MASK;
+      slots[level][slot].push_back(e);
+      used_slots[level] |= 1ULL << slot;
+      return;
+    }
+  }
+  overflow.push_back(e);
+}
+
+uint64_t EventQueue::get_next_time() const {
+  if (!due.empty()) {
+    return time;
+  }
+  uint64_t next = UINT64_MAX;
+  // the used slots of a level are all after the current one
+  for (int level = 0; level < EVENT_WHEEL_LEVELS; ++level) {
+    const unsigned int shift = level * EVENT_WHEEL_SHIFT;
+    const uint64_t current = time >> shift;
+    const unsigned int distance = get_distance_to_used(
+        used_slots[level], (current + 1) & EVENT_WHEEL_MASK);
+    if (distance < EVENT_WHEEL_SIZE) {
+      next = std::min(next, (current + 1 + distance) << shift);
+    }
+  }
+  // overflow events fit in the top level this many of its slots before
+  const unsigned int top_shift = (EVENT_WHEEL_LEVELS - 1) * EVENT_WHEEL_SHIFT;
+  for (const event &e : overflow) {
+    next = std::min(next, ((e.at >> top_shift) - EVENT_WHEEL_MASK)
+                              << top_shift);
+  }
+  return next;
+}
+
+void EventQueue::advance(uint64_t to) {
+  while (true) {
+    run_due();
+    const uint64_t next = get_next_time();
+    if (next > to) {
+      // nothing happens before to, so the slots stay where they are
+      time = std::max(time, to);
+      update_run_deadline();
+      return;
+    }
+    time = next;
+    cascade();
+  }
+}
+
+void EventQueue::begin_run(const uint64_t *retired) {
+  assert(!run_retired);
+  run_start = time;
+  run_retired = retired;
+  update_run_deadline();
+}
+
+void EventQueue::end_run() {
+  advance(run_start + *run_retired);
+  run_retired = nullptr;
+  run_deadline = UINT64_MAX;
+}
+
+void EventQueue::update_run_deadline() {
+  if (!run_retired) {
+    return;
+  }
+  const uint64_t next = get_next_time();
+  if (next == UINT64_MAX) {
+    run_deadline = UINT64_MAX;
+  } else {
+    run_deadline = next > run_start ? next - run_start : 0;
+  }
+}
+
+void EventQueue::cascade() {
+  if (!overflow.empty()) {
+    std::vector<event> waiting;
+    waiting.swap(overflow);
+    for (const event &e : waiting) {
+      insert(e);
+    }
+  }
+  // higher levels first, as their events can move to the current slot of a
+  // lower level
+  for (int level = EVENT_WHEEL_LEVELS - 1; level >= 0; --level) {
+    const unsigned int shift = level * EVENT_WHEEL_SHIFT;
+    if (time & ((1ULL << shift) - 1)) {
+      continue;
+    }
+    const unsigned int slot = (time >> shift) & EVENT_WHEEL_MASK;
+    if (!(used_slots[level] & (1ULL << slot))) {
+      continue;
+    }
+    std::vector<event> moved;
+    moved.swap(slots[level][slot]);
+    used_slots[level] &= ~(1ULL << slot);
+    for (const event &e : moved) {
+      insert(e);
+    }
+  }
+}
+
+void EventQueue::run_due() {
+  while (!due.empty()) {
+    std::vector<event> ready;
+    ready.swap(due);
+    std::sort(ready.begin(), ready.end(), [](const event &a, const event &b) {
+      return a.at != b.at ? a.at < b.at : a.id < b.id;
+    });
+    for (const event &e : ready) {
+      auto found = handlers.find(e.id);
+      if (found == handlers.end()) {
+        continue;
+      }
+      event_handler handler = std::move(found->second);
+      handlers.erase(found);
+      handler(e.at);
+    }
+  }
+}
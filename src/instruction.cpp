@@ -81,3 +81,46 @@ size_t Instruction::get_register_count() const { return registers.size(); }
 void Instruction::append_to_registers(uint8_t index) {
   registers.push_back(index);
 }
+
+void Instruction::set_shift(shift_types type, uint8_t amount) {
+  // shifting by 0 keeps the value as it is, except for RRX that has no amount
+  shift_type = (amount == 0 && type != shift_types::RRX) ? shift_types::NONE
+                                                         : type;
+  shift_operand = amount;
+  shift_by_register = false;
+}
+
+void Instruction::set_shift_by_register(shift_types type,
+                                        uint8_t shift_register) {
+  shift_type = type;
+  shift_operand = shift_register;
+  shift_by_register = true;
+}
+
+shift_types Instruction::get_shift_type() const { return shift_type; }
+
+uint8_t Instruction::get_shift_amount() const {
+  assert(!shift_by_register);
+  return shift_operand;
+}
+
+bool Instruction::is_shift_by_register() const { return shift_by_register; }
+
+uint8_t Instruction::get_shift_register() const {
+  assert(shift_by_register);
+  return shift_operand;
+}
+
+void Instruction::set_writeback(bool enabled) { writeback = enabled; }
+
+bool Instruction::has_writeback() const { return writeback; }
+
+void Instruction::set_post_indexed(bool enabled) { post_indexed = enabled; }
+
+bool Instruction::is_post_indexed() const { return post_indexed; }
+
+void Instruction::set_offset_subtracted(bool subtracted) {
+  offset_subtracted = subtracted;
+}
+
+bool Instruction::is_offset_subtracted() const { return offset_subtracted; }
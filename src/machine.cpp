@@ -1,447 +1,1062 @@
 #include "machine.h"
+#include "arm_codec.h"
+#include "coverage.h"
 #include "instruction.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <utility>
 
-#define REGISTER_COUNT 16
+#if defined(__unix__) || defined(__APPLE__)
+#define ARSMULATOR_USE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define CODE_PAGE_SIZE (1 << CODE_PAGE_SHIFT)
+
+// indexes of the register banks in Cpu_state
+#define USER_BANK 0
+#define FIQ_BANK 1
+#define IRQ_BANK 2
+#define SVC_BANK 3
+
+// returns the register bank of the mode of the CPSR
+static inline int get_bank(uint32_t cpsr) {
+  switch (cpsr & BITMASK_CPSR_MODE) {
+  case MODE_FIQ:
+    return FIQ_BANK;
+  case MODE_IRQ:
+    return IRQ_BANK;
+  case MODE_SVC:
+    return SVC_BANK;
+  default:
+    return USER_BANK;
+  }
+}
+
+// Guest word accesses are atomic, so cores that share memory never see torn
+// words, and a store is visible to a load on another core together with the
+// stores before it. Both are plain moves on x86 hosts
+static inline uint32_t load_word(const uint32_t *word) {
+#if defined(__GNUC__)
+  return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+#else
+  return *word;
+#endif
+}
+
+static inline void store_word(uint32_t *word, uint32_t value) {
+#if defined(__GNUC__)
+  __atomic_store_n(word, value, __ATOMIC_RELEASE);
+#else
+  *word = value;
+#endif
+}
+
+// Memory is allocated in whole host pages so that file pages can be mapped
+// over it
+static size_t get_memory_allocation_size(int mem_size) {
+  const size_t bytes = static_cast<size_t>(mem_size) * sizeof(uint32_t);
+#ifdef ARSMULATOR_USE_MMAP
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  return ((bytes + page_size - 1) / page_size) * page_size;
+#else
+  return bytes;
+#endif
+}
 
 Machine::Machine(int mem_size) {
-  memory = static_cast<Machine_byte *>(malloc(mem_size * sizeof(Machine_byte)));
+  memory_size = mem_size;
+#ifdef ARSMULATOR_USE_MMAP
+  // anonymous mappings are zero filled by the kernel
+  void *allocation =
+      mmap(nullptr, get_memory_allocation_size(memory_size),
+           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  memory = allocation == MAP_FAILED ? nullptr
+                                    : static_cast<uint32_t *>(allocation);
+#else
+  memory = static_cast<uint32_t *>(calloc(memory_size, sizeof(uint32_t)));
+#endif
   // Fail if it was not able to reserve memory
   assert(memory);
-  memory_size = mem_size;
-  for (int i = 0; i < memory_size; ++i) {
-    memory[i] = Machine_byte(0);
-  }
-  registers = std::vector<Machine_byte>(REGISTER_COUNT, 0);
-  current_program_status_register = 0;
+  Metrics::add(metrics::ALLOCATIONS);
+  Metrics::add(metrics::ALLOCATED_BYTES,
+               get_memory_allocation_size(memory_size));
+  own_state = Cpu_state();
+  state = &own_state;
+  decoded_pages.resize((memory_size >> CODE_PAGE_SHIFT) + 1);
+}
+
+Machine::Machine(Machine *memory_owner) {
+  memory = memory_owner->memory;
+  memory_size = memory_owner->memory_size;
+  owns_memory = false;
+  own_state = Cpu_state();
+  state = &own_state;
+  decoded_pages.resize((memory_size >> CODE_PAGE_SHIFT) + 1);
 }
 
 Machine::~Machine() {
-  if (memory) {
+  flush_metrics();
+  if (memory && owns_memory) {
+#ifdef ARSMULATOR_USE_MMAP
+    munmap(memory, get_memory_allocation_size(memory_size));
+#else
     free(memory);
+#endif
+  }
+}
+
+Machine &Machine::operator=(Machine &&machine) {
+  std::swap(own_state, machine.own_state);
+  std::swap(state, machine.state);
+  // a machine on its own state stays on it
+  if (state == &machine.own_state) {
+    state = &own_state;
   }
+  if (machine.state == &own_state) {
+    machine.state = &machine.own_state;
+  }
+  std::swap(memory, machine.memory);
+  std::swap(memory_size, machine.memory_size);
+  std::swap(decoded_pages, machine.decoded_pages);
+  std::swap(pending_metrics, machine.pending_metrics);
+  std::swap(coverage, machine.coverage);
+  std::swap(swi_handlers, machine.swi_handlers);
+  std::swap(extra_retired, machine.extra_retired);
+  std::swap(owns_memory, machine.owns_memory);
+  std::swap(halted, machine.halted);
+  std::swap(devices, machine.devices);
+  std::swap(events, machine.events);
+  std::swap(swi_exceptions, machine.swi_exceptions);
+  std::swap(byte_addresses, machine.byte_addresses);
+  std::swap(irq_line, machine.irq_line);
+  std::swap(fiq_line, machine.fiq_line);
+  std::swap(interrupt_pending, machine.interrupt_pending);
+  return *this;
 }
 
-bool Machine::execute(Instruction i) {
+// Handlers of the data processing instructions for each combination of
+// flag update and register second operand. Compares always update the flags
+#define ALU_HANDLERS(code)                                                     \
+  {{&Machine::execute_data_processing<code, false, false>,                     \
+    &Machine::execute_data_processing<code, false, true>},                     \
+   {&Machine::execute_data_processing<code, true, false>,                      \
+    &Machine::execute_data_processing<code, true, true>}}
+#define COMPARE_HANDLERS(code)                                                 \
+  {{&Machine::execute_data_processing<code, true, false>,                      \
+    &Machine::execute_data_processing<code, true, true>},                      \
+   {&Machine::execute_data_processing<code, true, false>,                      \
+    &Machine::execute_data_processing<code, true, true>}}
+#define NO_ALU_HANDLERS {{nullptr, nullptr}, {nullptr, nullptr}}
+
+bool Machine::execute(const Instruction &i) {
+  // in the order of the opcodes enum
+  static constexpr alu_handler alu_handlers[][2][2] = {
+      NO_ALU_HANDLERS,                   // NONE
+      ALU_HANDLERS(opcodes::ADC),        // ADC
+      ALU_HANDLERS(opcodes::ADD),        // ADD
+      ALU_HANDLERS(opcodes::AND),        // AND
+      NO_ALU_HANDLERS,                   // B
+      ALU_HANDLERS(opcodes::BIC),        // BIC
+      NO_ALU_HANDLERS,                   // BL
+      COMPARE_HANDLERS(opcodes::CMN),    // CMN
+      COMPARE_HANDLERS(opcodes::CMP),    // CMP
+      ALU_HANDLERS(opcodes::EOR),        // EOR
+      NO_ALU_HANDLERS,                   // LDM
+      NO_ALU_HANDLERS,                   // LDR
+      NO_ALU_HANDLERS,                   // MLA
+      ALU_HANDLERS(opcodes::MOV),        // MOV
+      NO_ALU_HANDLERS,                   // MUL
+      ALU_HANDLERS(opcodes::MVN),        // MVN
+      ALU_HANDLERS(opcodes::ORR),        // ORR
+      ALU_HANDLERS(opcodes::RSB),        // RSB
+      ALU_HANDLERS(opcodes::RSC),        // RSC
+      ALU_HANDLERS(opcodes::SBC),        // SBC
+      NO_ALU_HANDLERS,                   // SMLAL
+      NO_ALU_HANDLERS,                   // SMULL
+      NO_ALU_HANDLERS,                   // STM
+      NO_ALU_HANDLERS,                   // STR
+      ALU_HANDLERS(opcodes::SUB),        // SUB
+      NO_ALU_HANDLERS,                   // SWI
+      COMPARE_HANDLERS(opcodes::TEQ),    // TEQ
+      COMPARE_HANDLERS(opcodes::TST),    // TST
+      NO_ALU_HANDLERS,                   // UMLAL
+      NO_ALU_HANDLERS};                  // UMULL
+  static_assert(sizeof(alu_handlers) / sizeof(alu_handlers[0]) ==
+                    static_cast<size_t>(opcodes::UMULL) + 1,
+                "every opcode needs an entry");
+
   bool halt = false;
+  // The program counter points to the next instruction while executing, so
+  // an instruction that writes it branches to the written address
+  state->registers[PROGRAM_COUNTER_INDEX]++;
 
   // only executed if the condition code flags in the CPSR meet the specified
   // condition
-  if (meets_condition_code(i.get_condition_code())) {
-    switch (i.get_opcode()) {
-    case opcodes::ADC:
-      execute_add(i, true);
-      break;
-    case opcodes::CMN: // Same as ADD except result is discarded
-      i.set_suffix(suffixes::S);
-      i.set_register(0, REGISTER_COUNT); // discards result
-    case opcodes::ADD:                   // intentional fall-through
-      execute_add(i, false);
-      break;
-    case opcodes::BIC:
-      i.set_second_operand(~i.get_second_operand());
-      execute_and(i);
-      break;
-    case opcodes::TST: // Performs bitwise but discards result
-      i.set_suffix(suffixes::S);
-      i.set_register(0, REGISTER_COUNT);
-    case opcodes::AND: // intentional fall-through
-      execute_and(i);
-      break;
-    case opcodes::TEQ: // Performs exclusive or but discards result
-      i.set_suffix(suffixes::S);
-      i.set_register(0, REGISTER_COUNT);
-    case opcodes::EOR:
-      execute_eor(i);
-      break;
-    case opcodes::ORR:
-      execute_orr(i);
-      break;
-    case opcodes::CMP: // Same as SUB except result is discarded
-      i.set_suffix(suffixes::S);
-      i.set_register(0, REGISTER_COUNT); // discards result
-    case opcodes::RSB:                   // intentional fall-through
-    case opcodes::RSC:                   // intentional fall-through
-    case opcodes::SBC:                   // intentional fall-through
-    case opcodes::SUB:                   // intentional fall-through
-      execute_subtract(i, ((i.get_opcode() == opcodes::SBC) ||
-                           (i.get_opcode() == opcodes::RSC)));
-      break;
-    case opcodes::LDR:
-      execute_load(i);
-      break;
-    case opcodes::STR:
-      execute_store(i);
-      break;
-    case opcodes::MVN:
-      i.set_second_operand(~i.get_second_operand());
-    case opcodes::MOV: // intentional fall-through
-      execute_move(i);
-      break;
-    case opcodes::BL:
-      registers[LINK_REGISTER_INDEX] =
-          Machine_byte(registers[PROGRAM_COUNTER_INDEX].to_unsigned32() + 1);
-    case opcodes::B: // intentional fall-through
-                     // -1 because PC register is increased after executing the
-                     // instruction -> this results in PC to be
-                     // i.get_second_operand() when execution returns from this
-                     // method
-      registers[PROGRAM_COUNTER_INDEX] = i.get_second_operand() - 1;
-      break;
-    case opcodes::LDM:
-      execute_load_multiple(i);
-      break;
-    case opcodes::STM:
-      execute_store_multiple(i);
-      break;
-    case opcodes::NONE:
-      std::cout << "Instruction with opcode NONE" << std::endl;
-      halt = true;
-      break;
-    default:
-      std::cout << "Unknown opcode " << static_cast<uint8_t>(i.get_opcode())
-                << std::endl;
-    case opcodes::SWI: // intentional fall-through
-      halt = true;
-      break;
+  if (!meets_condition_code(i.get_condition_code())) {
+    count(metrics::CONDITION_FAILED);
+    if (coverage) {
+      const uint32_t next = state->registers[PROGRAM_COUNTER_INDEX];
+      coverage->add_edge(next - 1, next);
     }
+    return halt;
+  }
+  const alu_handler handler =
+      alu_handlers[static_cast<size_t>(i.get_opcode())]
+                  [i.get_update_condition_flags()][i.is_2nd_operand_register()];
+  if (handler != nullptr) {
+    (this->*handler)(i);
+    return halt;
+  }
+  switch (i.get_opcode()) {
+  case opcodes::LDR:
+    count(metrics::LOADS);
+    execute_load(i);
+    break;
+  case opcodes::STR:
+    count(metrics::STORES);
+    execute_store(i);
+    break;
+  case opcodes::MLA:
+  case opcodes::MUL: // intentional fall-through
+    execute_multiply(i);
+    break;
+  case opcodes::SMLAL:
+  case opcodes::SMULL: // intentional fall-through
+  case opcodes::UMLAL: // intentional fall-through
+  case opcodes::UMULL: // intentional fall-through
+    execute_multiply_long(i);
+    break;
+  case opcodes::BL:
+    state->registers[LINK_REGISTER_INDEX] =
+        state->registers[PROGRAM_COUNTER_INDEX];
+  case opcodes::B: // intentional fall-through
+    state->registers[PROGRAM_COUNTER_INDEX] = i.get_second_operand();
+    break;
+  case opcodes::LDM:
+    count(metrics::LOADS);
+    execute_load_multiple(i);
+    break;
+  case opcodes::STM:
+    count(metrics::STORES);
+    execute_store_multiple(i);
+    break;
+  case opcodes::NONE:
+    std::cout << "Instruction with opcode NONE" << std::endl;
+    halt = true;
+    halted = true;
+    break;
+  case opcodes::SWI:
+    count(metrics::SWIS);
+    halt = execute_software_interrupt(i);
+    halted = halt;
+    break;
+  default:
+    std::cout << "Unknown opcode " << static_cast<uint8_t>(i.get_opcode())
+              << std::endl;
+    halt = true;
+    halted = true;
+    break;
   }
-  // Increment program counter to next instruction
-  set_register_value(PROGRAM_COUNTER_INDEX,
-                     get_register_value(PROGRAM_COUNTER_INDEX) + 1);
   return halt;
 }
 
-Machine_byte Machine::get_flex_2nd_operand_value(Instruction i) {
-  if (i.is_2nd_operand_register()) {
-    return registers[i.get_last_register()];
+// Applies a barrel shifter operation. carry holds the C flag when called and
+// the shifter carry-out on return
+static uint32_t barrel_shift(uint32_t value, shift_types type, uint32_t amount,
+                             bool &carry) {
+  switch (type) {
+  case shift_types::LSL:
+    if (amount == 0) {
+      return value;
+    }
+    if (amount < 32) {
+      carry = (value >> (32 - amount)) & 1;
+      return value << amount;
+    }
+    carry = amount == 32 && (value & 1);
+    return 0;
+  case shift_types::LSR:
+    if (amount == 0) {
+      return value;
+    }
+    if (amount < 32) {
+      carry = (value >> (amount - 1)) & 1;
+      return value >> amount;
+    }
+    carry = amount == 32 && (value >> 31);
+    return 0;
+  case shift_types::ASR:
+    if (amount == 0) {
+      return value;
+    }
+    if (amount < 32) {
+      carry = (value >> (amount - 1)) & 1;
+      return static_cast<uint32_t>(static_cast<int32_t>(value) >> amount);
+    }
+    carry = value >> 31;
+    return carry ? 0xFFFFFFFF : 0;
+  case shift_types::ROR:
+    if (amount == 0) {
+      return value;
+    }
+    amount &= 31;
+    if (amount == 0) {
+      carry = value >> 31;
+      return value;
+    }
+    carry = (value >> (amount - 1)) & 1;
+    return (value >> amount) | (value << (32 - amount));
+  case shift_types::RRX: {
+    const uint32_t result = (static_cast<uint32_t>(carry) << 31) | (value >> 1);
+    carry = value & 1;
+    return result;
+  }
+  case shift_types::NONE: // intentional fall-through
+  default:
+    return value;
   }
-  return i.get_second_operand();
 }
 
-void Machine::execute_add(Instruction i, bool use_carry) {
-  // calculate result of add operation
-  Machine_byte operand_byte(get_flex_2nd_operand_value(i));
-  registers[i.get_register(1)].set_carry(use_carry);
-  Machine_byte result_byte = registers[i.get_register(1)] + operand_byte;
+uint32_t Machine::get_shifted_operand(const Instruction &i, bool &carry) {
+  carry = state->cpsr & BITMASK_CPSR_C;
+  if (!i.is_2nd_operand_register()) {
+    const uint32_t value = static_cast<uint32_t>(i.get_second_operand());
+    // Immediates that don't fit in 8 bits are encoded rotated, and a rotated
+    // immediate sets the carry to its bit 31
+    if (value > 0xFF) {
+      carry = value >> 31;
+    }
+    return value;
+  }
+  const uint32_t value = state->registers[i.get_last_register()];
+  // shifts by a constant zero were already dropped when decoding
+  if (i.get_shift_type() == shift_types::NONE) {
+    return value;
+  }
+  const uint32_t amount =
+      i.is_shift_by_register()
+          ? state->registers[i.get_shift_register()] & 0xFF
+          : i.get_shift_amount();
+  return barrel_shift(value, i.get_shift_type(), amount, carry);
+}
 
-  // update flags if requested
-  if (i.get_update_condition_flags()) {
-    const int64_t result =
-        static_cast<int64_t>(registers[i.get_register(1)].to_signed32()) +
-        static_cast<int64_t>(get_flex_2nd_operand_value(i).to_signed32());
-    current_program_status_register |= ((result < 0) << SHIFT_CPRS_N);
-    current_program_status_register |= ((result == 0) << SHIFT_CPRS_Z);
-
-    // For an addition C is set to 1 if the addition produced a carry (that is,
-    // an unsigned overflow), and to 0 otherwise.
-    current_program_status_register |=
-        ((registers[i.get_register(1)].get_carry()) << SHIFT_CPRS_C);
-    // Overflow occurs if the result of an add, subtract, or compare is greater
-    // than or equal to 2^31, or less than -2^31
-    current_program_status_register |=
-        (((result >= std::pow(2, 31)) || (result < -std::pow(2, 31)))
-         << SHIFT_CPRS_V);
-  }
-
-  // write result to register (it's not written for compare operation)
-  const uint32_t register_to_write = i.get_register(0);
-  if (register_to_write < REGISTER_COUNT) {
-    registers[register_to_write] = result_byte;
-  }
-}
-
-void Machine::execute_subtract(Instruction i, bool use_carry) {
-  // calculate result of subtract operation
-  Machine_byte operand_byte(get_flex_2nd_operand_value(i));
-  const Machine_byte carry_byte(use_carry ? 1 : 0);
-  Machine_byte result_byte(std::bitset<BIT_COUNT>(0));
-  if (opcodes::RSB == i.get_opcode() || opcodes::RSC == i.get_opcode()) {
-    result_byte = operand_byte - registers[i.get_register(1)] - carry_byte;
+uint32_t Machine::subtract_with_flags(const Instruction &i) {
+  const uint32_t first = state->registers[i.get_register(1)];
+  const uint32_t operand =
+      i.is_2nd_operand_register()
+          ? state->registers[i.get_last_register()]
+          : static_cast<uint32_t>(i.get_second_operand());
+  const uint32_t result = first - operand;
+  // the operands have different signs, and the result hasn't the sign of
+  // first
+  const uint32_t overflow = ((first ^ operand) & (first ^ result)) >> 31;
+  state->cpsr &= ~static_cast<uint32_t>(BITMASK_CPSR_N | BITMASK_CPSR_Z |
+                                        BITMASK_CPSR_C | BITMASK_CPSR_V);
+  state->cpsr |= ((result >> 31) << SHIFT_CPRS_N);
+  state->cpsr |= ((result == 0) << SHIFT_CPRS_Z);
+  state->cpsr |= ((first >= operand) << SHIFT_CPRS_C);
+  state->cpsr |= (overflow << SHIFT_CPRS_V);
+  return result;
+}
+
+void Machine::execute_fused_branch(const Instruction &branch) {
+  // the PC is already past the first instruction
+  state->registers[PROGRAM_COUNTER_INDEX]++;
+  if (meets_condition_code(branch.get_condition_code())) {
+    state->registers[PROGRAM_COUNTER_INDEX] =
+        static_cast<uint32_t>(branch.get_second_operand());
   } else {
-    result_byte = registers[i.get_register(1)] - operand_byte - carry_byte;
+    count(metrics::CONDITION_FAILED);
   }
+}
 
-  // update flags if requested
-  if (i.get_update_condition_flags()) {
-    const int64_t result =
-        static_cast<int64_t>(registers[i.get_register(1)].to_signed32()) -
-        static_cast<int64_t>(get_flex_2nd_operand_value(i).to_signed32()) -
-        carry_byte.to_signed32();
-    current_program_status_register |= ((result < 0) << SHIFT_CPRS_N);
-    current_program_status_register |=
-        ((registers[i.get_register(1)].get_bits() == operand_byte.get_bits())
-         << SHIFT_CPRS_Z);
-
-    // A carry occurs if the result of a subtraction is positive
-    current_program_status_register |=
-        ((!registers[i.get_register(1)].get_borrow()) << SHIFT_CPRS_C);
-    // Overflow occurs if the result of an add, subtract, or compare is greater
-    // than or equal to 2^31, or less than -2^31
-    current_program_status_register |=
-        (((result >= std::pow(2, 31)) || (result < -std::pow(2, 31)))
-         << SHIFT_CPRS_V);
-  }
-
-  // write result to register (it's not written for compare operation)
-  const uint32_t register_to_write = i.get_register(0);
-  if (register_to_write < REGISTER_COUNT) {
-    registers[register_to_write] = result_byte;
-  }
-}
-
-void Machine::execute_and(Instruction i) {
-  // Execute bitwise and
-  Machine_byte result_byte = registers[i.get_register(1)] &
-                             Machine_byte(get_flex_2nd_operand_value(i));
-
-  // update flags if requested
-  if (i.get_update_condition_flags()) {
-    current_program_status_register |=
-        ((result_byte.to_signed32() < 0) << SHIFT_CPRS_N);
-    current_program_status_register |=
-        ((result_byte.to_unsigned32() == 0) << SHIFT_CPRS_Z);
+void Machine::execute_compare_and_branch(const Instruction &compare,
+                                         const Instruction &branch) {
+  state->registers[PROGRAM_COUNTER_INDEX]++;
+  subtract_with_flags(compare);
+  execute_fused_branch(branch);
+}
+
+void Machine::execute_subtract_and_branch(const Instruction &subtract,
+                                          const Instruction &branch) {
+  state->registers[PROGRAM_COUNTER_INDEX]++;
+  state->registers[subtract.get_register(0)] = subtract_with_flags(subtract);
+  execute_fused_branch(branch);
+}
+
+Machine_byte Machine::get_flex_2nd_operand_value(Instruction i) {
+  bool carry;
+  return Machine_byte(get_shifted_operand(i, carry));
+}
+
+void Machine::update_logical_flags(uint32_t result, bool carry) {
+  state->cpsr &=
+      ~static_cast<uint32_t>(BITMASK_CPSR_N | BITMASK_CPSR_Z | BITMASK_CPSR_C);
+  state->cpsr |= ((result >> 31) << SHIFT_CPRS_N);
+  state->cpsr |= ((result == 0) << SHIFT_CPRS_Z);
+  state->cpsr |= (carry << SHIFT_CPRS_C);
+}
+
+template <opcodes code, bool update_flags, bool register_operand>
+void Machine::execute_data_processing(const Instruction &i) {
+  const bool is_compare = code == opcodes::CMN || code == opcodes::CMP ||
+                          code == opcodes::TEQ || code == opcodes::TST;
+  const bool is_move = code == opcodes::MOV || code == opcodes::MVN;
+  const bool carry_in = state->cpsr & BITMASK_CPSR_C;
+
+  // second operand, and the shifter carry-out that logical operations use
+  bool shifter_carry = carry_in;
+  uint32_t operand;
+  if (register_operand) {
+    operand = state->registers[i.get_last_register()];
+    // shifts by a constant zero were already dropped when decoding
+    if (i.get_shift_type() != shift_types::NONE) {
+      const uint32_t amount =
+          i.is_shift_by_register()
+              ? state->registers[i.get_shift_register()] & 0xFF
+              : i.get_shift_amount();
+      operand =
+          barrel_shift(operand, i.get_shift_type(), amount, shifter_carry);
+    }
+  } else {
+    operand = static_cast<uint32_t>(i.get_second_operand());
+    // Immediates that don't fit in 8 bits are encoded rotated, and a rotated
+    // immediate sets the carry to its bit 31
+    if (operand > 0xFF) {
+      shifter_carry = operand >> 31;
+    }
   }
+  const uint32_t first = is_move ? 0 : state->registers[i.get_register(1)];
 
-  // write result to register (it's not written for compare operation)
-  const uint32_t register_to_write = i.get_register(0);
-  if (register_to_write < REGISTER_COUNT) {
-    registers[register_to_write] = result_byte;
+  // N and Z come from the 32-bit result, and V from the result as a signed
+  // 64-bit value, which is in the 32-bit range when there's no overflow
+  uint32_t result = 0;
+  int64_t signed_result = 0;
+  bool arithmetic_carry = false;
+  bool is_arithmetic = true;
+  switch (code) {
+  case opcodes::ADC:
+  case opcodes::ADD: // intentional fall-through
+  case opcodes::CMN: { // intentional fall-through
+    const uint32_t carry = code == opcodes::ADC ? carry_in : 0;
+    result = first + operand + carry;
+    signed_result = static_cast<int64_t>(static_cast<int32_t>(first)) +
+                    static_cast<int32_t>(operand) + carry;
+    arithmetic_carry =
+        static_cast<uint64_t>(first) + operand + carry > UINT32_MAX;
+    break;
+  }
+  case opcodes::CMP:
+  case opcodes::RSB: // intentional fall-through
+  case opcodes::RSC: // intentional fall-through
+  case opcodes::SBC: // intentional fall-through
+  case opcodes::SUB: { // intentional fall-through
+    const bool reverse = code == opcodes::RSB || code == opcodes::RSC;
+    const uint32_t minuend = reverse ? operand : first;
+    const uint32_t subtrahend = reverse ? first : operand;
+    const uint32_t borrow =
+        (code == opcodes::RSC || code == opcodes::SBC) ? !carry_in : 0;
+    result = minuend - subtrahend - borrow;
+    signed_result = static_cast<int64_t>(static_cast<int32_t>(minuend)) -
+                    static_cast<int32_t>(subtrahend) - borrow;
+    // the carry is set when there's no borrow
+    arithmetic_carry =
+        static_cast<uint64_t>(minuend) >=
+        static_cast<uint64_t>(subtrahend) + borrow;
+    break;
+  }
+  case opcodes::AND:
+  case opcodes::TST: // intentional fall-through
+    result = first & operand;
+    is_arithmetic = false;
+    break;
+  case opcodes::BIC:
+    result = first & ~operand;
+    is_arithmetic = false;
+    break;
+  case opcodes::EOR:
+  case opcodes::TEQ: // intentional fall-through
+    result = first ^ operand;
+    is_arithmetic = false;
+    break;
+  case opcodes::ORR:
+    result = first | operand;
+    is_arithmetic = false;
+    break;
+  case opcodes::MOV:
+    result = operand;
+    is_arithmetic = false;
+    break;
+  case opcodes::MVN:
+    result = ~operand;
+    is_arithmetic = false;
+    break;
+  default:
+    break;
+  }
+
+  if (!is_compare) {
+    state->registers[i.get_register(0)] = result;
+  }
+  // writing the PC with S returns from an exception mode
+  if (update_flags && !is_compare &&
+      i.get_register(0) == PROGRAM_COUNTER_INDEX &&
+      get_bank(state->cpsr) != USER_BANK) {
+    return_from_exception();
+  } else if (update_flags && is_arithmetic) {
+    state->cpsr &= ~static_cast<uint32_t>(
+        BITMASK_CPSR_N | BITMASK_CPSR_Z | BITMASK_CPSR_C | BITMASK_CPSR_V);
+    state->cpsr |= ((result >> 31) << SHIFT_CPRS_N);
+    state->cpsr |= ((result == 0) << SHIFT_CPRS_Z);
+    state->cpsr |= (arithmetic_carry << SHIFT_CPRS_C);
+    state->cpsr |= ((signed_result > INT32_MAX || signed_result < INT32_MIN)
+                   << SHIFT_CPRS_V);
+  } else if (update_flags) {
+    update_logical_flags(result, shifter_carry);
   }
 }
 
-void Machine::execute_orr(Instruction i) {
-  const uint32_t register_to_write = i.get_register(0);
-  assert(register_to_write < REGISTER_COUNT);
+uint32_t Machine::get_transfer_address(const Instruction &i,
+                                       uint32_t &updated_base) {
+  assert(i.get_register(1) < REGISTER_COUNT);
 
-  registers[register_to_write] = registers[i.get_register(1)] |
-                                 Machine_byte(get_flex_2nd_operand_value(i));
+  const uint32_t base = state->registers[i.get_register(1)];
+  uint32_t offset;
+  if (i.is_2nd_operand_register()) {
+    bool carry;
+    offset = get_shifted_operand(i, carry);
+    if (i.is_offset_subtracted()) {
+      offset = 0 - offset;
+    }
+  } else {
+    offset = static_cast<uint32_t>(i.get_second_operand());
+  }
+  updated_base = base + offset;
+  return i.is_post_indexed() ? base : updated_base;
+}
 
-  // update flags if requested
-  if (i.get_update_condition_flags()) {
-    current_program_status_register |=
-        ((registers[register_to_write].to_signed32() < 0) << SHIFT_CPRS_N);
-    current_program_status_register |=
-        ((registers[register_to_write].to_unsigned32() == 0) << SHIFT_CPRS_Z);
+void Machine::write_back_base(const Instruction &i, uint32_t updated_base) {
+  if (i.has_writeback() || i.is_post_indexed()) {
+    state->registers[i.get_register(1)] = updated_base;
   }
 }
 
-void Machine::execute_eor(Instruction i) {
-  // Execute exclusive or
-  Machine_byte result_byte = registers[i.get_register(1)] ^
-                             Machine_byte(get_flex_2nd_operand_value(i));
+inline uint32_t Machine::load(uint32_t address) {
+  if (address < static_cast<uint32_t>(memory_size)) {
+    return load_word(memory + address);
+  }
+  return load_device(address);
+}
 
-  // update flags if requested
-  if (i.get_update_condition_flags()) {
-    current_program_status_register |=
-        ((result_byte.to_signed32() < 0) << SHIFT_CPRS_N);
-    current_program_status_register |=
-        ((result_byte.to_unsigned32() == 0) << SHIFT_CPRS_Z);
+inline void Machine::store(uint32_t address, uint32_t value) {
+  if (address < static_cast<uint32_t>(memory_size)) {
+    store_word(memory + address, value);
+    invalidate_decoded_instruction(address);
+  } else {
+    store_device(address, value);
   }
+}
 
-  // write result to register (it's not written for compare operation)
-  const uint32_t register_to_write = i.get_register(0);
-  if (register_to_write < REGISTER_COUNT) {
-    registers[register_to_write] = result_byte;
+uint32_t Machine::load_device(uint32_t address) {
+  for (auto &device : devices) {
+    if (address - device.address < device.word_count) {
+      return device.read(address - device.address);
+    }
   }
+  std::cout << "Load from unmapped address " << address << std::endl;
+  return 0;
+}
+
+void Machine::store_device(uint32_t address, uint32_t value) {
+  for (auto &device : devices) {
+    if (address - device.address < device.word_count) {
+      device.write(address - device.address, value);
+      return;
+    }
+  }
+  std::cout << "Store to unmapped address " << address << std::endl;
 }
 
 void Machine::execute_load(Instruction i) {
-  assert(i.get_register(1) < memory_size);
   assert(i.get_register(0) < REGISTER_COUNT);
 
+  uint32_t updated_base;
+  const uint32_t address = get_transfer_address(i, updated_base);
+  // the loaded value wins if the base is also the destination
+  write_back_base(i, updated_base);
+  if (byte_addresses) {
+    execute_byte_addressed_load(i, address);
+    return;
+  }
+
+  const uint32_t value = load(address);
   switch (i.get_suffix()) {
   case suffixes::H:
+    state->registers[i.get_register(0)] = value & 0xFFFF;
+    break;
   case suffixes::SH:
-    registers[i.get_register(0)] =
-        memory[registers[i.get_register(1)].to_unsigned32()] & 0xFFFF;
+    state->registers[i.get_register(0)] = static_cast<uint32_t>(
+        static_cast<int32_t>(static_cast<int16_t>(value & 0xFFFF)));
     break;
   case suffixes::B:
-  case suffixes::SB: // intentional fall-through
-    registers[i.get_register(0)] =
-        memory[registers[i.get_register(1)].to_unsigned32()] & 0xFF;
+    state->registers[i.get_register(0)] = value & 0xFF;
+    break;
+  case suffixes::SB:
+    state->registers[i.get_register(0)] = static_cast<uint32_t>(
+        static_cast<int32_t>(static_cast<int8_t>(value & 0xFF)));
     break;
   case suffixes::D:
-    assert(i.get_register(1) + 1 < memory_size);
     assert(i.get_register(0) + 1 < REGISTER_COUNT);
     assert(i.get_register(0) % 2 == 0);
     assert(i.get_register(0) + 1 != i.get_register(1));
-    registers[i.get_register(0) + 1] =
-        memory[registers[i.get_register(1)].to_unsigned32() + 1];
+    state->registers[i.get_register(0) + 1] = load(address + 1);
   case suffixes::NONE: // intentional fall-through
   default:
-    registers[i.get_register(0)] =
-        memory[registers[i.get_register(1)].to_unsigned32()];
+    state->registers[i.get_register(0)] = value;
   }
 }
 
 void Machine::execute_store(Instruction i) {
-  assert(i.get_register(1) < memory_size);
   assert(i.get_register(0) < REGISTER_COUNT);
 
+  uint32_t updated_base;
+  const uint32_t address = get_transfer_address(i, updated_base);
+  if (byte_addresses) {
+    execute_byte_addressed_store(i, address);
+    write_back_base(i, updated_base);
+    return;
+  }
+
   switch (i.get_suffix()) {
   case suffixes::H:
-  case suffixes::SH:
-    memory[registers[i.get_register(1)].to_unsigned32()] =
-        registers[i.get_register(0)] & 0xFFFF;
+  case suffixes::SH: // intentional fall-through
+    store(address, state->registers[i.get_register(0)] & 0xFFFF);
     break;
   case suffixes::B:
   case suffixes::SB: // intentional fall-through
-    memory[registers[i.get_register(1)].to_unsigned32()] =
-        registers[i.get_register(0)] & 0xFF;
+    store(address, state->registers[i.get_register(0)] & 0xFF);
     break;
   case suffixes::D:
-    assert(i.get_register(1) + 1 < memory_size);
     assert(i.get_register(0) + 1 < REGISTER_COUNT);
     assert(i.get_register(0) % 2 == 0);
     assert(i.get_register(0) + 1 != i.get_register(1));
-    memory[registers[i.get_register(1)].to_unsigned32() + 1] =
-        registers[i.get_register(0) + 1];
+    store(address + 1, state->registers[i.get_register(0) + 1]);
   case suffixes::NONE: // intentional fall-through
   default:
-    memory[registers[i.get_register(1)].to_unsigned32()] =
-        registers[i.get_register(0)];
+    store(address, state->registers[i.get_register(0)]);
   }
+  // the stored value is the base before it's updated
+  write_back_base(i, updated_base);
 }
 
-void Machine::execute_move(Instruction i) {
+void Machine::execute_byte_addressed_load(const Instruction &i,
+                                          uint32_t address) {
+  const uint32_t value = load(address >> 2);
+  // the byte lane of the address, in little-endian order
+  const uint32_t shift = (address & 3) * 8;
+  uint32_t &destination = state->registers[i.get_register(0)];
+  switch (i.get_suffix()) {
+  case suffixes::H:
+    destination = (value >> (shift & 16)) & 0xFFFF;
+    break;
+  case suffixes::SH:
+    destination = static_cast<uint32_t>(static_cast<int32_t>(
+        static_cast<int16_t>((value >> (shift & 16)) & 0xFFFF)));
+    break;
+  case suffixes::B:
+    destination = (value >> shift) & 0xFF;
+    break;
+  case suffixes::SB:
+    destination = static_cast<uint32_t>(
+        static_cast<int32_t>(static_cast<int8_t>((value >> shift) & 0xFF)));
+    break;
+  case suffixes::D:
+    assert(i.get_register(0) + 1 < REGISTER_COUNT);
+    state->registers[i.get_register(0) + 1] = load((address >> 2) + 1);
+    destination = value;
+    break;
+  case suffixes::NONE: // intentional fall-through
+  default:
+    // unaligned word loads rotate the word, as on ARMv4
+    destination = shift ? (value >> shift) | (value << (32 - shift)) : value;
+  }
+}
+
+void Machine::execute_byte_addressed_store(const Instruction &i,
+                                           uint32_t address) {
+  const uint32_t word_address = address >> 2;
+  const uint32_t value = state->registers[i.get_register(0)];
+  uint32_t mask;
+  uint32_t shift;
+  switch (i.get_suffix()) {
+  case suffixes::H:
+  case suffixes::SH: // intentional fall-through
+    mask = 0xFFFF;
+    shift = (address & 2) * 8;
+    break;
+  case suffixes::B:
+  case suffixes::SB: // intentional fall-through
+    mask = 0xFF;
+    shift = (address & 3) * 8;
+    break;
+  case suffixes::D:
+    assert(i.get_register(0) + 1 < REGISTER_COUNT);
+    store(word_address + 1, state->registers[i.get_register(0) + 1]);
+  case suffixes::NONE: // intentional fall-through
+  default:
+    store(word_address, value);
+    return;
+  }
+  // the rest of the word keeps its bytes
+  store(word_address, (load(word_address) & ~(mask << shift)) |
+                          ((value & mask) << shift));
+}
+
+void Machine::execute_multiply(Instruction i) {
+  assert(i.get_register_count() >= 3);
   assert(i.get_register(0) < REGISTER_COUNT);
 
-  registers[i.get_register(0)] = Machine_byte(get_flex_2nd_operand_value(i));
+  // the low 32 bits of the product are the same for signed and unsigned
+  uint32_t result =
+      state->registers[i.get_register(1)] * state->registers[i.get_register(2)];
+  if (i.get_opcode() == opcodes::MLA) {
+    assert(i.get_register_count() >= 4);
+    result += state->registers[i.get_register(3)];
+  }
+  state->registers[i.get_register(0)] = result;
 
+  // multiplies leave C and V unchanged
   if (i.get_update_condition_flags()) {
-    current_program_status_register |=
-        ((registers[i.get_register(0)].to_signed32() < 0) << SHIFT_CPRS_N);
-    current_program_status_register |=
-        ((registers[i.get_register(0)].to_unsigned32() == 0) << SHIFT_CPRS_Z);
+    state->cpsr &= ~static_cast<uint32_t>(BITMASK_CPSR_N | BITMASK_CPSR_Z);
+    state->cpsr |= ((result >> 31) << SHIFT_CPRS_N);
+    state->cpsr |= ((result == 0) << SHIFT_CPRS_Z);
   }
 }
 
-void Machine::execute_load_multiple(Instruction i) {
-  uint32_t address = registers[i.get_register(0)].to_unsigned32();
-  const update_modes mode = i.get_update_mode();
-
-  if (mode == update_modes::IB) {
-    address++;
-  } else if (mode == update_modes::DB) {
-    address--;
-  }
-  for (uint8_t idx = 1; idx < i.get_register_count(); ++idx) {
-    registers[i.get_register(idx)] = memory[address];
-    switch (mode) {
-    case update_modes::DA:
-    case update_modes::DB:
-      address--;
-      break;
-    case update_modes::IA:
-    case update_modes::IB:
-      address++;
-      break;
-    default:
-      std::cout << "Unknown update mode" << std::endl;
-      break;
+void Machine::execute_multiply_long(Instruction i) {
+  assert(i.get_register_count() >= 4);
+  const uint8_t low_register = i.get_register(0);
+  const uint8_t high_register = i.get_register(1);
+  assert(low_register < REGISTER_COUNT && high_register < REGISTER_COUNT);
+  assert(low_register != high_register);
+
+  const uint32_t operand1 = state->registers[i.get_register(2)];
+  const uint32_t operand2 = state->registers[i.get_register(3)];
+  uint64_t result;
+  if (i.get_opcode() == opcodes::SMULL || i.get_opcode() == opcodes::SMLAL) {
+    const int64_t signed_operand1 = static_cast<int32_t>(operand1);
+    const int64_t signed_operand2 = static_cast<int32_t>(operand2);
+    result = static_cast<uint64_t>(signed_operand1 * signed_operand2);
+  } else {
+    result = static_cast<uint64_t>(operand1) * operand2;
+  }
+  // the accumulating forms add the 64-bit value already in RdHi:RdLo
+  if (i.get_opcode() == opcodes::SMLAL || i.get_opcode() == opcodes::UMLAL) {
+    const uint64_t high = state->registers[high_register];
+    result += (high << 32) | state->registers[low_register];
+  }
+  state->registers[low_register] = static_cast<uint32_t>(result);
+  state->registers[high_register] = static_cast<uint32_t>(result >> 32);
+
+  if (i.get_update_condition_flags()) {
+    state->cpsr &= ~static_cast<uint32_t>(BITMASK_CPSR_N | BITMASK_CPSR_Z);
+    state->cpsr |= static_cast<uint32_t>(result >> 63) << SHIFT_CPRS_N;
+    state->cpsr |= ((result == 0) << SHIFT_CPRS_Z);
+  }
+}
+
+uint32_t Machine::get_multiple_transfer_address(const Instruction &i,
+                                                uint32_t &updated_base) {
+  assert(i.get_register(0) < REGISTER_COUNT);
+
+  // the base steps by 4 per register with byte addresses
+  const uint32_t shift = byte_addresses ? 2 : 0;
+  const uint32_t step = 1 << shift;
+  const uint32_t size = (i.get_register_count() - 1) << shift;
+  const uint32_t base = state->registers[i.get_register(0)];
+  switch (i.get_update_mode()) {
+  case update_modes::DA:
+    updated_base = base - size;
+    return (updated_base + step) >> shift;
+  case update_modes::DB:
+    updated_base = base - size;
+    return updated_base >> shift;
+  case update_modes::IB:
+    updated_base = base + size;
+    return (base + step) >> shift;
+  case update_modes::IA:
+  case update_modes::NONE: // intentional fall-through
+  default:
+    updated_base = base + size;
+    return base >> shift;
+  }
+}
+
+void Machine::copy_register_block(const Instruction &i, uint32_t *block,
+                                  bool load) {
+  // word by word, as the words are atomic for cores that share memory
+  const uint32_t count = i.get_register_count() - 1;
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    uint32_t &value = state->registers[i.get_register(idx + 1)];
+    if (load) {
+      value = load_word(block + idx);
+    } else {
+      store_word(block + idx, value);
     }
   }
 }
 
+void Machine::execute_load_multiple(Instruction i) {
+  uint32_t updated_base;
+  const uint32_t address = get_multiple_transfer_address(i, updated_base);
+  const uint32_t count = i.get_register_count() - 1;
+  // a loaded base register wins over the written back value
+  if (i.has_writeback()) {
+    state->registers[i.get_register(0)] = updated_base;
+  }
+
+  // The block is checked once, and blocks that reach past the end of memory
+  // or wrap go to the devices. Registers are in ascending order, the lowest
+  // one is at the lowest address
+  if (static_cast<uint64_t>(address) + count <=
+      static_cast<uint32_t>(memory_size)) {
+    copy_register_block(i, memory + address, true);
+  } else {
+    transfer_device_block(i, address, true);
+  }
+}
+
 void Machine::execute_store_multiple(Instruction i) {
-  uint32_t address = registers[i.get_register(0)].to_unsigned32();
-  const update_modes mode = i.get_update_mode();
-
-  if (mode == update_modes::IB) {
-    address++;
-  } else if (mode == update_modes::DB) {
-    address--;
-  }
-  for (uint8_t idx = 1; idx < i.get_register_count(); ++idx) {
-    memory[address] = registers[i.get_register(idx)];
-    switch (mode) {
-    case update_modes::DA:
-    case update_modes::DB:
-      address--;
-      break;
-    case update_modes::IA:
-    case update_modes::IB:
-      address++;
-      break;
-    default:
-      std::cout << "Unknown update mode" << std::endl;
-      break;
+  uint32_t updated_base;
+  const uint32_t address = get_multiple_transfer_address(i, updated_base);
+  const uint32_t count = i.get_register_count() - 1;
+
+  if (static_cast<uint64_t>(address) + count <=
+      static_cast<uint32_t>(memory_size)) {
+    copy_register_block(i, memory + address, false);
+    invalidate_decoded_range(address, count);
+  } else {
+    transfer_device_block(i, address, false);
+  }
+  // a stored base register is stored with its original value
+  if (i.has_writeback()) {
+    state->registers[i.get_register(0)] = updated_base;
+  }
+}
+
+void Machine::transfer_device_block(const Instruction &i, uint32_t address,
+                                    bool load_registers) {
+  const uint32_t count = i.get_register_count() - 1;
+  for (uint32_t idx = 0; idx < count; ++idx) {
+    uint32_t &value = state->registers[i.get_register(idx + 1)];
+    if (load_registers) {
+      value = load(address + idx);
+    } else {
+      store(address + idx, value);
+    }
+  }
+}
+
+bool Machine::execute_software_interrupt(const Instruction &i) {
+  const uint32_t number = static_cast<uint32_t>(i.get_second_operand());
+  for (auto &handler : swi_handlers) {
+    if (handler.first == number) {
+      return handler.second(*this);
     }
   }
+  if (swi_exceptions) {
+    enter_exception(MODE_SVC, VECTOR_SWI,
+                    state->registers[PROGRAM_COUNTER_INDEX]);
+    return false;
+  }
+  return true;
+}
+
+void Machine::write_cpsr(uint32_t value) {
+  const int from = get_bank(state->cpsr);
+  const int to = get_bank(value);
+  if (from != to) {
+    uint32_t *registers = state->registers;
+    state->banked_sp_lr[from][0] = registers[STACK_POINTER_INDEX];
+    state->banked_sp_lr[from][1] = registers[LINK_REGISTER_INDEX];
+    registers[STACK_POINTER_INDEX] = state->banked_sp_lr[to][0];
+    registers[LINK_REGISTER_INDEX] = state->banked_sp_lr[to][1];
+    if ((from == FIQ_BANK) != (to == FIQ_BANK)) {
+      std::copy(registers + 8, registers + 8 + FIQ_BANKED_COUNT,
+                state->banked_r8_r12[from == FIQ_BANK]);
+      std::copy(state->banked_r8_r12[to == FIQ_BANK],
+                state->banked_r8_r12[to == FIQ_BANK] + FIQ_BANKED_COUNT,
+                registers + 8);
+    }
+  }
+  state->cpsr = value;
+  update_interrupt_pending();
+}
+
+void Machine::enter_exception(uint32_t mode, uint32_t vector,
+                              uint32_t return_address) {
+  const uint32_t saved = state->cpsr;
+  uint32_t value = (saved & ~BITMASK_CPSR_MODE) | mode | BITMASK_CPSR_I;
+  if (mode == MODE_FIQ) {
+    value |= BITMASK_CPSR_F;
+  }
+  write_cpsr(value);
+  state->spsr[get_bank(value)] = saved;
+  state->registers[LINK_REGISTER_INDEX] = return_address;
+  state->registers[PROGRAM_COUNTER_INDEX] = vector;
+}
+
+void Machine::return_from_exception() {
+  write_cpsr(state->spsr[get_bank(state->cpsr)]);
+}
+
+void Machine::update_interrupt_pending() {
+  interrupt_pending = (irq_line && !(state->cpsr & BITMASK_CPSR_I)) ||
+                      (fiq_line && !(state->cpsr & BITMASK_CPSR_F));
+}
+
+void Machine::set_irq_line(bool raised) {
+  irq_line = raised;
+  update_interrupt_pending();
+}
+
+void Machine::set_fiq_line(bool raised) {
+  fiq_line = raised;
+  update_interrupt_pending();
+}
+
+void Machine::take_interrupt() {
+  if (!interrupt_pending) {
+    return;
+  }
+  count(metrics::INTERRUPTS);
+  // the PC points to the next instruction between instructions
+  const uint32_t return_address = state->registers[PROGRAM_COUNTER_INDEX] + 1;
+  if (fiq_line && !(state->cpsr & BITMASK_CPSR_F)) {
+    enter_exception(MODE_FIQ, VECTOR_FIQ, return_address);
+  } else {
+    enter_exception(MODE_IRQ, VECTOR_IRQ, return_address);
+  }
+}
+
+void Machine::set_swi_handler(uint32_t number, swi_handler handler) {
+  auto it = std::find_if(swi_handlers.begin(), swi_handlers.end(),
+                         [number](const std::pair<uint32_t, swi_handler> &h) {
+                           return h.first == number;
+                         });
+  if (it != swi_handlers.end()) {
+    swi_handlers.erase(it);
+  }
+  if (handler) {
+    swi_handlers.emplace_back(number, std::move(handler));
+  }
+}
+
+uint64_t Machine::take_retired_instructions() {
+  const uint64_t count = extra_retired;
+  extra_retired = 0;
+  return count;
+}
+
+uint8_t *Machine::get_guest_bytes(uint32_t address, uint32_t byte_count,
+                                  bool write) {
+  const uint64_t start_byte =
+      byte_addresses ? address : static_cast<uint64_t>(address) * 4;
+  if (start_byte + byte_count > static_cast<uint64_t>(memory_size) * 4) {
+    return nullptr;
+  }
+  if (write && byte_count > 0) {
+    const uint32_t first_word = static_cast<uint32_t>(start_byte / 4);
+    invalidate_decoded_range(
+        first_word,
+        static_cast<size_t>((start_byte + byte_count + 3) / 4 - first_word));
+  }
+  return reinterpret_cast<uint8_t *>(memory) + start_byte;
+}
+
+void Machine::set_byte_addresses(bool enabled) {
+  byte_addresses = enabled;
+  // decoded PC relative instructions depend on the addressing
+  for (auto &page : decoded_pages) {
+    page.clear();
+  }
 }
 
 void Machine::set_register_value(uint8_t reg_number, Machine_byte value) {
   assert(reg_number < REGISTER_COUNT);
-  registers[reg_number] = value;
+  state->registers[reg_number] = value.to_unsigned32();
 }
 
 Machine_byte Machine::get_register_value(uint8_t reg_number) {
   assert(reg_number < REGISTER_COUNT);
-  return registers[reg_number];
+  return Machine_byte(state->registers[reg_number]);
 }
 
 void Machine::print_registers() {
   for (uint8_t i = 0; i < REGISTER_COUNT; ++i) {
     std::cout << "Register " << static_cast<int16_t>(i) << ": "
-              << registers[i].get_bits() << std::endl;
+              << std::bitset<BIT_COUNT>(state->registers[i]) << std::endl;
   }
 }
 
+Cpu_state &Machine::get_state() { return *state; }
+
+const Cpu_state &Machine::get_state() const { return *state; }
+
+void Machine::switch_context(Cpu_state *context) {
+  state = context ? context : &own_state;
+  update_interrupt_pending();
+}
+
 uint32_t Machine::get_current_program_status_register() {
-  return current_program_status_register;
+  return state->cpsr;
 }
 
 bool Machine::meets_condition_code(condition_codes code) {
   switch (code) {
   case condition_codes::EQ:
-    return BITMASK_CPSR_Z & current_program_status_register;
+    return BITMASK_CPSR_Z & state->cpsr;
   case condition_codes::NE:
-    return !static_cast<bool>(BITMASK_CPSR_Z & current_program_status_register);
+    return !static_cast<bool>(BITMASK_CPSR_Z & state->cpsr);
   case condition_codes::CS:
-    return BITMASK_CPSR_C & current_program_status_register;
+    return BITMASK_CPSR_C & state->cpsr;
   case condition_codes::CC:
-    return !static_cast<bool>(BITMASK_CPSR_C & current_program_status_register);
+    return !static_cast<bool>(BITMASK_CPSR_C & state->cpsr);
   case condition_codes::MI:
-    return BITMASK_CPSR_N & current_program_status_register;
+    return BITMASK_CPSR_N & state->cpsr;
   case condition_codes::PL:
-    return !static_cast<bool>(BITMASK_CPSR_N & current_program_status_register);
+    return !static_cast<bool>(BITMASK_CPSR_N & state->cpsr);
   case condition_codes::VS:
-    return BITMASK_CPSR_V & current_program_status_register;
+    return BITMASK_CPSR_V & state->cpsr;
   case condition_codes::VC:
-    return !static_cast<bool>(BITMASK_CPSR_V & current_program_status_register);
+    return !static_cast<bool>(BITMASK_CPSR_V & state->cpsr);
   case condition_codes::HI:
-    return (BITMASK_CPSR_C & current_program_status_register) &&
-           !static_cast<bool>(BITMASK_CPSR_Z & current_program_status_register);
+    return (BITMASK_CPSR_C & state->cpsr) &&
+           !static_cast<bool>(BITMASK_CPSR_Z & state->cpsr);
   case condition_codes::LS:
-    return !static_cast<bool>(BITMASK_CPSR_C &
-                              current_program_status_register) ||
-           (BITMASK_CPSR_Z & current_program_status_register);
+    return !static_cast<bool>(BITMASK_CPSR_C & state->cpsr) ||
+           (BITMASK_CPSR_Z & state->cpsr);
   case condition_codes::GE:
-    return static_cast<bool>(BITMASK_CPSR_N &
-                             current_program_status_register) ==
-           static_cast<bool>(BITMASK_CPSR_V & current_program_status_register);
+    return static_cast<bool>(BITMASK_CPSR_N & state->cpsr) ==
+           static_cast<bool>(BITMASK_CPSR_V & state->cpsr);
   case condition_codes::LT:
-    return static_cast<bool>(BITMASK_CPSR_N &
-                             current_program_status_register) !=
-           static_cast<bool>(BITMASK_CPSR_V & current_program_status_register);
+    return static_cast<bool>(BITMASK_CPSR_N & state->cpsr) !=
+           static_cast<bool>(BITMASK_CPSR_V & state->cpsr);
   case condition_codes::GT:
-    return !static_cast<bool>(BITMASK_CPSR_Z &
-                              current_program_status_register) &&
-           (static_cast<bool>(BITMASK_CPSR_N &
-                              current_program_status_register) ==
-            static_cast<bool>(BITMASK_CPSR_V &
-                              current_program_status_register));
+    return !static_cast<bool>(BITMASK_CPSR_Z & state->cpsr) &&
+           (static_cast<bool>(BITMASK_CPSR_N & state->cpsr) ==
+            static_cast<bool>(BITMASK_CPSR_V & state->cpsr));
   case condition_codes::LE:
-    return (BITMASK_CPSR_Z & current_program_status_register) &&
-           (static_cast<bool>(BITMASK_CPSR_N &
-                              current_program_status_register) !=
-            static_cast<bool>(BITMASK_CPSR_V &
-                              current_program_status_register));
+    return (BITMASK_CPSR_Z & state->cpsr) &&
+           (static_cast<bool>(BITMASK_CPSR_N & state->cpsr) !=
+            static_cast<bool>(BITMASK_CPSR_V & state->cpsr));
   default:
     // TODO log missing code
   case condition_codes::AL:   // intentional fall-through
@@ -451,15 +1066,157 @@ bool Machine::meets_condition_code(condition_codes code) {
 }
 
 void Machine::set_current_program_status_register(uint32_t register_value) {
-  current_program_status_register = register_value;
+  write_cpsr(register_value);
 }
 
 void Machine::set_memory(int address, Machine_byte byte) {
   assert(address < memory_size);
-  memory[address] = byte;
+  memory[address] = byte.to_unsigned32();
+  invalidate_decoded_instruction(address);
 }
 
 Machine_byte Machine::get_memory(int address) {
   assert(address < memory_size);
-  return memory[address];
+  return Machine_byte(memory[address]);
+}
+
+int Machine::get_memory_size() const { return memory_size; }
+
+void Machine::set_coverage(Coverage *coverage) { this->coverage = coverage; }
+
+void Machine::map_device(uint32_t address, uint32_t word_count,
+                         device_read_handler read,
+                         device_write_handler write) {
+  assert(address >= static_cast<uint32_t>(memory_size));
+  devices.push_back(
+      device_region{address, word_count, std::move(read), std::move(write)});
+}
+
+void Machine::flush_metrics() {
+  Metrics::add(pending_metrics);
+  pending_metrics = metrics_snapshot();
+}
+
+const Instruction *Machine::fetch_instruction(uint32_t address) {
+  assert(address < static_cast<uint32_t>(memory_size));
+  std::vector<Instruction> &page = decoded_pages[address >> CODE_PAGE_SHIFT];
+  if (page.empty()) {
+    page.resize(CODE_PAGE_SIZE,
+                Instruction(opcodes::NONE, condition_codes::NONE,
+                            suffixes::NONE, update_modes::NONE, {}, 0));
+    Metrics::add(metrics::ALLOCATIONS);
+    Metrics::add(metrics::ALLOCATED_BYTES,
+                 CODE_PAGE_SIZE * sizeof(Instruction));
+  }
+  // opcode NONE marks an address that has not been decoded
+  Instruction &cached = page[address & (CODE_PAGE_SIZE - 1)];
+  if (cached.get_opcode() == opcodes::NONE) {
+    if (!ArmCodec::decode(memory[address], address, cached)) {
+      cached.set_opcode(opcodes::NONE);
+      return nullptr;
+    }
+    if (byte_addresses) {
+      adjust_pc_relative_offset(cached, address);
+    }
+  }
+  return &cached;
+}
+
+void Machine::adjust_pc_relative_offset(Instruction &i, uint32_t address) {
+  const opcodes code = i.get_opcode();
+  const bool is_transfer = code == opcodes::LDR || code == opcodes::STR;
+  const bool is_add_or_sub = (code == opcodes::ADD || code == opcodes::SUB) &&
+                             !i.get_update_condition_flags();
+  if ((!is_transfer && !is_add_or_sub) || i.get_register_count() < 2 ||
+      i.get_register(1) != PROGRAM_COUNTER_INDEX ||
+      i.is_2nd_operand_register() || i.is_post_indexed()) {
+    return;
+  }
+  // The PC reads as address + 1 while the instruction runs, and ARM reads it
+  // as the byte address of the instruction plus 8. The immediate makes up
+  // the difference, modulo 2^32 like the address arithmetic
+  const uint32_t difference = (address * 4 + 8) - (address + 1);
+  const uint32_t operand = static_cast<uint32_t>(i.get_second_operand());
+  const uint32_t adjusted =
+      code == opcodes::SUB ? operand - difference : operand + difference;
+  i.set_second_operand(static_cast<int32_t>(adjusted));
+}
+
+void Machine::invalidate_decoded_instruction(uint32_t address) {
+  // stores to pages without fetched code only pay for this check
+  std::vector<Instruction> &page = decoded_pages[address >> CODE_PAGE_SHIFT];
+  if (!page.empty()) {
+    page[address & (CODE_PAGE_SIZE - 1)].set_opcode(opcodes::NONE);
+  }
+}
+
+void Machine::load_memory(uint32_t address, const uint32_t *words,
+                          size_t count) {
+  assert(address + count <= static_cast<size_t>(memory_size));
+  std::memcpy(memory + address, words, count * sizeof(uint32_t));
+  invalidate_decoded_range(address, count);
+}
+
+bool Machine::map_file(int file_descriptor, uint64_t offset, uint32_t address,
+                       uint32_t byte_count) {
+#ifdef ARSMULATOR_USE_MMAP
+  // Word n of memory holds guest bytes 4n..4n+3, so the host layout is the
+  // guest byte layout only on a little-endian host
+  const uint32_t endian_test = 1;
+  if (*reinterpret_cast<const uint8_t *>(&endian_test) != 1) {
+    return false;
+  }
+  const uint64_t page_size = sysconf(_SC_PAGESIZE);
+  const uint64_t start = static_cast<uint64_t>(address) * sizeof(uint32_t);
+  const uint64_t end = start + byte_count;
+  if ((start % page_size) != (offset % page_size) ||
+      end > static_cast<uint64_t>(memory_size) * sizeof(uint32_t)) {
+    return false;
+  }
+  const uint64_t map_start = start - (start % page_size);
+  const uint64_t map_end = ((end + page_size - 1) / page_size) * page_size;
+  // private mapping makes the pages copy-on-write, so guest stores are never
+  // written back to the file
+  void *mapped = mmap(reinterpret_cast<uint8_t *>(memory) + map_start,
+                      map_end - map_start, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_FIXED, file_descriptor,
+                      offset - (start - map_start));
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  invalidate_decoded_range(map_start / sizeof(uint32_t),
+                           (map_end - map_start) / sizeof(uint32_t));
+  return true;
+#else
+  (void)file_descriptor;
+  (void)offset;
+  (void)address;
+  (void)byte_count;
+  return false;
+#endif
+}
+
+void Machine::invalidate_decoded_range(uint32_t address, size_t count) {
+  // Pages that are written as a whole are dropped. Partly written pages keep
+  // the rest of their instructions, as data is often next to the code
+  const uint64_t end = static_cast<uint64_t>(address) + count;
+  for (uint64_t page_start = address & ~(CODE_PAGE_SIZE - 1);
+       page_start < end &&
+       (page_start >> CODE_PAGE_SHIFT) < decoded_pages.size();
+       page_start += CODE_PAGE_SIZE) {
+    std::vector<Instruction> &page =
+        decoded_pages[page_start >> CODE_PAGE_SHIFT];
+    const uint64_t page_end = page_start + CODE_PAGE_SIZE;
+    if (page.empty()) {
+      continue;
+    }
+    if (address <= page_start && end >= page_end) {
+      page.clear();
+      continue;
+    }
+    for (uint64_t idx = std::max<uint64_t>(address, page_start);
+         idx < std::min(end, page_end); ++idx) {
+      page[idx & (CODE_PAGE_SIZE - 1)].set_opcode(opcodes::NONE);
+    }
+  }
 }
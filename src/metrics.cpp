@@ -0,0 +1,148 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define METRIC_COUNT static_cast<int>(metrics::COUNT)
+
+struct metric_description {
+  const char *name;
+  const char *help;
+};
+
+// in the order of the metrics enum
+static const metric_description descriptions[] = {
+    {"instructions_retired", "Instructions retired by simulator runs"},
+    {"instructions_condition_failed",
+     "Instructions skipped because their condition failed"},
+    {"loads", "Load instructions executed"},
+    {"stores", "Store instructions executed"},
+    {"swis", "Software interrupts executed"},
+    {"interrupts", "Interrupt requests taken"},
+    {"runs", "Simulator runs"},
+    {"run_seconds", "Wall clock time of simulator runs"},
+    {"allocations", "Guest memory and decoded page allocations"},
+    {"allocated_bytes", "Bytes of guest memory and decoded pages allocated"}};
+static_assert(sizeof(descriptions) / sizeof(descriptions[0]) == METRIC_COUNT,
+              "every metric needs a description");
+
+// Only the owning thread writes its block, so a relaxed load and store is
+// enough, and readers see each counter as a whole value. The block takes
+// whole cache lines, so threads don't share lines
+struct alignas(64) thread_metrics {
+  std::atomic<uint64_t> values[METRIC_COUNT];
+};
+
+struct metrics_registry {
+  std::mutex mutex;
+  std::vector<const thread_metrics *> threads;
+  // counts of the threads that have exited
+  uint64_t retired[METRIC_COUNT] = {};
+};
+
+static metrics_registry &get_registry() {
+  static metrics_registry registry;
+  return registry;
+}
+
+// registers the block of a thread on its first use and keeps its counts when
+// the thread exits
+class thread_registration {
+public:
+  thread_registration() : registry(get_registry()) {
+    for (auto &value : block.values) {
+      value.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(&block);
+  }
+  ~thread_registration() {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (int idx = 0; idx < METRIC_COUNT; ++idx) {
+      registry.retired[idx] +=
+          block.values[idx].load(std::memory_order_relaxed);
+    }
+    registry.threads.erase(
+        std::find(registry.threads.begin(), registry.threads.end(), &block));
+  }
+
+  thread_metrics block;
+
+private:
+  metrics_registry &registry;
+};
+
+static thread_metrics &get_thread_metrics() {
+  static thread_local thread_registration registration;
+  return registration.block;
+}
+
+static void add_to(std::atomic<uint64_t> &value, uint64_t amount) {
+  value.store(value.load(std::memory_order_relaxed) + amount,
+              std::memory_order_relaxed);
+}
+
+void Metrics::add(metrics counter, uint64_t amount) {
+  add_to(get_thread_metrics().values[static_cast<int>(counter)], amount);
+}
+
+void Metrics::add(const metrics_snapshot &amounts) {
+  thread_metrics &block = get_thread_metrics();
+  for (int idx = 0; idx < METRIC_COUNT; ++idx) {
+    if (amounts.values[idx]) {
+      add_to(block.values[idx], amounts.values[idx]);
+    }
+  }
+}
+
+metrics_snapshot Metrics::get_snapshot() {
+  metrics_registry &registry = get_registry();
+  metrics_snapshot snapshot;
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (int idx = 0; idx < METRIC_COUNT; ++idx) {
+    snapshot.values[idx] = registry.retired[idx];
+    for (const thread_metrics *block : registry.threads) {
+      snapshot.values[idx] +=
+          block->values[idx].load(std::memory_order_relaxed);
+    }
+  }
+  return snapshot;
+}
+
+// run time is counted in nanoseconds and exported in seconds
+static void write_value(std::ostream &out, const metrics_snapshot &snapshot,
+                        int idx) {
+  if (idx == static_cast<int>(metrics::RUN_NANOSECONDS)) {
+    out << snapshot.values[idx] / 1000000000 << "."
+        << std::to_string(1000000000 + snapshot.values[idx] % 1000000000)
+               .substr(1);
+  } else {
+    out << snapshot.values[idx];
+  }
+}
+
+void Metrics::write_prometheus(std::ostream &out) {
+  const metrics_snapshot snapshot = get_snapshot();
+  for (int idx = 0; idx < METRIC_COUNT; ++idx) {
+    const std::string name =
+        std::string("arsmulator_") + descriptions[idx].name + "_total";
+    out << "# HELP " << name << " " << descriptions[idx].help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " ";
+    write_value(out, snapshot, idx);
+    out << "\n";
+  }
+}
+
+void Metrics::write_json(std::ostream &out) {
+  const metrics_snapshot snapshot = get_snapshot();
+  out << "{";
+  for (int idx = 0; idx < METRIC_COUNT; ++idx) {
+    out << (idx ? ", " : "") << "\"" << descriptions[idx].name << "\": ";
+    write_value(out, snapshot, idx);
+  }
+  out << "}\n";
+}
@@ -0,0 +1,194 @@
+#include "optimizer.h"
+#include "machine.h"
+
+#include <cstdint>
+#include <vector>
+
+static bool is_unconditional(const Instruction &i) {
+  return i.get_condition_code() == condition_codes::NONE ||
+         i.get_condition_code() == condition_codes::AL;
+}
+
+// data processing instructions that write a destination register
+static bool is_data_processing(opcodes code) {
+  switch (code) {
+  case opcodes::ADC:
+  case opcodes::ADD: // intentional fall-through
+  case opcodes::AND: // intentional fall-through
+  case opcodes::BIC: // intentional fall-through
+  case opcodes::EOR: // intentional fall-through
+  case opcodes::MOV: // intentional fall-through
+  case opcodes::MVN: // intentional fall-through
+  case opcodes::ORR: // intentional fall-through
+  case opcodes::RSB: // intentional fall-through
+  case opcodes::RSC: // intentional fall-through
+  case opcodes::SBC: // intentional fall-through
+  case opcodes::SUB: // intentional fall-through
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Instructions whose only effect is writing the first register, which is
+// not the PC. They can be conditional
+static bool only_writes_destination(const Instruction &i) {
+  const opcodes code = i.get_opcode();
+  return (is_data_processing(code) || code == opcodes::MUL ||
+          code == opcodes::MLA) &&
+         !i.get_update_condition_flags() && i.get_register_count() > 0 &&
+         i.get_register(0) != PROGRAM_COUNTER_INDEX;
+}
+
+// operand registers are the ones after the destination
+static bool reads_register(const Instruction &i, uint32_t reg) {
+  for (uint8_t idx = 1; idx < i.get_register_count(); ++idx) {
+    if (i.get_register(idx) == reg) {
+      return true;
+    }
+  }
+  return i.is_shift_by_register() && i.get_shift_register() == reg;
+}
+
+// true if the instruction always writes the register without reading it
+static bool overwrites(const Instruction &i, uint32_t reg) {
+  const opcodes code = i.get_opcode();
+  return is_unconditional(i) &&
+         (is_data_processing(code) || code == opcodes::MUL ||
+          code == opcodes::MLA || code == opcodes::LDR) &&
+         i.get_suffix() != suffixes::D && i.get_register_count() > 0 &&
+         i.get_register(0) == reg && !reads_register(i, reg);
+}
+
+static bool is_plain_immediate(const Instruction &i) {
+  return !i.is_2nd_operand_register() &&
+         i.get_shift_type() == shift_types::NONE;
+}
+
+// Folds MOV rX, #a followed by an operation rX, rX, #b to one MOV. Returns
+// false if the instructions can't be folded. first and result can be the
+// same instruction
+static bool fold_immediates(const Instruction &first,
+                            const Instruction &second, Instruction &result) {
+  const opcodes code = first.get_opcode();
+  if ((code != opcodes::MOV && code != opcodes::MVN) ||
+      !only_writes_destination(first) || !is_unconditional(first) ||
+      !is_plain_immediate(first) || !is_unconditional(second) ||
+      second.get_update_condition_flags() || !is_plain_immediate(second) ||
+      second.get_register_count() != 2 ||
+      second.get_register(0) != first.get_register(0) ||
+      second.get_register(1) != first.get_register(0)) {
+    return false;
+  }
+  uint32_t value = static_cast<uint32_t>(first.get_second_operand());
+  if (code == opcodes::MVN) {
+    value = ~value;
+  }
+  const uint32_t operand = static_cast<uint32_t>(second.get_second_operand());
+  switch (second.get_opcode()) {
+  case opcodes::ADD:
+    value += operand;
+    break;
+  case opcodes::SUB:
+    value -= operand;
+    break;
+  case opcodes::RSB:
+    value = operand - value;
+    break;
+  case opcodes::AND:
+    value &= operand;
+    break;
+  case opcodes::BIC:
+    value &= ~operand;
+    break;
+  case opcodes::EOR:
+    value ^= operand;
+    break;
+  case opcodes::ORR:
+    value |= operand;
+    break;
+  default:
+    return false;
+  }
+  result = Instruction(opcodes::MOV, condition_codes::NONE, suffixes::NONE,
+                       update_modes::NONE,
+                       {static_cast<uint8_t>(first.get_register(0))}, value);
+  return true;
+}
+
+static bool is_fused_branch(fusion_types fusion) {
+  return fusion == fusion_types::COMPARE_BRANCH ||
+         fusion == fusion_types::SUBTRACT_BRANCH;
+}
+
+// CMP or SUBS followed by a B, which end most loops. Returns the
+// superinstruction of the machine that runs them, or NONE
+static fusion_types get_branch_fusion(const Instruction &first,
+                                      const Instruction &second) {
+  const opcodes code = first.get_opcode();
+  const bool register_operand = first.is_2nd_operand_register();
+  if (second.get_opcode() != opcodes::B || !is_unconditional(first) ||
+      first.get_shift_type() != shift_types::NONE ||
+      first.get_register_count() != (register_operand ? 3 : 2)) {
+    return fusion_types::NONE;
+  }
+  for (uint8_t idx = 0; idx < first.get_register_count(); ++idx) {
+    if (first.get_register(idx) == PROGRAM_COUNTER_INDEX) {
+      return fusion_types::NONE;
+    }
+  }
+  if (code == opcodes::CMP) {
+    return fusion_types::COMPARE_BRANCH;
+  }
+  if (code == opcodes::SUB && first.get_update_condition_flags()) {
+    return fusion_types::SUBTRACT_BRANCH;
+  }
+  return fusion_types::NONE;
+}
+
+std::vector<optimized_instruction>
+Optimizer::optimize(const std::vector<Instruction> &program) {
+  std::vector<optimized_instruction> result(program.size());
+  // Immediate chains are folded going forwards. Going backwards, a dropped
+  // instruction can build on the already optimized entry after it
+  for (size_t idx = program.size(); idx-- > 0;) {
+    optimized_instruction &entry = result[idx];
+    entry.original = program[idx];
+    entry.instruction = program[idx];
+    if (idx + 1 == program.size()) {
+      continue;
+    }
+    Instruction folded = program[idx];
+    size_t end = idx + 1;
+    while (end < program.size() && end - idx < UINT8_MAX &&
+           fold_immediates(folded, program[end], folded)) {
+      end++;
+    }
+    if (end > idx + 1) {
+      entry.instruction = folded;
+      entry.fusion = fusion_types::FOLDED;
+      entry.length = end - idx;
+      continue;
+    }
+
+    const optimized_instruction &next = result[idx + 1];
+    if (is_fused_branch(next.fusion) || next.length == UINT8_MAX) {
+      continue;
+    }
+    const fusion_types branch_fusion =
+        next.length == 1 ? get_branch_fusion(program[idx], program[idx + 1])
+                         : fusion_types::NONE;
+    if (only_writes_destination(program[idx]) &&
+               overwrites(next.instruction, program[idx].get_register(0))) {
+      // the result is overwritten before it's read
+      entry.instruction = next.instruction;
+      entry.fusion = fusion_types::FOLDED;
+      entry.length = next.length + 1;
+    } else if (branch_fusion != fusion_types::NONE) {
+      entry.second = program[idx + 1];
+      entry.fusion = branch_fusion;
+      entry.length = 2;
+    }
+  }
+  return result;
+}
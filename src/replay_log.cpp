@@ -0,0 +1,91 @@
+#include "replay_log.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static const char replay_file_magic[8] = {'A', 'R', 'S', 'R',
+                                          'P', 'L', '1', '\n'};
+
+void ReplayLog::add_number(uint32_t value) {
+  // seven bits at a time, the high bit tells that more follow
+  while (value >= 0x80) {
+    bytes.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  bytes.push_back(static_cast<uint8_t>(value));
+}
+
+bool ReplayLog::read_number(uint32_t &value) {
+  value = 0;
+  for (unsigned int shift = 0; shift < 35; shift += 7) {
+    if (position >= bytes.size()) {
+      return false;
+    }
+    const uint8_t byte = bytes[position++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ReplayLog::add(uint8_t operation, uint32_t result, const uint8_t *data,
+                    uint32_t size) {
+  bytes.push_back(operation);
+  add_number(result);
+  add_number(size);
+  bytes.insert(bytes.end(), data, data + size);
+  entry_count++;
+}
+
+bool ReplayLog::next(uint8_t operation, uint32_t &result,
+                     const uint8_t *&data, uint32_t &size) {
+  if (at_end() || bytes[position] != operation) {
+    return false;
+  }
+  const size_t entry_start = position++;
+  if (!read_number(result) || !read_number(size) ||
+      size > bytes.size() - position) {
+    // a truncated entry is left for the next call to fail on
+    position = entry_start;
+    return false;
+  }
+  data = bytes.data() + position;
+  position += size;
+  entry_count++;
+  return true;
+}
+
+uint64_t ReplayLog::get_entry_count() const { return entry_count; }
+
+bool ReplayLog::at_end() const { return position >= bytes.size(); }
+
+void ReplayLog::rewind() {
+  position = 0;
+  entry_count = 0;
+}
+
+bool ReplayLog::write(const std::string &file_name) const {
+  std::ofstream file(file_name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  file.write(replay_file_magic, sizeof(replay_file_magic));
+  file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  return static_cast<bool>(file);
+}
+
+bool ReplayLog::read(const std::string &file_name) {
+  std::ifstream file(file_name, std::ios::binary);
+  char magic[sizeof(replay_file_magic)];
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, replay_file_magic, sizeof(magic)) != 0) {
+    return false;
+  }
+  bytes.assign(std::istreambuf_iterator<char>(file),
+               std::istreambuf_iterator<char>());
+  rewind();
+  return true;
+}
@@ -0,0 +1,71 @@
+#include "scheduler.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+int Scheduler::add_task(Machine &m, const Cpu_state &state) {
+  tasks.push_back(task{&m, state, false});
+  return static_cast<int>(tasks.size()) - 1;
+}
+
+int Scheduler::get_task_count() const {
+  return static_cast<int>(tasks.size());
+}
+
+Cpu_state &Scheduler::get_state(int task) {
+  assert(task >= 0 && task < get_task_count());
+  return tasks[task].state;
+}
+
+bool Scheduler::is_finished(int task) const {
+  assert(task >= 0 && task < get_task_count());
+  return tasks[task].finished;
+}
+
+uint64_t Scheduler::run(std::vector<Instruction> &program,
+                        unsigned int quantum, uint64_t count) {
+  assert(quantum > 0);
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t retired = 0;
+  size_t running_count = 0;
+  for (const task &t : tasks) {
+    running_count += t.finished ? 0 : 1;
+  }
+  while (running_count > 0 && (count == 0 || retired < count)) {
+    if (turn_left == 0) {
+      while (tasks[next].finished) {
+        next = (next + 1) % tasks.size();
+      }
+      current = next;
+      next = (next + 1) % tasks.size();
+      turn_left = quantum;
+    }
+    task &t = tasks[current];
+    unsigned int turn = turn_left;
+    if (count != 0) {
+      turn = static_cast<unsigned int>(
+          std::min<uint64_t>(turn, count - retired));
+    }
+    Machine &m = *t.machine;
+    m.switch_context(&t.state);
+    m.clear_halted();
+    const uint64_t ran = Simulator::run_slice(program, m, turn);
+    m.switch_context(nullptr);
+    retired += ran;
+    turn_left -= static_cast<unsigned int>(std::min<uint64_t>(ran, turn));
+    if (m.is_halted() ||
+        t.state.registers[PROGRAM_COUNTER_INDEX] >= program.size()) {
+      t.finished = true;
+      running_count--;
+      turn_left = 0;
+    }
+  }
+  // the turns are one run in the metrics
+  for (const task &t : tasks) {
+    t.machine->flush_metrics();
+  }
+  Simulator::add_run_metrics(retired, start);
+  return retired;
+}
@@ -0,0 +1,338 @@
+#include "semihosting.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#define CONSOLE_INPUT 0
+#define CONSOLE_OUTPUT 1
+#define CONSOLE_ERROR 2
+#define OPERATION_COUNT (SYS_EXIT_EXTENDED + 1)
+#define SEMIHOSTING_ERROR 0xFFFFFFFF
+
+// fopen modes by the semihosting mode number
+static const char *const open_modes[] = {"r",  "rb",  "r+", "r+b",
+                                         "w",  "wb",  "w+", "w+b",
+                                         "a",  "ab",  "a+", "a+b"};
+
+Semihosting::Semihosting(std::ostream &out, std::istream &in)
+    : out(out), in(in), files(3, nullptr),
+      start(std::chrono::steady_clock::now()) {}
+
+Semihosting::~Semihosting() {
+  for (std::FILE *file : files) {
+    if (file) {
+      std::fclose(file);
+    }
+  }
+  out.flush();
+}
+
+void Semihosting::attach(Machine &m) {
+  m.set_swi_handler(SEMIHOSTING_SWI,
+                    [this](Machine &machine) { return call(machine); });
+}
+
+bool Semihosting::call(Machine &m) {
+  // by the operation number, nullptr for the ones that are not supported
+  static const operation operations[OPERATION_COUNT] = {
+      nullptr,                       // 0x00
+      &Semihosting::open,            // SYS_OPEN
+      &Semihosting::close,           // SYS_CLOSE
+      &Semihosting::write_character, // SYS_WRITEC
+      &Semihosting::write_string,    // SYS_WRITE0
+      &Semihosting::write,           // SYS_WRITE
+      &Semihosting::read,            // SYS_READ
+      &Semihosting::read_character,  // SYS_READC
+      nullptr, nullptr, nullptr, nullptr, // 0x08-0x0B
+      nullptr, nullptr, nullptr, nullptr, // 0x0C-0x0F
+      &Semihosting::clock,           // SYS_CLOCK
+      &Semihosting::time,            // SYS_TIME
+      nullptr, nullptr, nullptr,     // 0x12-0x14
+      nullptr, nullptr, nullptr,     // 0x15-0x17
+      &Semihosting::exit,            // SYS_EXIT
+      nullptr, nullptr, nullptr,     // 0x19-0x1B
+      nullptr, nullptr, nullptr,     // 0x1C-0x1E
+      nullptr,                       // 0x1F
+      &Semihosting::exit_extended};  // SYS_EXIT_EXTENDED
+  const uint32_t number = m.get_register_value(0).to_unsigned32();
+  const uint32_t parameter = m.get_register_value(1).to_unsigned32();
+  if (number >= OPERATION_COUNT || !operations[number]) {
+    std::cout << "Unsupported semihosting operation " << number << std::endl;
+    m.set_register_value(0, Machine_byte(SEMIHOSTING_ERROR));
+    return false;
+  }
+  uint32_t result = 0;
+  if (replay_mode == replay_modes::REPLAY && is_nondeterministic(number)) {
+    if (!replay(m, number, parameter, result)) {
+      std::cout << "Replay diverged at input " << log->get_entry_count() + 1
+                << ", operation " << number << std::endl;
+      diverged = true;
+      return true;
+    }
+  } else {
+    result = (this->*operations[number])(m, parameter);
+    if (replay_mode == replay_modes::RECORD && is_nondeterministic(number)) {
+      record(m, number, parameter, result);
+    }
+  }
+  m.set_register_value(0, Machine_byte(result));
+  return exited;
+}
+
+bool Semihosting::has_exited() const { return exited; }
+
+int Semihosting::get_exit_code() const { return exit_code; }
+
+void Semihosting::set_replay_log(ReplayLog *log, replay_modes mode) {
+  this->log = log;
+  replay_mode = log ? mode : replay_modes::NONE;
+}
+
+bool Semihosting::has_diverged() const { return diverged; }
+
+bool Semihosting::is_nondeterministic(uint32_t number) {
+  switch (number) {
+  case SYS_OPEN:
+  case SYS_CLOSE: // intentional fall-through
+  case SYS_WRITE: // intentional fall-through
+  case SYS_READ:  // intentional fall-through
+  case SYS_READC: // intentional fall-through
+  case SYS_CLOCK: // intentional fall-through
+  case SYS_TIME:  // intentional fall-through
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Semihosting::record(Machine &m, uint32_t number, uint32_t parameter,
+                         uint32_t result) {
+  uint32_t parameters[3];
+  if (number != SYS_READ || !get_parameters(m, parameter, parameters, 3) ||
+      result > parameters[2]) {
+    log->add(number, result, nullptr, 0);
+    return;
+  }
+  // the result is the number of bytes that were not read
+  const uint32_t size = parameters[2] - result;
+  const uint8_t *data = m.get_guest_bytes(parameters[1], size, false);
+  log->add(number, result, data, data ? size : 0);
+}
+
+bool Semihosting::replay(Machine &m, uint32_t number, uint32_t parameter,
+                         uint32_t &result) {
+  const uint8_t *data = nullptr;
+  uint32_t size = 0;
+  if (!log->next(number, result, data, size)) {
+    return false;
+  }
+  uint32_t parameters[3];
+  if (number == SYS_READ && size > 0 &&
+      get_parameters(m, parameter, parameters, 3)) {
+    uint8_t *buffer = m.get_guest_bytes(parameters[1], size, true);
+    if (buffer) {
+      std::memcpy(buffer, data, size);
+    }
+  } else if (number == SYS_WRITE &&
+             get_parameters(m, parameter, parameters, 3) &&
+             (parameters[0] == CONSOLE_OUTPUT ||
+              parameters[0] == CONSOLE_ERROR)) {
+    // the output is the same, and only files are left alone
+    write(m, parameter);
+  }
+  return true;
+}
+
+bool Semihosting::get_parameters(Machine &m, uint32_t address,
+                                 uint32_t *parameters, uint32_t count) {
+  const uint8_t *block =
+      m.get_guest_bytes(address, count * sizeof(uint32_t), false);
+  if (!block) {
+    return false;
+  }
+  std::memcpy(parameters, block, count * sizeof(uint32_t));
+  return true;
+}
+
+// {name, mode, name length}
+uint32_t Semihosting::open(Machine &m, uint32_t parameter) {
+  uint32_t parameters[3];
+  if (!get_parameters(m, parameter, parameters, 3) ||
+      parameters[1] >= sizeof(open_modes) / sizeof(open_modes[0])) {
+    return SEMIHOSTING_ERROR;
+  }
+  const uint8_t *name = m.get_guest_bytes(parameters[0], parameters[2], false);
+  if (!name) {
+    return SEMIHOSTING_ERROR;
+  }
+  const std::string file_name(reinterpret_cast<const char *>(name),
+                              parameters[2]);
+  if (file_name == ":tt") {
+    // read, write and append modes
+    return parameters[1] < 4   ? CONSOLE_INPUT
+           : parameters[1] < 8 ? CONSOLE_OUTPUT
+                               : CONSOLE_ERROR;
+  }
+  std::FILE *file = std::fopen(file_name.c_str(), open_modes[parameters[1]]);
+  if (!file) {
+    return SEMIHOSTING_ERROR;
+  }
+  files.push_back(file);
+  return files.size() - 1;
+}
+
+// {handle}
+uint32_t Semihosting::close(Machine &m, uint32_t parameter) {
+  uint32_t handle;
+  if (!get_parameters(m, parameter, &handle, 1) || handle >= files.size()) {
+    return SEMIHOSTING_ERROR;
+  }
+  if (handle > CONSOLE_ERROR) {
+    if (!files[handle]) {
+      return SEMIHOSTING_ERROR;
+    }
+    std::fclose(files[handle]);
+    files[handle] = nullptr;
+  }
+  return 0;
+}
+
+// the character is the lowest byte of the word at the address
+uint32_t Semihosting::write_character(Machine &m, uint32_t parameter) {
+  const uint8_t *character = m.get_guest_bytes(parameter, 1, false);
+  if (character) {
+    out.put(static_cast<char>(*character));
+  }
+  return 0;
+}
+
+uint32_t Semihosting::write_string(Machine &m, uint32_t parameter) {
+  // the string ends at the end of memory at the latest
+  const uint64_t memory_bytes = static_cast<uint64_t>(m.get_memory_size()) * 4;
+  const uint64_t start_byte = m.has_byte_addresses()
+                                  ? parameter
+                                  : static_cast<uint64_t>(parameter) * 4;
+  const uint32_t available =
+      start_byte < memory_bytes
+          ? std::min<uint64_t>(memory_bytes - start_byte, UINT32_MAX)
+          : 0;
+  const uint8_t *text = m.get_guest_bytes(parameter, available, false);
+  if (text) {
+    const void *end = std::memchr(text, 0, available);
+    out.write(reinterpret_cast<const char *>(text),
+              end ? static_cast<const uint8_t *>(end) - text : available);
+  }
+  return 0;
+}
+
+// {handle, buffer, length}, returns the number of bytes not written
+uint32_t Semihosting::write(Machine &m, uint32_t parameter) {
+  uint32_t parameters[3];
+  if (!get_parameters(m, parameter, parameters, 3) ||
+      parameters[0] >= files.size()) {
+    return SEMIHOSTING_ERROR;
+  }
+  const uint32_t length = parameters[2];
+  const uint8_t *buffer = m.get_guest_bytes(parameters[1], length, false);
+  if (!buffer) {
+    return length;
+  }
+  const char *bytes = reinterpret_cast<const char *>(buffer);
+  switch (parameters[0]) {
+  case CONSOLE_INPUT:
+    return length;
+  case CONSOLE_OUTPUT:
+    out.write(bytes, length);
+    return out ? 0 : length;
+  case CONSOLE_ERROR:
+    std::cerr.write(bytes, length);
+    return 0;
+  default:
+    if (!files[parameters[0]]) {
+      return length;
+    }
+    return length - std::fwrite(bytes, 1, length, files[parameters[0]]);
+  }
+}
+
+// {handle, buffer, length}, returns the number of bytes not read
+uint32_t Semihosting::read(Machine &m, uint32_t parameter) {
+  uint32_t parameters[3];
+  if (!get_parameters(m, parameter, parameters, 3) ||
+      parameters[0] >= files.size()) {
+    return SEMIHOSTING_ERROR;
+  }
+  const uint32_t length = parameters[2];
+  uint8_t *buffer = m.get_guest_bytes(parameters[1], length, true);
+  if (!buffer) {
+    return length;
+  }
+  char *bytes = reinterpret_cast<char *>(buffer);
+  switch (parameters[0]) {
+  case CONSOLE_INPUT: {
+    // the prompt is shown before waiting, and a read ends with the line
+    out.flush();
+    uint32_t count = 0;
+    char character;
+    while (count < length && in.get(character)) {
+      bytes[count++] = character;
+      if (character == '\n') {
+        break;
+      }
+    }
+    return length - count;
+  }
+  case CONSOLE_OUTPUT:
+  case CONSOLE_ERROR: // intentional fall-through
+    return length;
+  default:
+    if (!files[parameters[0]]) {
+      return length;
+    }
+    return length - std::fread(bytes, 1, length, files[parameters[0]]);
+  }
+}
+
+uint32_t Semihosting::read_character(Machine &, uint32_t) {
+  out.flush();
+  char character;
+  return in.get(character) ? static_cast<uint8_t>(character)
+                           : SEMIHOSTING_ERROR;
+}
+
+// centiseconds since the start
+uint32_t Semihosting::clock(Machine &, uint32_t) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         10;
+}
+
+uint32_t Semihosting::time(Machine &, uint32_t) {
+  return static_cast<uint32_t>(std::time(nullptr));
+}
+
+// the parameter is the reason
+uint32_t Semihosting::exit(Machine &, uint32_t parameter) {
+  exited = true;
+  exit_code = parameter == ADP_STOPPED_APPLICATION_EXIT ? 0 : 1;
+  out.flush();
+  return 0;
+}
+
+// {reason, exit status}
+uint32_t Semihosting::exit_extended(Machine &m, uint32_t parameter) {
+  uint32_t parameters[2];
+  exited = true;
+  if (!get_parameters(m, parameter, parameters, 2)) {
+    exit_code = 1;
+  } else {
+    exit_code = parameters[0] == ADP_STOPPED_APPLICATION_EXIT
+                    ? static_cast<int>(parameters[1])
+                    : 1;
+  }
+  out.flush();
+  return 0;
+}
@@ -1,28 +1,218 @@
 #include "simulator.h"
+#include "arm_codec.h"
+#include "coverage.h"
+#include "event_queue.h"
 #include "instruction.h"
 #include "machine.h"
+#include "metrics.h"
 
+#include <chrono>
 #include <iostream>
 #include <vector>
 
-void Simulator::run_program(std::vector<Instruction> &program, Machine &m,
-                            unsigned int count) {
-  bool cont = true;
-  bool stop_after_count_instructions = (count != 0);
-  while (cont) {
-    unsigned int instruction_address =
-        m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32();
-    if (instruction_address >= program.size()) {
+// Flushes the counts of the machine, adds the run to the metrics and tells
+// that the program halted
+static void record_run(Machine &m, uint64_t retired,
+                       std::chrono::steady_clock::time_point start) {
+  m.flush_metrics();
+  Simulator::add_run_metrics(retired, start);
+  std::cout << "Program halted!" << std::endl;
+}
+
+void Simulator::add_run_metrics(uint64_t retired,
+                                std::chrono::steady_clock::time_point start) {
+  metrics_snapshot run;
+  run.values[static_cast<int>(metrics::INSTRUCTIONS_RETIRED)] = retired;
+  run.values[static_cast<int>(metrics::RUNS)] = 1;
+  run.values[static_cast<int>(metrics::RUN_NANOSECONDS)] =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count();
+  Metrics::add(run);
+}
+
+// the event deadline of runs on machines without events
+static const uint64_t no_event_deadline = UINT64_MAX;
+
+// Runs the instruction at the address, and records it when the machine has
+// coverage on. Coverage only costs the check when it's off, and the machine
+// records the skipped instructions itself
+static inline bool execute(Machine &m, const Instruction &i,
+                           uint32_t address) {
+  Coverage *coverage = m.get_coverage();
+  if (!coverage) {
+    return m.execute(i);
+  }
+  coverage->add_hit(address);
+  const bool halt = m.execute(i);
+  const uint32_t next = m.get_state().registers[PROGRAM_COUNTER_INDEX];
+  if (next != address + 1) {
+    coverage->add_edge(address, next);
+  }
+  return halt;
+}
+
+// The loop of every run. step(address, left, halted) runs the instructions
+// at the address, no more than left of them when left isn't 0, and sets
+// halted when they halt the machine. It returns how many original
+// instructions ran, or 0 when there is no instruction at the address. The
+// returned count includes the instructions SWI handlers ran in place of
+// guest code
+template <typename Step>
+static uint64_t run_loop(Machine &m, unsigned int count, Step step) {
+  uint64_t retired = 0;
+  bool halted = false;
+  // events only cost a compare of the retired count with their deadline
+  EventQueue *events = m.get_event_queue();
+  const uint64_t *event_deadline = &no_event_deadline;
+  if (events) {
+    events->begin_run(&retired);
+    event_deadline = events->get_run_deadline();
+  }
+  while (!halted) {
+    // interrupts are taken between instructions, from a raised line that
+    // the CPSR doesn't mask
+    if (m.is_interrupt_pending()) {
+      m.take_interrupt();
+    }
+    const unsigned int executed = step(
+        m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32(), count,
+        halted);
+    if (executed == 0) {
       break;
     }
-    Instruction i = program[instruction_address];
-    cont = !m.execute(i);
-    if (stop_after_count_instructions) {
-      count--;
+    retired += executed;
+    if (retired >= *event_deadline) {
+      events->advance(events->get_time());
+    }
+    if (count != 0) {
+      count -= executed;
       if (count == 0) {
-        cont = false;
+        break;
       }
     }
   }
-  std::cout << "Program halted!" << std::endl;
+  // the time of the events includes the instructions SWI handlers ran
+  retired += m.take_retired_instructions();
+  if (events) {
+    events->end_run();
+  }
+  return retired;
+}
+
+uint64_t Simulator::run_program(std::vector<Instruction> &program,
+                                Machine &m, unsigned int count) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t retired = run_slice(program, m, count);
+  record_run(m, retired, start);
+  return retired;
+}
+
+uint64_t Simulator::run_slice(std::vector<Instruction> &program, Machine &m,
+                              unsigned int count) {
+  return run_loop(m, count,
+                  [&](uint32_t address, unsigned int, bool &halted) {
+                    if (address >= program.size()) {
+                      return 0u;
+                    }
+                    halted = execute(m, program[address], address);
+                    return 1u;
+                  });
+}
+
+uint64_t
+Simulator::run_program(const std::vector<optimized_instruction> &program,
+                       Machine &m, unsigned int count) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t retired = run_slice(program, m, count);
+  record_run(m, retired, start);
+  return retired;
+}
+
+uint64_t
+Simulator::run_slice(const std::vector<optimized_instruction> &program,
+                     Machine &m, unsigned int count) {
+  return run_loop(
+      m, count, [&](uint32_t address, unsigned int left, bool &halted) {
+        if (address >= program.size()) {
+          return 0u;
+        }
+        const optimized_instruction &entry = program[address];
+        // coverage is recorded for the original instructions
+        if ((left != 0 && left < entry.length) || m.get_coverage()) {
+          halted = execute(m, entry.original, address);
+          return 1u;
+        }
+        switch (entry.fusion) {
+        case fusion_types::COMPARE_BRANCH:
+          m.execute_compare_and_branch(entry.instruction, entry.second);
+          break;
+        case fusion_types::SUBTRACT_BRANCH:
+          m.execute_subtract_and_branch(entry.instruction, entry.second);
+          break;
+        default:
+          if (entry.length > 1) {
+            // a folded instruction sees the PC of the last instruction it
+            // replaces
+            m.set_register_value(PROGRAM_COUNTER_INDEX,
+                                 Machine_byte(address + entry.length - 1));
+          }
+          halted = m.execute(entry.instruction);
+          break;
+        }
+        return static_cast<unsigned int>(entry.length);
+      });
+}
+
+bool Simulator::load_program(const std::vector<Instruction> &program,
+                             Machine &m) {
+  if (program.size() > static_cast<size_t>(m.get_memory_size())) {
+    std::cout << "Program does not fit in memory" << std::endl;
+    return false;
+  }
+  for (uint32_t address = 0; address < program.size(); ++address) {
+    uint32_t word;
+    if (!ArmCodec::encode(program[address], address, word)) {
+      std::cout << "Instruction " << address << " can't be encoded"
+                << std::endl;
+      return false;
+    }
+    m.set_memory(address, Machine_byte(word));
+  }
+  return true;
+}
+
+bool Simulator::load_data(const std::vector<uint32_t> &data, uint32_t address,
+                          Machine &m) {
+  if (static_cast<uint64_t>(address) + data.size() >
+      static_cast<uint64_t>(m.get_memory_size())) {
+    std::cout << "Program data does not fit in memory" << std::endl;
+    return false;
+  }
+  if (!data.empty()) {
+    m.load_memory(address, data.data(), data.size());
+  }
+  return true;
+}
+
+uint64_t Simulator::run_from_memory(Machine &m, unsigned int count) {
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t retired = run_slice_from_memory(m, count);
+  record_run(m, retired, start);
+  return retired;
+}
+
+uint64_t Simulator::run_slice_from_memory(Machine &m, unsigned int count) {
+  return run_loop(m, count, [&](uint32_t address, unsigned int, bool &halted) {
+    if (address >= static_cast<uint32_t>(m.get_memory_size())) {
+      return 0u;
+    }
+    const Instruction *i = m.fetch_instruction(address);
+    if (!i) {
+      std::cout << "Invalid instruction at address " << address << std::endl;
+      return 0u;
+    }
+    halted = execute(m, *i, address);
+    return 1u;
+  });
 }
@@ -0,0 +1,93 @@
+#include "smp.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+Smp::Smp(int core_count, int mem_size) {
+  assert(core_count > 0);
+  cores.emplace_back(new Machine(mem_size));
+  for (int number = 1; number < core_count; ++number) {
+    cores.emplace_back(new Machine(cores[0].get()));
+    cores.back()->set_register_value(0, Machine_byte(number));
+  }
+}
+
+// Flushes the counts of the cores and adds what they ran to the metrics as
+// one run
+static void record_run(std::vector<std::unique_ptr<Machine>> &cores,
+                       const std::vector<uint64_t> &retired,
+                       std::chrono::steady_clock::time_point start) {
+  uint64_t total = 0;
+  for (size_t number = 0; number < cores.size(); ++number) {
+    cores[number]->flush_metrics();
+    total += retired[number];
+  }
+  Simulator::add_run_metrics(total, start);
+}
+
+int Smp::get_core_count() const { return static_cast<int>(cores.size()); }
+
+Machine &Smp::get_core(int number) {
+  assert(number >= 0 && number < get_core_count());
+  return *cores[number];
+}
+
+std::vector<uint64_t> Smp::run(std::vector<Instruction> &program,
+                               unsigned int count) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<uint64_t> retired(cores.size());
+  std::vector<std::thread> threads;
+  // the calling thread runs core 0, and the cores are recorded after they
+  // all halt, so the threads don't write to the metrics or the output
+  for (size_t number = 1; number < cores.size(); ++number) {
+    threads.emplace_back([this, &program, &retired, number, count]() {
+      retired[number] = Simulator::run_slice(program, *cores[number], count);
+    });
+  }
+  retired[0] = Simulator::run_slice(program, *cores[0], count);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  record_run(cores, retired, start);
+  return retired;
+}
+
+std::vector<uint64_t>
+Smp::run_deterministic(std::vector<Instruction> &program, unsigned int quantum,
+                       unsigned int count) {
+  assert(quantum > 0);
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<uint64_t> retired(cores.size());
+  std::vector<bool> running(cores.size(), true);
+  size_t running_count = cores.size();
+  // halted cores continue after the instruction that halted them
+  for (auto &core : cores) {
+    core->clear_halted();
+  }
+  while (running_count > 0) {
+    for (size_t number = 0; number < cores.size(); ++number) {
+      if (!running[number]) {
+        continue;
+      }
+      Machine &core = *cores[number];
+      unsigned int turn = quantum;
+      if (count != 0) {
+        turn = static_cast<unsigned int>(
+            std::min<uint64_t>(quantum, count - retired[number]));
+      }
+      retired[number] += Simulator::run_slice(program, core, turn);
+      const uint32_t next =
+          core.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32();
+      if (core.is_halted() || next >= program.size() ||
+          (count != 0 && retired[number] >= count)) {
+        running[number] = false;
+        running_count--;
+      }
+    }
+  }
+  record_run(cores, retired, start);
+  return retired;
+}
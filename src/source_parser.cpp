@@ -1,20 +1,33 @@
 #include "source_parser.h"
+#include "arm_codec.h"
+#include "machine.h"
 
-#include <cassert>
+#include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <map>
 
+// in words, far more than any memory the machine can have
+#define MAX_SPACE_SIZE (1 << 24)
+
 std::map<std::string, opcodes> opcode_table{
-    {"ADC", opcodes::ADC}, {"ADD", opcodes::ADD}, {"AND", opcodes::AND},
-    {"B", opcodes::B},     {"BIC", opcodes::BIC}, {"BL", opcodes::BL},
-    {"CMN", opcodes::CMN}, {"CMP", opcodes::CMP}, {"EOR", opcodes::EOR},
-    {"LDM", opcodes::LDM}, {"LDR", opcodes::LDR}, {"MOV", opcodes::MOV},
-    {"MVN", opcodes::MVN}, {"ORR", opcodes::ORR}, {"RSB", opcodes::RSB},
-    {"RSC", opcodes::RSC}, {"SBC", opcodes::SBC}, {"STM", opcodes::STM},
-    {"STR", opcodes::STR}, {"SUB", opcodes::SUB}, {"SWI", opcodes::SWI},
-    {"TEQ", opcodes::TEQ}, {"TST", opcodes::TST}};
+    {"ADC", opcodes::ADC},     {"ADD", opcodes::ADD},
+    {"AND", opcodes::AND},     {"B", opcodes::B},
+    {"BIC", opcodes::BIC},     {"BL", opcodes::BL},
+    {"CMN", opcodes::CMN},     {"CMP", opcodes::CMP},
+    {"EOR", opcodes::EOR},     {"LDM", opcodes::LDM},
+    {"LDR", opcodes::LDR},     {"MLA", opcodes::MLA},
+    {"MOV", opcodes::MOV},     {"MUL", opcodes::MUL},
+    {"MVN", opcodes::MVN},     {"ORR", opcodes::ORR},
+    {"RSB", opcodes::RSB},     {"RSC", opcodes::RSC},
+    {"SBC", opcodes::SBC},     {"SMLAL", opcodes::SMLAL},
+    {"SMULL", opcodes::SMULL}, {"STM", opcodes::STM},
+    {"STR", opcodes::STR},     {"SUB", opcodes::SUB},
+    {"SWI", opcodes::SWI},     {"TEQ", opcodes::TEQ},
+    {"TST", opcodes::TST},     {"UMLAL", opcodes::UMLAL},
+    {"UMULL", opcodes::UMULL}};
 
 std::map<std::string, condition_codes> condition_code_table{
     {"AL", condition_codes::AL}, {"EQ", condition_codes::EQ},
@@ -31,44 +44,494 @@ std::map<std::string, update_modes> update_mode_table{{"IA", update_modes::IA},
                                                       {"DA", update_modes::DA},
                                                       {"DB", update_modes::DB}};
 
+// Stack addressing modes mean different update modes for loads and stores,
+// the first one is for LDM
+std::map<std::string, std::pair<update_modes, update_modes>> stack_mode_table{
+    {"FD", {update_modes::IA, update_modes::DB}},
+    {"ED", {update_modes::IB, update_modes::DA}},
+    {"FA", {update_modes::DA, update_modes::IB}},
+    {"EA", {update_modes::DB, update_modes::IA}}};
+
+// PUSH and POP are multiple transfers with the stack pointer as base
+std::map<std::string, std::pair<opcodes, update_modes>> stack_alias_table{
+    {"PUSH", {opcodes::STM, update_modes::DB}},
+    {"POP", {opcodes::LDM, update_modes::IA}}};
+
+std::map<std::string, std::string> register_alias_table{
+    {"sp", "r13"}, {"lr", "r14"}, {"pc", "r15"}};
+
 std::map<std::string, suffixes> suffix_table{
     {"S", suffixes::S}, {"B", suffixes::B},   {"SH", suffixes::SH},
     {"H", suffixes::H}, {"SB", suffixes::SB}, {"D", suffixes::D}};
 
+std::map<std::string, shift_types> shift_table{{"LSL", shift_types::LSL},
+                                               {"LSR", shift_types::LSR},
+                                               {"ASR", shift_types::ASR},
+                                               {"ROR", shift_types::ROR},
+                                               {"RRX", shift_types::RRX}};
+
 std::vector<Instruction> SourceCodeParser::parse(std::string file_name) {
-  std::ifstream asm_file_in;
+  std::ifstream asm_file_in(file_name);
+  if (!asm_file_in) {
+    error_count = 1;
+    std::cout << "Can't open " << file_name << std::endl;
+    return {};
+  }
+  return parse(asm_file_in);
+}
+
+std::vector<Instruction> SourceCodeParser::parse(std::istream &source) {
   std::string instruction_line;
 
-  asm_file_in.open(file_name);
+  symbol_address_table.clear();
+  data_symbol_table.clear();
+  pending_labels.clear();
+  unsolved_labels.clear();
+  unsolved_data_labels.clear();
+  unsolved_relative_labels.clear();
+  literals.clear();
+  literal_loads.clear();
+  data.clear();
+  data_alignment = 1;
+  line_number = 0;
+  source_line_number = 0;
+  error_count = 0;
+  source_lines.clear();
+
   std::vector<Instruction> parsed_program;
-  while (asm_file_in) {
-    getline(asm_file_in, instruction_line);
+  while (getline(source, instruction_line)) {
+    source_line_number++;
+    // files written on Windows end lines with \r\n
+    if (!instruction_line.empty() && instruction_line.back() == '\r') {
+      instruction_line.pop_back();
+    }
     Instruction read_instruction;
     std::pair<std::string, unsigned int> unsolved_label_info;
     const bool is_new_instruction =
         parse_line(instruction_line, read_instruction, unsolved_label_info);
     if (is_new_instruction) {
       parsed_program.push_back(read_instruction);
+      source_lines.push_back(source_line_number);
     }
     if (!unsolved_label_info.first.empty()) {
       unsolved_labels.push_back(unsolved_label_info);
     }
   }
-  asm_file_in.close();
+
+  // data is placed after the code, aligned to the largest .align
+  data_address = (parsed_program.size() + data_alignment - 1) /
+                 data_alignment * data_alignment;
+  for (const auto &symbol : data_symbol_table) {
+    symbol_address_table[symbol.first] = data_address + symbol.second;
+  }
 
   for (auto label_info : unsolved_labels) {
-    auto it = symbol_address_table.find(label_info.first);
-    assert(it != symbol_address_table.end());
+    parsed_program[label_info.second].set_second_operand(
+        find_symbol(label_info.first));
+  }
+  for (auto label_info : unsolved_data_labels) {
+    data[label_info.second] = find_symbol(label_info.first);
+  }
+  for (auto label_info : unsolved_relative_labels) {
+    Instruction &adr = parsed_program[label_info.second];
+    const int64_t offset = static_cast<int64_t>(find_symbol(label_info.first)) -
+                           (label_info.second + 1);
+    adr.set_opcode(offset < 0 ? opcodes::SUB : opcodes::ADD);
+    adr.set_second_operand(offset < 0 ? -offset : offset);
+  }
 
-    parsed_program[label_info.second].append_to_registers(it->second);
+  // the literal pool is the end of the data image
+  const uint32_t literal_pool_address = data_address + data.size();
+  for (const auto &literal : literals) {
+    data.push_back(literal.first.empty() ? literal.second
+                                         : find_symbol(literal.first));
+  }
+  for (const auto &load : literal_loads) {
+    parsed_program[load.first].set_second_operand(
+        literal_pool_address + load.second - (load.first + 1));
   }
 
   return parsed_program;
 }
 
-static std::string remove_leading_spaces(std::string const &line) {
-  const auto first_non_whitespace = line.find_first_not_of(' ');
-  return line.substr(first_non_whitespace, line.size() - first_non_whitespace);
+const std::vector<uint32_t> &SourceCodeParser::get_data() const {
+  return data;
+}
+
+uint32_t SourceCodeParser::get_data_address() const { return data_address; }
+
+unsigned int SourceCodeParser::get_error_count() const { return error_count; }
+
+const std::vector<unsigned int> &SourceCodeParser::get_source_lines() const {
+  return source_lines;
+}
+
+unsigned int SourceCodeParser::find_symbol(const std::string &label) {
+  auto it = symbol_address_table.find(label);
+  if (it == symbol_address_table.end()) {
+    // labels are solved after the whole file is read, so there's no line
+    error_count++;
+    std::cout << "Undefined label: " << label << std::endl;
+    return 0;
+  }
+  return it->second;
+}
+
+// Errors only build their message here, so valid lines don't pay for it
+void SourceCodeParser::report_error(const char *message,
+                                    const std::string &text) {
+  error_count++;
+  std::cout << "Line " << source_line_number << ": " << message << text
+            << std::endl;
+}
+
+static bool is_identifier_character(char c) {
+  return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Replaces sp, lr and pc with register numbers when they are whole words
+static void replace_register_aliases(std::string &line) {
+  for (const auto &alias : register_alias_table) {
+    auto pos = line.find(alias.first);
+    while (pos != std::string::npos) {
+      const auto end = pos + alias.first.size();
+      if ((pos == 0 || !is_identifier_character(line[pos - 1])) &&
+          (end == line.size() || !is_identifier_character(line[end]))) {
+        line.replace(pos, alias.first.size(), alias.second);
+      }
+      pos = line.find(alias.first, pos + 1);
+    }
+  }
+}
+
+// true if only spaces follow the number that ends at end, so r1x and #12abc
+// aren't taken for r1 and #12
+static bool is_end_of_number(const char *end) {
+  while (*end == ' ' || *end == '\t') {
+    end++;
+  }
+  return *end == '\0';
+}
+
+// Parses a register name like r12, ignoring leading and trailing spaces
+static bool parse_register_name(const std::string &text, uint8_t &reg) {
+  const auto pos = text.find_first_not_of(' ');
+  if (pos == std::string::npos || text[pos] != 'r' || pos + 1 >= text.size() ||
+      !isdigit(static_cast<unsigned char>(text[pos + 1]))) {
+    return false;
+  }
+  char *end = nullptr;
+  const long value = std::strtol(text.c_str() + pos + 1, &end, 10);
+  if (value > 15 || !is_end_of_number(end)) {
+    return false;
+  }
+  reg = static_cast<uint8_t>(value);
+  return true;
+}
+
+// Parses a signed decimal or hexadecimal (0x) immediate without the #,
+// ignoring trailing spaces
+static bool parse_immediate(const std::string &text, int64_t &value) {
+  const char *start = text.c_str();
+  const bool negative = *start == '-';
+  if (negative || *start == '+') {
+    start++;
+  }
+  const bool hexadecimal =
+      start[0] == '0' && (start[1] == 'x' || start[1] == 'X');
+  char *end = nullptr;
+  value = std::strtoll(hexadecimal ? start + 2 : start, &end,
+                       hexadecimal ? 16 : 10);
+  if (end == start || (hexadecimal && end == start + 2) ||
+      !is_end_of_number(end)) {
+    return false;
+  }
+  if (negative) {
+    value = -value;
+  }
+  return true;
+}
+
+bool SourceCodeParser::parse_address(std::string &line, Instruction &result,
+                                     std::vector<uint8_t> &register_list) {
+  const auto open_pos = line.find('[');
+  const auto close_pos = line.find(']', open_pos);
+  if (close_pos == std::string::npos) {
+    report_error("Missing ] in: ", line);
+    return false;
+  }
+  std::string base = line.substr(open_pos + 1, close_pos - open_pos - 1);
+  // a missing comment leaves the rest of the line, as substr limits the count
+  const std::string after_base =
+      line.substr(close_pos + 1, line.find(';', close_pos) - close_pos - 1);
+
+  uint8_t reg = 0;
+  if (!parse_register_name(
+          line.substr(0, std::min(open_pos, line.find(','))), reg)) {
+    report_error("Missing destination register in: ", line);
+    return false;
+  }
+  register_list.push_back(reg);
+
+  // [Rn, offset]{!} is pre-indexed and [Rn], offset is post-indexed
+  std::string offset;
+  const auto comma_pos = base.find(',');
+  if (comma_pos != std::string::npos) {
+    offset = base.substr(comma_pos + 1);
+    base = base.substr(0, comma_pos);
+    result.set_writeback(after_base.find('!') != std::string::npos);
+  } else if (after_base.find(',') != std::string::npos) {
+    offset = after_base.substr(after_base.find(',') + 1);
+    result.set_post_indexed(true);
+  }
+  if (!parse_register_name(base, reg)) {
+    report_error("Missing base register in: ", line);
+    return false;
+  }
+  register_list.push_back(reg);
+
+  parse_shift(offset, result);
+  const auto offset_pos = offset.find_first_not_of(' ');
+  if (offset_pos == std::string::npos) {
+    result.set_second_operand(0);
+    return true;
+  }
+  if (offset[offset_pos] == '#') {
+    int64_t value = 0;
+    if (!parse_immediate(offset.substr(offset_pos + 1), value)) {
+      report_error("Invalid offset in: ", line);
+      return false;
+    }
+    result.set_second_operand(value);
+    return true;
+  }
+  const bool subtracted = offset[offset_pos] == '-';
+  if (subtracted || offset[offset_pos] == '+') {
+    offset = offset.substr(offset_pos + 1);
+  }
+  if (!parse_register_name(offset, reg)) {
+    report_error("Invalid offset in: ", line);
+    return false;
+  }
+  register_list.push_back(reg);
+  result.set_is_2nd_operand_register(true);
+  result.set_offset_subtracted(subtracted);
+  return true;
+}
+
+bool SourceCodeParser::parse_pc_relative(std::string &line,
+                                         Instruction &result,
+                                         std::vector<uint8_t> &register_list) {
+  const bool is_literal = result.get_opcode() == opcodes::LDR;
+  const auto operand_pos = line.find(is_literal ? '=' : ',');
+  uint8_t reg = 0;
+  if (!parse_register_name(line.substr(0, line.find(',')), reg) ||
+      operand_pos == std::string::npos) {
+    report_error("Missing operand in: ", line);
+    return false;
+  }
+  register_list.push_back(reg);
+  std::string operand = line.substr(operand_pos + 1);
+  operand = operand.substr(0, operand.find_first_of(";@"));
+  const auto start = operand.find_first_not_of(" \t");
+  if (start == std::string::npos) {
+    report_error("Missing operand in: ", line);
+    return false;
+  }
+  operand = operand.substr(start, operand.find_first_of(" \t", start) - start);
+
+  if (!is_literal) {
+    // the label can be on either side, so the offset is solved at the end
+    register_list.push_back(PROGRAM_COUNTER_INDEX);
+    unsolved_relative_labels.push_back(std::make_pair(operand, line_number));
+    return true;
+  }
+
+  int64_t value = 0;
+  std::pair<std::string, uint32_t> literal("", 0);
+  if (parse_immediate(operand, value)) {
+    uint32_t encoded;
+    if (ArmCodec::encode_immediate(static_cast<uint32_t>(value), encoded)) {
+      result.set_opcode(opcodes::MOV);
+      result.set_second_operand(static_cast<uint32_t>(value));
+      return true;
+    }
+    if (ArmCodec::encode_immediate(~static_cast<uint32_t>(value), encoded)) {
+      result.set_opcode(opcodes::MVN);
+      result.set_second_operand(~static_cast<uint32_t>(value));
+      return true;
+    }
+    literal.second = static_cast<uint32_t>(value);
+  } else {
+    literal.first = operand;
+  }
+  // loads of the same value share a literal
+  const auto found = std::find(literals.begin(), literals.end(), literal);
+  literal_loads.push_back(
+      std::make_pair(line_number, found - literals.begin()));
+  if (found == literals.end()) {
+    literals.push_back(literal);
+  }
+  register_list.push_back(PROGRAM_COUNTER_INDEX);
+  return true;
+}
+
+void SourceCodeParser::parse_shift(std::string &line, Instruction &result) {
+  // the shift is the last operand, so it's the only one after a comma that
+  // begins with a shift name
+  auto comma_pos = line.find(',');
+  while (comma_pos != std::string::npos) {
+    const auto name_pos = line.find_first_not_of(' ', comma_pos + 1);
+    if (name_pos == std::string::npos) {
+      return;
+    }
+    auto found_shift = shift_table.find(line.substr(name_pos, 3));
+    if (found_shift != shift_table.end()) {
+      std::string shift_operand = line.substr(name_pos + 3);
+      line = line.substr(0, comma_pos);
+      const auto operand_pos = shift_operand.find_first_not_of(' ');
+      int64_t amount = 0;
+      uint8_t reg = 0;
+      if (found_shift->second == shift_types::RRX) {
+        result.set_shift(shift_types::RRX, 0);
+      } else if (operand_pos != std::string::npos &&
+                 shift_operand[operand_pos] == '#') {
+        // LSR #32 and ASR #32 are the largest shifts that can be encoded
+        if (!parse_immediate(shift_operand.substr(operand_pos + 1), amount) ||
+            amount < 0 || amount > 32) {
+          report_error("Invalid shift amount in: ", shift_operand);
+        } else {
+          result.set_shift(found_shift->second, amount);
+        }
+      } else if (parse_register_name(shift_operand, reg)) {
+        result.set_shift_by_register(found_shift->second, reg);
+      } else {
+        report_error("Missing shift amount in: ", shift_operand);
+      }
+      return;
+    }
+    comma_pos = line.find(',', comma_pos + 1);
+  }
+}
+
+void SourceCodeParser::add_data(uint32_t value) {
+  // the labels before the first value are data labels
+  for (const auto &label : pending_labels) {
+    symbol_address_table.erase(label);
+    data_symbol_table[label] = data.size();
+  }
+  pending_labels.clear();
+  data.push_back(value);
+}
+
+// Parses a quoted string with C escapes. Returns false if the closing quote
+// is missing
+static bool parse_string(const std::string &text, std::string &value) {
+  auto pos = text.find('"');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  value.clear();
+  for (++pos; pos < text.size(); ++pos) {
+    char c = text[pos];
+    if (c == '"') {
+      return true;
+    }
+    if (c == '\\' && pos + 1 < text.size()) {
+      c = text[++pos];
+      switch (c) {
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case '0':
+        c = '\0';
+        break;
+      default: // \\ and \" are the character itself
+        break;
+      }
+    }
+    value.push_back(c);
+  }
+  return false;
+}
+
+void SourceCodeParser::parse_directive(std::string &line) {
+  const auto name_end = line.find_first_of(" \t");
+  const std::string name = line.substr(0, name_end);
+  std::string arguments =
+      name_end == std::string::npos ? "" : line.substr(name_end);
+
+  if (name == ".ascii" || name == ".asciz") {
+    std::string text;
+    if (!parse_string(arguments, text)) {
+      report_error("Invalid string in: ", line);
+      return;
+    }
+    // memory is word addressed, so every character takes a word
+    for (char c : text) {
+      add_data(static_cast<uint8_t>(c));
+    }
+    if (name == ".asciz") {
+      add_data(0);
+    }
+    return;
+  }
+
+  arguments = arguments.substr(0, arguments.find_first_of(";@"));
+  std::vector<std::string> values;
+  auto pos = arguments.find_first_not_of(" \t,");
+  while (pos != std::string::npos) {
+    const auto end = arguments.find_first_of(" \t,", pos);
+    values.push_back(arguments.substr(
+        pos, end == std::string::npos ? end : end - pos));
+    pos = arguments.find_first_not_of(" \t,", end);
+  }
+
+  int64_t value = 0;
+  if (name == ".word" || name == ".byte") {
+    for (const auto &item : values) {
+      if (parse_immediate(item, value)) {
+        add_data(name == ".byte" ? value & 0xFF : value);
+      } else {
+        // label addresses are known when the whole file is parsed
+        unsolved_data_labels.push_back(std::make_pair(item, data.size()));
+        add_data(0);
+      }
+    }
+  } else if (name == ".space") {
+    int64_t fill = 0;
+    if (values.empty() || !parse_immediate(values[0], value) || value < 0 ||
+        value > MAX_SPACE_SIZE ||
+        (values.size() > 1 && !parse_immediate(values[1], fill))) {
+      report_error("Invalid size in: ", line);
+      return;
+    }
+    for (int64_t idx = 0; idx < value; ++idx) {
+      add_data(fill & 0xFF);
+    }
+  } else if (name == ".align") {
+    // The alignment is 2^n bytes. Every word is 4 bytes, so .align 2 and
+    // smaller leave the data as it is
+    if (values.empty() || !parse_immediate(values[0], value) || value < 0 ||
+        value > 16) {
+      report_error("Invalid alignment in: ", line);
+      return;
+    }
+    const uint32_t alignment = value > 2 ? 1u << (value - 2) : 1;
+    data_alignment = std::max(data_alignment, alignment);
+    while (data.size() % alignment != 0) {
+      data.push_back(0);
+    }
+  } else if (name != ".data" && name != ".text" && name != ".global" &&
+             name != ".globl" && name != ".section") {
+    report_error("Unknown directive: ", name);
+  }
 }
 
 std::vector<uint8_t> SourceCodeParser::parse_registers(std::string &line,
@@ -76,91 +539,176 @@ std::vector<uint8_t> SourceCodeParser::parse_registers(std::string &line,
                                                        bool &unsolved_label) {
   unsolved_label = false;
   std::vector<uint8_t> register_list;
-  while (line.size() > 0) {
-    line = remove_leading_spaces(line);
-    switch (line[0]) {
-    case '{': // register list begins
-      line = line.substr(1, line.size() - 1);
-    // intenional fall-through
-    case 'r': // register
-      line = line.substr(1, line.size() - 1);
-      register_list.push_back(std::stoi(line));
-      break;
-    case '-': // register range
-    {
-      line = line.substr(2, line.size() - 2);
-      uint8_t end_value = std::stoi(line);
-      for (uint8_t i = register_list.back() + 1; i <= end_value; ++i) {
-        register_list.push_back(i);
-      }
-    } break;
-    case '#': // immediate
-      line = line.substr(1, line.size() - 1);
-      if (line.size() > 1 && line[1] == 'x') {
-        // hexadecimal value
-        result.set_second_operand(
-            std::stoi(line.substr(2, line.size() - 2), nullptr, 16));
-      } else {
-        result.set_second_operand(std::stoi(line));
+  line = line.substr(0, line.find_first_of(";@"));
+  parse_shift(line, result);
+
+  // operands are separated by spaces, commas and the register list braces
+  const char *separators = " ,{}!";
+  bool register_range = false;
+  std::string label;
+  auto pos = line.find_first_not_of(separators);
+  while (pos != std::string::npos) {
+    const auto end = line.find_first_of(separators, pos);
+    std::string token =
+        line.substr(pos, end == std::string::npos ? end : end - pos);
+    pos = line.find_first_not_of(separators, end);
+
+    if (token[0] == '-' && !register_list.empty()) {
+      // register range with spaces, like r5 - r8
+      register_range = true;
+      token = token.substr(1);
+      if (token.empty()) {
+        continue;
       }
-      break;
-    default:
-      break;
     }
 
-    auto next_pos = line.find_first_of("r#-{;");
-    if (next_pos == std::string::npos || line[next_pos] == ';') {
-      break;
+    uint8_t reg = 0;
+    if (token[0] == '#' ||
+        isdigit(static_cast<unsigned char>(token[0]))) { // like SWI 0
+      int64_t value = 0;
+      if (!parse_immediate(token.substr(token[0] == '#' ? 1 : 0), value)) {
+        report_error("Invalid immediate: ", token);
+      }
+      result.set_second_operand(value);
+    } else if (parse_register_name(token.substr(0, token.find('-')),
+                                   reg)) { // register
+      if (register_range) {
+        for (uint8_t idx = register_list.back() + 1; idx < reg; ++idx) {
+          register_list.push_back(idx);
+        }
+        register_range = false;
+      }
+      register_list.push_back(reg);
+      // a range written without spaces, like r5-r8
+      const auto dash_pos = token.find('-');
+      if (dash_pos != std::string::npos) {
+        uint8_t last = 0;
+        if (parse_register_name(token.substr(dash_pos + 1), last)) {
+          for (uint8_t idx = reg + 1; idx <= last; ++idx) {
+            register_list.push_back(idx);
+          }
+        } else {
+          register_range = true;
+        }
+      }
+    } else { // label
+      auto item = symbol_address_table.find(token);
+      if (item != symbol_address_table.end()) {
+        result.set_second_operand(item->second);
+      } else {
+        unsolved_label = true;
+        label = token;
+      }
     }
-    line = line.substr(next_pos, line.size() - next_pos);
   }
-  if (!line.empty() && line[0] != ';' && !isdigit(line[0])) {
-    // it's a label
-    auto next_pos = line.find_first_of(" ;,");
-    if (next_pos != std::string::npos) {
-      line = line.substr(0, next_pos);
-    }
-    auto item = symbol_address_table.find(line);
-    if (item != symbol_address_table.end()) {
-      register_list.push_back(symbol_address_table[line]);
-    } else {
-      unsolved_label = true;
-    }
+  if (unsolved_label) {
+    // the caller solves the label when the whole file is parsed
+    line = label;
   }
   return register_list;
 }
 
+// The registers Machine reads for each opcode. Compares have the first
+// operand twice
+static size_t get_minimum_register_count(opcodes code) {
+  switch (code) {
+  case opcodes::MOV:
+  case opcodes::MVN: // intentional fall-through
+    return 1;
+  case opcodes::ADC:
+  case opcodes::ADD: // intentional fall-through
+  case opcodes::AND: // intentional fall-through
+  case opcodes::BIC: // intentional fall-through
+  case opcodes::CMN: // intentional fall-through
+  case opcodes::CMP: // intentional fall-through
+  case opcodes::EOR: // intentional fall-through
+  case opcodes::LDM: // intentional fall-through
+  case opcodes::LDR: // intentional fall-through
+  case opcodes::ORR: // intentional fall-through
+  case opcodes::RSB: // intentional fall-through
+  case opcodes::RSC: // intentional fall-through
+  case opcodes::SBC: // intentional fall-through
+  case opcodes::STM: // intentional fall-through
+  case opcodes::STR: // intentional fall-through
+  case opcodes::SUB: // intentional fall-through
+  case opcodes::TEQ: // intentional fall-through
+  case opcodes::TST: // intentional fall-through
+    return 2;
+  case opcodes::MUL:
+    return 3;
+  case opcodes::MLA:
+  case opcodes::SMLAL: // intentional fall-through
+  case opcodes::SMULL: // intentional fall-through
+  case opcodes::UMLAL: // intentional fall-through
+  case opcodes::UMULL: // intentional fall-through
+    return 4;
+  default:
+    return 0;
+  }
+}
+
 bool SourceCodeParser::parse_line(
     std::string &line, Instruction &result,
     std::pair<std::string, unsigned int> &unsolved_label_info) {
-  if (line[0] == '@' || line[0] == ';') {
-    // it's comment line
+  if (line.find_first_not_of(" \t") == std::string::npos || line[0] == '@' ||
+      line[0] == ';') {
+    // it's an empty or comment line
     return false;
   }
 
-  if (line[0] != ' ') {
-    // it's a label
-    symbol_address_table[line] = line_number;
-    line_number++;
+  if (line[0] != ' ' && line[0] != '\t') {
+    // It's a label, which can be followed by a colon and an instruction or a
+    // directive. It points to the next instruction until it's followed by
+    // data instead
+    const auto label_end = line.find_first_of(" \t:;@");
+    const std::string label = line.substr(0, label_end);
+    symbol_address_table[label] = line_number;
+    pending_labels.push_back(label);
+    if (label_end == std::string::npos) {
+      return false;
+    }
+    line = line.substr(label_end + (line[label_end] == ':' ? 1 : 0));
+    const auto next_pos = line.find_first_not_of(" \t");
+    if (next_pos == std::string::npos || line[next_pos] == ';' ||
+        line[next_pos] == '@') {
+      return false;
+    }
+  }
+  line = line.substr(line.find_first_not_of(" \t"));
+
+  if (line[0] == '.') {
+    parse_directive(line);
     return false;
   }
-  line = remove_leading_spaces(line);
 
-  // parse opcode
-  int n = 3;
+  // parse opcode, the longest opcodes have 5 letters
+  int n = 5;
   auto found_opcode = opcode_table.end();
+  auto found_stack_alias = stack_alias_table.end();
   do {
     found_opcode = opcode_table.find(line.substr(0, n));
+    found_stack_alias = stack_alias_table.find(line.substr(0, n));
     n--;
-  } while (found_opcode == opcode_table.end() && n > 0);
+  } while (found_opcode == opcode_table.end() &&
+           found_stack_alias == stack_alias_table.end() && n > 0);
 
-  if (found_opcode == opcode_table.end()) {
-    std::cout << "Unknown opcode in: " << line << std::endl;
+  // ADR is an ADD or a SUB from the PC, which is known when labels are solved
+  const bool is_adr = line.compare(0, 3, "ADR") == 0;
+  if (is_adr) {
+    result.set_opcode(opcodes::ADD);
+    n = 2;
+  } else if (found_stack_alias != stack_alias_table.end()) {
+    result.set_opcode(found_stack_alias->second.first);
+    result.set_update_mode(found_stack_alias->second.second);
+    result.set_writeback(true);
+  } else if (found_opcode != opcode_table.end()) {
+    result.set_opcode(found_opcode->second);
+  } else {
+    report_error("Unknown opcode in: ", line);
     return false;
   }
-
-  result.set_opcode(found_opcode->second);
-  line = line.substr(n + 1, line.size() - n);
+  // the matched name can be shorter than n + 1 when the line ends after it
+  line = line.substr(std::min<size_t>(n + 1, line.size()));
 
   // parse condition code if it exists
   auto found_condition_code = condition_code_table.find(line.substr(0, 2));
@@ -171,9 +719,15 @@ bool SourceCodeParser::parse_line(
 
   // parse update mode if it exists
   auto found_update_mode = update_mode_table.find(line.substr(0, 2));
+  auto found_stack_mode = stack_mode_table.find(line.substr(0, 2));
   if (found_update_mode != update_mode_table.end()) {
     line = line.substr(2, line.size() - 2);
     result.set_update_mode(found_update_mode->second);
+  } else if (found_stack_mode != stack_mode_table.end()) {
+    line = line.substr(2, line.size() - 2);
+    result.set_update_mode(result.get_opcode() == opcodes::LDM
+                               ? found_stack_mode->second.first
+                               : found_stack_mode->second.second);
   }
 
   // parse suffix if it exists
@@ -184,20 +738,104 @@ bool SourceCodeParser::parse_line(
     n--;
   } while (found_suffix == suffix_table.end() && n > 0);
   if (found_suffix != suffix_table.end()) {
-    line = line.substr(n + 1, line.size() - n);
+    line = line.substr(std::min<size_t>(n + 1, line.size()));
     result.set_suffix(found_suffix->second);
   }
 
   // parse registers
-  bool unsolved_label;
-  std::vector<uint8_t> register_list =
-      parse_registers(line, result, unsolved_label);
+  replace_register_aliases(line);
+  bool unsolved_label = false;
+  std::vector<uint8_t> register_list;
+  const auto writeback_pos = line.find('!');
+  if ((result.get_opcode() == opcodes::LDM ||
+       result.get_opcode() == opcodes::STM) &&
+      writeback_pos != std::string::npos && writeback_pos < line.find('{')) {
+    result.set_writeback(true);
+  }
+  if (is_adr ||
+      (result.get_opcode() == opcodes::LDR &&
+       line.find('=') != std::string::npos)) {
+    if (!parse_pc_relative(line, result, register_list)) {
+      return false;
+    }
+  } else if ((result.get_opcode() == opcodes::LDR ||
+              result.get_opcode() == opcodes::STR) &&
+             line.find('[') != std::string::npos) {
+    if (!parse_address(line, result, register_list)) {
+      return false;
+    }
+  } else {
+    register_list = parse_registers(line, result, unsolved_label);
+  }
+  if (found_stack_alias != stack_alias_table.end()) {
+    register_list.insert(register_list.begin(), STACK_POINTER_INDEX);
+  }
+  set_operand_registers(register_list, result);
+  if (result.get_register_count() <
+      get_minimum_register_count(result.get_opcode())) {
+    report_error("Missing registers in: ", line);
+    return false;
+  }
   if (unsolved_label) {
     unsolved_label_info.first = line;
     unsolved_label_info.second = line_number;
   }
-  result.set_registers(register_list);
 
+  // the labels before the instruction are code labels
+  pending_labels.clear();
   line_number++;
   return true;
 }
+
+void SourceCodeParser::set_operand_registers(
+    std::vector<uint8_t> &register_list, Instruction &result) {
+  // Registers in addition to destination and first operand are the second
+  // operand. Compares have no destination, Machine expects the first operand
+  // as the second register
+  size_t operand_register_count = 0;
+  switch (result.get_opcode()) {
+  case opcodes::CMN:
+  case opcodes::CMP: // intentional fall-through
+  case opcodes::TEQ: // intentional fall-through
+  case opcodes::TST: // intentional fall-through
+    if (!register_list.empty()) {
+      register_list.insert(register_list.begin(), register_list.front());
+    }
+    operand_register_count = 2;
+    break;
+  case opcodes::MOV:
+  case opcodes::MVN: // intentional fall-through
+    operand_register_count = 1;
+    break;
+  case opcodes::LDM:
+  case opcodes::STM: // intentional fall-through
+    // the lowest register is always transferred at the lowest address, so
+    // the list is a set of registers after the base
+    if (register_list.size() > 1) {
+      std::sort(register_list.begin() + 1, register_list.end());
+      register_list.erase(
+          std::unique(register_list.begin() + 1, register_list.end()),
+          register_list.end());
+    }
+    break;
+  case opcodes::ADC:
+  case opcodes::ADD: // intentional fall-through
+  case opcodes::AND: // intentional fall-through
+  case opcodes::BIC: // intentional fall-through
+  case opcodes::EOR: // intentional fall-through
+  case opcodes::ORR: // intentional fall-through
+  case opcodes::RSB: // intentional fall-through
+  case opcodes::RSC: // intentional fall-through
+  case opcodes::SBC: // intentional fall-through
+  case opcodes::SUB: // intentional fall-through
+    operand_register_count = 2;
+    break;
+  default:
+    break;
+  }
+  result.set_registers(register_list);
+  if (operand_register_count > 0 &&
+      register_list.size() > operand_register_count) {
+    result.set_is_2nd_operand_register(true);
+  }
+}
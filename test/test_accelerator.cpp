@@ -0,0 +1,217 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "accelerator.h"
+#include "machine.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <sstream>
+#include <string>
+
+// the reference routines of the README
+static const char *reference_routines =
+    "memcpy MOV r3, r0\n"
+    "    CMP r2, #0\n"
+    "    BEQ memcpy_end\n"
+    "memcpy_loop LDR r12, [r1], #1\n"
+    "    STR r12, [r3], #1\n"
+    "    SUBS r2, r2, #1\n"
+    "    BNE memcpy_loop\n"
+    "memcpy_end MOV pc, lr\n"
+    "memmove CMP r1, r0\n"
+    "    BCS memcpy\n"
+    "    ADD r3, r1, r2\n"
+    "    CMP r0, r3\n"
+    "    BCS memcpy\n"
+    "    ADD r1, r1, r2\n"
+    "    ADD r3, r0, r2\n"
+    "memmove_loop LDR r12, [r1, #-1]!\n"
+    "    STR r12, [r3, #-1]!\n"
+    "    SUBS r2, r2, #1\n"
+    "    BNE memmove_loop\n"
+    "    MOV pc, lr\n"
+    "memset MOV r3, r0\n"
+    "    CMP r2, #0\n"
+    "    BEQ memset_end\n"
+    "memset_loop STR r1, [r3], #1\n"
+    "    SUBS r2, r2, #1\n"
+    "    BNE memset_loop\n"
+    "memset_end MOV pc, lr\n"
+    "memcmp MOV r3, #0\n"
+    "memcmp_loop CMP r2, #0\n"
+    "    BEQ memcmp_end\n"
+    "    LDR r3, [r0], #1\n"
+    "    LDR r12, [r1], #1\n"
+    "    SUBS r3, r3, r12\n"
+    "    BNE memcmp_end\n"
+    "    SUB r2, r2, #1\n"
+    "    B memcmp_loop\n"
+    "memcmp_end MOV r0, r3\n"
+    "    MOV pc, lr\n"
+    "strlen MOV r1, r0\n"
+    "strlen_loop LDR r2, [r1], #1\n"
+    "    CMP r2, #0\n"
+    "    BNE strlen_loop\n"
+    "    SUB r0, r1, r0\n"
+    "    SUB r0, r0, #1\n"
+    "    MOV pc, lr\n"
+    "    .data\n"
+    "words .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10\n"
+    "other .word 1, 2, 3, 9, 5\n"
+    "text .asciz \"abc\"\n"
+    "empty .word 0\n"
+    "lowest .word 0x80000000\n";
+
+// Runs the setup and the call, and then halts before the routines.
+// Returns the retired instructions
+static uint64_t run_call(const std::string &setup, const std::string &call,
+                         Machine &m, bool accelerated) {
+  std::istringstream source(setup + "    " + call + "\n    SWI 0\n" +
+                            reference_routines);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  REQUIRE(0 == parser.get_error_count());
+  Simulator::load_data(parser.get_data(), parser.get_data_address(), m);
+  if (accelerated) {
+    Accelerator::attach(m, true);
+  }
+  return Simulator::run_program(program, m);
+}
+
+// Checks that the SWI runs like the BL to the reference routine
+static void check_like_reference(const std::string &setup,
+                                 const std::string &routine,
+                                 const std::string &swi) {
+  Machine reference(256);
+  Machine accelerated(256);
+  const uint64_t reference_retired =
+      run_call(setup, "BL " + routine, reference, false);
+  const uint64_t accelerated_retired =
+      run_call(setup, "SWI " + swi, accelerated, true);
+
+  CHECK(reference_retired == accelerated_retired);
+  // the BL also sets lr
+  for (uint8_t reg = 0; reg <= 12; ++reg) {
+    INFO("register " << static_cast<int>(reg));
+    CHECK(reference.get_register_value(reg).to_unsigned32() ==
+          accelerated.get_register_value(reg).to_unsigned32());
+  }
+  CHECK(reference.get_state().cpsr == accelerated.get_state().cpsr);
+  for (int address = 0; address < 256; ++address) {
+    INFO("address " << address);
+    CHECK(reference.get_memory(address).to_unsigned32() ==
+          accelerated.get_memory(address).to_unsigned32());
+  }
+}
+
+TEST_CASE("memcpy runs like the reference routine") {
+  SECTION("separate ranges") {
+    check_like_reference("    LDR r0, =other\n"
+                         "    LDR r1, =words\n"
+                         "    MOV r2, #5\n",
+                         "memcpy", "0x100");
+  }
+  SECTION("destination inside the source") {
+    check_like_reference("    LDR r1, =words\n"
+                         "    ADD r0, r1, #2\n"
+                         "    MOV r2, #6\n",
+                         "memcpy", "0x100");
+  }
+  SECTION("nothing to copy") {
+    check_like_reference("    LDR r0, =other\n"
+                         "    LDR r1, =words\n"
+                         "    MOV r2, #0\n"
+                         "    MOV r12, #7\n",
+                         "memcpy", "0x100");
+  }
+}
+
+TEST_CASE("memmove runs like the reference routine") {
+  SECTION("destination before the source") {
+    check_like_reference("    LDR r0, =words\n"
+                         "    ADD r1, r0, #3\n"
+                         "    MOV r2, #7\n",
+                         "memmove", "0x101");
+  }
+  SECTION("destination inside the source") {
+    check_like_reference("    LDR r1, =words\n"
+                         "    ADD r0, r1, #3\n"
+                         "    MOV r2, #7\n",
+                         "memmove", "0x101");
+  }
+  SECTION("destination after the source") {
+    check_like_reference("    LDR r1, =words\n"
+                         "    ADD r0, r1, #5\n"
+                         "    MOV r2, #5\n",
+                         "memmove", "0x101");
+  }
+}
+
+TEST_CASE("memset runs like the reference routine") {
+  SECTION("some words") {
+    check_like_reference("    LDR r0, =words\n"
+                         "    MVN r1, #0\n"
+                         "    MOV r2, #4\n",
+                         "memset", "0x102");
+  }
+  SECTION("no words") {
+    check_like_reference("    LDR r0, =words\n"
+                         "    MOV r1, #1\n"
+                         "    MOV r2, #0\n",
+                         "memset", "0x102");
+  }
+}
+
+TEST_CASE("memcmp runs like the reference routine") {
+  SECTION("equal words") {
+    check_like_reference("    LDR r0, =words\n"
+                         "    LDR r1, =other\n"
+                         "    MOV r2, #3\n",
+                         "memcmp", "0x103");
+  }
+  SECTION("smaller word") {
+    check_like_reference("    LDR r0, =words\n"
+                         "    LDR r1, =other\n"
+                         "    MOV r2, #5\n",
+                         "memcmp", "0x103");
+  }
+  SECTION("larger word") {
+    check_like_reference("    LDR r0, =other\n"
+                         "    LDR r1, =words\n"
+                         "    MOV r2, #5\n",
+                         "memcmp", "0x103");
+  }
+  SECTION("no words") {
+    check_like_reference("    LDR r0, =other\n"
+                         "    LDR r1, =words\n"
+                         "    MOV r2, #0\n",
+                         "memcmp", "0x103");
+  }  SECTION("overflowing difference") {
+    // 0x80000000 - 1 overflows, so V is set and N is clear
+    check_like_reference("    LDR r0, =lowest\n"
+                         "    LDR r1, =words\n"
+                         "    MOV r2, #1\n",
+                         "memcmp", "0x103");
+  }
+}
+
+TEST_CASE("strlen runs like the reference routine") {
+  SECTION("text") {
+    check_like_reference("    LDR r0, =text\n", "strlen", "0x104");
+  }
+  SECTION("empty text") {
+    check_like_reference("    LDR r0, =empty\n", "strlen", "0x104");
+  }
+}
+
+TEST_CASE("Accelerated routines halt outside of memory") {
+  Machine m(256);
+  // two instructions of the setup, then the SWI halts
+  CHECK(3 == run_call("    LDR r0, =other\n"
+                      "    MOV r2, #1000\n",
+                      "SWI 0x100", m, true));
+  CHECK(1 == m.get_memory(m.get_register_value(0).to_unsigned32())
+                 .to_unsigned32());
+}
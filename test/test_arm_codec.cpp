@@ -0,0 +1,342 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "arm_codec.h"
+#include "instruction.h"
+
+static uint32_t encode(const Instruction &i, uint32_t address = 0) {
+  uint32_t word = 0;
+  REQUIRE(ArmCodec::encode(i, address, word));
+  return word;
+}
+
+static Instruction decode(uint32_t word, uint32_t address = 0) {
+  Instruction i;
+  REQUIRE(ArmCodec::decode(word, address, i));
+  return i;
+}
+
+TEST_CASE("ArmCodec, rotated immediates") {
+  uint32_t encoded = 0;
+  CHECK(ArmCodec::encode_immediate(0xFF, encoded));
+  CHECK(0x0FF == encoded);
+  CHECK(ArmCodec::encode_immediate(0xFF000000, encoded));
+  CHECK(0xFF000000 == ArmCodec::decode_immediate(encoded));
+  CHECK(ArmCodec::encode_immediate(0xF000000F, encoded));
+  CHECK(0xF000000F == ArmCodec::decode_immediate(encoded));
+  CHECK(false == ArmCodec::encode_immediate(0x101, encoded));
+  CHECK(false == ArmCodec::encode_immediate(0x12345678, encoded));
+}
+
+TEST_CASE("ArmCodec, encode data processing") {
+  CHECK(0xE282101E == encode(Instruction(opcodes::ADD, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {1, 2}, 30)));
+  CHECK(0xE3A0007B == encode(Instruction(opcodes::MOV, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0}, 123)));
+  CHECK(0xE351000A == encode(Instruction(opcodes::CMP, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0, 1}, 10)));
+  CHECK(0x0311000A == encode(Instruction(opcodes::TST, condition_codes::EQ,
+                                         suffixes::S, update_modes::NONE,
+                                         {0, 1}, 10)));
+
+  Instruction subtract(opcodes::SUB, condition_codes::NONE, suffixes::S,
+                       update_modes::NONE, {3, 5, 2}, 0);
+  subtract.set_is_2nd_operand_register(true);
+  CHECK(0xE0553002 == encode(subtract));
+}
+
+TEST_CASE("ArmCodec, unencodable immediate uses complementary operation") {
+  // MOV r0, #0xFFFFFF00 becomes MVN r0, #0xFF
+  CHECK(0xE3E000FF == encode(Instruction(opcodes::MOV, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0}, -256)));
+  // ADD r0, r1, #-10 becomes SUB r0, r1, #10
+  CHECK(0xE241000A == encode(Instruction(opcodes::ADD, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0, 1}, -10)));
+
+  uint32_t word = 0;
+  CHECK(false ==
+        ArmCodec::encode(Instruction(opcodes::ADD, condition_codes::NONE,
+                                     suffixes::S, update_modes::NONE, {0, 1},
+                                     -10),
+                         0, word));
+  CHECK(false ==
+        ArmCodec::encode(Instruction(opcodes::ORR, condition_codes::NONE,
+                                     suffixes::NONE, update_modes::NONE,
+                                     {0, 1}, 0x12345678),
+                         0, word));
+}
+
+TEST_CASE("ArmCodec, encode branches relative to the address") {
+  CHECK(0xEA000003 == encode(Instruction(opcodes::B, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {}, 5)));
+  CHECK(0xEBFFFFF9 == encode(Instruction(opcodes::BL, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {}, 5),
+                             10));
+
+  Instruction i = decode(0x1AFFFFFE, 20);
+  CHECK(i.get_opcode() == opcodes::B);
+  CHECK(i.get_condition_code() == condition_codes::NE);
+  CHECK(i.get_second_operand() == 20);
+}
+
+TEST_CASE("ArmCodec, encode loads and stores") {
+  auto transfer = [](opcodes code, suffixes suf) {
+    return encode(Instruction(code, condition_codes::NONE, suf,
+                              update_modes::NONE, {0, 1}, 0));
+  };
+  CHECK(0xE5910000 == transfer(opcodes::LDR, suffixes::NONE));
+  CHECK(0xE5810000 == transfer(opcodes::STR, suffixes::NONE));
+  CHECK(0xE5D10000 == transfer(opcodes::LDR, suffixes::B));
+  CHECK(0xE5C10000 == transfer(opcodes::STR, suffixes::B));
+  CHECK(0xE1D100B0 == transfer(opcodes::LDR, suffixes::H));
+  CHECK(0xE1C100B0 == transfer(opcodes::STR, suffixes::H));
+  CHECK(0xE1D100D0 == transfer(opcodes::LDR, suffixes::SB));
+  CHECK(0xE1D100F0 == transfer(opcodes::LDR, suffixes::SH));
+  CHECK(0xE1C100D0 == transfer(opcodes::LDR, suffixes::D));
+  CHECK(0xE1C100F0 == transfer(opcodes::STR, suffixes::D));
+}
+
+TEST_CASE("ArmCodec, load and store addressing modes") {
+  Instruction pre_indexed(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                          update_modes::NONE, {0, 1}, 4);
+  pre_indexed.set_writeback(true);
+  CHECK(0xE5B10004 == encode(pre_indexed));
+
+  Instruction post_indexed(opcodes::LDR, condition_codes::NONE,
+                           suffixes::NONE, update_modes::NONE, {0, 1}, -4);
+  post_indexed.set_post_indexed(true);
+  CHECK(0xE4110004 == encode(post_indexed));
+
+  Instruction register_offset(opcodes::LDR, condition_codes::NONE,
+                              suffixes::NONE, update_modes::NONE, {0, 1, 2},
+                              0);
+  register_offset.set_is_2nd_operand_register(true);
+  register_offset.set_offset_subtracted(true);
+  register_offset.set_shift(shift_types::LSL, 2);
+  CHECK(0xE7110102 == encode(register_offset));
+
+  CHECK(0xE1D101F2 == encode(Instruction(opcodes::LDR, condition_codes::NONE,
+                                         suffixes::SH, update_modes::NONE,
+                                         {0, 1}, 0x12)));
+
+  Instruction halfword(opcodes::STR, condition_codes::NONE, suffixes::H,
+                       update_modes::NONE, {0, 1, 2}, 0);
+  halfword.set_is_2nd_operand_register(true);
+  halfword.set_post_indexed(true);
+  CHECK(0xE08100B2 == encode(halfword));
+
+  // extra transfers have an 8-bit offset and no shifted register
+  uint32_t word = 0;
+  CHECK(false == ArmCodec::encode(Instruction(opcodes::LDR,
+                                              condition_codes::NONE,
+                                              suffixes::H, update_modes::NONE,
+                                              {0, 1}, 0x100),
+                                  0, word));
+  halfword.set_shift(shift_types::LSL, 1);
+  CHECK(false == ArmCodec::encode(halfword, 0, word));
+
+  Instruction decoded = decode(0xE7110102);
+  CHECK(decoded.is_2nd_operand_register());
+  CHECK(decoded.is_offset_subtracted());
+  CHECK(decoded.get_shift_type() == shift_types::LSL);
+  CHECK(decoded.get_last_register() == 2);
+  decoded = decode(0xE4110004);
+  CHECK(decoded.is_post_indexed());
+  CHECK(decoded.has_writeback() == false);
+  CHECK(decoded.get_second_operand() == -4);
+  decoded = decode(0xE1F101F2);
+  CHECK(decoded.get_suffix() == suffixes::SH);
+  CHECK(decoded.has_writeback());
+  CHECK(decoded.get_second_operand() == 0x12);
+  // user mode transfers are not supported
+  Instruction i;
+  CHECK(false == ArmCodec::decode(0xE4B10004, 0, i));
+}
+
+TEST_CASE("ArmCodec, encode multiple transfers") {
+  CHECK(0xE8900128 == encode(Instruction(opcodes::LDM, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::IA,
+                                         {0, 3, 5, 8}, 0)));
+  CHECK(0xE9000128 == encode(Instruction(opcodes::STM, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::DB,
+                                         {0, 3, 5, 8}, 0)));
+
+  // PUSH {r4, lr}
+  Instruction push(opcodes::STM, condition_codes::NONE, suffixes::NONE,
+                   update_modes::DB, {13, 4, 14}, 0);
+  push.set_writeback(true);
+  CHECK(0xE92D4010 == encode(push));
+  CHECK(decode(0xE8BD8010).has_writeback());
+
+  // ARM always transfers the lowest register first
+  uint32_t word = 0;
+  CHECK(false ==
+        ArmCodec::encode(Instruction(opcodes::LDM, condition_codes::NONE,
+                                     suffixes::NONE, update_modes::IA,
+                                     {0, 5, 3}, 0),
+                         0, word));
+}
+
+TEST_CASE("ArmCodec, multiplies") {
+  CHECK(0xE0000291 == encode(Instruction(opcodes::MUL, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0, 1, 2}, 0)));
+  CHECK(0xE0303291 == encode(Instruction(opcodes::MLA, condition_codes::NONE,
+                                         suffixes::S, update_modes::NONE,
+                                         {0, 1, 2, 3}, 0)));
+  CHECK(0xE0810392 == encode(Instruction(opcodes::UMULL, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {0, 1, 2, 3}, 0)));
+  CHECK(0xE0F10392 == encode(Instruction(opcodes::SMLAL, condition_codes::NONE,
+                                         suffixes::S, update_modes::NONE,
+                                         {0, 1, 2, 3}, 0)));
+
+  const opcodes multiplies[] = {opcodes::MLA,   opcodes::SMLAL, opcodes::SMULL,
+                                opcodes::UMLAL, opcodes::UMULL};
+  for (opcodes code : multiplies) {
+    Instruction decoded = decode(encode(Instruction(
+        code, condition_codes::LT, suffixes::S, update_modes::NONE,
+        {4, 5, 6, 7}, 0)));
+    CHECK(decoded.get_opcode() == code);
+    CHECK(decoded.get_condition_code() == condition_codes::LT);
+    CHECK(decoded.get_suffix() == suffixes::S);
+    REQUIRE(decoded.get_register_count() == 4);
+    CHECK(decoded.get_register(0) == 4);
+    CHECK(decoded.get_register(1) == 5);
+    CHECK(decoded.get_register(2) == 6);
+    CHECK(decoded.get_register(3) == 7);
+  }
+  Instruction multiply = decode(0xE0000291);
+  CHECK(multiply.get_opcode() == opcodes::MUL);
+  REQUIRE(multiply.get_register_count() == 3);
+  CHECK(multiply.get_register(1) == 1);
+  CHECK(multiply.get_register(2) == 2);
+}
+
+TEST_CASE("ArmCodec, software interrupt") {
+  CHECK(0xEF123456 == encode(Instruction(opcodes::SWI, condition_codes::NONE,
+                                         suffixes::NONE, update_modes::NONE,
+                                         {}, 0x123456)));
+}
+
+TEST_CASE("ArmCodec, every opcode survives a round trip") {
+  const opcodes data_processing[] = {
+      opcodes::ADC, opcodes::ADD, opcodes::AND, opcodes::BIC,
+      opcodes::EOR, opcodes::ORR, opcodes::RSB, opcodes::RSC,
+      opcodes::SBC, opcodes::SUB, opcodes::MOV, opcodes::MVN,
+      opcodes::CMN, opcodes::CMP, opcodes::TEQ, opcodes::TST};
+  for (opcodes code : data_processing) {
+    Instruction original(code, condition_codes::GT, suffixes::NONE,
+                         update_modes::NONE, {4, 6}, 0x3F0);
+    if (code == opcodes::MOV || code == opcodes::MVN) {
+      original.set_registers({4});
+    }
+    Instruction decoded = decode(encode(original, 7), 7);
+    CHECK(decoded.get_opcode() == code);
+    CHECK(decoded.get_condition_code() == condition_codes::GT);
+    CHECK(decoded.get_second_operand() == 0x3F0);
+    CHECK(decoded.is_2nd_operand_register() == false);
+    CHECK(decoded.get_register(decoded.get_register_count() - 1) ==
+          (original.get_register_count() > 1 ? 6 : 4));
+  }
+
+  Instruction reg_operand(opcodes::EOR, condition_codes::NONE, suffixes::S,
+                          update_modes::NONE, {1, 2, 3}, 0);
+  reg_operand.set_is_2nd_operand_register(true);
+  Instruction decoded = decode(encode(reg_operand));
+  CHECK(decoded.get_opcode() == opcodes::EOR);
+  CHECK(decoded.get_suffix() == suffixes::S);
+  CHECK(decoded.is_2nd_operand_register());
+  REQUIRE(decoded.get_register_count() == 3);
+  CHECK(decoded.get_register(0) == 1);
+  CHECK(decoded.get_register(1) == 2);
+  CHECK(decoded.get_register(2) == 3);
+
+  const suffixes transfer_suffixes[] = {suffixes::NONE, suffixes::B,
+                                        suffixes::H, suffixes::D};
+  for (suffixes suf : transfer_suffixes) {
+    for (opcodes code : {opcodes::LDR, opcodes::STR}) {
+      Instruction original(code, condition_codes::NONE, suf,
+                           update_modes::NONE, {2, 9}, 0);
+      Instruction decoded = decode(encode(original));
+      CHECK(decoded.get_opcode() == code);
+      CHECK(decoded.get_suffix() == suf);
+      CHECK(decoded.get_register(0) == 2);
+      CHECK(decoded.get_register(1) == 9);
+    }
+  }
+
+  const update_modes modes[] = {update_modes::IA, update_modes::IB,
+                                update_modes::DA, update_modes::DB};
+  for (update_modes mode : modes) {
+    Instruction original(opcodes::STM, condition_codes::NONE, suffixes::NONE,
+                         mode, {13, 0, 4, 14}, 0);
+    Instruction decoded = decode(encode(original));
+    CHECK(decoded.get_opcode() == opcodes::STM);
+    CHECK(decoded.get_update_mode() == mode);
+    REQUIRE(decoded.get_register_count() == 4);
+    CHECK(decoded.get_register(0) == 13);
+    CHECK(decoded.get_register(3) == 14);
+  }
+}
+
+TEST_CASE("ArmCodec, unsupported words are not decoded") {
+  Instruction i;
+  // unconditional instruction space
+  CHECK(false == ArmCodec::decode(0xF57FF01F, 0, i));
+  // coprocessor data operation
+  CHECK(false == ArmCodec::decode(0xEE000000, 0, i));
+  // branch and exchange
+  CHECK(false == ArmCodec::decode(0xE12FFF1E, 0, i));
+}
+
+TEST_CASE("ArmCodec, shifted register operands") {
+  Instruction add(opcodes::ADD, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {0, 1, 2}, 0);
+  add.set_is_2nd_operand_register(true);
+  add.set_shift(shift_types::LSL, 2);
+  CHECK(0xE0810102 == encode(add));
+
+  add.set_shift_by_register(shift_types::LSL, 3);
+  CHECK(0xE0810312 == encode(add));
+  Instruction decoded = decode(0xE0810312);
+  CHECK(decoded.get_shift_type() == shift_types::LSL);
+  CHECK(decoded.is_shift_by_register());
+  CHECK(decoded.get_shift_register() == 3);
+  CHECK(decoded.get_last_register() == 2);
+
+  Instruction move(opcodes::MOV, condition_codes::NONE, suffixes::S,
+                   update_modes::NONE, {0, 1}, 0);
+  move.set_is_2nd_operand_register(true);
+  move.set_shift(shift_types::RRX, 0);
+  CHECK(0xE1B00061 == encode(move));
+  move.set_shift(shift_types::ASR, 32);
+  CHECK(0xE1B00041 == encode(move));
+}
+
+TEST_CASE("ArmCodec, special shift encodings are resolved when decoding") {
+  // MOV r0, r1, LSL #0
+  CHECK(decode(0xE1A00001).get_shift_type() == shift_types::NONE);
+  // MOV r0, r1, LSR #32
+  Instruction i = decode(0xE1A00021);
+  CHECK(i.get_shift_type() == shift_types::LSR);
+  CHECK(i.get_shift_amount() == 32);
+  // MOV r0, r1, ASR #32
+  i = decode(0xE1A00041);
+  CHECK(i.get_shift_type() == shift_types::ASR);
+  CHECK(i.get_shift_amount() == 32);
+  // MOV r0, r1, RRX
+  CHECK(decode(0xE1A00061).get_shift_type() == shift_types::RRX);
+  // MOV r0, r1, ROR #4
+  i = decode(0xE1A00261);
+  CHECK(i.get_shift_type() == shift_types::ROR);
+  CHECK(i.get_shift_amount() == 4);
+}
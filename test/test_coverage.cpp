@@ -0,0 +1,118 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "coverage.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <cstdio>
+#include <sstream>
+
+// the loop runs three times, MOVEQ only in the last one
+static const char *coverage_source = "    MOV r1, #3\n"
+                                     "\n"
+                                     "loop SUBS r1, r1, #1\n"
+                                     "    MOVEQ r2, #1\n"
+                                     "    BNE loop\n"
+                                     "    SWI 0\n"
+                                     "    MOV r3, #1\n";
+
+static std::vector<Instruction>
+parse_coverage_source(SourceCodeParser &parser) {
+  std::istringstream source(coverage_source);
+  return parser.parse(source);
+}
+
+TEST_CASE("Coverage counts hits and edges") {
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parse_coverage_source(parser);
+  Coverage coverage(program.size());
+  Machine m(256);
+  m.set_coverage(&coverage);
+  Simulator::run_program(program, m);
+
+  CHECK(1 == coverage.get_hit_count(0));
+  CHECK(3 == coverage.get_hit_count(1));
+  CHECK(3 == coverage.get_hit_count(2));
+  CHECK(3 == coverage.get_hit_count(3));
+  CHECK(1 == coverage.get_hit_count(4));
+  CHECK(0 == coverage.get_hit_count(5));
+  // BNE taken twice and skipped once, MOVEQ skipped twice
+  CHECK(2 == coverage.get_edge_count(3, 1));
+  CHECK(1 == coverage.get_edge_count(3, 4));
+  CHECK(2 == coverage.get_edge_count(2, 3));
+  CHECK(3 == coverage.get_covered_edge_count());
+}
+
+TEST_CASE("Coverage of optimized programs and memory runs is the same") {
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parse_coverage_source(parser);
+  Coverage expected(program.size());
+  Machine reference(256);
+  reference.set_coverage(&expected);
+  Simulator::run_program(program, reference);
+
+  Coverage optimized(program.size());
+  Machine m(256);
+  m.set_coverage(&optimized);
+  Simulator::run_program(Optimizer::optimize(program), m);
+  CHECK(expected.get_hits() == optimized.get_hits());
+  CHECK(expected.get_edges() == optimized.get_edges());
+
+  Coverage from_memory(program.size());
+  Machine memory_machine(256);
+  REQUIRE(Simulator::load_program(program, memory_machine));
+  memory_machine.set_coverage(&from_memory);
+  Simulator::run_from_memory(memory_machine);
+  CHECK(expected.get_hits() == from_memory.get_hits());
+  CHECK(expected.get_edges() == from_memory.get_edges());
+}
+
+TEST_CASE("Coverage merges runs and files") {
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parse_coverage_source(parser);
+  Coverage coverage(program.size());
+  Machine m(256);
+  m.set_coverage(&coverage);
+  Simulator::run_program(program, m);
+
+  Coverage merged;
+  merged.merge(coverage);
+  merged.merge(coverage);
+  CHECK(6 == merged.get_hit_count(1));
+  CHECK(4 == merged.get_edge_count(3, 1));
+
+  const std::string file_name = "coverage_test.cov";
+  REQUIRE(merged.write(file_name));
+  CHECK(coverage.merge_file(file_name));
+  std::remove(file_name.c_str());
+  CHECK(9 == coverage.get_hit_count(1));
+  CHECK(6 == coverage.get_edge_count(3, 1));
+  CHECK_FALSE(coverage.merge_file(file_name));
+
+  // edge counters saturate
+  Coverage saturated;
+  for (int idx = 0; idx < 300; ++idx) {
+    saturated.add_edge(7, 1);
+  }
+  CHECK(255 == saturated.get_edge_count(7, 1));
+  saturated.merge(saturated);
+  CHECK(255 == saturated.get_edge_count(7, 1));
+}
+
+TEST_CASE("Coverage is written per source line") {
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parse_coverage_source(parser);
+  Coverage coverage(program.size());
+  Machine m(256);
+  m.set_coverage(&coverage);
+  Simulator::run_program(program, m);
+
+  std::ostringstream out;
+  coverage.write_line_coverage(out, "loop.s", parser.get_source_lines());
+  CHECK(out.str() == "TN:\nSF:loop.s\nDA:1,1\nDA:3,3\nDA:4,3\nDA:5,3\nDA:6,1\n"
+                     "DA:7,0\nLF:6\nLH:5\nend_of_record\n");
+}
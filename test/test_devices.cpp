@@ -0,0 +1,168 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "devices.h"
+#include "event_queue.h"
+#include "machine.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <sstream>
+
+// devices are mapped at 1024, past the end of the 256 words of memory
+static uint64_t run_source(const char *source_code, Machine &m,
+                           unsigned int count = 0) {
+  std::istringstream source(source_code);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  REQUIRE(0 == parser.get_error_count());
+  return Simulator::run_program(program, m, count);
+}
+
+TEST_CASE("The UART sends and receives bytes") {
+  std::ostringstream out;
+  std::istringstream in("x");
+  Uart uart(out, in);
+  Machine m(256);
+  uart.attach(m, 1024);
+  run_source("    MOV r1, #1024\n"
+             "    MOV r2, #72\n"
+             "    STR r2, [r1]\n"
+             "    MOV r2, #105\n"
+             "    MOV r3, #33\n"
+             "    STMIA r1, {r2, r3}\n"
+             "    LDR r4, [r1, #1]\n"
+             "    LDR r5, [r1]\n"
+             "    LDR r6, [r1, #1]\n"
+             "    SWI 0\n",
+             m);
+  // the second word of the STM is the status register, which ignores it
+  CHECK(out.str() == "Hi");
+  CHECK((UART_TX_READY | UART_RX_READY) ==
+        m.get_register_value(4).to_unsigned32());
+  CHECK('x' == m.get_register_value(5).to_unsigned32());
+  CHECK(UART_TX_READY == m.get_register_value(6).to_unsigned32());
+}
+
+TEST_CASE("Unmapped addresses past memory read as zero") {
+  Machine m(256);
+  m.set_register_value(7, Machine_byte(5));
+  run_source("    MOV r1, #1024\n"
+             "    STR r1, [r1]\n"
+             "    LDR r7, [r1]\n"
+             "    SWI 0\n",
+             m);
+  CHECK(0 == m.get_register_value(7).to_unsigned32());
+}
+
+// starts the timer and counts the loops until it expires
+static const char *timer_source = "    MOV r1, #1024\n"
+                                  "    MOV r2, #10\n"
+                                  "    STR r2, [r1]\n"
+                                  "    MOV r2, #1\n"
+                                  "    STR r2, [r1, #1]\n"
+                                  "    MOV r3, #0\n"
+                                  "wait ADD r3, r3, #1\n"
+                                  "    LDR r4, [r1, #2]\n"
+                                  "    CMP r4, #0\n"
+                                  "    BEQ wait\n"
+                                  "    SWI 0\n";
+
+TEST_CASE("The timer expires after its count of instructions") {
+  EventQueue events;
+  Timer timer(events);
+  int expiries = 0;
+  timer.set_expiry_handler([&]() { expiries++; });
+  Machine m(256);
+  timer.attach(m, 1024);
+  m.set_event_queue(&events);
+
+  SECTION("in one run") {
+    // started at time 4 and expired after the 14th instruction, in the
+    // second loop
+    CHECK(19 == run_source(timer_source, m));
+  }
+  SECTION("in steps") {
+    uint64_t retired = 0;
+    uint64_t step;
+    while ((step = run_source(timer_source, m, 3)) == 3) {
+      retired += step;
+    }
+    CHECK(19 == retired + step);
+  }
+  CHECK(3 == m.get_register_value(3).to_unsigned32());
+  CHECK(1 == expiries);
+  CHECK(timer.has_expired());
+  CHECK(19 == events.get_time());
+}
+
+TEST_CASE("A periodic timer expires again from its last expiry") {
+  EventQueue events;
+  Timer timer(events);
+  int expiries = 0;
+  timer.set_expiry_handler([&]() { expiries++; });
+  Machine m(256);
+  timer.attach(m, 1024);
+  m.set_event_queue(&events);
+  // expires at 104, 204, ... 904
+  CHECK(1000 == run_source("    MOV r1, #1024\n"
+                           "    MOV r2, #100\n"
+                           "    STR r2, [r1]\n"
+                           "    MOV r2, #3\n"
+                           "    STR r2, [r1, #1]\n"
+                           "loop B loop\n",
+                           m, 1000));
+  CHECK(9 == expiries);
+  CHECK(1 == events.get_pending_count());
+}
+
+TEST_CASE("Timer interrupts run a handler in IRQ mode") {
+  EventQueue events;
+  Timer timer(events);
+  InterruptController interrupts;
+  Machine m(256);
+  timer.attach(m, 1024);
+  interrupts.attach(m, 1028);
+  timer.set_expiry_handler([&]() { interrupts.raise(3); });
+  m.set_event_queue(&events);
+  // the handler stack
+  m.set_current_program_status_register(MODE_IRQ);
+  m.set_register_value(STACK_POINTER_INDEX, Machine_byte(200));
+  m.set_current_program_status_register(MODE_USR);
+  // r5 counts the interrupts, and the program waits for three
+  run_source("    B start\n"
+             "    SWI 0\n"
+             "    SWI 0\n"
+             "    SWI 0\n"
+             "    SWI 0\n"
+             "    SWI 0\n"
+             "    B irq\n"
+             "    SWI 0\n"
+             "start MOV r1, #1024\n"
+             "    MOV r2, #8\n"
+             "    STR r2, [r1, #5]\n"
+             "    MOV r2, #50\n"
+             "    STR r2, [r1]\n"
+             "    MOV r2, #3\n"
+             "    STR r2, [r1, #1]\n"
+             "    MOV r5, #0\n"
+             "wait CMP r5, #3\n"
+             "    BNE wait\n"
+             "    SWI 0\n"
+             "irq STMDB sp!, {r1, r2}\n"
+             "    MOV r1, #1024\n"
+             "    MOV r2, #8\n"
+             "    STR r2, [r1, #4]\n"
+             "    ADD r5, r5, #1\n"
+             "    LDMIA sp!, {r1, r2}\n"
+             "    SUBS pc, lr, #1\n",
+             m);
+  CHECK(3 == m.get_register_value(5).to_unsigned32());
+  CHECK(MODE_USR == (m.get_current_program_status_register() &
+                     BITMASK_CPSR_MODE));
+  CHECK(1024 == m.get_register_value(1).to_unsigned32());
+  CHECK(0 == m.get_register_value(STACK_POINTER_INDEX).to_unsigned32());
+  m.set_current_program_status_register(MODE_IRQ);
+  CHECK(200 == m.get_register_value(STACK_POINTER_INDEX).to_unsigned32());
+}
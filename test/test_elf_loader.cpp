@@ -0,0 +1,236 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "arm_codec.h"
+#include "elf_loader.h"
+#include "machine.h"
+#include "simulator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Segments are page aligned in the file, so they can be mapped on any host
+#define SEGMENT_ALIGNMENT 0x10000
+
+class ElfLoaderTestFixture {
+public:
+  ElfLoaderTestFixture() : m(0x10000) {}
+  ~ElfLoaderTestFixture() {
+    for (const std::string &file_name : written) {
+      std::remove(file_name.c_str());
+    }
+  }
+
+  static void put(std::vector<uint8_t> &bytes, size_t offset, uint32_t value,
+                  size_t size) {
+    if (bytes.size() < offset + size) {
+      bytes.resize(offset + size, 0);
+    }
+    for (size_t idx = 0; idx < size; ++idx) {
+      bytes[offset + idx] = (value >> (8 * idx)) & 0xFF;
+    }
+  }
+
+  // Writes an executable with a read-only code segment and a writable data
+  // segment, which has room for bss after the file contents, to the temporary
+  // directory. Returns its path, and the file is removed with the fixture
+  std::string write_executable(std::string const &name,
+                               std::vector<uint32_t> const &code,
+                               std::vector<uint32_t> const &data,
+                               uint32_t bss_size = 0, uint16_t machine = 40) {
+    const uint32_t code_address = SEGMENT_ALIGNMENT;
+    const uint32_t data_address = 2 * SEGMENT_ALIGNMENT;
+    std::vector<uint8_t> bytes;
+    // ELF header
+    bytes.push_back(0x7F);
+    bytes.push_back('E');
+    bytes.push_back('L');
+    bytes.push_back('F');
+    put(bytes, 4, 1, 1); // 32-bit
+    put(bytes, 5, 1, 1); // little-endian
+    put(bytes, 6, 1, 1); // version
+    put(bytes, 16, 2, 2); // executable
+    put(bytes, 18, machine, 2);
+    put(bytes, 20, 1, 4);
+    put(bytes, 24, code_address, 4); // entry
+    put(bytes, 28, 52, 4);           // program headers follow the header
+    put(bytes, 40, 52, 2);
+    put(bytes, 42, 32, 2);
+    put(bytes, 44, 2, 2);
+
+    // read-only, executable code segment
+    put(bytes, 52, 1, 4);
+    put(bytes, 56, SEGMENT_ALIGNMENT, 4);
+    put(bytes, 60, code_address, 4);
+    put(bytes, 68, code.size() * 4, 4);
+    put(bytes, 72, code.size() * 4, 4);
+    put(bytes, 76, 0x5, 4);
+    put(bytes, 80, SEGMENT_ALIGNMENT, 4);
+
+    // writable data segment
+    put(bytes, 84, 1, 4);
+    put(bytes, 88, 2 * SEGMENT_ALIGNMENT, 4);
+    put(bytes, 92, data_address, 4);
+    put(bytes, 100, data.size() * 4, 4);
+    put(bytes, 104, data.size() * 4 + bss_size, 4);
+    put(bytes, 108, 0x6, 4);
+    put(bytes, 112, SEGMENT_ALIGNMENT, 4);
+
+    for (size_t idx = 0; idx < code.size(); ++idx) {
+      put(bytes, SEGMENT_ALIGNMENT + idx * 4, code[idx], 4);
+    }
+    for (size_t idx = 0; idx < data.size(); ++idx) {
+      put(bytes, 2 * SEGMENT_ALIGNMENT + idx * 4, data[idx], 4);
+    }
+    const char *directory = std::getenv("TMPDIR");
+    const std::string file_name =
+        std::string(directory ? directory : "/tmp") + "/" + name;
+    std::ofstream file(file_name, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    written.push_back(file_name);
+    return file_name;
+  }
+
+  static uint32_t encode(Instruction const &i, uint32_t address) {
+    uint32_t word = 0;
+    REQUIRE(ArmCodec::encode(i, address, word));
+    return word;
+  }
+
+protected:
+  Machine m;
+  std::vector<std::string> written;
+};
+
+TEST_CASE_METHOD(ElfLoaderTestFixture, "load and run an executable") {
+  const uint32_t entry = SEGMENT_ALIGNMENT / 4;
+  const uint32_t data = 2 * SEGMENT_ALIGNMENT / 4;
+  std::vector<uint32_t> code;
+  // r1 = data byte address, r0 = first data word + 1, stored to the second
+  code.push_back(encode(Instruction(opcodes::MOV, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {1},
+                                    2 * SEGMENT_ALIGNMENT),
+                        entry));
+  code.push_back(encode(Instruction(opcodes::LDR, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {0, 1},
+                                    0),
+                        entry + 1));
+  code.push_back(encode(Instruction(opcodes::ADD, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {0, 0},
+                                    1),
+                        entry + 2));
+  code.push_back(encode(Instruction(opcodes::ADD, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {1, 1},
+                                    4),
+                        entry + 3));
+  code.push_back(encode(Instruction(opcodes::STR, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {0, 1},
+                                    0),
+                        entry + 4));
+  code.push_back(encode(Instruction(opcodes::SWI, condition_codes::NONE,
+                                    suffixes::NONE, update_modes::NONE, {}, 0),
+                        entry + 5));
+  const std::string file_name =
+      write_executable("test_executable.elf", code, {41}, 8);
+
+  REQUIRE(ElfLoader::load(file_name, m));
+  CHECK(entry == m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32());
+  CHECK(0x40000 ==
+        m.get_register_value(STACK_POINTER_INDEX).to_unsigned32());
+  CHECK(code[0] == m.get_memory(entry).to_unsigned32());
+  CHECK(41 == m.get_memory(data).to_unsigned32());
+
+  Simulator::run_from_memory(m);
+  CHECK(42 == m.get_register_value(0).to_unsigned32());
+  CHECK(42 == m.get_memory(data + 1).to_unsigned32());
+}
+
+// What a compiler makes of
+//   int table[] = {10, 20, 30};
+//   int main() { char *p = (char *)table; p[9] = 7; return table[1] + 5; }
+// with the table address in a literal pool and a frame on the stack
+TEST_CASE_METHOD(ElfLoaderTestFixture, "run toolchain code") {
+  const uint32_t entry = SEGMENT_ALIGNMENT / 4;
+  const uint32_t data = 2 * SEGMENT_ALIGNMENT / 4;
+  Instruction push(opcodes::STM, condition_codes::NONE, suffixes::NONE,
+                   update_modes::DB, {13, 4, 14}, 0);
+  push.set_writeback(true);
+  Instruction pop(opcodes::LDM, condition_codes::NONE, suffixes::NONE,
+                  update_modes::IA, {13, 4, 5}, 0);
+  pop.set_writeback(true);
+  const std::vector<Instruction> program = {
+      push,
+      // LDR r3, [pc, #24], the literal after the SWI
+      Instruction(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {3, 15}, 24),
+      Instruction(opcodes::MOV, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {2}, 7),
+      Instruction(opcodes::STR, condition_codes::NONE, suffixes::B,
+                  update_modes::NONE, {2, 3}, 9),
+      Instruction(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {0, 3}, 4),
+      Instruction(opcodes::ADD, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {0, 0}, 5),
+      Instruction(opcodes::LDR, condition_codes::NONE, suffixes::B,
+                  update_modes::NONE, {1, 3}, 9),
+      pop,
+      Instruction(opcodes::SWI, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {}, 0)};
+  std::vector<uint32_t> code;
+  for (size_t idx = 0; idx < program.size(); ++idx) {
+    code.push_back(encode(program[idx], entry + idx));
+  }
+  // the literal pool
+  code.push_back(2 * SEGMENT_ALIGNMENT);
+  const std::string file_name =
+      write_executable("test_executable_toolchain.elf", code, {10, 20, 30});
+  REQUIRE(ElfLoader::load(file_name, m));
+  m.set_register_value(4, Machine_byte(44));
+  m.set_register_value(14, Machine_byte(55));
+
+  Simulator::run_from_memory(m);
+  CHECK(25 == m.get_register_value(0).to_unsigned32());
+  CHECK(7 == m.get_register_value(1).to_unsigned32());
+  CHECK(2 * SEGMENT_ALIGNMENT == m.get_register_value(3).to_unsigned32());
+  // the byte went to the second byte of the third word
+  CHECK(30 + (7 << 8) == m.get_memory(data + 2).to_unsigned32());
+  // the frame was pushed below the end of memory and popped
+  CHECK(44 == m.get_memory(0x10000 - 2).to_unsigned32());
+  CHECK(55 == m.get_memory(0x10000 - 1).to_unsigned32());
+  CHECK(44 == m.get_register_value(4).to_unsigned32());
+  CHECK(55 == m.get_register_value(5).to_unsigned32());
+  CHECK(0x40000 ==
+        m.get_register_value(STACK_POINTER_INDEX).to_unsigned32());
+}
+
+TEST_CASE_METHOD(ElfLoaderTestFixture, "stores to loaded code stay in memory") {
+  const uint32_t entry = SEGMENT_ALIGNMENT / 4;
+  const std::string file_name = write_executable(
+      "test_executable_store.elf", {0xE3A0007B, 0xEF000000}, {});
+
+  REQUIRE(ElfLoader::load(file_name, m));
+  m.set_memory(entry, Machine_byte(0xE3A00007));
+  CHECK(0xE3A00007 == m.get_memory(entry).to_unsigned32());
+
+  // the file is not modified
+  Machine other(0x10000);
+  REQUIRE(ElfLoader::load(file_name, other));
+  CHECK(0xE3A0007B == other.get_memory(entry).to_unsigned32());
+}
+
+TEST_CASE_METHOD(ElfLoaderTestFixture, "reject non-ARM executable") {
+  const std::string file_name =
+      write_executable("test_executable_x86.elf", {0xEF000000}, {}, 0, 3);
+  CHECK(false == ElfLoader::load(file_name, m));
+}
+
+TEST_CASE_METHOD(ElfLoaderTestFixture, "reject executable larger than memory") {
+  Machine small(256);
+  const std::string file_name =
+      write_executable("test_executable_large.elf", {0xEF000000}, {});
+  CHECK(false == ElfLoader::load(file_name, small));
+}
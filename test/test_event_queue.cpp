@@ -0,0 +1,105 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "event_queue.h"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+TEST_CASE("Events run in the order of their times") {
+  EventQueue events;
+  std::vector<int> order;
+  events.schedule(100, [&](uint64_t) { order.push_back(3); });
+  events.schedule(5, [&](uint64_t) { order.push_back(1); });
+  events.schedule(100, [&](uint64_t) { order.push_back(4); });
+  events.schedule(64, [&](uint64_t) { order.push_back(2); });
+  CHECK(4 == events.get_pending_count());
+  CHECK(events.get_next_time() <= 5);
+
+  events.advance(4);
+  CHECK(order.empty());
+  events.advance(64);
+  CHECK(order == std::vector<int>{1, 2});
+  CHECK(64 == events.get_time());
+  events.advance(1000);
+  CHECK(order == std::vector<int>{1, 2, 3, 4});
+  CHECK(0 == events.get_pending_count());
+  CHECK(UINT64_MAX == events.get_next_time());
+}
+
+TEST_CASE("Cancelled events don't run") {
+  EventQueue events;
+  bool ran = false;
+  const uint64_t id = events.schedule(10, [&](uint64_t) { ran = true; });
+  CHECK(events.cancel(id));
+  CHECK_FALSE(events.cancel(id));
+  events.advance(20);
+  CHECK_FALSE(ran);
+}
+
+TEST_CASE("Handlers can schedule events") {
+  EventQueue events;
+  std::vector<uint64_t> times;
+  // a periodic event
+  std::function<void(uint64_t)> tick = [&](uint64_t time) {
+    times.push_back(time);
+    if (times.size() < 3) {
+      events.schedule(time + 1000, tick);
+    }
+  };
+  events.schedule(1000, tick);
+  events.advance(10000);
+  CHECK(times == std::vector<uint64_t>{1000, 2000, 3000});
+}
+
+TEST_CASE("Events far ahead and events in the past run on time") {
+  EventQueue events;
+  std::vector<uint64_t> times;
+  const auto record = [&](uint64_t time) {
+    times.push_back(events.get_time());
+    CHECK(time <= events.get_time());
+  };
+  // past the top level of the wheel
+  events.schedule(uint64_t(1) << 30, record);
+  events.schedule(300000, record);
+  events.advance(1000);
+  // already due
+  events.schedule(10, record);
+  events.advance(1000);
+  REQUIRE(1 == times.size());
+  CHECK(1000 == times[0]);
+  events.advance(uint64_t(1) << 31);
+  REQUIRE(3 == times.size());
+  CHECK(300000 == times[1]);
+  CHECK(uint64_t(1) << 30 == times[2]);
+}
+
+TEST_CASE("Events run at their times when advanced in random steps") {
+  std::mt19937_64 random(7);
+  EventQueue events;
+  std::vector<std::pair<uint64_t, uint64_t>> scheduled;
+  std::vector<std::pair<uint64_t, uint64_t>> ran;
+  for (int idx = 0; idx < 2000; ++idx) {
+    // times spread over all the levels and the overflow list
+    const uint64_t at = random() % (uint64_t(1) << (random() % 28));
+    const uint64_t id = events.schedule(at, [&ran, &events, at](uint64_t) {
+      ran.push_back({at, events.get_time()});
+    });
+    scheduled.push_back({at, id});
+  }
+  uint64_t time = 0;
+  while (events.get_pending_count() > 0) {
+    time += random() % 100000;
+    events.advance(time);
+  }
+  REQUIRE(scheduled.size() == ran.size());
+  std::stable_sort(scheduled.begin(), scheduled.end());
+  for (size_t idx = 0; idx < ran.size(); ++idx) {
+    CHECK(scheduled[idx].first == ran[idx].first);
+    // advances stop at every event on the way
+    CHECK(ran[idx].second == ran[idx].first);
+  }
+}
@@ -172,7 +172,9 @@ TEST_CASE_METHOD(MachineTestFixture,
 
   CHECK(std::pow(2, 31) + 9 ==
         static_cast<uint32_t>(m.get_register_value(0).to_signed32()));
-  CHECK(BITMASK_CPSR_V == m.get_current_program_status_register());
+  // N is bit 31 of the result
+  CHECK((BITMASK_CPSR_V | BITMASK_CPSR_N) ==
+        m.get_current_program_status_register());
 }
 
 TEST_CASE_METHOD(MachineTestFixture,
@@ -248,7 +250,7 @@ TEST_CASE_METHOD(MachineTestFixture,
 
   // overflowed value is 3
   CHECK(3 == m.get_register_value(0).to_signed32());
-  CHECK((BITMASK_CPSR_V | BITMASK_CPSR_N | BITMASK_CPSR_C) ==
+  CHECK((BITMASK_CPSR_V | BITMASK_CPSR_C) ==
         m.get_current_program_status_register());
 }
 
@@ -496,7 +498,540 @@ TEST_CASE_METHOD(MachineTestFixture, "Store multiple") {
   m.set_memory(257, 2);
   m.set_memory(258, 3);
   m.execute(i);
-  CHECK(3 == m.get_register_value(3).to_unsigned32());
+  // the lowest register is at the lowest address in every mode
+  CHECK(1 == m.get_register_value(3).to_unsigned32());
   CHECK(2 == m.get_register_value(5).to_unsigned32());
-  CHECK(1 == m.get_register_value(8).to_unsigned32());
-}
\ No newline at end of file
+  CHECK(3 == m.get_register_value(8).to_unsigned32());
+  CHECK(258 == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "multiple transfers with writeback") {
+  m.set_register_value(13, 512);
+  m.set_register_value(4, 4);
+  m.set_register_value(5, 5);
+  m.set_register_value(14, 14);
+
+  // PUSH {r4, r5, lr}
+  Instruction push(opcodes::STM, condition_codes::NONE, suffixes::NONE,
+                   update_modes::DB, {13, 4, 5, 14}, 0);
+  push.set_writeback(true);
+  m.execute(push);
+  CHECK(509 == m.get_register_value(13).to_unsigned32());
+  CHECK(4 == m.get_memory(509).to_unsigned32());
+  CHECK(5 == m.get_memory(510).to_unsigned32());
+  CHECK(14 == m.get_memory(511).to_unsigned32());
+
+  // POP {r4, r5, pc} returns to the pushed link register
+  m.set_register_value(4, 0);
+  m.set_register_value(5, 0);
+  Instruction pop(opcodes::LDM, condition_codes::NONE, suffixes::NONE,
+                  update_modes::IA, {13, 4, 5, 15}, 0);
+  pop.set_writeback(true);
+  m.execute(pop);
+  CHECK(512 == m.get_register_value(13).to_unsigned32());
+  CHECK(4 == m.get_register_value(4).to_unsigned32());
+  CHECK(5 == m.get_register_value(5).to_unsigned32());
+  CHECK(14 == m.get_register_value(15).to_unsigned32());
+
+  Instruction increment_before(opcodes::STM, condition_codes::NONE,
+                               suffixes::NONE, update_modes::IB, {13, 4, 5},
+                               0);
+  increment_before.set_writeback(true);
+  m.execute(increment_before);
+  CHECK(514 == m.get_register_value(13).to_unsigned32());
+  CHECK(4 == m.get_memory(513).to_unsigned32());
+  CHECK(5 == m.get_memory(514).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "return with link register") {
+  // BL 10 at address 3, then MOV pc, lr
+  m.set_register_value(15, 3);
+  m.execute(Instruction(opcodes::BL, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {}, 10));
+  CHECK(10 == m.get_register_value(15).to_unsigned32());
+  CHECK(4 == m.get_register_value(14).to_unsigned32());
+  Instruction ret(opcodes::MOV, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {15, 14}, 0);
+  ret.set_is_2nd_operand_register(true);
+  m.execute(ret);
+  CHECK(4 == m.get_register_value(15).to_unsigned32());
+}
+TEST_CASE_METHOD(MachineTestFixture,
+                 "fetch decodes an instruction from memory") {
+  // MOV r0, #123
+  m.set_memory(10, Machine_byte(0xE3A0007B));
+  const Instruction *i = m.fetch_instruction(10);
+  REQUIRE(i != nullptr);
+  CHECK(i->get_opcode() == opcodes::MOV);
+  CHECK(i->get_second_operand() == 123);
+  // the cached instruction is returned on the next fetch
+  CHECK(i == m.fetch_instruction(10));
+
+  // coprocessor instructions are not supported
+  m.set_memory(11, Machine_byte(0xEE000000));
+  CHECK(nullptr == m.fetch_instruction(11));
+}
+
+TEST_CASE_METHOD(MachineTestFixture,
+                 "store to decoded code invalidates the cached instruction") {
+  // MOV r0, #123
+  m.set_memory(10, Machine_byte(0xE3A0007B));
+  REQUIRE(m.fetch_instruction(10) != nullptr);
+
+  // overwrite it with MOV r0, #7
+  m.set_register_value(1, Machine_byte(10));
+  m.set_register_value(2, Machine_byte(0xE3A00007));
+  m.execute(Instruction(opcodes::STR, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {2, 1}, 0));
+
+  const Instruction *i = m.fetch_instruction(10);
+  REQUIRE(i != nullptr);
+  CHECK(i->get_second_operand() == 7);
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "register operand shifted by immediate") {
+  m.set_register_value(1, Machine_byte(3));
+  m.set_register_value(2, Machine_byte(0x80000001));
+  Instruction i(opcodes::ADD, condition_codes::NONE, suffixes::NONE,
+                update_modes::NONE, {0, 1, 2}, 0);
+  i.set_is_2nd_operand_register(true);
+
+  i.set_shift(shift_types::LSL, 4);
+  m.execute(i);
+  CHECK(0x13 == m.get_register_value(0).to_unsigned32());
+
+  i.set_shift(shift_types::LSR, 32);
+  m.execute(i);
+  CHECK(3 == m.get_register_value(0).to_unsigned32());
+
+  i.set_shift(shift_types::ASR, 4);
+  m.execute(i);
+  CHECK(0xF8000003 == m.get_register_value(0).to_unsigned32());
+
+  i.set_shift(shift_types::ROR, 1);
+  m.execute(i);
+  CHECK(0xC0000003 == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "shifter carry-out updates carry flag") {
+  m.set_register_value(1, Machine_byte(0x80000001));
+  Instruction i(opcodes::MOV, condition_codes::NONE, suffixes::S,
+                update_modes::NONE, {0, 1}, 0);
+  i.set_is_2nd_operand_register(true);
+
+  // bit 31 is shifted out
+  i.set_shift(shift_types::LSL, 1);
+  m.execute(i);
+  CHECK(2 == m.get_register_value(0).to_unsigned32());
+  CHECK(BITMASK_CPSR_C == m.get_current_program_status_register());
+
+  // carry is rotated in and bit 0 out
+  i.set_shift(shift_types::RRX, 0);
+  m.execute(i);
+  CHECK(0xC0000000 == m.get_register_value(0).to_unsigned32());
+  CHECK((BITMASK_CPSR_N | BITMASK_CPSR_C) ==
+        m.get_current_program_status_register());
+
+  // shifting right by more than 32 leaves nothing, including the carry
+  m.set_register_value(3, Machine_byte(33));
+  i.set_shift_by_register(shift_types::LSR, 3);
+  m.execute(i);
+  CHECK(0 == m.get_register_value(0).to_unsigned32());
+  CHECK(BITMASK_CPSR_Z == m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "register operand shifted by register") {
+  m.set_register_value(1, Machine_byte(0xF0));
+  m.set_register_value(2, Machine_byte(1));
+  m.set_register_value(3, Machine_byte(0x104)); // only bottom byte is used
+  Instruction i(opcodes::ORR, condition_codes::NONE, suffixes::NONE,
+                update_modes::NONE, {0, 1, 2}, 0);
+  i.set_is_2nd_operand_register(true);
+  i.set_shift_by_register(shift_types::LSL, 3);
+  m.execute(i);
+  CHECK(0xF0 | (1 << 4) == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "bit clear and move not with register") {
+  m.set_register_value(1, Machine_byte(0xFF));
+  m.set_register_value(2, Machine_byte(0x0F));
+  Instruction bic(opcodes::BIC, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {0, 1, 2}, 0);
+  bic.set_is_2nd_operand_register(true);
+  m.execute(bic);
+  CHECK(0xF0 == m.get_register_value(0).to_unsigned32());
+
+  Instruction mvn(opcodes::MVN, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {0, 2}, 0);
+  mvn.set_is_2nd_operand_register(true);
+  m.execute(mvn);
+  CHECK(0xFFFFFFF0 == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "flags are cleared when updated") {
+  m.set_current_program_status_register(BITMASK_CPSR_N | BITMASK_CPSR_Z |
+                                        BITMASK_CPSR_C | BITMASK_CPSR_V);
+  m.set_register_value(1, Machine_byte(10));
+  m.execute(Instruction(opcodes::SUB, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1}, 5));
+  CHECK(BITMASK_CPSR_C == m.get_current_program_status_register());
+
+  // logical operations keep the overflow flag, and so does the carry when
+  // the immediate is not rotated
+  m.set_current_program_status_register(BITMASK_CPSR_N | BITMASK_CPSR_Z |
+                                        BITMASK_CPSR_C | BITMASK_CPSR_V);
+  m.execute(Instruction(opcodes::AND, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1}, 2));
+  CHECK((BITMASK_CPSR_C | BITMASK_CPSR_V) ==
+        m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "flags at the overflow boundaries") {
+  const uint32_t n = BITMASK_CPSR_N;
+  const uint32_t z = BITMASK_CPSR_Z;
+  const uint32_t c = BITMASK_CPSR_C;
+  const uint32_t v = BITMASK_CPSR_V;
+  // {first, second, NZCV after ADDS, NZCV after CMP}
+  const uint32_t cases[][4] = {{0x7FFFFFFF, 1, n | v, c},
+                               {0x80000000, 0x80000000, z | c | v, z | c},
+                               {0x80000000, 1, n, c | v},
+                               {0x7FFFFFFF, 0xFFFFFFFF, c, n | v},
+                               {0xFFFFFFFF, 1, z | c, n | c}};
+  for (const auto &flags : cases) {
+    m.set_register_value(1, Machine_byte(flags[0]));
+    m.set_register_value(2, Machine_byte(flags[1]));
+    Instruction adds(opcodes::ADD, condition_codes::NONE, suffixes::S,
+                     update_modes::NONE, {0, 1, 2}, 0);
+    adds.set_is_2nd_operand_register(true);
+    m.execute(adds);
+    CHECK(flags[0] + flags[1] == m.get_register_value(0).to_unsigned32());
+    CHECK(flags[2] == m.get_current_program_status_register());
+
+    Instruction cmp(opcodes::CMP, condition_codes::NONE, suffixes::NONE,
+                    update_modes::NONE, {0, 1, 2}, 0);
+    cmp.set_is_2nd_operand_register(true);
+    m.execute(cmp);
+    CHECK(flags[3] == m.get_current_program_status_register());
+  }
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "add and subtract with carry") {
+  // 64-bit addition of 0x1_FFFFFFFF and 1 in r1:r0 and r3:r2
+  m.set_register_value(0, Machine_byte(0xFFFFFFFF));
+  m.set_register_value(1, Machine_byte(1));
+  m.set_register_value(2, Machine_byte(1));
+  Instruction adds(opcodes::ADD, condition_codes::NONE, suffixes::S,
+                   update_modes::NONE, {4, 0, 2}, 0);
+  adds.set_is_2nd_operand_register(true);
+  m.execute(adds);
+  Instruction adc(opcodes::ADC, condition_codes::NONE, suffixes::NONE,
+                  update_modes::NONE, {5, 1, 3}, 0);
+  adc.set_is_2nd_operand_register(true);
+  m.execute(adc);
+  CHECK(0 == m.get_register_value(4).to_unsigned32());
+  CHECK(2 == m.get_register_value(5).to_unsigned32());
+
+  // SBC and RSC subtract one more when the carry is clear
+  m.set_register_value(1, Machine_byte(10));
+  m.set_current_program_status_register(BITMASK_CPSR_C);
+  m.execute(Instruction(opcodes::SBC, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1}, 3));
+  CHECK(7 == m.get_register_value(0).to_unsigned32());
+  m.set_current_program_status_register(0);
+  m.execute(Instruction(opcodes::SBC, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1}, 3));
+  CHECK(6 == m.get_register_value(0).to_unsigned32());
+  m.execute(Instruction(opcodes::RSC, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1}, 20));
+  CHECK(9 == m.get_register_value(0).to_unsigned32());
+  CHECK(BITMASK_CPSR_C == m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "reverse subtract flags") {
+  m.set_register_value(1, Machine_byte(10));
+  m.execute(Instruction(opcodes::RSB, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1}, 5));
+  CHECK(static_cast<uint32_t>(-5) == m.get_register_value(0).to_unsigned32());
+  CHECK(BITMASK_CPSR_N == m.get_current_program_status_register());
+
+  m.execute(Instruction(opcodes::RSB, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1}, 10));
+  CHECK(0 == m.get_register_value(0).to_unsigned32());
+  CHECK((BITMASK_CPSR_Z | BITMASK_CPSR_C) ==
+        m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "multiply and multiply accumulate") {
+  m.set_register_value(1, Machine_byte(0x10001));
+  m.set_register_value(2, Machine_byte(0x10003));
+  m.set_register_value(3, Machine_byte(5));
+  m.set_current_program_status_register(BITMASK_CPSR_C | BITMASK_CPSR_V);
+
+  // only the low 32 bits of the product are kept
+  m.execute(Instruction(opcodes::MUL, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 2}, 0));
+  CHECK(0x40003 == m.get_register_value(0).to_unsigned32());
+  CHECK((BITMASK_CPSR_C | BITMASK_CPSR_V) ==
+        m.get_current_program_status_register());
+
+  m.set_register_value(1, Machine_byte(-3, true));
+  m.execute(Instruction(opcodes::MLA, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 3, 3}, 0));
+  CHECK(-10 == m.get_register_value(0).to_signed32());
+  CHECK((BITMASK_CPSR_N | BITMASK_CPSR_C | BITMASK_CPSR_V) ==
+        m.get_current_program_status_register());
+
+  m.set_register_value(3, Machine_byte(0));
+  m.execute(Instruction(opcodes::MUL, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 3}, 0));
+  CHECK(0 == m.get_register_value(0).to_unsigned32());
+  CHECK((BITMASK_CPSR_Z | BITMASK_CPSR_C | BITMASK_CPSR_V) ==
+        m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "long multiply") {
+  m.set_register_value(2, Machine_byte(0xFFFFFFFF));
+  m.set_register_value(3, Machine_byte(2));
+
+  m.execute(Instruction(opcodes::UMULL, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 2, 3}, 0));
+  CHECK(0xFFFFFFFE == m.get_register_value(0).to_unsigned32());
+  CHECK(1 == m.get_register_value(1).to_unsigned32());
+  CHECK(0 == m.get_current_program_status_register());
+
+  // -1 * 2
+  m.execute(Instruction(opcodes::SMULL, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 2, 3}, 0));
+  CHECK(0xFFFFFFFE == m.get_register_value(0).to_unsigned32());
+  CHECK(0xFFFFFFFF == m.get_register_value(1).to_unsigned32());
+  CHECK(BITMASK_CPSR_N == m.get_current_program_status_register());
+
+  // r1:r0 = -2 + -1 * 2
+  m.execute(Instruction(opcodes::SMLAL, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1, 2, 3}, 0));
+  CHECK(0xFFFFFFFC == m.get_register_value(0).to_unsigned32());
+  CHECK(0xFFFFFFFF == m.get_register_value(1).to_unsigned32());
+
+  // the carry from the low word goes to the high word
+  m.set_register_value(0, Machine_byte(0xFFFFFFFF));
+  m.set_register_value(1, Machine_byte(0));
+  m.set_register_value(3, Machine_byte(1));
+  m.execute(Instruction(opcodes::UMLAL, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {0, 1, 2, 3}, 0));
+  CHECK(0xFFFFFFFE == m.get_register_value(0).to_unsigned32());
+  CHECK(1 == m.get_register_value(1).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "load and store with immediate offset") {
+  m.set_register_value(1, Machine_byte(100));
+  m.set_memory(104, Machine_byte(42));
+  m.set_memory(96, Machine_byte(7));
+
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1}, 4));
+  CHECK(42 == m.get_register_value(0).to_unsigned32());
+  CHECK(100 == m.get_register_value(1).to_unsigned32());
+
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1}, -4));
+  CHECK(7 == m.get_register_value(0).to_unsigned32());
+
+  m.execute(Instruction(opcodes::STR, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {0, 1}, 2));
+  CHECK(7 == m.get_memory(102).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "pre-indexed and post-indexed writeback") {
+  m.set_register_value(1, Machine_byte(100));
+  m.set_register_value(2, Machine_byte(11));
+  m.set_memory(100, Machine_byte(1));
+  m.set_memory(104, Machine_byte(2));
+
+  Instruction pre_indexed(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                          update_modes::NONE, {0, 1}, 4);
+  pre_indexed.set_writeback(true);
+  m.execute(pre_indexed);
+  CHECK(2 == m.get_register_value(0).to_unsigned32());
+  CHECK(104 == m.get_register_value(1).to_unsigned32());
+
+  Instruction post_indexed(opcodes::STR, condition_codes::NONE,
+                           suffixes::NONE, update_modes::NONE, {2, 1}, -4);
+  post_indexed.set_post_indexed(true);
+  m.execute(post_indexed);
+  CHECK(11 == m.get_memory(104).to_unsigned32());
+  CHECK(100 == m.get_register_value(1).to_unsigned32());
+
+  // the stored value is the base before writeback
+  Instruction store_base(opcodes::STR, condition_codes::NONE, suffixes::NONE,
+                         update_modes::NONE, {1, 1}, 1);
+  store_base.set_post_indexed(true);
+  m.execute(store_base);
+  CHECK(100 == m.get_memory(100).to_unsigned32());
+  CHECK(101 == m.get_register_value(1).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "load with register offset") {
+  m.set_register_value(1, Machine_byte(100));
+  m.set_register_value(2, Machine_byte(3));
+  m.set_memory(112, Machine_byte(5));
+  m.set_memory(88, Machine_byte(6)); // 100 - (3 << 2)
+
+  Instruction i(opcodes::LDR, condition_codes::NONE, suffixes::NONE,
+                update_modes::NONE, {0, 1, 2}, 0);
+  i.set_is_2nd_operand_register(true);
+  i.set_shift(shift_types::LSL, 2);
+  m.execute(i);
+  CHECK(5 == m.get_register_value(0).to_unsigned32());
+
+  i.set_offset_subtracted(true);
+  m.execute(i);
+  CHECK(6 == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "signed loads are sign extended") {
+  m.set_register_value(1, Machine_byte(100));
+  m.set_memory(100, Machine_byte(0x1234F080));
+
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::B,
+                        update_modes::NONE, {0, 1}, 0));
+  CHECK(0x80 == m.get_register_value(0).to_unsigned32());
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::SB,
+                        update_modes::NONE, {0, 1}, 0));
+  CHECK(0xFFFFFF80 == m.get_register_value(0).to_unsigned32());
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::H,
+                        update_modes::NONE, {0, 1}, 0));
+  CHECK(0xF080 == m.get_register_value(0).to_unsigned32());
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::SH,
+                        update_modes::NONE, {0, 1}, 0));
+  CHECK(0xFFFFF080 == m.get_register_value(0).to_unsigned32());
+
+  m.set_memory(100, Machine_byte(0x7F));
+  m.execute(Instruction(opcodes::LDR, condition_codes::NONE, suffixes::SB,
+                        update_modes::NONE, {0, 1}, 0));
+  CHECK(0x7F == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "state snapshot and restore") {
+  m.set_register_value(1, Machine_byte(10));
+  const Cpu_state snapshot = m.get_state();
+  m.execute(Instruction(opcodes::SUB, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {1, 1}, 10));
+  CHECK(m.get_state() != snapshot);
+  CHECK(m.get_state().registers[1] == 0);
+  CHECK(m.get_state().cpsr == (BITMASK_CPSR_Z | BITMASK_CPSR_C));
+
+  m.get_state() = snapshot;
+  CHECK(m.get_state() == snapshot);
+  CHECK(10 == m.get_register_value(1).to_unsigned32());
+  CHECK(0 == m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "multiple transfers with register runs") {
+  m.set_register_value(0, Machine_byte(300));
+  for (uint8_t reg = 1; reg <= 7; ++reg) {
+    m.set_register_value(reg, Machine_byte(reg * 11));
+  }
+  m.execute(Instruction(opcodes::STM, condition_codes::NONE, suffixes::NONE,
+                        update_modes::IA, {0, 1, 2, 3, 6, 7}, 0));
+  CHECK(11 == m.get_memory(300).to_unsigned32());
+  CHECK(33 == m.get_memory(302).to_unsigned32());
+  CHECK(66 == m.get_memory(303).to_unsigned32());
+  CHECK(77 == m.get_memory(304).to_unsigned32());
+
+  m.execute(Instruction(opcodes::LDM, condition_codes::NONE, suffixes::NONE,
+                        update_modes::IA, {0, 4, 5, 8, 9, 10}, 0));
+  CHECK(11 == m.get_register_value(4).to_unsigned32());
+  CHECK(22 == m.get_register_value(5).to_unsigned32());
+  CHECK(33 == m.get_register_value(8).to_unsigned32());
+  CHECK(66 == m.get_register_value(9).to_unsigned32());
+  CHECK(77 == m.get_register_value(10).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "modes switch the banked registers") {
+  for (uint8_t reg = 8; reg < 15; ++reg) {
+    m.set_register_value(reg, Machine_byte(reg));
+  }
+  m.set_current_program_status_register(MODE_IRQ);
+  // IRQ mode only banks sp and lr
+  CHECK(8 == m.get_register_value(8).to_unsigned32());
+  CHECK(0 == m.get_register_value(13).to_unsigned32());
+  m.set_register_value(13, Machine_byte(500));
+  m.set_current_program_status_register(MODE_FIQ);
+  for (uint8_t reg = 8; reg < 15; ++reg) {
+    CHECK(0 == m.get_register_value(reg).to_unsigned32());
+  }
+  m.set_register_value(8, Machine_byte(80));
+  m.set_current_program_status_register(MODE_IRQ);
+  CHECK(8 == m.get_register_value(8).to_unsigned32());
+  CHECK(500 == m.get_register_value(13).to_unsigned32());
+  // system mode runs on the user registers
+  m.set_current_program_status_register(MODE_SYS);
+  for (uint8_t reg = 8; reg < 15; ++reg) {
+    CHECK(reg == m.get_register_value(reg).to_unsigned32());
+  }
+  m.set_current_program_status_register(MODE_FIQ);
+  CHECK(80 == m.get_register_value(8).to_unsigned32());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "interrupts enter and return") {
+  m.set_current_program_status_register(BITMASK_CPSR_C);
+  m.set_register_value(14, Machine_byte(7));
+  m.set_register_value(15, Machine_byte(20));
+  CHECK_FALSE(m.is_interrupt_pending());
+  m.set_irq_line(true);
+  REQUIRE(m.is_interrupt_pending());
+  m.take_interrupt();
+  CHECK((MODE_IRQ | BITMASK_CPSR_I | BITMASK_CPSR_C) ==
+        m.get_current_program_status_register());
+  CHECK(VECTOR_IRQ == m.get_register_value(15).to_unsigned32());
+  CHECK(21 == m.get_register_value(14).to_unsigned32());
+  CHECK(BITMASK_CPSR_C == m.get_state().spsr[2]);
+  // masked while the handler runs
+  CHECK_FALSE(m.is_interrupt_pending());
+
+  // a FIQ preempts the IRQ handler
+  m.set_fiq_line(true);
+  m.take_interrupt();
+  CHECK((MODE_FIQ | BITMASK_CPSR_I | BITMASK_CPSR_F | BITMASK_CPSR_C) ==
+        m.get_current_program_status_register());
+  CHECK(VECTOR_FIQ == m.get_register_value(15).to_unsigned32());
+  m.set_fiq_line(false);
+
+  // SUBS pc, lr, #1 returns to the first instruction of the IRQ handler,
+  // and then to the program
+  const Instruction ret(opcodes::SUB, condition_codes::NONE, suffixes::S,
+                        update_modes::NONE, {15, 14}, 1);
+  m.execute(ret);
+  CHECK(VECTOR_IRQ == m.get_register_value(15).to_unsigned32());
+  CHECK((MODE_IRQ | BITMASK_CPSR_I | BITMASK_CPSR_C) ==
+        m.get_current_program_status_register());
+  m.set_irq_line(false);
+  m.execute(ret);
+  CHECK(20 == m.get_register_value(15).to_unsigned32());
+  CHECK(7 == m.get_register_value(14).to_unsigned32());
+  CHECK(BITMASK_CPSR_C == m.get_current_program_status_register());
+}
+
+TEST_CASE_METHOD(MachineTestFixture, "SWIs can enter supervisor mode") {
+  const Instruction swi(opcodes::SWI, condition_codes::NONE, suffixes::NONE,
+                        update_modes::NONE, {}, 5);
+  m.set_register_value(15, Machine_byte(30));
+  CHECK(m.execute(swi));
+  m.clear_halted();
+
+  m.set_swi_exceptions(true);
+  m.set_register_value(15, Machine_byte(30));
+  CHECK_FALSE(m.execute(swi));
+  CHECK((MODE_SVC | BITMASK_CPSR_I) ==
+        m.get_current_program_status_register());
+  CHECK(VECTOR_SWI == m.get_register_value(15).to_unsigned32());
+  CHECK(31 == m.get_register_value(14).to_unsigned32());
+  // MOVS pc, lr
+  Instruction ret(opcodes::MOV, condition_codes::NONE, suffixes::S,
+                  update_modes::NONE, {15, 14}, 0);
+  ret.set_is_2nd_operand_register(true);
+  m.execute(ret);
+  CHECK(31 == m.get_register_value(15).to_unsigned32());
+  CHECK(0 == m.get_current_program_status_register());
+  CHECK(0 == m.get_register_value(14).to_unsigned32());
+}
@@ -0,0 +1,78 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "machine.h"
+#include "metrics.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <sstream>
+#include <thread>
+
+static uint64_t get_change(const metrics_snapshot &before, metrics counter) {
+  return Metrics::get_snapshot().get(counter) - before.get(counter);
+}
+
+static void run_counting_program() {
+  std::istringstream source("    MOV r0, #0x40\n"
+                            "    MOV r1, #2\n"
+                            "loop STR r1, [r0]\n"
+                            "    LDR r2, [r0]\n"
+                            "    SUBS r1, r1, #1\n"
+                            "    MOVEQ r3, #1\n"
+                            "    BNE loop\n"
+                            "    SWI 0\n");
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  Machine m(256);
+  Simulator::run_program(program, m);
+}
+
+TEST_CASE("Metrics count the instructions of a run") {
+  const metrics_snapshot before = Metrics::get_snapshot();
+  run_counting_program();
+
+  CHECK(13 == get_change(before, metrics::INSTRUCTIONS_RETIRED));
+  // MOVEQ in the first iteration and BNE in the second
+  CHECK(2 == get_change(before, metrics::CONDITION_FAILED));
+  CHECK(2 == get_change(before, metrics::LOADS));
+  CHECK(2 == get_change(before, metrics::STORES));
+  CHECK(1 == get_change(before, metrics::SWIS));
+  CHECK(1 == get_change(before, metrics::RUNS));
+  CHECK(1 == get_change(before, metrics::ALLOCATIONS));
+  CHECK(256 * sizeof(uint32_t) <=
+        get_change(before, metrics::ALLOCATED_BYTES));
+}
+
+TEST_CASE("Metrics keep the counts of threads that have exited") {
+  const metrics_snapshot before = Metrics::get_snapshot();
+  std::thread first(run_counting_program);
+  std::thread second(run_counting_program);
+  first.join();
+  second.join();
+
+  CHECK(26 == get_change(before, metrics::INSTRUCTIONS_RETIRED));
+  CHECK(2 == get_change(before, metrics::RUNS));
+}
+
+TEST_CASE("Metrics are written as Prometheus text and JSON") {
+  run_counting_program();
+  const uint64_t retired =
+      Metrics::get_snapshot().get(metrics::INSTRUCTIONS_RETIRED);
+
+  std::ostringstream prometheus;
+  Metrics::write_prometheus(prometheus);
+  CHECK(prometheus.str().find(
+            "# TYPE arsmulator_instructions_retired_total counter\n"
+            "arsmulator_instructions_retired_total " +
+            std::to_string(retired) + "\n") != std::string::npos);
+  CHECK(prometheus.str().find("arsmulator_run_seconds_total 0.") !=
+        std::string::npos);
+
+  std::ostringstream json;
+  Metrics::write_json(json);
+  CHECK(json.str().find("{\"instructions_retired\": " +
+                        std::to_string(retired) + ", ") == 0);
+  CHECK(json.str().find("\"allocated_bytes\": ") != std::string::npos);
+}
@@ -0,0 +1,165 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "instruction.h"
+#include "machine.h"
+#include "optimizer.h"
+#include "simulator.h"
+
+#include <vector>
+
+static Instruction make(opcodes code, std::vector<uint8_t> regs,
+                        int64_t operand = 0,
+                        condition_codes condition = condition_codes::NONE,
+                        suffixes suf = suffixes::NONE) {
+  return Instruction(code, condition, suf, update_modes::NONE, regs, operand);
+}
+
+static Instruction make_register_operand(opcodes code,
+                                         std::vector<uint8_t> regs) {
+  Instruction i = make(code, regs);
+  i.set_is_2nd_operand_register(true);
+  return i;
+}
+
+// runs the program with and without optimization and compares the results
+static void check_same_result(std::vector<Instruction> &program) {
+  Machine original(64);
+  Machine optimized(64);
+  const uint64_t original_retired = Simulator::run_program(program, original);
+  const uint64_t optimized_retired =
+      Simulator::run_program(Optimizer::optimize(program), optimized);
+  CHECK(original_retired == optimized_retired);
+  for (uint8_t reg = 0; reg <= PROGRAM_COUNTER_INDEX; ++reg) {
+    CHECK(original.get_register_value(reg).to_unsigned32() ==
+          optimized.get_register_value(reg).to_unsigned32());
+  }
+  CHECK(original.get_current_program_status_register() ==
+        optimized.get_current_program_status_register());
+}
+
+TEST_CASE("Optimizer, immediate chain is folded") {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MVN, {0}, 0));
+  program.push_back(make(opcodes::AND, {0, 0}, 0xFF));
+  program.push_back(make(opcodes::ADD, {0, 0}, 2));
+  program.push_back(make(opcodes::SWI, {}, 0));
+
+  auto optimized = Optimizer::optimize(program);
+  REQUIRE(optimized.size() == program.size());
+  CHECK(optimized[0].fusion == fusion_types::FOLDED);
+  CHECK(optimized[0].length == 3);
+  CHECK(optimized[0].instruction.get_opcode() == opcodes::MOV);
+  CHECK(optimized[0].instruction.get_second_operand() == 0x101);
+  CHECK(optimized[0].original.get_opcode() == opcodes::MVN);
+  // the rest of the chain is still there for branches into it
+  CHECK(optimized[2].fusion == fusion_types::NONE);
+  CHECK(optimized[2].instruction.get_opcode() == opcodes::ADD);
+  check_same_result(program);
+}
+
+TEST_CASE("Optimizer, overwritten result is dropped") {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MOV, {2}, 9));
+  program.push_back(make(opcodes::MOV, {1}, 5));
+  program.push_back(make_register_operand(opcodes::MOV, {1, 2}));
+  // reads r1, so the MOV before it stays
+  program.push_back(make(opcodes::MOV, {3}, 4));
+  program.push_back(make_register_operand(opcodes::ADD, {3, 3, 1}));
+  program.push_back(make(opcodes::SWI, {}, 0));
+
+  auto optimized = Optimizer::optimize(program);
+  CHECK(optimized[1].fusion == fusion_types::FOLDED);
+  CHECK(optimized[1].length == 2);
+  CHECK(optimized[1].instruction.is_2nd_operand_register());
+  CHECK(optimized[3].fusion == fusion_types::NONE);
+  check_same_result(program);
+}
+
+TEST_CASE("Optimizer, loop counter and branch are fused") {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MOV, {0}, 10));
+  program.push_back(make(opcodes::ADD, {1, 1}, 3));
+  program.push_back(
+      make(opcodes::SUB, {0, 0}, 1, condition_codes::NONE, suffixes::S));
+  program.push_back(make(opcodes::B, {}, 1, condition_codes::NE));
+  program.push_back(make(opcodes::CMP, {1, 1}, 30));
+  program.push_back(make(opcodes::B, {}, 7, condition_codes::EQ));
+  program.push_back(make(opcodes::MOV, {2}, 1));
+  program.push_back(make(opcodes::SWI, {}, 0));
+
+  auto optimized = Optimizer::optimize(program);
+  CHECK(optimized[2].fusion == fusion_types::SUBTRACT_BRANCH);
+  CHECK(optimized[2].second.get_opcode() == opcodes::B);
+  CHECK(optimized[4].fusion == fusion_types::COMPARE_BRANCH);
+  check_same_result(program);
+}
+
+TEST_CASE("Optimizer, fused branches set the flags like the originals") {
+  // the SUBS and CMP overflow, so the branches test V as well
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MOV, {0}, 0x80000000));
+  program.push_back(make(opcodes::MOV, {1}, 1));
+  program.push_back(make_register_operand(opcodes::CMP, {0, 0, 1}));
+  program.push_back(make(opcodes::B, {}, 5, condition_codes::LT));
+  program.push_back(make(opcodes::MOV, {2}, 1));
+  program.push_back(
+      make(opcodes::SUB, {3, 0}, 1, condition_codes::NONE, suffixes::S));
+  program.push_back(make(opcodes::B, {}, 8, condition_codes::VS));
+  program.push_back(make(opcodes::MOV, {4}, 1));
+  program.push_back(make(opcodes::SWI, {}, 0));
+
+  auto optimized = Optimizer::optimize(program);
+  CHECK(optimized[2].fusion == fusion_types::COMPARE_BRANCH);
+  CHECK(optimized[5].fusion == fusion_types::SUBTRACT_BRANCH);
+  check_same_result(program);
+}
+
+TEST_CASE("Optimizer, branches after other instructions aren't fused") {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::MOV, {0}, 3));
+  // conditional, shifted and PC operands keep the plain instructions
+  program.push_back(
+      make(opcodes::CMP, {0, 0}, 3, condition_codes::NE, suffixes::NONE));
+  program.push_back(make(opcodes::B, {}, 3, condition_codes::EQ));
+  Instruction shifted = make_register_operand(opcodes::CMP, {0, 0, 0});
+  shifted.set_shift(shift_types::LSL, 1);
+  program.push_back(shifted);
+  program.push_back(make(opcodes::B, {}, 5, condition_codes::NE));
+  program.push_back(make(opcodes::CMP, {15, 15}, 0));
+  program.push_back(make(opcodes::B, {}, 7, condition_codes::NE));
+  program.push_back(
+      make(opcodes::ADD, {1, 0}, 1, condition_codes::NONE, suffixes::S));
+  program.push_back(make(opcodes::B, {}, 9, condition_codes::NE));
+  program.push_back(make(opcodes::SWI, {}, 0));
+
+  auto optimized = Optimizer::optimize(program);
+  for (size_t idx = 0; idx < optimized.size(); ++idx) {
+    INFO("address " << idx);
+    CHECK(optimized[idx].fusion == fusion_types::NONE);
+  }
+  check_same_result(program);
+}
+
+TEST_CASE("Optimizer, stepping stops at original instructions") {
+  std::vector<Instruction> program;
+  program.push_back(make(opcodes::B, {}, 2));
+  program.push_back(make(opcodes::MOV, {0}, 1));
+  program.push_back(make(opcodes::ADD, {0, 0}, 2));
+  program.push_back(make(opcodes::MOV, {1}, 1));
+  program.push_back(make(opcodes::ADD, {1, 1}, 2));
+  program.push_back(make(opcodes::SWI, {}, 0));
+  auto optimized = Optimizer::optimize(program);
+  REQUIRE(optimized[3].length == 2);
+
+  Machine m(64);
+  // the branch skips the first half of the folded MOV and ADD
+  CHECK(2 == Simulator::run_program(optimized, m, 2));
+  CHECK(2 == m.get_register_value(0).to_unsigned32());
+  CHECK(1 == Simulator::run_program(optimized, m, 1));
+  CHECK(1 == m.get_register_value(1).to_unsigned32());
+  CHECK(4 == m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32());
+  CHECK(2 == Simulator::run_program(optimized, m));
+  CHECK(3 == m.get_register_value(1).to_unsigned32());
+}
@@ -0,0 +1,128 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "machine.h"
+#include "replay_log.h"
+#include "semihosting.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <cstdio>
+#include <sstream>
+
+// reads a line from the console, echoes it and keeps the clock and time
+static const char *echo_source = "    MOV r0, #6\n"
+                                 "    LDR r1, =block\n"
+                                 "    SWI 0x123456\n"
+                                 "    MOV r4, r0\n"
+                                 "    MOV r0, #5\n"
+                                 "    LDR r1, =echo\n"
+                                 "    SWI 0x123456\n"
+                                 "    MOV r0, #0x10\n"
+                                 "    SWI 0x123456\n"
+                                 "    MOV r5, r0\n"
+                                 "    MOV r0, #0x11\n"
+                                 "    SWI 0x123456\n"
+                                 "    MOV r6, r0\n"
+                                 "    SWI 0\n"
+                                 "    .data\n"
+                                 "block .word 0, buffer, 8\n"
+                                 "echo .word 1, buffer, 3\n"
+                                 "buffer .word 0, 0\n";
+
+TEST_CASE("ReplayLog returns the entries in order") {
+  ReplayLog log;
+  const uint8_t data[] = {1, 2, 3};
+  log.add(6, 5, data, 3);
+  log.add(0x10, 300, nullptr, 0);
+  log.add(0x11, 0xFFFFFFFF, nullptr, 0);
+  CHECK(3 == log.get_entry_count());
+
+  log.rewind();
+  uint32_t result;
+  const uint8_t *read_data;
+  uint32_t size;
+  REQUIRE(log.next(6, result, read_data, size));
+  CHECK(5 == result);
+  REQUIRE(3 == size);
+  CHECK(3 == read_data[2]);
+  // the next entry is of another operation
+  CHECK_FALSE(log.next(6, result, read_data, size));
+  REQUIRE(log.next(0x10, result, read_data, size));
+  CHECK(300 == result);
+  CHECK(0 == size);
+
+  const std::string file_name = "replay_log_test.log";
+  REQUIRE(log.write(file_name));
+  ReplayLog read_log;
+  REQUIRE(read_log.read(file_name));
+  std::remove(file_name.c_str());
+  REQUIRE(read_log.next(6, result, read_data, size));
+  REQUIRE(read_log.next(0x10, result, read_data, size));
+  REQUIRE(read_log.next(0x11, result, read_data, size));
+  CHECK(0xFFFFFFFF == result);
+  CHECK(read_log.at_end());
+  CHECK_FALSE(read_log.next(0x11, result, read_data, size));
+  CHECK_FALSE(read_log.read(file_name));
+}
+
+TEST_CASE("Replays run the same as the recorded run") {
+  std::istringstream source(echo_source);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  ReplayLog log;
+
+  std::ostringstream recorded_out;
+  std::istringstream in("hi\nthere");
+  Semihosting recording(recorded_out, in);
+  recording.set_replay_log(&log, replay_modes::RECORD);
+  Machine recorded(256);
+  Simulator::load_data(parser.get_data(), parser.get_data_address(),
+                       recorded);
+  recording.attach(recorded);
+  Simulator::run_program(program, recorded);
+  CHECK(recorded_out.str() == "hi\n");
+  CHECK(4 == log.get_entry_count());
+
+  // no input this time, and the replay is stepped a few instructions at a
+  // time
+  log.rewind();
+  std::ostringstream replayed_out;
+  std::istringstream no_input;
+  Semihosting replaying(replayed_out, no_input);
+  replaying.set_replay_log(&log, replay_modes::REPLAY);
+  Machine replayed(256);
+  Simulator::load_data(parser.get_data(), parser.get_data_address(),
+                       replayed);
+  replaying.attach(replayed);
+  while (Simulator::run_program(program, replayed, 3) == 3) {
+  }
+  CHECK(replayed_out.str() == "hi\n");
+  CHECK(recorded.get_state() == replayed.get_state());
+  CHECK(recorded.get_memory(20).to_unsigned32() ==
+        replayed.get_memory(20).to_unsigned32());
+  CHECK(log.at_end());
+  CHECK_FALSE(replaying.has_diverged());
+}
+
+TEST_CASE("Replays stop when the guest asks for other inputs") {
+  ReplayLog log;
+  log.add(0x11, 1234, nullptr, 0);
+  log.rewind();
+  std::istringstream source("    MOV r0, #0x10\n"
+                            "    SWI 0x123456\n"
+                            "    MOV r1, #1\n");
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  std::ostringstream out;
+  std::istringstream in;
+  Semihosting replaying(out, in);
+  replaying.set_replay_log(&log, replay_modes::REPLAY);
+  Machine m(256);
+  replaying.attach(m);
+
+  CHECK(2 == Simulator::run_program(program, m));
+  CHECK(replaying.has_diverged());
+  CHECK(0 == m.get_register_value(1).to_unsigned32());
+}
@@ -0,0 +1,123 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "machine.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <sstream>
+
+// every task adds its r0 to a shared total three times without a lock
+static const char *total_source = "    LDR r1, =total\n"
+                                  "    MOV r3, #3\n"
+                                  "add LDR r2, [r1]\n"
+                                  "    ADD r2, r2, r0\n"
+                                  "    STR r2, [r1]\n"
+                                  "    SUBS r3, r3, #1\n"
+                                  "    BNE add\n"
+                                  "    SWI 0\n"
+                                  "    .data\n"
+                                  "total .word 0\n";
+
+static std::vector<Instruction> parse_total_source(Machine &m,
+                                                   uint32_t &total_address) {
+  std::istringstream source(total_source);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  REQUIRE(0 == parser.get_error_count());
+  total_address = parser.get_data_address();
+  Simulator::load_data(parser.get_data(), total_address, m);
+  return program;
+}
+
+// adds tasks with r0 = 1, 2, 3 ...
+static void add_tasks(Scheduler &scheduler, Machine &m, int count) {
+  for (int idx = 0; idx < count; ++idx) {
+    Cpu_state state = Cpu_state();
+    state.registers[0] = idx + 1;
+    scheduler.add_task(m, state);
+  }
+}
+
+TEST_CASE("Tasks run in turns on their own registers") {
+  Machine m(256);
+  uint32_t total_address;
+  std::vector<Instruction> program = parse_total_source(m, total_address);
+  Scheduler scheduler;
+  add_tasks(scheduler, m, 3);
+  REQUIRE(3 == scheduler.get_task_count());
+
+  SECTION("turns longer than the tasks") {
+    CHECK(3 * 18 == scheduler.run(program, 100));
+    // no task is interrupted, so no update is lost
+    CHECK(18 == m.get_memory(total_address).to_unsigned32());
+  }
+  SECTION("turns inside the read, add and write") {
+    // the tasks all read the total before any of them writes it
+    CHECK(3 * 18 == scheduler.run(program, 1));
+    CHECK(9 == m.get_memory(total_address).to_unsigned32());
+  }
+  for (int task = 0; task < 3; ++task) {
+    CHECK(scheduler.is_finished(task));
+    CHECK(static_cast<uint32_t>(task + 1) ==
+          scheduler.get_state(task).registers[0]);
+  }
+  // the machine is back on its own registers
+  CHECK(0 == m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32());
+}
+
+TEST_CASE("Stepped runs interleave the tasks the same way") {
+  uint32_t totals[2];
+  for (int stepped = 0; stepped < 2; ++stepped) {
+    Machine m(256);
+    uint32_t total_address;
+    std::vector<Instruction> program = parse_total_source(m, total_address);
+    Scheduler scheduler;
+    add_tasks(scheduler, m, 4);
+    if (stepped) {
+      uint64_t retired = 0;
+      uint64_t step;
+      while ((step = scheduler.run(program, 5, 3)) > 0) {
+        retired += step;
+      }
+      CHECK(4 * 18 == retired);
+    } else {
+      scheduler.run(program, 5);
+    }
+    totals[stepped] = m.get_memory(total_address).to_unsigned32();
+  }
+  CHECK(totals[0] == totals[1]);
+}
+
+TEST_CASE("Tasks on other machines don't share memory") {
+  Machine first(256);
+  Machine second(256);
+  uint32_t total_address;
+  std::vector<Instruction> program = parse_total_source(first, total_address);
+  parse_total_source(second, total_address);
+  Scheduler scheduler;
+  add_tasks(scheduler, first, 1);
+  add_tasks(scheduler, second, 1);
+  scheduler.run(program, 2);
+  CHECK(3 == first.get_memory(total_address).to_unsigned32());
+  CHECK(3 == second.get_memory(total_address).to_unsigned32());
+}
+
+TEST_CASE("A scheduler run is one run in the metrics") {
+  Machine m(256);
+  uint32_t total_address;
+  std::vector<Instruction> program = parse_total_source(m, total_address);
+  Scheduler scheduler;
+  add_tasks(scheduler, m, 3);
+  const metrics_snapshot before = Metrics::get_snapshot();
+  scheduler.run(program, 1);
+
+  const metrics_snapshot after = Metrics::get_snapshot();
+  CHECK(1 == after.get(metrics::RUNS) - before.get(metrics::RUNS));
+  CHECK(3 * 18 == after.get(metrics::INSTRUCTIONS_RETIRED) -
+                      before.get(metrics::INSTRUCTIONS_RETIRED));
+  CHECK(3 == after.get(metrics::SWIS) - before.get(metrics::SWIS));
+}
@@ -0,0 +1,177 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "machine.h"
+#include "semihosting.h"
+#include "simulator.h"
+#include "source_parser.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+// Runs the source with semihosting and returns the retired instructions
+static uint64_t run_semihosted(const std::string &source_code,
+                               Semihosting &semihosting, Machine &m) {
+  std::istringstream source(source_code);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  REQUIRE(0 == parser.get_error_count());
+  Simulator::load_data(parser.get_data(), parser.get_data_address(), m);
+  semihosting.attach(m);
+  return Simulator::run_program(program, m);
+}
+
+TEST_CASE("Semihosting writes guest buffers to the console") {
+  std::ostringstream out;
+  std::istringstream in;
+  Semihosting semihosting(out, in);
+  Machine m(256);
+  // "Hello\n" packed four bytes to a word
+  run_semihosted("    MOV r0, #5\n"
+                 "    LDR r1, =block\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r4, r0\n"
+                 "    MOV r0, #4\n"
+                 "    LDR r1, =text\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r0, #3\n"
+                 "    LDR r1, =character\n"
+                 "    SWI 0x123456\n"
+                 "    SWI 0\n"
+                 "    .data\n"
+                 "block .word 1, text, 6\n"
+                 "text .word 0x6C6C6548, 0x0A6F\n"
+                 "character .word 0x21\n",
+                 semihosting, m);
+
+  CHECK(out.str() == "Hello\nHello\n!");
+  CHECK(0 == m.get_register_value(4).to_unsigned32());
+  CHECK_FALSE(semihosting.has_exited());
+}
+
+TEST_CASE("Semihosting reads the console") {
+  std::ostringstream out;
+  std::istringstream in("ab\ncd");
+  Semihosting semihosting(out, in);
+  Machine m(256);
+  run_semihosted("    MOV r0, #6\n"
+                 "    LDR r1, =block\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r4, r0\n"
+                 "    MOV r0, #7\n"
+                 "    SWI 0x123456\n"
+                 "    SWI 0\n"
+                 "    .data\n"
+                 "block .word 0, buffer, 8\n"
+                 "buffer .word 0, 0\n",
+                 semihosting, m);
+
+  // a read ends with the line, and 5 of 8 bytes were not read. The buffer is
+  // after the code and the block
+  CHECK(5 == m.get_register_value(4).to_unsigned32());
+  CHECK(0x0A6261 == m.get_memory(10).to_unsigned32());
+  CHECK('c' == m.get_register_value(0).to_unsigned32());
+}
+
+TEST_CASE("Semihosting opens, writes, reads and closes files") {
+  const std::string file_name = "semihosting_test.txt";
+  std::ostringstream out;
+  std::istringstream in;
+  Semihosting semihosting(out, in);
+  Machine m(256);
+  // opens the file for writing with mode 4, and for reading with mode 0
+  run_semihosted("    MOV r0, #1\n"
+                 "    LDR r1, =open_write\n"
+                 "    SWI 0x123456\n"
+                 "    LDR r1, =write_block\n"
+                 "    STR r0, [r1]\n"
+                 "    LDR r1, =close_block\n"
+                 "    STR r0, [r1]\n"
+                 "    MOV r0, #5\n"
+                 "    LDR r1, =write_block\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r0, #2\n"
+                 "    LDR r1, =close_block\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r0, #1\n"
+                 "    LDR r1, =open_read\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r5, r0\n"
+                 "    LDR r1, =read_block\n"
+                 "    STR r0, [r1]\n"
+                 "    MOV r0, #6\n"
+                 "    SWI 0x123456\n"
+                 "    MOV r6, r0\n"
+                 "    SWI 0\n"
+                 "    .data\n"
+                 "open_write .word name, 4, 20\n"
+                 "open_read .word name, 0, 20\n"
+                 "write_block .word 0, text, 8\n"
+                 "read_block .word 0, buffer, 12\n"
+                 "close_block .word 0\n"
+                 "text .word 0x64636261, 0x68676665\n"
+                 "buffer .word 0, 0, 0\n"
+                 "name .word 0x696D6573, 0x74736F68, 0x5F676E69, 0x74736574,"
+                 " 0x7478742E\n",
+                 semihosting, m);
+  std::ifstream file(file_name);
+  std::string contents;
+  std::getline(file, contents);
+  file.close();
+  std::remove(file_name.c_str());
+
+  CHECK(contents == "abcdefgh");
+  CHECK(m.get_register_value(5).to_unsigned32() > 2);
+  // 8 of 12 bytes were read to the buffer after the code and 15 words of data
+  CHECK(4 == m.get_register_value(6).to_unsigned32());
+  CHECK(0x64636261 == m.get_memory(38).to_unsigned32());
+  CHECK(0x68676665 == m.get_memory(39).to_unsigned32());
+}
+
+TEST_CASE("Semihosting exit halts the machine with an exit code") {
+  std::ostringstream out;
+  std::istringstream in;
+  {
+    Semihosting semihosting(out, in);
+    Machine m(256);
+    CHECK(3 == run_semihosted("    MOV r0, #0x18\n"
+                              "    LDR r1, =0x20026\n"
+                              "    SWI 0x123456\n"
+                              "    MOV r2, #1\n",
+                              semihosting, m));
+    CHECK(semihosting.has_exited());
+    CHECK(0 == semihosting.get_exit_code());
+    CHECK(0 == m.get_register_value(2).to_unsigned32());
+  }
+  {
+    Semihosting semihosting(out, in);
+    Machine m(256);
+    run_semihosted("    MOV r0, #0x20\n"
+                   "    LDR r1, =block\n"
+                   "    SWI 0x123456\n"
+                   "    .data\n"
+                   "block .word 0x20026, 3\n",
+                   semihosting, m);
+    CHECK(semihosting.has_exited());
+    CHECK(3 == semihosting.get_exit_code());
+  }
+}
+
+TEST_CASE("Semihosting leaves other SWIs and operations alone") {
+  std::ostringstream out;
+  std::istringstream in;
+  Semihosting semihosting(out, in);
+  Machine m(256);
+  // an unsupported operation returns -1, SWI 0 still halts
+  CHECK(4 == run_semihosted("    MOV r0, #0x30\n"
+                            "    SWI 0x123456\n"
+                            "    MOV r4, r0\n"
+                            "    SWI 0\n"
+                            "    MOV r5, #1\n",
+                            semihosting, m));
+  CHECK(0xFFFFFFFF == m.get_register_value(4).to_unsigned32());
+  CHECK(0 == m.get_register_value(5).to_unsigned32());
+  CHECK_FALSE(semihosting.has_exited());
+}
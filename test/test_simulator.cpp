@@ -2,6 +2,7 @@
 
 #include <catch2/catch_all.hpp>
 
+#include "arm_codec.h"
 #include "simulator.h"
 
 TEST_CASE("Simulator, run program to the end") {
@@ -45,8 +46,95 @@ TEST_CASE("Simulator, run 2 instructions, stop, continue 1 more instruction") {
                      {0, 1},
                      150});
   Machine m(1024);
-  Simulator::run_program(program, m, 2);
+  CHECK(2 == Simulator::run_program(program, m, 2));
   CHECK(70 == m.get_register_value(1).to_unsigned32());
-  Simulator::run_program(program, m, 2);
+  CHECK(1 == Simulator::run_program(program, m, 2));
   CHECK(220 == m.get_register_value(0).to_unsigned32());
 }
+
+TEST_CASE("Simulator, run program encoded to memory") {
+  std::vector<Instruction> program;
+  program.push_back({opcodes::MOV,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {2},
+                     20});
+  program.push_back({opcodes::ADD,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {1, 2},
+                     50});
+  program.push_back({opcodes::SWI,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {},
+                     0});
+  Machine m(1024);
+
+  REQUIRE(Simulator::load_program(program, m));
+  Simulator::run_from_memory(m);
+  CHECK(70 == m.get_register_value(1).to_unsigned32());
+  CHECK(3 == m.get_register_value(PROGRAM_COUNTER_INDEX).to_unsigned32());
+}
+
+TEST_CASE("Simulator, load data image and read it") {
+  std::vector<Instruction> program;
+  program.push_back({opcodes::LDR,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {1, 0},
+                     1});
+  Machine m(16);
+  m.set_register_value(0, Machine_byte(10));
+
+  CHECK_FALSE(Simulator::load_data({1, 2, 3}, 14, m));
+  REQUIRE(Simulator::load_data({1, 2, 3}, 10, m));
+  Simulator::run_program(program, m);
+  CHECK(2 == m.get_register_value(1).to_unsigned32());
+  CHECK(3 == m.get_memory(12).to_unsigned32());
+}
+
+TEST_CASE("Simulator, store multiple over decoded code") {
+  std::vector<Instruction> program;
+  program.push_back({opcodes::MOV,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {2},
+                     1});
+  program.push_back({opcodes::SWI,
+                     condition_codes::NONE,
+                     suffixes::NONE,
+                     update_modes::NONE,
+                     {},
+                     0});
+  Machine m(1024);
+  REQUIRE(Simulator::load_program(program, m));
+  Simulator::run_from_memory(m);
+  CHECK(1 == m.get_register_value(2).to_unsigned32());
+
+  // only the stored word is decoded again
+  uint32_t word;
+  REQUIRE(ArmCodec::encode({opcodes::MOV,
+                            condition_codes::NONE,
+                            suffixes::NONE,
+                            update_modes::NONE,
+                            {2},
+                            7},
+                           0, word));
+  m.set_register_value(0, Machine_byte(0));
+  m.set_register_value(1, Machine_byte(word));
+  m.execute({opcodes::STM,
+             condition_codes::NONE,
+             suffixes::NONE,
+             update_modes::IA,
+             {0, 1},
+             0});
+  m.set_register_value(PROGRAM_COUNTER_INDEX, Machine_byte(0));
+  CHECK(2 == Simulator::run_from_memory(m));
+  CHECK(7 == m.get_register_value(2).to_unsigned32());
+}
@@ -0,0 +1,151 @@
+#define CATCH_CONFIG_MAIN
+
+#include <catch2/catch_all.hpp>
+
+#include "metrics.h"
+#include "simulator.h"
+#include "smp.h"
+#include "source_parser.h"
+
+#include <sstream>
+
+// core 0 passes a value to the other cores through a flag
+static const char *message_source = "    LDR r1, =flag\n"
+                                    "    LDR r2, =value\n"
+                                    "    CMP r0, #0\n"
+                                    "    BNE wait\n"
+                                    "    MOV r3, #42\n"
+                                    "    STR r3, [r2]\n"
+                                    "    MOV r3, #1\n"
+                                    "    STR r3, [r1]\n"
+                                    "    SWI 0\n"
+                                    "wait LDR r3, [r1]\n"
+                                    "    CMP r3, #0\n"
+                                    "    BEQ wait\n"
+                                    "    LDR r4, [r2]\n"
+                                    "    SWI 0\n"
+                                    "    .data\n"
+                                    "flag .word 0\n"
+                                    "value .word 0\n";
+
+// every core appends its number to a log three times without a lock
+static const char *log_source = "    LDR r1, =next\n"
+                                "    LDR r2, =log\n"
+                                "    MOV r3, #3\n"
+                                "append LDR r4, [r1]\n"
+                                "    STR r0, [r2, r4]\n"
+                                "    ADD r4, r4, #1\n"
+                                "    STR r4, [r1]\n"
+                                "    SUBS r3, r3, #1\n"
+                                "    BNE append\n"
+                                "    SWI 0\n"
+                                "    .data\n"
+                                "next .word 0\n"
+                                "log .word 0, 0, 0, 0, 0, 0\n";
+
+static std::vector<Instruction> load_source(const char *source_code,
+                                            Smp &smp,
+                                            uint32_t &data_address) {
+  std::istringstream source(source_code);
+  SourceCodeParser parser;
+  std::vector<Instruction> program = parser.parse(source);
+  REQUIRE(0 == parser.get_error_count());
+  data_address = parser.get_data_address();
+  Simulator::load_data(parser.get_data(), data_address, smp.get_core(0));
+  return program;
+}
+
+TEST_CASE("Cores share memory and have their own registers") {
+  Smp smp(3, 256);
+  REQUIRE(3 == smp.get_core_count());
+  CHECK(2 == smp.get_core(2).get_register_value(0).to_unsigned32());
+  smp.get_core(1).set_memory(100, Machine_byte(7));
+  CHECK(7 == smp.get_core(0).get_memory(100).to_unsigned32());
+  CHECK(7 == smp.get_core(2).get_memory(100).to_unsigned32());
+  smp.get_core(1).set_register_value(5, Machine_byte(9));
+  CHECK(0 == smp.get_core(0).get_register_value(5).to_unsigned32());
+}
+
+TEST_CASE("Cores on host threads see the stores before a flag") {
+  Smp smp(4, 256);
+  uint32_t data_address;
+  std::vector<Instruction> program =
+      load_source(message_source, smp, data_address);
+  const metrics_snapshot before = Metrics::get_snapshot();
+  const std::vector<uint64_t> retired = smp.run(program);
+  const metrics_snapshot after = Metrics::get_snapshot();
+  REQUIRE(4 == retired.size());
+  CHECK(9 == retired[0]);
+  uint64_t total = retired[0];
+  for (int number = 1; number < 4; ++number) {
+    CHECK(42 == smp.get_core(number).get_register_value(4).to_unsigned32());
+    total += retired[number];
+  }
+  // the cores are recorded once, after they all halt
+  CHECK(1 == after.get(metrics::RUNS) - before.get(metrics::RUNS));
+  CHECK(total == after.get(metrics::INSTRUCTIONS_RETIRED) -
+                     before.get(metrics::INSTRUCTIONS_RETIRED));
+}
+
+TEST_CASE("Cores run in turns of quantum instructions") {
+  SECTION("turns longer than the program") {
+    Smp smp(2, 256);
+    uint32_t data_address;
+    std::vector<Instruction> program =
+        load_source(log_source, smp, data_address);
+    const std::vector<uint64_t> retired = smp.run_deterministic(program, 100);
+    CHECK(22 == retired[0]);
+    CHECK(22 == retired[1]);
+    const uint32_t expected[] = {0, 0, 0, 1, 1, 1};
+    for (uint32_t idx = 0; idx < 6; ++idx) {
+      CHECK(expected[idx] ==
+            smp.get_core(0).get_memory(data_address + 1 + idx).to_unsigned32());
+    }
+  }
+  SECTION("turns of one instruction") {
+    // both cores read the same index before either writes it, so they
+    // overwrite each other's entries the same way on every run
+    uint32_t log[2][7];
+    for (int run = 0; run < 2; ++run) {
+      Smp smp(2, 256);
+      uint32_t data_address;
+      std::vector<Instruction> program =
+          load_source(log_source, smp, data_address);
+      smp.run_deterministic(program, 1);
+      for (uint32_t idx = 0; idx < 7; ++idx) {
+        log[run][idx] =
+            smp.get_core(1).get_memory(data_address + idx).to_unsigned32();
+      }
+    }
+    CHECK(3 == log[0][0]);
+    CHECK(1 == log[0][3]);
+    CHECK(0 == log[0][4]);
+    for (uint32_t idx = 0; idx < 7; ++idx) {
+      CHECK(log[0][idx] == log[1][idx]);
+    }
+  }
+  SECTION("a count for each core") {
+    Smp smp(2, 256);
+    uint32_t data_address;
+    std::vector<Instruction> program =
+        load_source(message_source, smp, data_address);
+    // core 0 stops before it sets the flag, so core 1 keeps waiting
+    const std::vector<uint64_t> retired =
+        smp.run_deterministic(program, 2, 7);
+    CHECK(7 == retired[0]);
+    CHECK(7 == retired[1]);
+    CHECK(0 == smp.get_core(1).get_register_value(4).to_unsigned32());
+  }
+  SECTION("one run in the metrics") {
+    Smp smp(2, 256);
+    uint32_t data_address;
+    std::vector<Instruction> program =
+        load_source(log_source, smp, data_address);
+    const metrics_snapshot before = Metrics::get_snapshot();
+    smp.run_deterministic(program, 1);
+    const metrics_snapshot after = Metrics::get_snapshot();
+    CHECK(1 == after.get(metrics::RUNS) - before.get(metrics::RUNS));
+    CHECK(2 * 22 == after.get(metrics::INSTRUCTIONS_RETIRED) -
+                        before.get(metrics::INSTRUCTIONS_RETIRED));
+  }
+}
@@ -3,8 +3,10 @@
 #include <catch2/catch_all.hpp>
 
 #include "instruction.h"
+#include "simulator.h"
 #include "source_parser.h"
 #include <fstream>
+#include <sstream>
 #include <string>
 
 class SourceParserTestFixture {
@@ -204,8 +206,8 @@ TEST_CASE_METHOD(SourceParserTestFixture, "Label before it's used") {
   CHECK(parsed_program[0].get_opcode() == opcodes::MOV);
   CHECK(parsed_program[1].get_opcode() == opcodes::MOV);
   CHECK(parsed_program[2].get_opcode() == opcodes::B);
-  REQUIRE(parsed_program[2].get_register_count() == 1);
-  CHECK(parsed_program[2].get_register(0) == 1);
+  CHECK(parsed_program[2].get_register_count() == 0);
+  CHECK(parsed_program[2].get_second_operand() == 1);
 }
 
 TEST_CASE_METHOD(SourceParserTestFixture, "Label after it's used") {
@@ -220,8 +222,356 @@ TEST_CASE_METHOD(SourceParserTestFixture, "Label after it's used") {
 
   auto parsed_program = parse_file(file_name);
   CHECK(parsed_program[0].get_opcode() == opcodes::B);
-  REQUIRE(parsed_program[0].get_register_count() == 1);
-  CHECK(parsed_program[0].get_register(0) == 2);
+  CHECK(parsed_program[0].get_register_count() == 0);
+  CHECK(parsed_program[0].get_second_operand() == 2);
   CHECK(parsed_program[1].get_opcode() == opcodes::MOV);
   CHECK(parsed_program[2].get_opcode() == opcodes::MOV);
-}
\ No newline at end of file
+}
+TEST_CASE_METHOD(SourceParserTestFixture, "ADD with register operand") {
+  std::string test_line("    ADD r0, r1, r2");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.is_2nd_operand_register());
+  CHECK(i.get_shift_type() == shift_types::NONE);
+  REQUIRE(i.get_register_count() == 3);
+  CHECK(i.get_last_register() == 2);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "ADD with shifted register") {
+  std::string test_line("    ADD r0, r1, r2, LSL #2 ;r1 + 4 * r2");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.is_2nd_operand_register());
+  CHECK(i.get_shift_type() == shift_types::LSL);
+  CHECK(i.is_shift_by_register() == false);
+  CHECK(i.get_shift_amount() == 2);
+  REQUIRE(i.get_register_count() == 3);
+  CHECK(i.get_register(0) == 0);
+  CHECK(i.get_register(1) == 1);
+  CHECK(i.get_register(2) == 2);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "MOV with register shift") {
+  std::string test_line("    MOVS r0, r1, ASR r3");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_suffix() == suffixes::S);
+  CHECK(i.is_2nd_operand_register());
+  CHECK(i.get_shift_type() == shift_types::ASR);
+  CHECK(i.is_shift_by_register());
+  CHECK(i.get_shift_register() == 3);
+  REQUIRE(i.get_register_count() == 2);
+  CHECK(i.get_last_register() == 1);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "shift by zero is folded away") {
+  std::string test_line("    MOV r0, r1, LSL #0");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.is_2nd_operand_register());
+  CHECK(i.get_shift_type() == shift_types::NONE);
+
+  std::string rrx_line("    MOV r0, r1, RRX");
+  parse_line_and_check_return_value(rrx_line, i, true);
+  CHECK(i.get_shift_type() == shift_types::RRX);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "CMP registers") {
+  std::string test_line("    CMP r1, #5");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.is_2nd_operand_register() == false);
+  CHECK(i.get_second_operand() == 5);
+  // Machine reads the compared register from the second register
+  REQUIRE(i.get_register_count() == 2);
+  CHECK(i.get_register(1) == 1);
+
+  std::string register_line("    CMP r1, r2");
+  Instruction j;
+  parse_line_and_check_return_value(register_line, j, true);
+  CHECK(j.is_2nd_operand_register());
+  REQUIRE(j.get_register_count() == 3);
+  CHECK(j.get_register(1) == 1);
+  CHECK(j.get_last_register() == 2);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "MLA") {
+  std::string test_line("    MLAEQ r0, r1, r2, r3");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::MLA);
+  CHECK(i.get_condition_code() == condition_codes::EQ);
+  CHECK(i.is_2nd_operand_register() == false);
+  REQUIRE(i.get_register_count() == 4);
+  CHECK(i.get_register(0) == 0);
+  CHECK(i.get_register(3) == 3);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "long multiply opcodes") {
+  std::string test_line("    UMULLS r0, r1, r2, r3");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::UMULL);
+  CHECK(i.get_suffix() == suffixes::S);
+  REQUIRE(i.get_register_count() == 4);
+  CHECK(i.get_register(1) == 1);
+
+  std::string signed_line("    SMLALNE r4, r5, r6, r7");
+  parse_line_and_check_return_value(signed_line, i, true);
+  CHECK(i.get_opcode() == opcodes::SMLAL);
+  CHECK(i.get_condition_code() == condition_codes::NE);
+  CHECK(i.get_last_register() == 7);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "LDR with immediate offset") {
+  std::string test_line("    LDR r0, [r1, #-0x10] ;comment");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::LDR);
+  CHECK(i.get_second_operand() == -16);
+  CHECK(i.has_writeback() == false);
+  CHECK(i.is_post_indexed() == false);
+  REQUIRE(i.get_register_count() == 2);
+  CHECK(i.get_register(0) == 0);
+  CHECK(i.get_register(1) == 1);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "LDR pre-indexed with writeback") {
+  std::string test_line("    LDRSB r2, [r3, #4]!");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_suffix() == suffixes::SB);
+  CHECK(i.get_second_operand() == 4);
+  CHECK(i.has_writeback());
+  CHECK(i.is_post_indexed() == false);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "STR post-indexed") {
+  std::string test_line("    STRH r2, [r3], #2");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::STR);
+  CHECK(i.get_suffix() == suffixes::H);
+  CHECK(i.get_second_operand() == 2);
+  CHECK(i.is_post_indexed());
+  REQUIRE(i.get_register_count() == 2);
+  CHECK(i.get_register(1) == 3);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "LDR with register offset") {
+  std::string test_line("    LDR r0, [r1, -r2, LSL #2]");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.is_2nd_operand_register());
+  CHECK(i.is_offset_subtracted());
+  CHECK(i.get_shift_type() == shift_types::LSL);
+  CHECK(i.get_shift_amount() == 2);
+  REQUIRE(i.get_register_count() == 3);
+  CHECK(i.get_register(1) == 1);
+  CHECK(i.get_register(2) == 2);
+
+  std::string post_line("    LDR r0, [r1], r2");
+  Instruction j;
+  parse_line_and_check_return_value(post_line, j, true);
+  CHECK(j.is_post_indexed());
+  CHECK(j.is_2nd_operand_register());
+  CHECK(j.is_offset_subtracted() == false);
+  CHECK(j.get_last_register() == 2);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "LDR with malformed address") {
+  std::string test_line("    LDR r0, [r1, #4");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, false);
+  std::string offset_line("    LDR r0, [r1, #x]");
+  parse_line_and_check_return_value(offset_line, i, false);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "STM with writeback") {
+  std::string test_line("    STMFD sp!, {r8, r4-r5, lr}");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::STM);
+  CHECK(i.get_update_mode() == update_modes::DB);
+  CHECK(i.has_writeback());
+  // registers after the base are in ascending order
+  REQUIRE(i.get_register_count() == 5);
+  CHECK(i.get_register(0) == 13);
+  CHECK(i.get_register(1) == 4);
+  CHECK(i.get_register(2) == 5);
+  CHECK(i.get_register(3) == 8);
+  CHECK(i.get_register(4) == 14);
+
+  std::string load_line("    LDMFD r0, {r1}");
+  Instruction j;
+  parse_line_and_check_return_value(load_line, j, true);
+  CHECK(j.get_update_mode() == update_modes::IA);
+  CHECK(j.has_writeback() == false);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "PUSH and POP") {
+  std::string push_line("    PUSH {r4, lr}");
+  Instruction i;
+  parse_line_and_check_return_value(push_line, i, true);
+  CHECK(i.get_opcode() == opcodes::STM);
+  CHECK(i.get_update_mode() == update_modes::DB);
+  CHECK(i.has_writeback());
+  REQUIRE(i.get_register_count() == 3);
+  CHECK(i.get_register(0) == 13);
+  CHECK(i.get_register(1) == 4);
+  CHECK(i.get_register(2) == 14);
+
+  std::string pop_line("    POPNE {r4, pc}");
+  Instruction j;
+  parse_line_and_check_return_value(pop_line, j, true);
+  CHECK(j.get_opcode() == opcodes::LDM);
+  CHECK(j.get_condition_code() == condition_codes::NE);
+  CHECK(j.get_update_mode() == update_modes::IA);
+  CHECK(j.has_writeback());
+  REQUIRE(j.get_register_count() == 3);
+  CHECK(j.get_register(0) == 13);
+  CHECK(j.get_last_register() == 15);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "Labels and data directives") {
+  std::ofstream asm_file;
+  std::string file_name = "test_file_data.s";
+  asm_file.open(file_name);
+  asm_file << "start:  MOV r0, table" << std::endl;
+  asm_file << "" << std::endl;
+  asm_file << "loop    LDR r1, [r0]" << std::endl;
+  asm_file << "    B loop ; back to the start of the loop" << std::endl;
+  asm_file << "    .data" << std::endl;
+  asm_file << "table:" << std::endl;
+  asm_file << "    .word 7, -1, 0x10, message" << std::endl;
+  asm_file << "bytes  .byte 1, 0x1FF" << std::endl;
+  asm_file << "message: .asciz \"a\\n\"" << std::endl;
+  asm_file << "    .space 2, 3" << std::endl;
+  asm_file << "    .align 4" << std::endl;
+  asm_file << "end" << std::endl;
+  asm_file << "    .word end" << std::endl;
+  asm_file.close();
+
+  auto parsed_program = parse_file(file_name);
+  REQUIRE(parsed_program.size() == 3);
+  verify_symbol("start", 0);
+  verify_symbol("loop", 1);
+  CHECK(parsed_program[2].get_opcode() == opcodes::B);
+  CHECK(parsed_program[2].get_second_operand() == 1);
+
+  // data starts after the code, aligned to 16 bytes
+  const uint32_t data_address = 4;
+  CHECK(parser.get_data_address() == data_address);
+  CHECK(parsed_program[0].get_register_count() == 1);
+  CHECK(parsed_program[0].get_second_operand() == data_address);
+  verify_symbol("table", data_address);
+  verify_symbol("bytes", data_address + 4);
+  verify_symbol("message", data_address + 6);
+  verify_symbol("end", data_address + 12);
+  const std::vector<uint32_t> expected_data = {
+      7, 0xFFFFFFFF, 0x10, data_address + 6, 1, 0xFF, 'a', '\n', 0,
+      3, 3,          0,    data_address + 12};
+  CHECK(parser.get_data() == expected_data);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "LDR = and ADR") {
+  std::ofstream asm_file;
+  std::string file_name = "test_file_literals.s";
+  asm_file.open(file_name);
+  asm_file << "back    LDR r0, =0xFF000000" << std::endl;
+  asm_file << "    LDR r1, =-256" << std::endl;
+  asm_file << "    LDR r2, =0x12345678" << std::endl;
+  asm_file << "    LDR r3, =table ; label addresses are pooled" << std::endl;
+  asm_file << "    LDR r4, =0x12345678" << std::endl;
+  asm_file << "    ADR r5, back" << std::endl;
+  asm_file << "    ADR r6, table" << std::endl;
+  asm_file << "table .word 3" << std::endl;
+  asm_file.close();
+
+  auto parsed_program = parse_file(file_name);
+  REQUIRE(parsed_program.size() == 7);
+  CHECK(parsed_program[0].get_opcode() == opcodes::MOV);
+  CHECK(parsed_program[0].get_second_operand() == 0xFF000000);
+  CHECK(parsed_program[1].get_opcode() == opcodes::MVN);
+  CHECK(parsed_program[1].get_second_operand() == 0xFF);
+
+  // the pool follows the data, and equal values share a literal
+  const std::vector<uint32_t> expected_data = {3, 0x12345678, 7};
+  CHECK(parser.get_data() == expected_data);
+  CHECK(parsed_program[2].get_opcode() == opcodes::LDR);
+  REQUIRE(parsed_program[2].get_register_count() == 2);
+  CHECK(parsed_program[2].get_register(1) == PROGRAM_COUNTER_INDEX);
+  CHECK(parsed_program[2].get_second_operand() == 8 - 3);
+  CHECK(parsed_program[3].get_second_operand() == 9 - 4);
+  CHECK(parsed_program[4].get_second_operand() == 8 - 5);
+  CHECK(parsed_program[5].get_opcode() == opcodes::SUB);
+  CHECK(parsed_program[5].get_second_operand() == 6);
+  CHECK(parsed_program[6].get_opcode() == opcodes::ADD);
+  CHECK(parsed_program[6].get_second_operand() == 0);
+
+  Machine m(64);
+  REQUIRE(Simulator::load_data(parser.get_data(), parser.get_data_address(),
+                               m));
+  Simulator::run_program(parsed_program, m);
+  CHECK(m.get_register_value(0).to_unsigned32() == 0xFF000000);
+  CHECK(m.get_register_value(1).to_unsigned32() == 0xFFFFFF00);
+  CHECK(m.get_register_value(2).to_unsigned32() == 0x12345678);
+  CHECK(m.get_register_value(3).to_unsigned32() == 7);
+  CHECK(m.get_register_value(4).to_unsigned32() == 0x12345678);
+  CHECK(m.get_register_value(5).to_unsigned32() == 0);
+  CHECK(m.get_register_value(6).to_unsigned32() == 7);
+  // the pseudo-instructions are all real ARM instructions
+  CHECK(Simulator::load_program(parsed_program, m));
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "SWI without #") {
+  std::string test_line("    SWI 0x10");
+  Instruction i;
+  parse_line_and_check_return_value(test_line, i, true);
+  CHECK(i.get_opcode() == opcodes::SWI);
+  CHECK(i.get_register_count() == 0);
+  CHECK(i.get_second_operand() == 0x10);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture, "malformed lines are reported") {
+  std::istringstream source("    MOV r0, #1\n"
+                            "    MOV r1, r0, LSL #x\n"
+                            "    MOV r2, r0, LSL r99\n"
+                            "    MUL r3, r0\n"
+                            "    ADD r4, r0, #\xff\n"
+                            "    B nowhere\n"
+                            "    .space 0x7FFFFFFF\n"
+                            "    LDM\n"
+                            "    CMP r0, label r1\n"
+                            "    SWI 0\n");
+  auto parsed_program = parser.parse(source);
+  CHECK(parser.get_error_count() == 8);
+  // lines with missing registers are left out
+  REQUIRE(parsed_program.size() == 7);
+  CHECK(parsed_program[1].get_shift_type() == shift_types::NONE);
+  CHECK(parsed_program[3].get_register_count() == 2);
+  CHECK(parsed_program[4].get_opcode() == opcodes::B);
+  CHECK(parsed_program[5].get_register_count() == 3);
+  CHECK(parsed_program[6].get_opcode() == opcodes::SWI);
+
+  std::istringstream valid_source("    MOV r0, #1\n");
+  CHECK(parser.parse(valid_source).size() == 1);
+  CHECK(parser.get_error_count() == 0);
+}
+
+TEST_CASE_METHOD(SourceParserTestFixture,
+                 "numbers with characters after them are reported") {
+  std::istringstream source("    MOV r3, #12abc\n"
+                            "    ADD r2, r1x, #1\n"
+                            "    LDR r0, [r1x]\n"
+                            "    LDR r0, [r1, #4x]\n"
+                            "    MOV r4, #12   \n"
+                            "    SWI 0\n");
+  auto parsed_program = parser.parse(source);
+  CHECK(parser.get_error_count() == 4);
+  // trailing spaces are fine
+  REQUIRE(parsed_program.size() >= 2);
+  const Instruction &last_move = parsed_program[parsed_program.size() - 2];
+  CHECK(last_move.get_opcode() == opcodes::MOV);
+  CHECK(last_move.get_second_operand() == 12);
+}